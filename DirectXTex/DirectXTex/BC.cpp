@@ -208,9 +208,73 @@ static void OptimizeRGB(_Out_ HDRColorA *pX, _Out_ HDRColorA *pY,
     }
 
 
-    // Use Newton's Method to find local minima of sum-of-squares error.
     float fSteps = (float) (cSteps - 1);
 
+    // The fast tier assigns each point to its nearest step between the range
+    // endpoints once, then solves for the endpoints that best fit those steps.
+    if(flags & BC_FLAGS_FAST)
+    {
+        float fScale = fSteps / fAB;
+
+        Dir.r = (Y.r - X.r) * fScale;
+        Dir.g = (Y.g - X.g) * fScale;
+        Dir.b = (Y.b - X.b) * fScale;
+
+        float fCC, fCD, fDD;
+        HDRColorA CP, DP;
+        fCC = fCD = fDD = CP.r = CP.g = CP.b = DP.r = DP.g = DP.b = 0.0f;
+
+        for(size_t iPoint = 0; iPoint < NUM_PIXELS_PER_BLOCK; iPoint++)
+        {
+            float fDot = (pPoints[iPoint].r - X.r) * Dir.r +
+                         (pPoints[iPoint].g - X.g) * Dir.g +
+                         (pPoints[iPoint].b - X.b) * Dir.b;
+
+            // Clamped without branches, as which way they go is unpredictable
+            size_t iStep = static_cast<size_t>(static_cast<int32_t>(std::min(std::max(fDot + 0.5f, 0.0f), fSteps)));
+
+#ifdef COLOR_WEIGHTS
+            float fC = pC[iStep] * pPoints[iPoint].a;
+            float fD = pD[iStep] * pPoints[iPoint].a;
+#else
+            float fC = pC[iStep];
+            float fD = pD[iStep];
+#endif // COLOR_WEIGHTS
+
+            fCC  += fC * pC[iStep];
+            fCD  += fC * pD[iStep];
+            fDD  += fD * pD[iStep];
+            CP.r += fC * pPoints[iPoint].r;
+            CP.g += fC * pPoints[iPoint].g;
+            CP.b += fC * pPoints[iPoint].b;
+            DP.r += fD * pPoints[iPoint].r;
+            DP.g += fD * pPoints[iPoint].g;
+            DP.b += fD * pPoints[iPoint].b;
+        }
+
+        // Least squares solution; every point on the same step leaves the range fit
+        float fDet = fCC * fDD - fCD * fCD;
+
+        if(fDet > (1.0f / 4096.0f))
+        {
+            float fDetInv = 1.0f / fDet;
+
+            X.r = (fDD * CP.r - fCD * DP.r) * fDetInv;
+            X.g = (fDD * CP.g - fCD * DP.g) * fDetInv;
+            X.b = (fDD * CP.b - fCD * DP.b) * fDetInv;
+
+            Y.r = (fCC * DP.r - fCD * CP.r) * fDetInv;
+            Y.g = (fCC * DP.g - fCD * CP.g) * fDetInv;
+            Y.b = (fCC * DP.b - fCD * CP.b) * fDetInv;
+        }
+
+        pX->r = X.r; pX->g = X.g; pX->b = X.b;
+        pY->r = Y.r; pY->g = Y.g; pY->b = Y.b;
+        return;
+    }
+
+
+    // Use Newton's Method to find local minima of sum-of-squares error.
     for(size_t iIteration = 0; iIteration < 8; iIteration++)
     {
         // Calculate new steps
@@ -319,9 +383,39 @@ static void OptimizeRGB(_Out_ HDRColorA *pX, _Out_ HDRColorA *pY,
 
 
 //-------------------------------------------------------------------------------------
-inline static void DecodeBC1( _Out_writes_(NUM_PIXELS_PER_BLOCK) XMVECTOR *pColor, _In_ const D3DX_BC1 *pBC, _In_ bool isbc1 )
+// Fast alternative to OptimizeAlpha for BC3: the range of the values, which is where
+// OptimizeAlpha starts its search
+//-------------------------------------------------------------------------------------
+static void FitAlpha(_Out_ float *pX, _Out_ float *pY, _In_reads_(NUM_PIXELS_PER_BLOCK) const float *pPoints, _In_ size_t cSteps)
 {
-    assert( pColor && pBC );
+    float fX = 1.0f;
+    float fY = 0.0f;
+
+    for(size_t iPoint = 0; iPoint < NUM_PIXELS_PER_BLOCK; iPoint++)
+    {
+        // The 6 step mode has explicit 0 and 1 values, so those don't stretch the range
+        if((8 == cSteps) || (pPoints[iPoint] > 0.0f && pPoints[iPoint] < 1.0f))
+        {
+            fX = std::min(fX, pPoints[iPoint]);
+            fY = std::max(fY, pPoints[iPoint]);
+        }
+    }
+
+    if(fX > fY)
+    {
+        fX = 0.0f;
+        fY = 1.0f;
+    }
+
+    *pX = fX;
+    *pY = fY;
+}
+
+
+//-------------------------------------------------------------------------------------
+inline static void DecodeBC1Palette( _Out_writes_(4) XMVECTOR *pPalette, _In_ const D3DX_BC1 *pBC, _In_ bool isbc1 )
+{
+    assert( pPalette && pBC );
     static_assert( sizeof(D3DX_BC1) == 8, "D3DX_BC1 should be 8 bytes" );
 
     static XMVECTORF32 s_Scale = { 1.f/31.f, 1.f/63.f, 1.f/31.f, 1.f };
@@ -335,40 +429,204 @@ inline static void DecodeBC1( _Out_writes_(NUM_PIXELS_PER_BLOCK) XMVECTOR *pColo
     clr0 = XMVectorSwizzle<2, 1, 0, 3>( clr0 );
     clr1 = XMVectorSwizzle<2, 1, 0, 3>( clr1 );
 
-    clr0 = XMVectorSelect( g_XMIdentityR3, clr0, g_XMSelect1110 );
-    clr1 = XMVectorSelect( g_XMIdentityR3, clr1, g_XMSelect1110 );
+    pPalette[0] = XMVectorSelect( g_XMIdentityR3, clr0, g_XMSelect1110 );
+    pPalette[1] = XMVectorSelect( g_XMIdentityR3, clr1, g_XMSelect1110 );
 
-    XMVECTOR clr2, clr3;
     if ( isbc1 && (pBC->rgb[0] <= pBC->rgb[1]) )
     {
-        clr2 = XMVectorLerp( clr0, clr1, 0.5f );
-        clr3 = XMVectorZero();  // Alpha of 0
+        pPalette[2] = XMVectorLerp( pPalette[0], pPalette[1], 0.5f );
+        pPalette[3] = XMVectorZero();  // Alpha of 0
     }
     else
     {
-        clr2 = XMVectorLerp( clr0, clr1, 1.f/3.f );
-        clr3 = XMVectorLerp( clr0, clr1, 2.f/3.f );
+        pPalette[2] = XMVectorLerp( pPalette[0], pPalette[1], 1.f/3.f );
+        pPalette[3] = XMVectorLerp( pPalette[0], pPalette[1], 2.f/3.f );
     }
+}
+
+inline static void DecodeBC1( _Out_writes_(NUM_PIXELS_PER_BLOCK) XMVECTOR *pColor, _In_ const D3DX_BC1 *pBC, _In_ bool isbc1 )
+{
+    assert( pColor && pBC );
+
+    XMVECTOR clr[4];
+    DecodeBC1Palette( clr, pBC, isbc1 );
 
     uint32_t dw = pBC->bitmap;
 
     for(size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i, dw >>= 2)
     {
-        switch(dw & 3)
+        pColor[i] = clr[dw & 3];
+    }
+}
+
+
+//-------------------------------------------------------------------------------------
+inline static void DecodeBC3Alpha( _Out_writes_(8) float *pAlpha, _In_ const D3DX_BC3 *pBC )
+{
+    assert( pAlpha && pBC );
+
+    pAlpha[0] = ((float) pBC->alpha[0]) * (1.0f / 255.0f);
+    pAlpha[1] = ((float) pBC->alpha[1]) * (1.0f / 255.0f);
+
+    if(pBC->alpha[0] > pBC->alpha[1]) 
+    {
+        for(size_t i = 1; i < 7; ++i)
+            pAlpha[i + 1] = (pAlpha[0] * (7 - i) + pAlpha[1] * i) * (1.0f / 7.0f);
+    }
+    else 
+    {
+        for(size_t i = 1; i < 5; ++i)
+            pAlpha[i + 1] = (pAlpha[0] * (5 - i) + pAlpha[1] * i) * (1.0f / 5.0f);
+
+        pAlpha[6] = 0.0f;
+        pAlpha[7] = 1.0f;
+    }
+}
+
+
+//-------------------------------------------------------------------------------------
+// Decodes a row of blocks that end in a BC1 color part to 8-bit RGBA texels. Each
+// block's palette goes through the float decoder's math & D3DXStoreRGBA8, so only
+// the texels themselves are expanded with integer lookups. fnAlpha writes the 16
+// alpha values of a block, or is null for BC1.
+//-------------------------------------------------------------------------------------
+typedef void (*DecodeAlphaFn)( _Out_writes_(NUM_PIXELS_PER_BLOCK) uint8_t *pAlpha, _In_ const uint8_t *pBC, _In_reads_(16) const uint8_t *pLevels );
+
+static void DecodeRowRGBA8( _Out_ uint8_t *pDest, _In_ size_t rowPitch, _In_ const uint8_t *pBC, _In_ size_t blockSize, _In_ bool isbc1,
+                            _In_opt_ DecodeAlphaFn fnAlpha, _In_reads_opt_(16) const uint8_t *pLevels, _In_ size_t width, _In_ size_t height )
+{
+    assert( pDest && pBC && width > 0 && height > 0 && height <= 4 );
+
+    uint32_t aPalette[BC_EXPAND_BLOCKS * 4];
+    uint32_t aBitmap[BC_EXPAND_BLOCKS];
+    uint8_t aAlpha[BC_EXPAND_BLOCKS * NUM_PIXELS_PER_BLOCK];
+
+    for( size_t x = 0; x < width; x += BC_EXPAND_BLOCKS * 4 )
+    {
+        const size_t count = std::min<size_t>( width - x, BC_EXPAND_BLOCKS * 4 );
+        const size_t nBlocks = ( count + 3 ) >> 2;
+
+        for( size_t i = 0; i < nBlocks; ++i, pBC += blockSize )
         {
-        case 0: pColor[i] = clr0; break;
-        case 1: pColor[i] = clr1; break;
-        case 2: pColor[i] = clr2; break;
+            // The color part comes last in BC2 & BC3 blocks
+            auto pBC1 = reinterpret_cast<const D3DX_BC1*>( pBC + blockSize - sizeof(D3DX_BC1) );
+
+            XMVECTOR clr[4];
+            DecodeBC1Palette( clr, pBC1, isbc1 );
+
+            for( size_t j = 0; j < 4; ++j )
+                aPalette[i * 4 + j] = D3DXStoreRGBA8( clr[j] );
+
+            aBitmap[i] = pBC1->bitmap;
 
-        case 3:
-        default: pColor[i] = clr3; break;
+            if ( fnAlpha )
+                fnAlpha( aAlpha + i * NUM_PIXELS_PER_BLOCK, pBC, pLevels );
         }
+
+        D3DXExpandRowRGBA8( pDest + x * 4, rowPitch, aPalette, aBitmap, fnAlpha ? aAlpha : nullptr, count, height );
+    }
+}
+
+static void DecodeAlphaBC2( _Out_writes_(NUM_PIXELS_PER_BLOCK) uint8_t *pAlpha, _In_ const uint8_t *pBC, _In_reads_(16) const uint8_t *pLevels )
+{
+    auto pBC2 = reinterpret_cast<const D3DX_BC2 *>(pBC);
+
+    for(size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i)
+        pAlpha[i] = pLevels[ ( pBC2->bitmap[i >> 3] >> ( 4 * (i & 7) ) ) & 0xf ];
+}
+
+static void DecodeAlphaBC3( _Out_writes_(NUM_PIXELS_PER_BLOCK) uint8_t *pAlpha, _In_ const uint8_t *pBC, _In_opt_ const uint8_t * )
+{
+    auto pBC3 = reinterpret_cast<const D3DX_BC3 *>(pBC);
+
+    float fAlpha[8];
+    DecodeBC3Alpha( fAlpha, pBC3 );
+
+    uint8_t aLevels[8];
+    for(size_t i = 0; i < 8; i += 4)
+    {
+        const uint32_t c = D3DXStoreRGBA8( XMVectorSet( fAlpha[i], fAlpha[i + 1], fAlpha[i + 2], fAlpha[i + 3] ) );
+        aLevels[i    ] = uint8_t( c );
+        aLevels[i + 1] = uint8_t( c >> 8 );
+        aLevels[i + 2] = uint8_t( c >> 16 );
+        aLevels[i + 3] = uint8_t( c >> 24 );
     }
+
+    DWORD dw = pBC3->bitmap[0] | (pBC3->bitmap[1] << 8) | (pBC3->bitmap[2] << 16);
+
+    for(size_t i = 0; i < 8; ++i, dw >>= 3)
+        pAlpha[i] = aLevels[dw & 0x7];
+
+    dw = pBC3->bitmap[3] | (pBC3->bitmap[4] << 8) | (pBC3->bitmap[5] << 16);
+
+    for(size_t i = 8; i < NUM_PIXELS_PER_BLOCK; ++i, dw >>= 3)
+        pAlpha[i] = aLevels[dw & 0x7];
 }
 
 
 //-------------------------------------------------------------------------------------
+// Picks the two endpoints, out of iMax + 1 levels, whose 1/3 blend lands closest to
+// fValue. The best pair is never more than a level or two away from the rounded value.
+static void FitSolidChannel(_In_ float fValue, _In_ int iMax, _Out_ int *piA, _Out_ int *piB)
+{
+    const float fMax = (float) iMax;
+    fValue = (fValue < 0.0f) ? 0.0f : (fValue > 1.0f) ? 1.0f : fValue;
+
+    const int iRound = static_cast<int32_t>(fValue * fMax + 0.5f);
+    *piA = iRound;
+    *piB = iRound;
+
+    float fBestErr = fabsf((float) iRound / fMax - fValue);
+    for(int iA = std::max<int>(0, iRound - 1); iA <= std::min<int>(iMax, iRound + 1); ++iA)
+    {
+        for(int iB = std::max<int>(0, iRound - 2); iB <= std::min<int>(iMax, iRound + 2); ++iB)
+        {
+            float fErr = fabsf((float) (iA * 2 + iB) * (1.0f / 3.0f) / fMax - fValue);
+            if(fErr < fBestErr)
+            {
+                fBestErr = fErr;
+                *piA = iA;
+                *piB = iB;
+            }
+        }
+    }
+}
+
+// Solid blocks use the 1/3 blend of a pair of endpoints, which gets closer to the color
+// than rounding it to 565 does
+static void EncodeSolidRGB(_Out_ D3DX_BC1 *pBC, _In_ const HDRColorA *pColor)
+{
+    int iR0, iR1, iG0, iG1, iB0, iB1;
+    FitSolidChannel(pColor->r, 31, &iR0, &iR1);
+    FitSolidChannel(pColor->g, 63, &iG0, &iG1);
+    FitSolidChannel(pColor->b, 31, &iB0, &iB1);
+
+    uint16_t w0 = (uint16_t) ((iR0 << 11) | (iG0 << 5) | iB0);
+    uint16_t w1 = (uint16_t) ((iR1 << 11) | (iG1 << 5) | iB1);
+
+    if(w0 > w1)
+    {
+        pBC->rgb[0] = w0;
+        pBC->rgb[1] = w1;
+        pBC->bitmap = 0xaaaaaaaa;
+    }
+    else if(w0 < w1)
+    {
+        // Swapped endpoints keep the 4 color mode; the blend then comes from index 3
+        pBC->rgb[0] = w1;
+        pBC->rgb[1] = w0;
+        pBC->bitmap = 0xffffffff;
+    }
+    else
+    {
+        pBC->rgb[0] = w0;
+        pBC->rgb[1] = w1;
+        pBC->bitmap = 0x00000000;
+    }
+}
 
+
+//-------------------------------------------------------------------------------------
 static void EncodeBC1(_Out_ D3DX_BC1 *pBC, _In_reads_(NUM_PIXELS_PER_BLOCK) const HDRColorA *pColor,
                       _In_ bool bColorKey, _In_ float alphaRef, _In_ DWORD flags)
 {
@@ -403,6 +661,19 @@ static void EncodeBC1(_Out_ D3DX_BC1 *pBC, _In_reads_(NUM_PIXELS_PER_BLOCK) cons
         uSteps = 4;
     }
 
+    if(4 == uSteps)
+    {
+        size_t uSame = 1;
+        while(uSame < NUM_PIXELS_PER_BLOCK && pColor[uSame].r == pColor[0].r && pColor[uSame].g == pColor[0].g && pColor[uSame].b == pColor[0].b)
+            ++uSame;
+
+        if(NUM_PIXELS_PER_BLOCK == uSame)
+        {
+            EncodeSolidRGB(pBC, pColor);
+            return;
+        }
+    }
+
     // Quantize block to R56B5, using Floyd Stienberg error diffusion.  This 
     // increases the chance that colors will map directly to the quantized 
     // axis endpoints.
@@ -711,6 +982,394 @@ static void EncodeSolidBC1(_Out_ D3DX_BC1 *pBC, _In_reads_(NUM_PIXELS_PER_BLOCK)
 #endif // COLOR_WEIGHTS
 
 
+//-------------------------------------------------------------------------------------
+// Rate-distortion optimization. Colors are in 8 bit units, and errors are sums of
+// squared, uniformly weighted differences.
+//-------------------------------------------------------------------------------------
+
+static const size_t g_aFieldsBC1[] = { 4, 4 };          // endpoints, indices
+static const size_t g_aFieldsBC3[] = { 2, 6, 4, 4 };    // alpha endpoints & indices, then the BC1 block
+
+// 4 color palette of a BC1 block
+static void PaletteRGB(_Out_writes_(4) HDRColorA *pStep, _In_ uint16_t rgb0, _In_ uint16_t rgb1)
+{
+    Decode565(&pStep[0], rgb0);
+    Decode565(&pStep[1], rgb1);
+
+    pStep[0] *= 255.0f;
+    pStep[1] *= 255.0f;
+
+    HDRColorALerp(&pStep[2], &pStep[0], &pStep[1], 1.0f / 3.0f);
+    HDRColorALerp(&pStep[3], &pStep[0], &pStep[1], 2.0f / 3.0f);
+}
+
+inline static float DistanceRGB(_In_ const HDRColorA& c0, _In_ const HDRColorA& c1)
+{
+    float fR = c0.r - c1.r;
+    float fG = c0.g - c1.g;
+    float fB = c0.b - c1.b;
+    return fR * fR + fG * fG + fB * fB;
+}
+
+// Stops early once the error is over fBound, which rules the candidate out
+static float ErrorRGB(_In_reads_(4) const HDRColorA *pStep, _In_ uint32_t bitmap, _In_reads_(NUM_PIXELS_PER_BLOCK) const HDRColorA *pColor, _In_ float fBound)
+{
+    float fErr = 0.0f;
+    for(size_t i = 0; i < NUM_PIXELS_PER_BLOCK && fErr <= fBound; ++i, bitmap >>= 2)
+        fErr += DistanceRGB(pStep[bitmap & 3], pColor[i]);
+
+    return fErr;
+}
+
+// The indices that fit the colors best to a palette
+static uint32_t SelectRGB(_In_reads_(4) const HDRColorA *pStep, _In_reads_(NUM_PIXELS_PER_BLOCK) const HDRColorA *pColor, _In_ float fBound, _Out_ float *pfErr)
+{
+    uint32_t bitmap = 0;
+    float fErr = 0.0f;
+
+    for(size_t i = 0; i < NUM_PIXELS_PER_BLOCK && fErr <= fBound; ++i)
+    {
+        uint32_t iBest = 0;
+        float fBest = DistanceRGB(pStep[0], pColor[i]);
+
+        for(uint32_t iStep = 1; iStep < 4; ++iStep)
+        {
+            float fDist = DistanceRGB(pStep[iStep], pColor[i]);
+            if(fDist < fBest)
+            {
+                fBest = fDist;
+                iBest = iStep;
+            }
+        }
+
+        bitmap |= iBest << (2 * i);
+        fErr += fBest;
+    }
+
+    *pfErr = fErr;
+    return bitmap;
+}
+
+// Least squares endpoints for the colors with the given indices. Fails when the indices
+// don't pin down both endpoints.
+static bool FitRGB(_In_ uint32_t bitmap, _In_reads_(NUM_PIXELS_PER_BLOCK) const HDRColorA *pColor, _Out_ uint16_t *pRGB0, _Out_ uint16_t *pRGB1)
+{
+    static const float pWeights[] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+    float fAA = 0.0f, fAB = 0.0f, fBB = 0.0f;
+    HDRColorA A(0.0f, 0.0f, 0.0f, 0.0f);
+    HDRColorA B(0.0f, 0.0f, 0.0f, 0.0f);
+
+    for(size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i, bitmap >>= 2)
+    {
+        float fW = pWeights[bitmap & 3];
+        float fV = 1.0f - fW;
+
+        fAA += fV * fV;
+        fAB += fV * fW;
+        fBB += fW * fW;
+
+        A += pColor[i] * fV;
+        B += pColor[i] * fW;
+    }
+
+    float fDet = fAA * fBB - fAB * fAB;
+    if(fDet < 0.001f)
+        return false;
+
+    float fScale = 1.0f / (fDet * 255.0f);
+    HDRColorA C0 = (A * fBB - B * fAB) * fScale;
+    HDRColorA C1 = (B * fAA - A * fAB) * fScale;
+
+    *pRGB0 = Encode565(&C0);
+    *pRGB1 = Encode565(&C1);
+    return true;
+}
+
+// The BC1 part at uOffset in the block, tried with the endpoints and/or indices of each
+// block in the window. BC1 blocks keep the 4 color mode, which BC2 & BC3 always use.
+static void OptimizeRDORGB(_In_ const RDOBlock& rdo, _In_ size_t uOffset, _In_ bool isbc1,
+                           _In_reads_(NUM_PIXELS_PER_BLOCK) const HDRColorA *pColor, _In_ float fMaxErr)
+{
+    auto pBC = reinterpret_cast<D3DX_BC1 *>(rdo.pBlock + uOffset);
+
+    // 3 color (keyed) and single color BC1 blocks are left as they are
+    if(isbc1 && (pBC->rgb[0] <= pBC->rgb[1]))
+        return;
+
+    const D3DX_BC1 Orig = *pBC;
+
+    HDRColorA Step[4];
+    PaletteRGB(Step, Orig.rgb[0], Orig.rgb[1]);
+
+    const float fErr = ErrorRGB(Step, Orig.bitmap, pColor, FLT_MAX);
+    const float fLimit = std::max(fErr, fMaxErr);
+
+    D3DX_BC1 Best = Orig;
+    float fBestCost = rdo.Cost(fErr);
+
+    // Even a repeat of the whole block can't make up for more error than this
+    auto Bound = [&]() -> float
+    {
+        return std::min(fLimit, fBestCost - rdo.fLambda * BC_RDO_MATCH_BITS);
+    };
+
+    auto Try = [&](uint16_t rgb0, uint16_t rgb1, uint32_t bitmap, float fCandErr)
+    {
+        if(fCandErr >= Bound())
+            return;
+
+        if(isbc1 && (rgb0 <= rgb1))
+            return;
+
+        pBC->rgb[0] = rgb0;
+        pBC->rgb[1] = rgb1;
+        pBC->bitmap = bitmap;
+
+        float fCost = rdo.Cost(fCandErr);
+        if(fCost < fBestCost)
+        {
+            fBestCost = fCost;
+            Best = *pBC;
+        }
+    };
+
+    // Nearest first, skipping blocks that repeat a nearer one
+    for(size_t j = rdo.nWindow; j-- > 0; )
+    {
+        const uint8_t *pPrevBlock = rdo.pWindow + j * rdo.uBlockSize + uOffset;
+
+        bool bSeen = false;
+        for(size_t k = j + 1; k < rdo.nWindow && !bSeen; ++k)
+            bSeen = RDOBlock::SameBytes(rdo.pWindow + k * rdo.uBlockSize + uOffset, pPrevBlock, sizeof(D3DX_BC1));
+
+        if(bSeen)
+            continue;
+
+        auto pPrev = reinterpret_cast<const D3DX_BC1 *>(pPrevBlock);
+
+        HDRColorA StepPrev[4];
+        PaletteRGB(StepPrev, pPrev->rgb[0], pPrev->rgb[1]);
+
+        // Its endpoints, with the best indices for them and with its own indices
+        float fCandErr;
+        uint32_t bitmap = SelectRGB(StepPrev, pColor, Bound(), &fCandErr);
+        Try(pPrev->rgb[0], pPrev->rgb[1], bitmap, fCandErr);
+
+        if(bitmap != pPrev->bitmap)
+            Try(pPrev->rgb[0], pPrev->rgb[1], pPrev->bitmap, ErrorRGB(StepPrev, pPrev->bitmap, pColor, Bound()));
+
+        // Its indices, with our endpoints and with endpoints fitted to them
+        Try(Orig.rgb[0], Orig.rgb[1], pPrev->bitmap, ErrorRGB(Step, pPrev->bitmap, pColor, Bound()));
+
+        uint16_t rgb0, rgb1;
+        if(FitRGB(pPrev->bitmap, pColor, &rgb0, &rgb1))
+        {
+            HDRColorA StepFit[4];
+            PaletteRGB(StepFit, rgb0, rgb1);
+            Try(rgb0, rgb1, pPrev->bitmap, ErrorRGB(StepFit, pPrev->bitmap, pColor, Bound()));
+        }
+    }
+
+    *pBC = Best;
+}
+
+// Palette of a BC3 alpha block
+static void PaletteAlpha(_Out_writes_(8) float *pStep, _In_ uint8_t a0, _In_ uint8_t a1)
+{
+    pStep[0] = (float) a0;
+    pStep[1] = (float) a1;
+
+    if(a0 > a1)
+    {
+        for(size_t i = 1; i < 7; ++i)
+            pStep[i + 1] = (pStep[0] * (7 - i) + pStep[1] * i) * (1.0f / 7.0f);
+    }
+    else
+    {
+        for(size_t i = 1; i < 5; ++i)
+            pStep[i + 1] = (pStep[0] * (5 - i) + pStep[1] * i) * (1.0f / 5.0f);
+
+        pStep[6] = 0.0f;
+        pStep[7] = 255.0f;
+    }
+}
+
+inline static uint64_t GetAlphaIndices(_In_ const D3DX_BC3 *pBC)
+{
+    uint64_t indices = 0;
+    for(size_t i = 0; i < 6; ++i)
+        indices |= uint64_t(pBC->bitmap[i]) << (8 * i);
+
+    return indices;
+}
+
+inline static void SetAlphaIndices(_Out_ D3DX_BC3 *pBC, _In_ uint64_t indices)
+{
+    for(size_t i = 0; i < 6; ++i)
+        pBC->bitmap[i] = (uint8_t) (indices >> (8 * i));
+}
+
+static float ErrorAlpha(_In_reads_(8) const float *pStep, _In_ uint64_t indices, _In_reads_(NUM_PIXELS_PER_BLOCK) const float *pAlpha, _In_ float fBound)
+{
+    float fErr = 0.0f;
+    for(size_t i = 0; i < NUM_PIXELS_PER_BLOCK && fErr <= fBound; ++i, indices >>= 3)
+    {
+        float fDiff = pStep[indices & 7] - pAlpha[i];
+        fErr += fDiff * fDiff;
+    }
+
+    return fErr;
+}
+
+static uint64_t SelectAlpha(_In_reads_(8) const float *pStep, _In_reads_(NUM_PIXELS_PER_BLOCK) const float *pAlpha, _In_ float fBound, _Out_ float *pfErr)
+{
+    uint64_t indices = 0;
+    float fErr = 0.0f;
+
+    for(size_t i = 0; i < NUM_PIXELS_PER_BLOCK && fErr <= fBound; ++i)
+    {
+        uint64_t iBest = 0;
+        float fBest = (pStep[0] - pAlpha[i]) * (pStep[0] - pAlpha[i]);
+
+        for(uint64_t iStep = 1; iStep < 8; ++iStep)
+        {
+            float fDist = (pStep[iStep] - pAlpha[i]) * (pStep[iStep] - pAlpha[i]);
+            if(fDist < fBest)
+            {
+                fBest = fDist;
+                iBest = iStep;
+            }
+        }
+
+        indices |= iBest << (3 * i);
+        fErr += fBest;
+    }
+
+    *pfErr = fErr;
+    return indices;
+}
+
+// Least squares endpoints for the 8 step mode with the given indices. Fails when the
+// indices don't pin down both endpoints, or the endpoints would need the 6 step mode.
+static bool FitAlphaIndices(_In_ uint64_t indices, _In_reads_(NUM_PIXELS_PER_BLOCK) const float *pAlpha, _Out_ uint8_t *pA0, _Out_ uint8_t *pA1)
+{
+    static const float pWeights[] = { 0.0f, 1.0f, 1.0f / 7.0f, 2.0f / 7.0f, 3.0f / 7.0f, 4.0f / 7.0f, 5.0f / 7.0f, 6.0f / 7.0f };
+
+    float fAA = 0.0f, fAB = 0.0f, fBB = 0.0f;
+    float fA = 0.0f, fB = 0.0f;
+
+    for(size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i, indices >>= 3)
+    {
+        float fW = pWeights[indices & 7];
+        float fV = 1.0f - fW;
+
+        fAA += fV * fV;
+        fAB += fV * fW;
+        fBB += fW * fW;
+
+        fA += pAlpha[i] * fV;
+        fB += pAlpha[i] * fW;
+    }
+
+    float fDet = fAA * fBB - fAB * fAB;
+    if(fDet < 0.001f)
+        return false;
+
+    float fA0 = (fA * fBB - fB * fAB) / fDet;
+    float fA1 = (fB * fAA - fA * fAB) / fDet;
+
+    fA0 = (fA0 < 0.0f) ? 0.0f : (fA0 > 255.0f) ? 255.0f : fA0;
+    fA1 = (fA1 < 0.0f) ? 0.0f : (fA1 > 255.0f) ? 255.0f : fA1;
+
+    *pA0 = (uint8_t) static_cast<int32_t>(fA0 + 0.5f);
+    *pA1 = (uint8_t) static_cast<int32_t>(fA1 + 0.5f);
+    return *pA0 > *pA1;
+}
+
+// The alpha part of a BC3 block, tried with the endpoints and/or indices of each block
+// in the window
+static void OptimizeRDOAlpha(_In_ const RDOBlock& rdo, _In_reads_(NUM_PIXELS_PER_BLOCK) const float *pAlpha, _In_ float fMaxErr)
+{
+    auto pBC = reinterpret_cast<D3DX_BC3 *>(rdo.pBlock);
+
+    const uint8_t a0 = pBC->alpha[0];
+    const uint8_t a1 = pBC->alpha[1];
+    const uint64_t indices = GetAlphaIndices(pBC);
+
+    float fStep[8];
+    PaletteAlpha(fStep, a0, a1);
+
+    const float fErr = ErrorAlpha(fStep, indices, pAlpha, FLT_MAX);
+    const float fLimit = std::max(fErr, fMaxErr);
+
+    uint8_t aBest[8];
+    memcpy(aBest, pBC, sizeof(aBest));
+    float fBestCost = rdo.Cost(fErr);
+
+    auto Bound = [&]() -> float
+    {
+        return std::min(fLimit, fBestCost - rdo.fLambda * BC_RDO_MATCH_BITS);
+    };
+
+    auto Try = [&](uint8_t alpha0, uint8_t alpha1, uint64_t bitmap, float fCandErr)
+    {
+        if(fCandErr >= Bound())
+            return;
+
+        pBC->alpha[0] = alpha0;
+        pBC->alpha[1] = alpha1;
+        SetAlphaIndices(pBC, bitmap);
+
+        float fCost = rdo.Cost(fCandErr);
+        if(fCost < fBestCost)
+        {
+            fBestCost = fCost;
+            memcpy(aBest, pBC, sizeof(aBest));
+        }
+    };
+
+    for(size_t j = rdo.nWindow; j-- > 0; )
+    {
+        const uint8_t *pPrevBlock = rdo.pWindow + j * rdo.uBlockSize;
+
+        bool bSeen = false;
+        for(size_t k = j + 1; k < rdo.nWindow && !bSeen; ++k)
+            bSeen = RDOBlock::SameBytes(rdo.pWindow + k * rdo.uBlockSize, pPrevBlock, sizeof(aBest));
+
+        if(bSeen)
+            continue;
+
+        auto pPrev = reinterpret_cast<const D3DX_BC3 *>(pPrevBlock);
+        const uint64_t prevIndices = GetAlphaIndices(pPrev);
+
+        float fStepPrev[8];
+        PaletteAlpha(fStepPrev, pPrev->alpha[0], pPrev->alpha[1]);
+
+        // Its endpoints, with the best indices for them and with its own indices
+        float fCandErr;
+        uint64_t bitmap = SelectAlpha(fStepPrev, pAlpha, Bound(), &fCandErr);
+        Try(pPrev->alpha[0], pPrev->alpha[1], bitmap, fCandErr);
+
+        if(bitmap != prevIndices)
+            Try(pPrev->alpha[0], pPrev->alpha[1], prevIndices, ErrorAlpha(fStepPrev, prevIndices, pAlpha, Bound()));
+
+        // Its indices, with our endpoints and with endpoints fitted to them
+        Try(a0, a1, prevIndices, ErrorAlpha(fStep, prevIndices, pAlpha, Bound()));
+
+        uint8_t alpha0, alpha1;
+        if(FitAlphaIndices(prevIndices, pAlpha, &alpha0, &alpha1))
+        {
+            float fStepFit[8];
+            PaletteAlpha(fStepFit, alpha0, alpha1);
+            Try(alpha0, alpha1, prevIndices, ErrorAlpha(fStepFit, prevIndices, pAlpha, Bound()));
+        }
+    }
+
+    memcpy(pBC, aBest, sizeof(aBest));
+}
+
+
 //=====================================================================================
 // Entry points
 //=====================================================================================
@@ -725,6 +1384,12 @@ void D3DXDecodeBC1(XMVECTOR *pColor, const uint8_t *pBC)
     DecodeBC1( pColor, pBC1, true );
 }
 
+_Use_decl_annotations_
+void D3DXDecodeBC1RowRGBA8(uint8_t *pDest, size_t rowPitch, const uint8_t *pBC, size_t width, size_t height)
+{
+    DecodeRowRGBA8( pDest, rowPitch, pBC, sizeof(D3DX_BC1), true, nullptr, nullptr, width, height );
+}
+
 _Use_decl_annotations_
 void D3DXEncodeBC1(uint8_t *pBC, const XMVECTOR *pColor, float alphaRef, DWORD flags)
 {
@@ -786,6 +1451,23 @@ void D3DXEncodeBC1(uint8_t *pBC, const XMVECTOR *pColor, float alphaRef, DWORD f
     EncodeBC1(pBC1, Color, true, alphaRef, flags);
 }
 
+_Use_decl_annotations_
+void D3DXOptimizeBC1(uint8_t *pBC, const uint8_t *pWindow, size_t nWindow, const XMVECTOR *pColor, float lambda, float maxError)
+{
+    assert( pBC && pColor && (pWindow || !nWindow) );
+    assert( nWindow <= BC_RDO_WINDOW );
+
+    HDRColorA Color[NUM_PIXELS_PER_BLOCK];
+    for(size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i)
+    {
+        XMStoreFloat4( reinterpret_cast<XMFLOAT4*>( &Color[i] ), pColor[i] );
+        Color[i] *= 255.0f;
+    }
+
+    const RDOBlock rdo = { pBC, pWindow, nWindow, sizeof(D3DX_BC1), g_aFieldsBC1, _countof(g_aFieldsBC1), lambda };
+    OptimizeRDORGB(rdo, 0, true, Color, maxError * maxError * (NUM_PIXELS_PER_BLOCK * 3));
+}
+
 
 //-------------------------------------------------------------------------------------
 // BC2 Compression
@@ -816,6 +1498,26 @@ void D3DXDecodeBC2(XMVECTOR *pColor, const uint8_t *pBC)
         pColor[i] = XMVectorSetW( pColor[i], (float) (dw & 0xf) * (1.0f / 15.0f) );
 }
 
+_Use_decl_annotations_
+void D3DXDecodeBC2RowRGBA8(uint8_t *pDest, size_t rowPitch, const uint8_t *pBC, size_t width, size_t height)
+{
+    static_assert( sizeof(D3DX_BC2) == 16, "D3DX_BC2 should be 16 bytes" );
+
+    // The 4-bit alpha levels as the float decoder & D3DXStoreRGBA8 give them
+    uint8_t aLevels[16];
+    for(size_t i = 0; i < 16; i += 4)
+    {
+        const uint32_t c = D3DXStoreRGBA8( XMVectorSet( (float) (i    ) * (1.0f / 15.0f), (float) (i + 1) * (1.0f / 15.0f),
+                                                        (float) (i + 2) * (1.0f / 15.0f), (float) (i + 3) * (1.0f / 15.0f) ) );
+        aLevels[i    ] = uint8_t( c );
+        aLevels[i + 1] = uint8_t( c >> 8 );
+        aLevels[i + 2] = uint8_t( c >> 16 );
+        aLevels[i + 3] = uint8_t( c >> 24 );
+    }
+
+    DecodeRowRGBA8( pDest, rowPitch, pBC, sizeof(D3DX_BC2), false, DecodeAlphaBC2, aLevels, width, height );
+}
+
 _Use_decl_annotations_
 void D3DXEncodeBC2(uint8_t *pBC, const XMVECTOR *pColor, DWORD flags)
 {
@@ -906,23 +1608,7 @@ void D3DXDecodeBC3(XMVECTOR *pColor, const uint8_t *pBC)
 
     // Adaptive 3-bit alpha part
     float fAlpha[8];
-
-    fAlpha[0] = ((float) pBC3->alpha[0]) * (1.0f / 255.0f);
-    fAlpha[1] = ((float) pBC3->alpha[1]) * (1.0f / 255.0f);
-
-    if(pBC3->alpha[0] > pBC3->alpha[1]) 
-    {
-        for(size_t i = 1; i < 7; ++i)
-            fAlpha[i + 1] = (fAlpha[0] * (7 - i) + fAlpha[1] * i) * (1.0f / 7.0f);
-    }
-    else 
-    {
-        for(size_t i = 1; i < 5; ++i)
-            fAlpha[i + 1] = (fAlpha[0] * (5 - i) + fAlpha[1] * i) * (1.0f / 5.0f);
-
-        fAlpha[6] = 0.0f;
-        fAlpha[7] = 1.0f;
-    }
+    DecodeBC3Alpha( fAlpha, pBC3 );
 
     DWORD dw = pBC3->bitmap[0] | (pBC3->bitmap[1] << 8) | (pBC3->bitmap[2] << 16);
 
@@ -935,6 +1621,14 @@ void D3DXDecodeBC3(XMVECTOR *pColor, const uint8_t *pBC)
         pColor[i] = XMVectorSetW( pColor[i], fAlpha[dw & 0x7] );
 }
 
+_Use_decl_annotations_
+void D3DXDecodeBC3RowRGBA8(uint8_t *pDest, size_t rowPitch, const uint8_t *pBC, size_t width, size_t height)
+{
+    static_assert( sizeof(D3DX_BC3) == 16, "D3DX_BC3 should be 16 bytes" );
+
+    DecodeRowRGBA8( pDest, rowPitch, pBC, sizeof(D3DX_BC3), false, DecodeAlphaBC3, nullptr, width, height );
+}
+
 _Use_decl_annotations_
 void D3DXEncodeBC3(uint8_t *pBC, const XMVECTOR *pColor, DWORD flags)
 {
@@ -1016,10 +1710,11 @@ void D3DXEncodeBC3(uint8_t *pBC, const XMVECTOR *pColor, DWORD flags)
     EncodeBC1(&pBC3->bc1, Color, false, 0.f, flags);
 
     // Alpha part
-    if(1.0f == fMinAlpha)
+    if(fMinAlpha == fMaxAlpha)
     {
-        pBC3->alpha[0] = 0xff;
-        pBC3->alpha[1] = 0xff;
+        // Solid alpha is exact with both endpoints on it
+        pBC3->alpha[0] = (uint8_t) static_cast<int32_t>(fMinAlpha * 255.0f + 0.5f);
+        pBC3->alpha[1] = pBC3->alpha[0];
         memset(pBC3->bitmap, 0x00, 6);
         return;
     }
@@ -1028,7 +1723,10 @@ void D3DXEncodeBC3(uint8_t *pBC, const XMVECTOR *pColor, DWORD flags)
     size_t uSteps = ((0.0f == fMinAlpha) || (1.0f == fMaxAlpha)) ? 6 : 8;
 
     float fAlphaA, fAlphaB;
-    OptimizeAlpha<false>(&fAlphaA, &fAlphaB, fAlpha, uSteps);
+    if ( flags & BC_FLAGS_FAST )
+        FitAlpha(&fAlphaA, &fAlphaB, fAlpha, uSteps);
+    else
+        OptimizeAlpha<false>(&fAlphaA, &fAlphaB, fAlpha, uSteps);
 
     uint8_t bAlphaA = (uint8_t) static_cast<int32_t>(fAlphaA * 255.0f + 0.5f);
     uint8_t bAlphaB = (uint8_t) static_cast<int32_t>(fAlphaB * 255.0f + 0.5f);
@@ -1138,4 +1836,27 @@ void D3DXEncodeBC3(uint8_t *pBC, const XMVECTOR *pColor, DWORD flags)
     }
 }
 
+_Use_decl_annotations_
+void D3DXOptimizeBC3(uint8_t *pBC, const uint8_t *pWindow, size_t nWindow, const XMVECTOR *pColor, float lambda, float maxError)
+{
+    assert( pBC && pColor && (pWindow || !nWindow) );
+    assert( nWindow <= BC_RDO_WINDOW );
+
+    HDRColorA Color[NUM_PIXELS_PER_BLOCK];
+    float fAlpha[NUM_PIXELS_PER_BLOCK];
+    for(size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i)
+    {
+        XMStoreFloat4( reinterpret_cast<XMFLOAT4*>( &Color[i] ), pColor[i] );
+        Color[i] *= 255.0f;
+        fAlpha[i] = Color[i].a;
+    }
+
+    const RDOBlock rdo = { pBC, pWindow, nWindow, sizeof(D3DX_BC3), g_aFieldsBC3, _countof(g_aFieldsBC3), lambda };
+    const float fMaxErr = maxError * maxError * NUM_PIXELS_PER_BLOCK;
+
+    // Alpha first, as it comes first in the block
+    OptimizeRDOAlpha(rdo, fAlpha, fMaxErr);
+    OptimizeRDORGB(rdo, offsetof(D3DX_BC3, bc1), false, Color, fMaxErr * 3);
+}
+
 } // namespace
@@ -39,6 +39,12 @@ const uint16_t F16MAX       = 0x7bff;   // MAXFLT bit pattern for XMHALF
 #define BC7_MAX_REGIONS 3
 #define BC7_MAX_INDICES 16
 
+// Most blocks the batch encoders (D3DXEncodeBC1Batch, D3DXEncodeBC4UBatch, ...) are given at once by the compress loops
+const size_t BC_BATCH_BLOCKS = 16;
+
+// Most blocks the row decoders hand to D3DXExpandRow* at once
+const size_t BC_EXPAND_BLOCKS = 16;
+
 const size_t BC6H_NUM_CHANNELS = 3;
 const size_t BC6H_MAX_SHAPES = 32;
 
@@ -60,6 +66,9 @@ enum BC_FLAGS
     BC_FLAGS_DITHER_A   = 0x20000,  // Enables dithering for Alpha channel for BC1-3
     BC_FLAGS_UNIFORM    = 0x40000,  // By default, uses perceptual weighting for BC1-3; this flag makes it a uniform weighting
     BC_FLAGS_USE_3SUBSETS = 0x80000,// By default, BC7 skips mode 0 & 2; this flag adds those modes back
+    BC_FLAGS_FAST       = 0x100000, // By default, BC1-3 & BC6H search for the best endpoints; this flag fits them to the range of the colors & refits once instead
+    BC_FLAGS_BC7_QUALITY_MASK = 0xE00000, // BC7 quality level + 1; by default (0), BC7 uses its highest level
+    BC_FLAGS_SCALAR     = 0x4000000,// By default, BC1 & BC4/5 encode several blocks at once with SSE4.1 or AVX2; this flag uses the scalar encoders
 };
 
 //-------------------------------------------------------------------------------------
@@ -474,6 +483,22 @@ public:
         return ret;
     }
 
+    // The 64 bits starting at uStartBit, with zeros past the end of the block
+    uint64_t GetBits64(_In_ size_t uStartBit) const
+    {
+        static_assert(SizeInBytes == 16, "GetBits64 expects a 128-bit block");
+        assert(uStartBit < 128);
+        _Analysis_assume_(uStartBit < 128);
+        uint64_t uLow, uHigh;
+        memcpy(&uLow, m_uBits, sizeof(uint64_t));
+        memcpy(&uHigh, m_uBits + sizeof(uint64_t), sizeof(uint64_t));
+        if(uStartBit >= 64)
+            return uHigh >> (uStartBit - 64);
+        if(uStartBit == 0)
+            return uLow;
+        return (uLow >> uStartBit) | (uHigh << (64 - uStartBit));
+    }
+
     void SetBit(_Inout_ size_t& uStartBit, _In_ uint8_t uValue)
     {
         assert(uStartBit < 128 && uValue < 2);
@@ -521,6 +546,9 @@ class D3DX_BC6H : private CBits< 16 >
 public:
     void Decode(_In_ bool bSigned, _Out_writes_(NUM_PIXELS_PER_BLOCK) HDRColorA* pOut) const;
     void Encode(_In_ bool bSigned, _In_reads_(NUM_PIXELS_PER_BLOCK) const HDRColorA* const pIn);
+    void EncodeFast(_In_ bool bSigned, _In_reads_(NUM_PIXELS_PER_BLOCK) const HDRColorA* const pIn);
+    static void EncodeFastBatch(_Out_writes_(nBlocks) D3DX_BC6H* pBC, _In_ size_t nBlocks, _In_ bool bSigned,
+                                _In_reads_(nBlocks * NUM_PIXELS_PER_BLOCK) const HDRColorA* const pIn);
 
 private:
 #pragma warning(push)
@@ -580,6 +608,16 @@ private:
                 aIPixels[i].Set(aOriginal[i], bSigned);
             }
         }
+
+        // For pixels already converted to half float bit patterns
+        EncodeParams(const HDRColorA* const aOriginal, const INTColor* const aPixels, bool bSignedFormat) :
+            aHDRPixels(aOriginal), fBestErr(FLT_MAX), bSigned(bSignedFormat)
+        {
+            for(size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i)
+            {
+                aIPixels[i] = aPixels[i];
+            }
+        }
     };
 #pragma warning(pop)
 
@@ -604,10 +642,14 @@ private:
     void AssignIndices(_In_ const EncodeParams* pEP, _In_reads_(BC6H_MAX_REGIONS) const INTEndPntPair aEndPts[],
                         _Out_writes_(NUM_PIXELS_PER_BLOCK) size_t aIndices[],
                         _Out_writes_(BC6H_MAX_REGIONS) float aTotErr[]) const;
+    float AssignIndicesFast(_In_ const EncodeParams* pEP, _In_ const INTEndPntPair& endPts,
+                            _Out_writes_(NUM_PIXELS_PER_BLOCK) size_t aIndices[]) const;
     void QuantizeEndPts(_In_ const EncodeParams* pEP, _Out_writes_(BC6H_MAX_REGIONS) INTEndPntPair* qQntEndPts) const;
     void EmitBlock(_In_ const EncodeParams* pEP, _In_reads_(BC6H_MAX_REGIONS) const INTEndPntPair aEndPts[],
                    _In_reads_(NUM_PIXELS_PER_BLOCK) const size_t aIndices[]);
     void Refine(_Inout_ EncodeParams* pEP);
+    void EncodeSolid(_Inout_ EncodeParams* pEP);
+    void EncodeFastModes(_Inout_ EncodeParams* pEP, _In_ const INTEndPntPair& unqEndPts);
 
     static void GeneratePaletteUnquantized(_In_ const EncodeParams* pEP, _In_ size_t uRegion, _Out_writes_(BC6H_MAX_INDICES) INTColor aPalette[]);
     float MapColors(_In_ const EncodeParams* pEP, _In_ size_t uRegion, _In_ size_t np, _In_reads_(np) const size_t* auIndex) const;
@@ -624,7 +666,9 @@ class D3DX_BC7 : private CBits< 16 >
 {
 public:
     void Decode(_Out_writes_(NUM_PIXELS_PER_BLOCK) HDRColorA* pOut) const;
-    void Encode(bool skip3subsets, _In_reads_(NUM_PIXELS_PER_BLOCK) const HDRColorA* const pIn);
+    bool DecodeLDR(_Out_writes_(NUM_PIXELS_PER_BLOCK) LDRColorA* pOut) const;
+        // Returns false for an invalid block, which the caller fills with error colors
+    void Encode(_In_ DWORD flags, _In_reads_(NUM_PIXELS_PER_BLOCK) const HDRColorA* const pIn);
 
 private:
     struct ModeInfo
@@ -645,6 +689,7 @@ private:
     struct EncodeParams
     {
         uint8_t uMode;
+        uint8_t uRefine;
         LDREndPntPair aEndPts[BC7_MAX_SHAPES][BC7_MAX_REGIONS];
         LDRColorA aLDRPixels[NUM_PIXELS_PER_BLOCK];
         const HDRColorA* const aHDRPixels;
@@ -712,6 +757,7 @@ private:
                    _In_reads_(NUM_PIXELS_PER_BLOCK) const size_t aIndex[],
                    _In_reads_(NUM_PIXELS_PER_BLOCK) const size_t aIndex2[]);
     float Refine(_In_ const EncodeParams* pEP, _In_ size_t uShape, _In_ size_t uRotation, _In_ size_t uIndexMode);
+    void EncodeSolid(_Inout_ EncodeParams* pEP);
 
     float MapColors(_In_ const EncodeParams* pEP, _In_reads_(np) const LDRColorA aColors[], _In_ size_t np, _In_ size_t uIndexMode,
                     _In_ const LDREndPntPair& endPts, _In_ float fMinErr) const;
@@ -857,6 +903,97 @@ template <bool bRange> void OptimizeAlpha(float *pX, float *pY, const float *pPo
 #pragma warning(pop)
 
 
+//-------------------------------------------------------------------------------------
+// Rate-distortion optimization
+//-------------------------------------------------------------------------------------
+
+// Most blocks back that the RDO encoders look for bytes to repeat
+const size_t BC_RDO_WINDOW = 16;
+
+// Bits an LZ coder is taken to spend on a match, and the shortest match it finds
+const size_t BC_RDO_MATCH_BITS = 20;
+const size_t BC_RDO_MIN_MATCH = 3;
+
+// A block being rate-distortion optimized, with the blocks just before it in the output.
+// The block is split into fields (endpoints, indices) that are repeated whole.
+struct RDOBlock
+{
+    uint8_t        *pBlock;
+    const uint8_t  *pWindow;
+    size_t          nWindow;
+    size_t          uBlockSize;
+    const size_t   *pFieldSizes;
+    size_t          nFields;
+    float           fLambda;    // Squared error, in 8 bit units, worth one bit
+
+    // Estimated size of the block after LZ: a run of fields that repeats the same earlier
+    // block costs one match, and the other fields cost 8 bits a byte
+    size_t Bits() const
+    {
+        assert(nWindow <= 64);
+
+        size_t uBits = 0;
+        size_t uOffset = 0;
+        size_t uRun = 0;
+        uint64_t runMask = 0;
+
+        for(size_t iField = 0; iField < nFields; ++iField)
+        {
+            const size_t uSize = pFieldSizes[iField];
+
+            uint64_t mask = 0;
+            for(size_t j = 0; j < nWindow; ++j)
+            {
+                if(SameBytes(pWindow + j * uBlockSize + uOffset, pBlock + uOffset, uSize))
+                    mask |= uint64_t(1) << j;
+            }
+
+            if(runMask & mask)
+            {
+                runMask &= mask;
+                uRun += uSize;
+            }
+            else
+            {
+                uBits += RunBits(uRun);
+                runMask = mask;
+                uRun = (mask) ? uSize : 0;
+
+                if(!mask)
+                    uBits += uSize * 8;
+            }
+
+            uOffset += uSize;
+        }
+
+        return uBits + RunBits(uRun);
+    }
+
+    float Cost(_In_ float fErr) const
+    {
+        return fErr + fLambda * (float) Bits();
+    }
+
+    // Fields are short & mostly differ in the first byte, which beats calling memcmp
+    static bool SameBytes(_In_reads_bytes_(uSize) const uint8_t *p0, _In_reads_bytes_(uSize) const uint8_t *p1, _In_ size_t uSize)
+    {
+        for(size_t i = 0; i < uSize; ++i)
+        {
+            if(p0[i] != p1[i])
+                return false;
+        }
+
+        return true;
+    }
+
+private:
+    size_t RunBits(_In_ size_t uRun) const
+    {
+        return (uRun >= BC_RDO_MIN_MATCH) ? BC_RDO_MATCH_BITS : uRun * 8;
+    }
+};
+
+
 //-------------------------------------------------------------------------------------
 // Functions
 //-------------------------------------------------------------------------------------
@@ -875,17 +1012,78 @@ void D3DXDecodeBC6HU(_Out_writes_(NUM_PIXELS_PER_BLOCK) XMVECTOR *pColor, _In_re
 void D3DXDecodeBC6HS(_Out_writes_(NUM_PIXELS_PER_BLOCK) XMVECTOR *pColor, _In_reads_(16) const uint8_t *pBC);
 void D3DXDecodeBC7(_Out_writes_(NUM_PIXELS_PER_BLOCK) XMVECTOR *pColor, _In_reads_(16) const uint8_t *pBC);
 
+typedef void (*BC_DECODE_ROW)(uint8_t *pDest, size_t rowPitch, const uint8_t *pBC, size_t width, size_t height);
+
+void D3DXDecodeBC1RowRGBA8(_Out_writes_bytes_(rowPitch * (height - 1) + width * 4) uint8_t *pDest, _In_ size_t rowPitch, _In_reads_(((width + 3) >> 2) * 8) const uint8_t *pBC, _In_ size_t width, _In_range_(1,4) size_t height);
+void D3DXDecodeBC2RowRGBA8(_Out_writes_bytes_(rowPitch * (height - 1) + width * 4) uint8_t *pDest, _In_ size_t rowPitch, _In_reads_(((width + 3) >> 2) * 16) const uint8_t *pBC, _In_ size_t width, _In_range_(1,4) size_t height);
+void D3DXDecodeBC3RowRGBA8(_Out_writes_bytes_(rowPitch * (height - 1) + width * 4) uint8_t *pDest, _In_ size_t rowPitch, _In_reads_(((width + 3) >> 2) * 16) const uint8_t *pBC, _In_ size_t width, _In_range_(1,4) size_t height);
+void D3DXDecodeBC4URowR8(_Out_writes_bytes_(rowPitch * (height - 1) + width) uint8_t *pDest, _In_ size_t rowPitch, _In_reads_(((width + 3) >> 2) * 8) const uint8_t *pBC, _In_ size_t width, _In_range_(1,4) size_t height);
+void D3DXDecodeBC5URowR8G8(_Out_writes_bytes_(rowPitch * (height - 1) + width * 2) uint8_t *pDest, _In_ size_t rowPitch, _In_reads_(((width + 3) >> 2) * 16) const uint8_t *pBC, _In_ size_t width, _In_range_(1,4) size_t height);
+void D3DXDecodeBC7RowRGBA8(_Out_writes_bytes_(rowPitch * (height - 1) + width * 4) uint8_t *pDest, _In_ size_t rowPitch, _In_reads_(((width + 3) >> 2) * 16) const uint8_t *pBC, _In_ size_t width, _In_range_(1,4) size_t height);
+    // Decodes the row of blocks covering width texels straight to the first height rows of 8-bit texels, with the values
+    // D3DXDecode* followed by a store to DXGI_FORMAT_R8G8B8A8_UNORM, R8_UNORM or R8G8_UNORM would give
+
+void D3DXExpandRowRGBA8(_Out_writes_bytes_(rowPitch * (height - 1) + width * 4) uint8_t *pDest, _In_ size_t rowPitch, _In_reads_(((width + 3) >> 2) * 4) const uint32_t *pPalette,
+                        _In_reads_((width + 3) >> 2) const uint32_t *pBitmap, _In_reads_opt_(((width + 3) >> 2) * NUM_PIXELS_PER_BLOCK) const uint8_t *pAlpha, _In_ size_t width, _In_range_(1,4) size_t height);
+    // Writes blocks of 2-bit indices into 4 entry RGBA palettes, taking the alpha of each texel from pAlpha instead when
+    // it isn't null. Uses SIMD shuffles where the CPU allows.
+
+void D3DXExpandRowUNORM8(_Out_writes_bytes_(rowPitch * (height - 1) + width * channels) uint8_t *pDest, _In_ size_t rowPitch, _In_reads_(((width + 3) >> 2) * channels * 8) const uint8_t *pPalette,
+                         _In_reads_(((width + 3) >> 2) * channels) const uint64_t *pIndices, _In_range_(1,2) size_t channels, _In_ size_t width, _In_range_(1,4) size_t height);
+    // Writes blocks of 48 bits of 3-bit indices into 8 entry palettes, one per channel, for R8 (1 channel) or R8G8
+    // (2 channels) texels. Uses SIMD shuffles where the CPU allows.
+
+// The bytes _StoreScanline writes for a color stored to DXGI_FORMAT_R8G8B8A8_UNORM; the row decoders build their
+// palettes with it so they match the float decoders bit for bit
+inline uint32_t D3DXStoreRGBA8(_In_ FXMVECTOR v)
+{
+    // Must match g_8BitBias in DirectXTexConvert.cpp
+    static const XMVECTORF32 s_Bias = { 0.5f/255.f, 0.5f/255.f, 0.5f/255.f, 0.5f/255.f };
+
+    PackedVector::XMUBYTEN4 c;
+    PackedVector::XMStoreUByteN4( &c, XMVectorAdd( v, s_Bias ) );
+    return c.v;
+}
+
 void D3DXEncodeBC1(_Out_writes_(8) uint8_t *pBC, _In_reads_(NUM_PIXELS_PER_BLOCK) const XMVECTOR *pColor, _In_ float alphaRef, _In_ DWORD flags);
     // BC1 requires one additional parameter, so it doesn't match signature of BC_ENCODE above
 
+void D3DXEncodeBC1Batch(_Out_writes_(nBlocks * 8) uint8_t *pBC, _In_ size_t nBlocks, _In_reads_(nBlocks * NUM_PIXELS_PER_BLOCK) const XMVECTOR *pColor, _In_ float alphaRef, _In_ DWORD flags);
+    // Encodes nBlocks consecutive blocks to consecutive BC1 blocks, several at a time in SIMD lanes where the CPU allows,
+    // with the same results as D3DXEncodeBC1
+
 void D3DXEncodeBC2(_Out_writes_(16) uint8_t *pBC, _In_reads_(NUM_PIXELS_PER_BLOCK) const XMVECTOR *pColor, _In_ DWORD flags);
 void D3DXEncodeBC3(_Out_writes_(16) uint8_t *pBC, _In_reads_(NUM_PIXELS_PER_BLOCK) const XMVECTOR *pColor, _In_ DWORD flags);
 void D3DXEncodeBC4U(_Out_writes_(8) uint8_t *pBC, _In_reads_(NUM_PIXELS_PER_BLOCK) const XMVECTOR *pColor, _In_ DWORD flags);
 void D3DXEncodeBC4S(_Out_writes_(8) uint8_t *pBC, _In_reads_(NUM_PIXELS_PER_BLOCK) const XMVECTOR *pColor, _In_ DWORD flags);
 void D3DXEncodeBC5U(_Out_writes_(16) uint8_t *pBC, _In_reads_(NUM_PIXELS_PER_BLOCK) const XMVECTOR *pColor, _In_ DWORD flags);
 void D3DXEncodeBC5S(_Out_writes_(16) uint8_t *pBC, _In_reads_(NUM_PIXELS_PER_BLOCK) const XMVECTOR *pColor, _In_ DWORD flags);
+
+typedef void (*BC_ENCODE_BATCH)(uint8_t *pBC, size_t nBlocks, const XMVECTOR *pColor, DWORD flags);
+
+void D3DXEncodeBC4UBatch(_Out_writes_(nBlocks * 8) uint8_t *pBC, _In_ size_t nBlocks, _In_reads_(nBlocks * NUM_PIXELS_PER_BLOCK) const XMVECTOR *pColor, _In_ DWORD flags);
+void D3DXEncodeBC4SBatch(_Out_writes_(nBlocks * 8) uint8_t *pBC, _In_ size_t nBlocks, _In_reads_(nBlocks * NUM_PIXELS_PER_BLOCK) const XMVECTOR *pColor, _In_ DWORD flags);
+void D3DXEncodeBC5UBatch(_Out_writes_(nBlocks * 16) uint8_t *pBC, _In_ size_t nBlocks, _In_reads_(nBlocks * NUM_PIXELS_PER_BLOCK) const XMVECTOR *pColor, _In_ DWORD flags);
+void D3DXEncodeBC5SBatch(_Out_writes_(nBlocks * 16) uint8_t *pBC, _In_ size_t nBlocks, _In_reads_(nBlocks * NUM_PIXELS_PER_BLOCK) const XMVECTOR *pColor, _In_ DWORD flags);
+    // Encode nBlocks consecutive blocks, one channel of a block per SIMD lane where the CPU allows, with the same results
+    // as the single block encoders above
+
 void D3DXEncodeBC6HU(_Out_writes_(16) uint8_t *pBC, _In_reads_(NUM_PIXELS_PER_BLOCK) const XMVECTOR *pColor, _In_ DWORD flags);
 void D3DXEncodeBC6HS(_Out_writes_(16) uint8_t *pBC, _In_reads_(NUM_PIXELS_PER_BLOCK) const XMVECTOR *pColor, _In_ DWORD flags);
+
+void D3DXEncodeBC6HUBatch(_Out_writes_(nBlocks * 16) uint8_t *pBC, _In_ size_t nBlocks, _In_reads_(nBlocks * NUM_PIXELS_PER_BLOCK) const XMVECTOR *pColor, _In_ DWORD flags);
+void D3DXEncodeBC6HSBatch(_Out_writes_(nBlocks * 16) uint8_t *pBC, _In_ size_t nBlocks, _In_reads_(nBlocks * NUM_PIXELS_PER_BLOCK) const XMVECTOR *pColor, _In_ DWORD flags);
+    // With BC_FLAGS_FAST, fits the endpoints of four blocks at a time, one block per SIMD lane
+
 void D3DXEncodeBC7(_Out_writes_(16) uint8_t *pBC, _In_reads_(NUM_PIXELS_PER_BLOCK) const XMVECTOR *pColor, _In_ DWORD flags);
 
+typedef void (*BC_OPTIMIZE)(uint8_t *pBC, const uint8_t *pWindow, size_t nWindow, const XMVECTOR *pColor, float lambda, float maxError);
+
+void D3DXOptimizeBC1(_Inout_updates_(8) uint8_t *pBC, _In_reads_(nWindow * 8) const uint8_t *pWindow, _In_ size_t nWindow, _In_reads_(NUM_PIXELS_PER_BLOCK) const XMVECTOR *pColor, _In_ float lambda, _In_ float maxError);
+void D3DXOptimizeBC3(_Inout_updates_(16) uint8_t *pBC, _In_reads_(nWindow * 16) const uint8_t *pWindow, _In_ size_t nWindow, _In_reads_(NUM_PIXELS_PER_BLOCK) const XMVECTOR *pColor, _In_ float lambda, _In_ float maxError);
+void D3DXOptimizeBC7(_Inout_updates_(16) uint8_t *pBC, _In_reads_(nWindow * 16) const uint8_t *pWindow, _In_ size_t nWindow, _In_reads_(NUM_PIXELS_PER_BLOCK) const XMVECTOR *pColor, _In_ float lambda, _In_ float maxError);
+    // Rewrites a block encoded from pColor to repeat endpoints & indices of the nWindow (up to BC_RDO_WINDOW) blocks
+    // right before it at pWindow, where that lowers squared error + lambda * estimated bits. The RMS error of the
+    // block, in 8 bit units, stays within maxError or what the encoder gave if that is more.
+
 }; // namespace
@@ -17,6 +17,8 @@
 
 #include "BC.h"
 
+using namespace DirectX::PackedVector;
+
 namespace DirectX
 {
 
@@ -208,6 +210,15 @@ static void FindEndPointsBC4U( _In_reads_(BLOCK_SIZE) const float theTexelsU[],
         }
     }
 
+    // A solid block is exact with both endpoints on its value
+    if (fBlockMin == fBlockMax)
+    {
+        float fVal = std::max<float>( MIN_NORM, std::min<float>( MAX_NORM, fBlockMin ) );
+        endpointU_0 = (uint8_t) (fVal * 255.0f + 0.5f);
+        endpointU_1 = endpointU_0;
+        return;
+    }
+
     //  If there are boundary values in input texels, Should use 4 block-codec to guarantee
     //  the exact code of the boundary values.
     bool bUsing4BlockCodec = ( MIN_NORM == fBlockMin || MAX_NORM == fBlockMax );
@@ -262,6 +273,14 @@ static void FindEndPointsBC4S(_In_reads_(BLOCK_SIZE) const float theTexelsU[], _
         }
     }
 
+    // A solid block is exact with both endpoints on its value
+    if (fBlockMin == fBlockMax)
+    {
+        FloatToSNorm(fBlockMin, &endpointU_0);
+        endpointU_1 = endpointU_0;
+        return;
+    }
+
     //  If there are boundary values in input texels, Should use 4 block-codec to guarantee
     //  the exact code of the boundary values.
     bool bUsing4BlockCodec = ( MIN_NORM == fBlockMin || MAX_NORM == fBlockMax );
@@ -384,6 +403,39 @@ void D3DXDecodeBC4U( XMVECTOR *pColor, const uint8_t *pBC )
     }       
 }
 
+_Use_decl_annotations_
+void D3DXDecodeBC4URowR8(uint8_t *pDest, size_t rowPitch, const uint8_t *pBC, size_t width, size_t height)
+{
+    assert( pDest && pBC && width > 0 && height > 0 && height <= 4 );
+    static_assert( sizeof(BC4_UNORM) == 8, "BC4_UNORM should be 8 bytes" );
+
+    uint8_t aPalette[BC_EXPAND_BLOCKS * 8];
+    uint64_t aIndices[BC_EXPAND_BLOCKS];
+
+    auto pBC4 = reinterpret_cast<const BC4_UNORM*>(pBC);
+
+    for( size_t x = 0; x < width; x += BC_EXPAND_BLOCKS * 4 )
+    {
+        const size_t count = std::min<size_t>( width - x, BC_EXPAND_BLOCKS * 4 );
+        const size_t nBlocks = ( count + 3 ) >> 2;
+
+        for( size_t i = 0; i < nBlocks; ++i, ++pBC4 )
+        {
+            // Same clamp & truncation as _StoreScanline for DXGI_FORMAT_R8_UNORM
+            for( size_t j = 0; j < 8; ++j )
+            {
+                float v = pBC4->DecodeFromIndex( j );
+                v = std::max<float>( std::min<float>( v, 1.f ), 0.f );
+                aPalette[i * 8 + j] = static_cast<uint8_t>( v * 255.f );
+            }
+
+            aIndices[i] = pBC4->data >> 16;
+        }
+
+        D3DXExpandRowUNORM8( pDest + x, rowPitch, aPalette, aIndices, 1, count, height );
+    }
+}
+
 _Use_decl_annotations_
 void D3DXDecodeBC4S(XMVECTOR *pColor, const uint8_t *pBC)
 {
@@ -461,6 +513,41 @@ void D3DXDecodeBC5U(XMVECTOR *pColor, const uint8_t *pBC)
     }       
 }
 
+_Use_decl_annotations_
+void D3DXDecodeBC5URowR8G8(uint8_t *pDest, size_t rowPitch, const uint8_t *pBC, size_t width, size_t height)
+{
+    assert( pDest && pBC && width > 0 && height > 0 && height <= 4 );
+    static_assert( sizeof(BC4_UNORM) == 8, "BC4_UNORM should be 8 bytes" );
+
+    uint8_t aPalette[BC_EXPAND_BLOCKS * 16];
+    uint64_t aIndices[BC_EXPAND_BLOCKS * 2];
+
+    auto pBC4 = reinterpret_cast<const BC4_UNORM*>(pBC);
+
+    for( size_t x = 0; x < width; x += BC_EXPAND_BLOCKS * 4 )
+    {
+        const size_t count = std::min<size_t>( width - x, BC_EXPAND_BLOCKS * 4 );
+        const size_t nBlocks = ( count + 3 ) >> 2;
+
+        for( size_t i = 0; i < nBlocks; ++i, pBC4 += 2 )
+        {
+            // Red levels then green levels, each stored as _StoreScanline does for DXGI_FORMAT_R8G8_UNORM
+            for( size_t j = 0; j < 8; ++j )
+            {
+                XMUBYTEN2 rg;
+                XMStoreUByteN2( &rg, XMVectorSet( pBC4[0].DecodeFromIndex( j ), pBC4[1].DecodeFromIndex( j ), 0, 1.0f ) );
+                aPalette[i * 16 + j] = rg.x;
+                aPalette[i * 16 + 8 + j] = rg.y;
+            }
+
+            aIndices[i * 2] = pBC4[0].data >> 16;
+            aIndices[i * 2 + 1] = pBC4[1].data >> 16;
+        }
+
+        D3DXExpandRowUNORM8( pDest + x * 2, rowPitch, aPalette, aIndices, 2, count, height );
+    }
+}
+
 _Use_decl_annotations_
 void D3DXDecodeBC5S(XMVECTOR *pColor, const uint8_t *pBC)
 {
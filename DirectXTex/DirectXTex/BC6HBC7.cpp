@@ -554,6 +554,30 @@ const D3DX_BC7::ModeInfo D3DX_BC7::ms_aInfo[] =
         // Mode 7: Color+Alpha, 2 Subsets, RGBAP 55551 (unique P-bit), 2-bit indices, 64 partitions
 };
 
+// BC7 encoder effort for each quality level, from the quickest to the full search
+struct BC7Quality
+{
+    uint8_t uModes;         // modes to try (bit n for mode n); modes 0 & 2 also need BC_FLAGS_USE_3SUBSETS
+    uint8_t uPreselect;     // shapes passed to RoughMSE, the best by EstimateShapeError (0 for all of them)
+    uint8_t uItemsShift;    // of those, refine the best (shapes >> uItemsShift), at least 1
+    bool bRotations;        // try every rotation & index mode of modes 4 & 5, rather than only the first
+    uint8_t uRefine;        // endpoint search: 0 none, 1 one perturbation per channel, 2 alternating perturbations, 3 & then an exhaustive search
+};
+
+static const BC7Quality g_aBC7Quality[] =
+{
+    { 0x40, 1, 6, false, 0 },
+    { 0xC2, 1, 6, false, 0 },
+    { 0xC2, 2, 6, false, 1 },
+    { 0xFA, 2, 6, false, 1 },
+    { 0xFF, 4, 5, true,  2 },
+    { 0xFF, 16, 3, true, 3 },
+    { 0xFF, 0, 2, true,  3 },
+};
+
+static_assert( ARRAYSIZE(g_aBC7Quality) == BC7_QUALITY_LEVELS, "g_aBC7Quality should have an entry for each BC7 quality level" );
+static_assert( (BC_FLAGS_BC7_QUALITY_MASK >> 21) == BC7_QUALITY_LEVELS, "BC_FLAGS_BC7_QUALITY_MASK should hold each BC7 quality level + 1" );
+
 
 //-------------------------------------------------------------------------------------
 // Helper functions
@@ -601,6 +625,27 @@ inline static float Norm(_In_ const INTColor& a, _In_ const INTColor& b)
     return dr * dr + dg * dg + db * db;
 }
 
+// true if every pixel in the block is the same color
+inline static bool IsSolid(_In_reads_(NUM_PIXELS_PER_BLOCK) const INTColor aPixels[])
+{
+    for(size_t i = 1; i < NUM_PIXELS_PER_BLOCK; ++i)
+    {
+        if(aPixels[i].r != aPixels[0].r || aPixels[i].g != aPixels[0].g || aPixels[i].b != aPixels[0].b)
+            return false;
+    }
+    return true;
+}
+
+inline static bool IsSolid(_In_reads_(NUM_PIXELS_PER_BLOCK) const LDRColorA aPixels[])
+{
+    for(size_t i = 1; i < NUM_PIXELS_PER_BLOCK; ++i)
+    {
+        if(aPixels[i].r != aPixels[0].r || aPixels[i].g != aPixels[0].g || aPixels[i].b != aPixels[0].b || aPixels[i].a != aPixels[0].a)
+            return false;
+    }
+    return true;
+}
+
 // return # of bits needed to store n. handle signed or unsigned cases properly
 inline static int NBits(_In_ int n, _In_ bool bIsSigned)
 {
@@ -1055,6 +1100,86 @@ static float ComputeError(_Inout_ const LDRColorA& pixel, _In_reads_(1 << uIndex
 }
 
 
+//-------------------------------------------------------------------------------------
+// Cheap estimate of how badly a BC7 partition shape fits the pixels: the variance
+// left after each subset's principal axis, which is what its endpoints can't span.
+// Lets the lower quality levels pick a few shapes before trying any of them.
+//-------------------------------------------------------------------------------------
+static float EstimateShapeError(_In_reads_(NUM_PIXELS_PER_BLOCK) const LDRColorA aPixels[], _In_range_(0,2) size_t uPartitions, _In_range_(0,63) size_t uShape)
+{
+    float afSum[BC7_MAX_REGIONS][BC7_NUM_CHANNELS] = {};
+    float afCov[BC7_MAX_REGIONS][BC7_NUM_CHANNELS][BC7_NUM_CHANNELS] = {};
+    size_t anPixels[BC7_MAX_REGIONS] = {};
+
+    for(size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i)
+    {
+        const size_t p = g_aPartitionTable[uPartitions][uShape][i];
+        const float c[BC7_NUM_CHANNELS] = { float(aPixels[i].r), float(aPixels[i].g), float(aPixels[i].b), float(aPixels[i].a) };
+
+        ++anPixels[p];
+        for(size_t j = 0; j < BC7_NUM_CHANNELS; ++j)
+        {
+            afSum[p][j] += c[j];
+            for(size_t k = j; k < BC7_NUM_CHANNELS; ++k)
+                afCov[p][j][k] += c[j] * c[k];
+        }
+    }
+
+    float fError = 0;
+    for(size_t p = 0; p <= uPartitions; ++p)
+    {
+        // Two points or fewer always lie on a line
+        if(anPixels[p] <= 2)
+            continue;
+
+        const float fInvN = 1.0f / float(anPixels[p]);
+        float fTrace = 0;
+        size_t uLargest = 0;
+        for(size_t j = 0; j < BC7_NUM_CHANNELS; ++j)
+        {
+            for(size_t k = j; k < BC7_NUM_CHANNELS; ++k)
+            {
+                afCov[p][j][k] -= afSum[p][j] * afSum[p][k] * fInvN;
+                afCov[p][k][j] = afCov[p][j][k];
+            }
+            fTrace += afCov[p][j][j];
+            if(afCov[p][j][j] > afCov[p][uLargest][uLargest])
+                uLargest = j;
+        }
+
+        if(fTrace <= 0)
+            continue;
+
+        // A few power iterations, from the widest channel, find the principal axis
+        float v[BC7_NUM_CHANNELS] = { afCov[p][0][uLargest], afCov[p][1][uLargest], afCov[p][2][uLargest], afCov[p][3][uLargest] };
+        float fAxisVar = 0;
+        for(size_t iIteration = 0; iIteration < 3; ++iIteration)
+        {
+            float w[BC7_NUM_CHANNELS];
+            float fLen = 0, fDot = 0;
+            for(size_t j = 0; j < BC7_NUM_CHANNELS; ++j)
+            {
+                w[j] = afCov[p][j][0] * v[0] + afCov[p][j][1] * v[1] + afCov[p][j][2] * v[2] + afCov[p][j][3] * v[3];
+                fLen += v[j] * v[j];
+                fDot += v[j] * w[j];
+            }
+
+            if(fLen <= 0)
+                break;
+
+            fAxisVar = fDot / fLen;
+            const float fScale = 1.0f / sqrtf(fLen);
+            for(size_t j = 0; j < BC7_NUM_CHANNELS; ++j)
+                v[j] = w[j] * fScale;
+        }
+
+        fError += std::max(0.0f, fTrace - fAxisVar);
+    }
+
+    return fError;
+}
+
+
 inline static void FillWithErrorColors( _Out_writes_(NUM_PIXELS_PER_BLOCK) HDRColorA* pOut )
 {
     for(size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i)
@@ -1241,6 +1366,12 @@ void D3DX_BC6H::Encode(bool bSigned, const HDRColorA* const pIn)
 
     EncodeParams EP(pIn, bSigned);
 
+    if(IsSolid(EP.aIPixels))
+    {
+        EncodeSolid(&EP);
+        return;
+    }
+
     for(EP.uMode = 0; EP.uMode < ARRAYSIZE(ms_aInfo) && EP.fBestErr > 0; ++EP.uMode)
     {
         const uint8_t uShapes = ms_aInfo[EP.uMode].uPartitions ? 32 : 1;
@@ -1280,6 +1411,294 @@ void D3DX_BC6H::Encode(bool bSigned, const HDRColorA* const pIn)
 }
 
 
+//-------------------------------------------------------------------------------------
+// Fast encoding: one line through the block's principal axis, fitted in closed form,
+// and only the single region modes. Modes whose deltas can't hold the block's dynamic
+// range are skipped before any indices are assigned; mode 11 stores both endpoints in
+// full, so there is always one that fits.
+//-------------------------------------------------------------------------------------
+_Use_decl_annotations_
+void D3DX_BC6H::EncodeFast(bool bSigned, const HDRColorA* const pIn)
+{
+    EncodeFastBatch(this, 1, bSigned, pIn);
+}
+
+// The fits of four blocks are done together, one block per XMVECTOR lane; the mode
+// search & the indices then go block by block
+_Use_decl_annotations_
+void D3DX_BC6H::EncodeFastBatch(D3DX_BC6H* pBC, size_t nBlocks, bool bSigned, const HDRColorA* const pIn)
+{
+    assert( pBC && pIn );
+
+    const XMVECTOR vZero = XMVectorZero();
+
+    for(size_t uFirst = 0; uFirst < nBlocks; uFirst += 4)
+    {
+        const size_t uLanes = std::min<size_t>(4, nBlocks - uFirst);
+
+        // The fit is done on the half float bit patterns, which is what BC6H interpolates
+        INTColor aIPixels[4][NUM_PIXELS_PER_BLOCK];
+        for(size_t uLane = 0; uLane < uLanes; ++uLane)
+        {
+            const HDRColorA* pBlock = pIn + (uFirst + uLane) * NUM_PIXELS_PER_BLOCK;
+            for(size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i)
+                aIPixels[uLane][i].Set(pBlock[i], bSigned);
+        }
+
+        // Unused lanes repeat the last block
+        size_t auLane[4];
+        for(size_t uLane = 0; uLane < 4; ++uLane)
+            auLane[uLane] = std::min<size_t>(uLane, uLanes - 1);
+
+        XMVECTOR vR[NUM_PIXELS_PER_BLOCK], vG[NUM_PIXELS_PER_BLOCK], vB[NUM_PIXELS_PER_BLOCK];
+        XMVECTOR vMeanR = vZero, vMeanG = vZero, vMeanB = vZero;
+        for(size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i)
+        {
+            const INTColor& c0 = aIPixels[auLane[0]][i];
+            const INTColor& c1 = aIPixels[auLane[1]][i];
+            const INTColor& c2 = aIPixels[auLane[2]][i];
+            const INTColor& c3 = aIPixels[auLane[3]][i];
+            vR[i] = XMVectorSet(float(c0.r), float(c1.r), float(c2.r), float(c3.r));
+            vG[i] = XMVectorSet(float(c0.g), float(c1.g), float(c2.g), float(c3.g));
+            vB[i] = XMVectorSet(float(c0.b), float(c1.b), float(c2.b), float(c3.b));
+            vMeanR = XMVectorAdd(vMeanR, vR[i]);
+            vMeanG = XMVectorAdd(vMeanG, vG[i]);
+            vMeanB = XMVectorAdd(vMeanB, vB[i]);
+        }
+        vMeanR = XMVectorScale(vMeanR, 1.0f / NUM_PIXELS_PER_BLOCK);
+        vMeanG = XMVectorScale(vMeanG, 1.0f / NUM_PIXELS_PER_BLOCK);
+        vMeanB = XMVectorScale(vMeanB, 1.0f / NUM_PIXELS_PER_BLOCK);
+
+        // Covariance
+        XMVECTOR vRR = vZero, vGG = vZero, vBB = vZero;
+        XMVECTOR vRG = vZero, vGB = vZero, vBR = vZero;
+        for(size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i)
+        {
+            vR[i] = XMVectorSubtract(vR[i], vMeanR);
+            vG[i] = XMVectorSubtract(vG[i], vMeanG);
+            vB[i] = XMVectorSubtract(vB[i], vMeanB);
+            vRR = XMVectorMultiplyAdd(vR[i], vR[i], vRR);
+            vGG = XMVectorMultiplyAdd(vG[i], vG[i], vGG);
+            vBB = XMVectorMultiplyAdd(vB[i], vB[i], vBB);
+            vRG = XMVectorMultiplyAdd(vR[i], vG[i], vRG);
+            vGB = XMVectorMultiplyAdd(vG[i], vB[i], vGB);
+            vBR = XMVectorMultiplyAdd(vB[i], vR[i], vBR);
+        }
+
+        // Power iteration for the principal axis, starting from the variances; a lane
+        // whose axis vanishes keeps the one it had
+        XMVECTOR vAxisR = vRR, vAxisG = vGG, vAxisB = vBB;
+        for(size_t i = 0; i < 4; ++i)
+        {
+            const XMVECTOR x = XMVectorMultiplyAdd(vBR, vAxisB, XMVectorMultiplyAdd(vRG, vAxisG, XMVectorMultiply(vRR, vAxisR)));
+            const XMVECTOR y = XMVectorMultiplyAdd(vGB, vAxisB, XMVectorMultiplyAdd(vGG, vAxisG, XMVectorMultiply(vRG, vAxisR)));
+            const XMVECTOR z = XMVectorMultiplyAdd(vBB, vAxisB, XMVectorMultiplyAdd(vGB, vAxisG, XMVectorMultiply(vBR, vAxisR)));
+            const XMVECTOR vNorm = XMVectorMax(XMVectorAbs(x), XMVectorMax(XMVectorAbs(y), XMVectorAbs(z)));
+            const XMVECTOR vMove = XMVectorGreater(vNorm, vZero);
+            vAxisR = XMVectorSelect(vAxisR, XMVectorDivide(x, vNorm), vMove);
+            vAxisG = XMVectorSelect(vAxisG, XMVectorDivide(y, vNorm), vMove);
+            vAxisB = XMVectorSelect(vAxisB, XMVectorDivide(z, vNorm), vMove);
+        }
+
+        // Endpoints are where the pixels' projections onto the axis start and end
+        XMVECTOR vMin = XMVectorReplicate(FLT_MAX);
+        XMVECTOR vMax = XMVectorReplicate(-FLT_MAX);
+        for(size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i)
+        {
+            const XMVECTOR vDot = XMVectorMultiplyAdd(vB[i], vAxisB, XMVectorMultiplyAdd(vG[i], vAxisG, XMVectorMultiply(vR[i], vAxisR)));
+            vMin = XMVectorMin(vMin, vDot);
+            vMax = XMVectorMax(vMax, vDot);
+        }
+
+        const XMVECTOR vLenSq = XMVectorMultiplyAdd(vAxisB, vAxisB, XMVectorMultiplyAdd(vAxisG, vAxisG, XMVectorMultiply(vAxisR, vAxisR)));
+        const XMVECTOR vLine = XMVectorGreater(vLenSq, vZero);
+        vMin = XMVectorSelect(vZero, XMVectorDivide(vMin, vLenSq), vLine);
+        vMax = XMVectorSelect(vZero, XMVectorDivide(vMax, vLenSq), vLine);
+
+        XMFLOAT4A aEnd[6];
+        XMStoreFloat4A(&aEnd[0], XMVectorRound(XMVectorMultiplyAdd(vAxisR, vMin, vMeanR)));
+        XMStoreFloat4A(&aEnd[1], XMVectorRound(XMVectorMultiplyAdd(vAxisG, vMin, vMeanG)));
+        XMStoreFloat4A(&aEnd[2], XMVectorRound(XMVectorMultiplyAdd(vAxisB, vMin, vMeanB)));
+        XMStoreFloat4A(&aEnd[3], XMVectorRound(XMVectorMultiplyAdd(vAxisR, vMax, vMeanR)));
+        XMStoreFloat4A(&aEnd[4], XMVectorRound(XMVectorMultiplyAdd(vAxisG, vMax, vMeanG)));
+        XMStoreFloat4A(&aEnd[5], XMVectorRound(XMVectorMultiplyAdd(vAxisB, vMax, vMeanB)));
+
+        for(size_t uLane = 0; uLane < uLanes; ++uLane)
+        {
+            EncodeParams EP(pIn + (uFirst + uLane) * NUM_PIXELS_PER_BLOCK, aIPixels[uLane], bSigned);
+            D3DX_BC6H* pBlock = pBC + uFirst + uLane;
+
+            if(IsSolid(EP.aIPixels))
+            {
+                pBlock->EncodeSolid(&EP);
+                continue;
+            }
+
+            INTEndPntPair unqEndPts;
+            unqEndPts.A = INTColor(int((&aEnd[0].x)[uLane]), int((&aEnd[1].x)[uLane]), int((&aEnd[2].x)[uLane]));
+            unqEndPts.B = INTColor(int((&aEnd[3].x)[uLane]), int((&aEnd[4].x)[uLane]), int((&aEnd[5].x)[uLane]));
+            if(bSigned)
+            {
+                unqEndPts.A.Clamp(-F16MAX, F16MAX);
+                unqEndPts.B.Clamp(-F16MAX, F16MAX);
+            }
+            else
+            {
+                unqEndPts.A.Clamp(0, F16MAX);
+                unqEndPts.B.Clamp(0, F16MAX);
+            }
+
+            pBlock->EncodeFastModes(&EP, unqEndPts);
+        }
+    }
+}
+
+_Use_decl_annotations_
+void D3DX_BC6H::EncodeFastModes(EncodeParams* pEP, const INTEndPntPair& unqEndPts)
+{
+    assert( pEP );
+
+    // ms_aInfo entries for modes 14, 13, 12 & 11
+    static const uint8_t s_aFastModes[] = { 13, 12, 11, 10 };
+
+    pEP->uShape = 0;
+
+    for(size_t m = 0; m < ARRAYSIZE(s_aFastModes); ++m)
+    {
+        pEP->uMode = s_aFastModes[m];
+        pEP->aUnqEndPts[0][0] = unqEndPts;
+
+        const bool bTransformed = ms_aInfo[pEP->uMode].bTransformed;
+        INTEndPntPair aEndPts[BC6H_MAX_REGIONS];
+        size_t aIdx[NUM_PIXELS_PER_BLOCK];
+
+        QuantizeEndPts(pEP, aEndPts);
+        if(bTransformed)
+        {
+            // Index swapping only flips the delta's sign, so the range can be checked up front
+            const LDRColorA& Prec = ms_aInfo[pEP->uMode].RGBAPrec[0][1];
+            const INTColor delta = aEndPts[0].B - aEndPts[0].A;
+            if(NBits(abs(delta.r), true) > Prec.r ||
+               NBits(abs(delta.g), true) > Prec.g ||
+               NBits(abs(delta.b), true) > Prec.b)
+                continue;
+        }
+
+        const float fErr = AssignIndicesFast(pEP, aEndPts[0], aIdx);
+        SwapIndices(pEP, aEndPts, aIdx);
+
+        if(fErr >= pEP->fBestErr)
+            continue;
+
+        if(bTransformed) TransformForward(aEndPts);
+        if(EndPointsFit(pEP, aEndPts))
+        {
+            pEP->fBestErr = fErr;
+            EmitBlock(pEP, aEndPts, aIdx);
+            if(fErr <= 0.0f)
+                break;
+        }
+    }
+}
+
+
+//-------------------------------------------------------------------------------------
+// Solid blocks: every pixel takes the same index, so for each weight each channel's
+// endpoints can be searched on their own, a few steps either side of the quantized
+// color. Only the first half of the weights is needed, since the other half mirrors it
+// with the endpoints swapped, and that also keeps the fix-up index's high bit clear.
+//-------------------------------------------------------------------------------------
+_Use_decl_annotations_
+void D3DX_BC6H::EncodeSolid(EncodeParams* pEP)
+{
+    assert( pEP );
+
+    // ms_aInfo entries for modes 14, 13, 12 & 11, which all have 4 bit indices
+    static const uint8_t s_aSolidModes[] = { 13, 12, 11, 10 };
+    const int iSearch = 4;
+
+    const bool bSigned = pEP->bSigned;
+    INTColor color = pEP->aIPixels[0];
+    pEP->uShape = 0;
+
+    for(size_t m = 0; m < ARRAYSIZE(s_aSolidModes) && pEP->fBestErr > 0; ++m)
+    {
+        pEP->uMode = s_aSolidModes[m];
+        const bool bTransformed = ms_aInfo[pEP->uMode].bTransformed;
+        const LDRColorA& Prec = ms_aInfo[pEP->uMode].RGBAPrec[0][0];
+        const LDRColorA& DeltaPrec = ms_aInfo[pEP->uMode].RGBAPrec[0][1];
+        assert( ms_aInfo[pEP->uMode].uIndexPrec == 4 );
+
+        INTEndPntPair aEndPts[BC6H_MAX_REGIONS];
+        size_t uIndex = 0;
+        float fModeErr = FLT_MAX;
+
+        for(size_t i = 0; i < (BC6H_MAX_INDICES >> 1) && fModeErr > 0; ++i)
+        {
+            const int iWeight = g_aWeights4[i];
+            INTEndPntPair endPts;
+            float fErr = 0;
+
+            for(uint8_t c = 0; c < 3 && fErr < fModeErr; ++c)
+            {
+                const int iMax = bSigned ? ((Prec[c] >= 16) ? F16MAX : (1 << (Prec[c] - 1)) - 1)
+                                         : ((Prec[c] >= 15) ? F16MAX : (1 << Prec[c]) - 1);
+                const int iMin = bSigned ? -iMax : 0;
+                const int iQ = Quantize(color[c], Prec[c], bSigned);
+                const int iLo = std::max<int>(iMin, iQ - iSearch);
+                const int iHi = std::min<int>(iMax, iQ + iSearch);
+                float fBestErr = FLT_MAX;
+
+                for(int a = iLo; a <= iHi; ++a)
+                {
+                    const int iUnqA = Unquantize(a, Prec[c], bSigned);
+                    for(int b = iLo; b <= iHi; ++b)
+                    {
+                        if(bTransformed && NBits(b - a, true) > DeltaPrec[c])
+                            continue;
+
+                        const int iUnqB = Unquantize(b, Prec[c], bSigned);
+                        const int iValue = FinishUnquantize(
+                            (iUnqA * (BC67_WEIGHT_MAX - iWeight) + iUnqB * iWeight + BC67_WEIGHT_ROUND) >> BC67_WEIGHT_SHIFT,
+                            bSigned);
+                        const float fDiff = float(iValue - color[c]);
+                        if(fDiff * fDiff < fBestErr)
+                        {
+                            fBestErr = fDiff * fDiff;
+                            endPts.A[c] = a;
+                            endPts.B[c] = b;
+                        }
+                    }
+                }
+                fErr += fBestErr;
+            }
+
+            if(fErr < fModeErr)
+            {
+                fModeErr = fErr;
+                aEndPts[0] = endPts;
+                uIndex = i;
+            }
+        }
+
+        const float fErr = fModeErr * NUM_PIXELS_PER_BLOCK;
+        if(fErr >= pEP->fBestErr)
+            continue;
+
+        if(bTransformed) TransformForward(aEndPts);
+        if(EndPointsFit(pEP, aEndPts))
+        {
+            size_t aIdx[NUM_PIXELS_PER_BLOCK];
+            for(size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i)
+                aIdx[i] = uIndex;
+
+            pEP->fBestErr = fErr;
+            EmitBlock(pEP, aEndPts, aIdx);
+        }
+    }
+}
+
+
 //-------------------------------------------------------------------------------------
 _Use_decl_annotations_
 int D3DX_BC6H::Quantize(int iValue, int prec, bool bSigned)
@@ -1692,6 +2111,62 @@ void D3DX_BC6H::AssignIndices(const EncodeParams* pEP, const INTEndPntPair aEndP
     }
 }
 
+// AssignIndices for the single region modes: the distances to the whole palette are
+// taken four entries at a time, rather than searching until the error goes up, and the
+// closest entry wins
+_Use_decl_annotations_
+float D3DX_BC6H::AssignIndicesFast(const EncodeParams* pEP, const INTEndPntPair& endPts, size_t aIndices[]) const
+{
+    assert( pEP );
+    assert( ms_aInfo[pEP->uMode].uPartitions == 0 && ms_aInfo[pEP->uMode].uIndexPrec == 4 );
+
+    INTColor aPalette[BC6H_MAX_INDICES];
+    GeneratePaletteQuantized(pEP, endPts, aPalette);
+
+    XMVECTOR vPalR[BC6H_MAX_INDICES / 4], vPalG[BC6H_MAX_INDICES / 4], vPalB[BC6H_MAX_INDICES / 4];
+    for(size_t j = 0; j < BC6H_MAX_INDICES / 4; ++j)
+    {
+        const INTColor* p = &aPalette[j * 4];
+        vPalR[j] = XMVectorSet(float(p[0].r), float(p[1].r), float(p[2].r), float(p[3].r));
+        vPalG[j] = XMVectorSet(float(p[0].g), float(p[1].g), float(p[2].g), float(p[3].g));
+        vPalB[j] = XMVectorSet(float(p[0].b), float(p[1].b), float(p[2].b), float(p[3].b));
+    }
+
+    float fTotErr = 0;
+    for(size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i)
+    {
+        const XMVECTOR vR = XMVectorReplicate(float(pEP->aIPixels[i].r));
+        const XMVECTOR vG = XMVectorReplicate(float(pEP->aIPixels[i].g));
+        const XMVECTOR vB = XMVectorReplicate(float(pEP->aIPixels[i].b));
+
+        XMFLOAT4A aErr[BC6H_MAX_INDICES / 4];
+        for(size_t j = 0; j < BC6H_MAX_INDICES / 4; ++j)
+        {
+            const XMVECTOR vDR = XMVectorSubtract(vR, vPalR[j]);
+            const XMVECTOR vDG = XMVectorSubtract(vG, vPalG[j]);
+            const XMVECTOR vDB = XMVectorSubtract(vB, vPalB[j]);
+            XMStoreFloat4A(&aErr[j], XMVectorMultiplyAdd(vDB, vDB, XMVectorMultiplyAdd(vDG, vDG, XMVectorMultiply(vDR, vDR))));
+        }
+
+        const float* pErr = &aErr[0].x;
+        float fBestErr = pErr[0];
+        size_t uBest = 0;
+        for(size_t j = 1; j < BC6H_MAX_INDICES; ++j)
+        {
+            if(pErr[j] < fBestErr)
+            {
+                fBestErr = pErr[j];
+                uBest = j;
+            }
+        }
+
+        aIndices[i] = uBest;
+        fTotErr += fBestErr;
+    }
+
+    return fTotErr;
+}
+
 _Use_decl_annotations_
 void D3DX_BC6H::QuantizeEndPts(const EncodeParams* pEP, INTEndPntPair* aQntEndPts) const
 {
@@ -1934,7 +2409,7 @@ float D3DX_BC6H::RoughMSE(EncodeParams* pEP) const
 // BC7 Compression
 //-------------------------------------------------------------------------------------
 _Use_decl_annotations_
-void D3DX_BC7::Decode(HDRColorA* pOut) const
+bool D3DX_BC7::DecodeLDR(LDRColorA* pOut) const
 {
     assert( pOut );
 
@@ -1970,81 +2445,51 @@ void D3DX_BC7::Decode(HDRColorA* pOut) const
 
         assert( uNumEndPts <= (BC7_MAX_REGIONS << 1) );
 
-        // Red channel
-        for(i = 0; i < uNumEndPts; i++)
-        {
-            if ( uStartBit + RGBAPrec.r > 128 )
-            {
-#ifdef _DEBUG
-                OutputDebugStringA( "BC7: Invalid block encountered during decoding\n" );
-#endif
-                FillWithErrorColors( pOut );
-                return;
-            }
+        // The endpoint & index fields, which are checked against the block size once &
+        // then read a channel or an index field at a time from 64-bit windows
+        const uint8_t uPBits = ms_aInfo[uMode].uPBits;
+        assert( uPBits <= 6 );
+        _Analysis_assume_( uPBits <= 6 );
 
-            c[i].r = GetBits(uStartBit, RGBAPrec.r);
-        }
+        size_t uFieldBits = uNumEndPts * (RGBAPrec.r + RGBAPrec.g + RGBAPrec.b + RGBAPrec.a) + uPBits
+                            + NUM_PIXELS_PER_BLOCK * uIndexPrec - (uPartitions + 1);
+        if(uIndexPrec2)
+            uFieldBits += NUM_PIXELS_PER_BLOCK * uIndexPrec2 - 1;
 
-        // Green channel
-        for(i = 0; i < uNumEndPts; i++)
+        if ( uStartBit + uFieldBits > 128 )
         {
-            if ( uStartBit + RGBAPrec.g > 128 )
-            {
 #ifdef _DEBUG
-                OutputDebugStringA( "BC7: Invalid block encountered during decoding\n" );
+            OutputDebugStringA( "BC7: Invalid block encountered during decoding\n" );
 #endif
-                FillWithErrorColors( pOut );
-                return;
-            }
-
-             c[i].g = GetBits(uStartBit, RGBAPrec.g);
+            return false;
         }
 
-        // Blue channel
-        for(i = 0; i < uNumEndPts; i++)
+        for(register uint8_t ch = 0; ch < BC7_NUM_CHANNELS; ch++)
         {
-            if ( uStartBit + RGBAPrec.b > 128 )
+            const size_t uPrec = RGBAPrec[ch];
+            if(!uPrec)
             {
-#ifdef _DEBUG
-                OutputDebugStringA( "BC7: Invalid block encountered during decoding\n" );
-#endif
-                FillWithErrorColors( pOut );
-                return;
+                // Alpha is opaque for modes without it
+                for(i = 0; i < uNumEndPts; i++)
+                    c[i][ch] = 255;
+                continue;
             }
 
-            c[i].b = GetBits(uStartBit, RGBAPrec.b);
-        }
-
-        // Alpha channel
-        for(i = 0; i < uNumEndPts; i++)
-        {
-            if ( uStartBit + RGBAPrec.a > 128 )
-            {
-#ifdef _DEBUG
-                OutputDebugStringA( "BC7: Invalid block encountered during decoding\n" );
-#endif
-                FillWithErrorColors( pOut );
-                return;
-            }
+            uint64_t uBits = GetBits64(uStartBit);
+            for(i = 0; i < uNumEndPts; i++, uBits >>= uPrec)
+                c[i][ch] = uint8_t(uBits & ((1u << uPrec) - 1));
 
-            c[i].a = RGBAPrec.a ? GetBits(uStartBit, RGBAPrec.a) : 255;
+            uStartBit += uNumEndPts * uPrec;
         }
 
         // P-bits
-        assert( ms_aInfo[uMode].uPBits <= 6 );
-        _Analysis_assume_( ms_aInfo[uMode].uPBits <= 6 );
-        for(i = 0; i < ms_aInfo[uMode].uPBits; i++)
+        if(uPBits)
         {
-            if ( uStartBit > 127 )
-            {
-#ifdef _DEBUG
-                OutputDebugStringA( "BC7: Invalid block encountered during decoding\n" );
-#endif
-                FillWithErrorColors( pOut );
-                return;
-            }
+            uint64_t uBits = GetBits64(uStartBit);
+            for(i = 0; i < uPBits; i++, uBits >>= 1)
+                P[i] = uint8_t(uBits & 1);
 
-            P[i] = GetBit(uStartBit);
+            uStartBit += uPBits;
         }
 
         if(ms_aInfo[uMode].uPBits)
@@ -2067,60 +2512,70 @@ void D3DX_BC7::Decode(HDRColorA* pOut) const
             c[i] = Unquantize(c[i], RGBAPrecWithP);
         }
 
+        uint32_t uFixUps = 0;
+        for(i = 0; i <= uPartitions; i++)
+            uFixUps |= 1u << g_aFixUp[uPartitions][uShape][i];
+
         uint8_t w1[NUM_PIXELS_PER_BLOCK], w2[NUM_PIXELS_PER_BLOCK];
 
-        // read color indices
+        // read color indices, which like the alpha indices take at most 63 bits
+        uint64_t uBits = GetBits64(uStartBit);
         for(i = 0; i < NUM_PIXELS_PER_BLOCK; i++)
         {
-            size_t uNumBits = IsFixUpOffset(ms_aInfo[uMode].uPartitions, uShape, i) ? uIndexPrec - 1 : uIndexPrec;
-            if ( uStartBit + uNumBits > 128 )
-            {
-#ifdef _DEBUG
-                OutputDebugStringA( "BC7: Invalid block encountered during decoding\n" );
-#endif
-                FillWithErrorColors( pOut );
-                return;
-            }
-            w1[i] = GetBits(uStartBit, uNumBits);
+            size_t uNumBits = (uFixUps & (1u << i)) ? uIndexPrec - 1 : uIndexPrec;
+            w1[i] = uint8_t(uBits & ((1u << uNumBits) - 1));
+            uBits >>= uNumBits;
+            uStartBit += uNumBits;
         }
 
         // read alpha indices
         if(uIndexPrec2)
         {
+            uBits = GetBits64(uStartBit);
             for(i = 0; i < NUM_PIXELS_PER_BLOCK; i++)
             {
                 size_t uNumBits = i ? uIndexPrec2 : uIndexPrec2 - 1;
-                if ( uStartBit + uNumBits > 128 )
-                {
-#ifdef _DEBUG
-                    OutputDebugStringA( "BC7: Invalid block encountered during decoding\n" );
-#endif
-                    FillWithErrorColors( pOut );
-                    return;
-                }
-                w2[i] = GetBits(uStartBit, uNumBits );
+                w2[i] = uint8_t(uBits & ((1u << uNumBits) - 1));
+                uBits >>= uNumBits;
+                uStartBit += uNumBits;
             }
         }
 
-        for(i = 0; i < NUM_PIXELS_PER_BLOCK; ++i)
+        // Same weights & rounding as LDRColorA::Interpolate, picked once for the block
+        const uint8_t* pwc = w1;
+        const uint8_t* pwa = w1;
+        size_t wcprec = uIndexPrec;
+        size_t waprec = uIndexPrec;
+        if(uIndexPrec2)
         {
-            uint8_t uRegion = g_aPartitionTable[uPartitions][uShape][i];
-            LDRColorA outPixel;
-            if(uIndexPrec2 == 0)
+            if(uIndexMode == 0)
             {
-                LDRColorA::Interpolate(c[uRegion << 1], c[(uRegion << 1) + 1], w1[i], w1[i], uIndexPrec, uIndexPrec, outPixel);
+                pwa = w2;
+                waprec = uIndexPrec2;
             }
             else
             {
-                if(uIndexMode == 0)
-                {
-                    LDRColorA::Interpolate(c[uRegion << 1], c[(uRegion << 1) + 1], w1[i], w2[i], uIndexPrec, uIndexPrec2, outPixel);
-                }
-                else
-                {
-                    LDRColorA::Interpolate(c[uRegion << 1], c[(uRegion << 1) + 1], w2[i], w1[i], uIndexPrec2, uIndexPrec, outPixel);
-                }
+                pwc = w2;
+                wcprec = uIndexPrec2;
             }
+        }
+
+        const int* aWeightsC = (wcprec == 2) ? g_aWeights2 : (wcprec == 3) ? g_aWeights3 : g_aWeights4;
+        const int* aWeightsA = (waprec == 2) ? g_aWeights2 : (waprec == 3) ? g_aWeights3 : g_aWeights4;
+
+        for(i = 0; i < NUM_PIXELS_PER_BLOCK; ++i)
+        {
+            uint8_t uRegion = g_aPartitionTable[uPartitions][uShape][i];
+            const LDRColorA& c0 = c[uRegion << 1];
+            const LDRColorA& c1 = c[(uRegion << 1) + 1];
+            const uint32_t wc = uint32_t(aWeightsC[pwc[i]]);
+            const uint32_t wa = uint32_t(aWeightsA[pwa[i]]);
+
+            LDRColorA outPixel;
+            outPixel.r = uint8_t((uint32_t(c0.r) * (BC67_WEIGHT_MAX - wc) + uint32_t(c1.r) * wc + BC67_WEIGHT_ROUND) >> BC67_WEIGHT_SHIFT);
+            outPixel.g = uint8_t((uint32_t(c0.g) * (BC67_WEIGHT_MAX - wc) + uint32_t(c1.g) * wc + BC67_WEIGHT_ROUND) >> BC67_WEIGHT_SHIFT);
+            outPixel.b = uint8_t((uint32_t(c0.b) * (BC67_WEIGHT_MAX - wc) + uint32_t(c1.b) * wc + BC67_WEIGHT_ROUND) >> BC67_WEIGHT_SHIFT);
+            outPixel.a = uint8_t((uint32_t(c0.a) * (BC67_WEIGHT_MAX - wa) + uint32_t(c1.a) * wa + BC67_WEIGHT_ROUND) >> BC67_WEIGHT_SHIFT);
 
             switch(uRotation)
             {
@@ -2129,7 +2584,7 @@ void D3DX_BC7::Decode(HDRColorA* pOut) const
             case 3: std::swap(outPixel.b, outPixel.a); break;
             }
 
-            pOut[i] = HDRColorA(outPixel);
+            pOut[i] = outPixel;
         }
     }
     else
@@ -2138,17 +2593,42 @@ void D3DX_BC7::Decode(HDRColorA* pOut) const
         OutputDebugStringA( "BC7: Reserved mode 8 encountered during decoding\n" );
 #endif
         // Per the BC7 format spec, we must return transparent black
-        memset( pOut, 0, sizeof(HDRColorA) * NUM_PIXELS_PER_BLOCK );
+        memset( pOut, 0, sizeof(LDRColorA) * NUM_PIXELS_PER_BLOCK );
+    }
+
+    return true;
+}
+
+_Use_decl_annotations_
+void D3DX_BC7::Decode(HDRColorA* pOut) const
+{
+    assert( pOut );
+
+    LDRColorA aColor[NUM_PIXELS_PER_BLOCK];
+    if ( !DecodeLDR( aColor ) )
+    {
+        FillWithErrorColors( pOut );
+        return;
+    }
+
+    for(size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i)
+    {
+        pOut[i] = HDRColorA(aColor[i]);
     }
 }
 
 _Use_decl_annotations_
-void D3DX_BC7::Encode(bool skip3subsets, const HDRColorA* const pIn)
+void D3DX_BC7::Encode(DWORD flags, const HDRColorA* const pIn)
 {
     assert( pIn );
 
+    const DWORD uQualityBits = (flags & BC_FLAGS_BC7_QUALITY_MASK) >> 21;
+    const BC7Quality& quality = g_aBC7Quality[uQualityBits ? (uQualityBits - 1) : (BC7_QUALITY_LEVELS - 1)];
+    const bool skip3subsets = !(flags & BC_FLAGS_USE_3SUBSETS);
+
     D3DX_BC7 final = *this;
     EncodeParams EP(pIn);
+    EP.uRefine = quality.uRefine;
     float fMSEBest = FLT_MAX;
     
     for(size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i)
@@ -2159,8 +2639,21 @@ void D3DX_BC7::Encode(bool skip3subsets, const HDRColorA* const pIn)
         EP.aLDRPixels[i].a = uint8_t( std::max<float>( 0.0f, std::min<float>( 255.0f, pIn[i].a * 255.0f + 0.01f ) ) );
     }
 
+    if(IsSolid(EP.aLDRPixels))
+    {
+        EncodeSolid(&EP);
+        return;
+    }
+
+    // Shape estimates for the pre-selection only depend on the pixels & the number of subsets
+    float afEstimate[BC7_MAX_REGIONS][BC7_MAX_SHAPES];
+    bool abEstimated[BC7_MAX_REGIONS] = {};
+
     for(EP.uMode = 0; EP.uMode < 8 && fMSEBest > 0; ++EP.uMode)
     {
+        if ( !(quality.uModes & (1 << EP.uMode)) )
+            continue;
+
         if ( skip3subsets && (EP.uMode == 0 || EP.uMode == 2) )
         {
             // 3 subset modes tend to be used rarely and add significant compression time
@@ -2171,14 +2664,43 @@ void D3DX_BC7::Encode(bool skip3subsets, const HDRColorA* const pIn)
         assert( uShapes <= BC7_MAX_SHAPES );
         _Analysis_assume_( uShapes <= BC7_MAX_SHAPES );
 
-        const size_t uNumRots = size_t(1) << ms_aInfo[EP.uMode].uRotationBits;
-        const size_t uNumIdxMode = size_t(1) << ms_aInfo[EP.uMode].uIndexModeBits;
-        // Number of rough cases to look at. reasonable values of this are 1, uShapes/4, and uShapes
-        // uShapes/4 gets nearly all the cases; you can increase that a bit (say by 3 or 4) if you really want to squeeze the last bit out
-        const size_t uItems = std::max<size_t>(1, uShapes >> 2);
+        const size_t uNumRots = quality.bRotations ? (size_t(1) << ms_aInfo[EP.uMode].uRotationBits) : 1;
+        const size_t uNumIdxMode = quality.bRotations ? (size_t(1) << ms_aInfo[EP.uMode].uIndexModeBits) : 1;
         float afRoughMSE[BC7_MAX_SHAPES];
         size_t auShape[BC7_MAX_SHAPES];
 
+        // Shapes to look at roughly; the lower quality levels pre-select the best few by estimate
+        size_t auCandidate[BC7_MAX_SHAPES];
+        size_t uCandidates = uShapes;
+
+        for(size_t s = 0; s < uShapes; s++)
+            auCandidate[s] = s;
+
+        if(quality.uPreselect && quality.uPreselect < uShapes)
+        {
+            const uint8_t uPartitions = ms_aInfo[EP.uMode].uPartitions;
+            if(!abEstimated[uPartitions])
+            {
+                for(size_t s = 0; s < BC7_MAX_SHAPES; s++)
+                    afEstimate[uPartitions][s] = EstimateShapeError(EP.aLDRPixels, uPartitions, s);
+                abEstimated[uPartitions] = true;
+            }
+
+            uCandidates = quality.uPreselect;
+            for(size_t i = 0; i < uCandidates; i++)
+            {
+                for(size_t j = i + 1; j < uShapes; j++)
+                {
+                    if(afEstimate[uPartitions][auCandidate[i]] > afEstimate[uPartitions][auCandidate[j]])
+                        std::swap(auCandidate[i], auCandidate[j]);
+                }
+            }
+        }
+
+        // Number of rough cases to look at. reasonable values of this are 1, uShapes/4, and uShapes
+        // uShapes/4 gets nearly all the cases; you can increase that a bit (say by 3 or 4) if you really want to squeeze the last bit out
+        const size_t uItems = std::min<size_t>(uCandidates, std::max<size_t>(1, uShapes >> quality.uItemsShift));
+
         for(size_t r = 0; r < uNumRots && fMSEBest > 0; ++r)
         {
             switch(r)
@@ -2191,16 +2713,16 @@ void D3DX_BC7::Encode(bool skip3subsets, const HDRColorA* const pIn)
             for(size_t im = 0; im < uNumIdxMode && fMSEBest > 0; ++im)
             {
                 // pick the best uItems shapes and refine these.
-                for(size_t s = 0; s < uShapes; s++)
+                for(size_t s = 0; s < uCandidates; s++)
                 {
-                    afRoughMSE[s] = RoughMSE(&EP, s, im);
-                    auShape[s] = s;
+                    afRoughMSE[s] = RoughMSE(&EP, auCandidate[s], im);
+                    auShape[s] = auCandidate[s];
                 }
 
                 // Bubble up the first uItems items
                 for(size_t i = 0; i < uItems; i++)
                 {
-                    for(size_t j = i + 1; j < uShapes; j++)
+                    for(size_t j = i + 1; j < uCandidates; j++)
                     {
                         if(afRoughMSE[i] > afRoughMSE[j])
                         {
@@ -2234,6 +2756,63 @@ void D3DX_BC7::Encode(bool skip3subsets, const HDRColorA* const pIn)
 }
 
 
+//-------------------------------------------------------------------------------------
+// Solid blocks are exact in mode 5: every 8 bit value is the first interpolated color
+// of some pair of 7 bit endpoints near half of it, and the alpha endpoints are 8 bits.
+//-------------------------------------------------------------------------------------
+_Use_decl_annotations_
+void D3DX_BC7::EncodeSolid(EncodeParams* pEP)
+{
+    assert( pEP );
+
+    const int iSearch = 3;
+    const LDRColorA& color = pEP->aLDRPixels[0];
+    pEP->uMode = 5;
+
+    const LDRColorA& RGBAPrec = ms_aInfo[pEP->uMode].RGBAPrec;
+    assert( ms_aInfo[pEP->uMode].uIndexPrec == 2 && RGBAPrec.a == 8 );
+
+    LDREndPntPair aEndPts[BC7_MAX_REGIONS];
+    aEndPts[0].A.a = aEndPts[0].B.a = color.a;
+
+    for(size_t ch = 0; ch < BC7_NUM_CHANNELS - 1; ++ch)
+    {
+        const int iMax = (1 << RGBAPrec[ch]) - 1;
+        const int iLo = std::max<int>(0, (color[ch] >> 1) - iSearch);
+        const int iHi = std::min<int>(iMax, (color[ch] >> 1) + iSearch);
+        int iBestErr = 256;
+
+        for(int a = iLo; a <= iHi && iBestErr > 0; ++a)
+        {
+            for(int b = iLo; b <= iHi && iBestErr > 0; ++b)
+            {
+                const int iValue = (Unquantize(uint8_t(a), RGBAPrec[ch]) * (BC67_WEIGHT_MAX - g_aWeights2[1])
+                                    + Unquantize(uint8_t(b), RGBAPrec[ch]) * g_aWeights2[1] + BC67_WEIGHT_ROUND) >> BC67_WEIGHT_SHIFT;
+                const int iErr = abs(iValue - int(color[ch]));
+                if(iErr < iBestErr)
+                {
+                    iBestErr = iErr;
+                    aEndPts[0].A[ch] = uint8_t(a);
+                    aEndPts[0].B[ch] = uint8_t(b);
+                }
+            }
+        }
+        assert( iBestErr == 0 );
+    }
+
+    // Color indices all pick the first interpolated color, and alpha the first endpoint
+    size_t aIndex[NUM_PIXELS_PER_BLOCK];
+    size_t aIndex2[NUM_PIXELS_PER_BLOCK];
+    for(size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i)
+    {
+        aIndex[i] = 1;
+        aIndex2[i] = 0;
+    }
+
+    EmitBlock(pEP, 0, 0, 0, aEndPts, aIndex, aIndex2);
+}
+
+
 //-------------------------------------------------------------------------------------
 _Use_decl_annotations_
 void D3DX_BC7::GeneratePaletteQuantized(const EncodeParams* pEP, size_t uIndexMode, const LDREndPntPair& endPts, LDRColorA aPalette[]) const
@@ -2424,7 +3003,7 @@ void D3DX_BC7::OptimizeOne(const EncodeParams* pEP, const LDRColorA aColors[], s
         }
 
         // now alternate endpoints and keep trying until there is no improvement
-        for( ; ; )
+        while(pEP->uRefine >= 2)
         {
             float fErr = PerturbOne(pEP, aColors, np, uIndexMode, ch, opt, newEndPts, fOptErr, do_b);
             if(fErr >= fOptErr)
@@ -2439,8 +3018,11 @@ void D3DX_BC7::OptimizeOne(const EncodeParams* pEP, const LDRColorA aColors[], s
     }
 
     // finally, do a small exhaustive search around what we think is the global minima to be sure
-    for(size_t ch = 0; ch < BC7_NUM_CHANNELS; ch++)
-        Exhaustive(pEP, aColors, np, uIndexMode, ch, fOptErr, opt);
+    if(pEP->uRefine >= 3)
+    {
+        for(size_t ch = 0; ch < BC7_NUM_CHANNELS; ch++)
+            Exhaustive(pEP, aColors, np, uIndexMode, ch, fOptErr, opt);
+    }
 }
 
 _Use_decl_annotations_
@@ -2661,15 +3243,24 @@ float D3DX_BC7::Refine(const EncodeParams* pEP, size_t uShape, size_t uRotation,
     }
 
     AssignIndices(pEP, uShape, uIndexMode, aOrgEndPts, aOrgIdx, aOrgIdx2, aOrgErr);
+
+    float fOrgTotErr = 0;
+    for(register size_t p = 0; p <= uPartitions; p++)
+        fOrgTotErr += aOrgErr[p];
+
+    if(!pEP->uRefine)
+    {
+        EmitBlock(pEP, uShape, uRotation, uIndexMode, aOrgEndPts, aOrgIdx, aOrgIdx2);
+        return fOrgTotErr;
+    }
+
     OptimizeEndPoints(pEP, uShape, uIndexMode, aOrgErr, aOrgEndPts, aOptEndPts);
     AssignIndices(pEP, uShape, uIndexMode, aOptEndPts, aOptIdx, aOptIdx2, aOptErr);
 
-    float fOrgTotErr = 0, fOptTotErr = 0;
+    float fOptTotErr = 0;
     for(register size_t p = 0; p <= uPartitions; p++)
-    {
-        fOrgTotErr += aOrgErr[p];
         fOptTotErr += aOptErr[p];
-    }
+
     if(fOptTotErr < fOrgTotErr)
     {
         EmitBlock(pEP, uShape, uRotation, uIndexMode, aOptEndPts, aOptIdx, aOptIdx2);
@@ -2836,19 +3427,51 @@ void D3DXDecodeBC6HS(XMVECTOR *pColor, const uint8_t *pBC)
 _Use_decl_annotations_
 void D3DXEncodeBC6HU(uint8_t *pBC, const XMVECTOR *pColor, DWORD flags)
 {
-    UNREFERENCED_PARAMETER(flags);
     assert( pBC && pColor );
     static_assert( sizeof(D3DX_BC6H) == 16, "D3DX_BC6H should be 16 bytes" );
-    reinterpret_cast< D3DX_BC6H* >( pBC )->Encode(false, reinterpret_cast<const HDRColorA*>(pColor));
+    if(flags & BC_FLAGS_FAST)
+        reinterpret_cast< D3DX_BC6H* >( pBC )->EncodeFast(false, reinterpret_cast<const HDRColorA*>(pColor));
+    else
+        reinterpret_cast< D3DX_BC6H* >( pBC )->Encode(false, reinterpret_cast<const HDRColorA*>(pColor));
 }
 
 _Use_decl_annotations_
 void D3DXEncodeBC6HS(uint8_t *pBC, const XMVECTOR *pColor, DWORD flags)
 {
-    UNREFERENCED_PARAMETER(flags);
     assert( pBC && pColor );
     static_assert( sizeof(D3DX_BC6H) == 16, "D3DX_BC6H should be 16 bytes" );
-    reinterpret_cast< D3DX_BC6H* >( pBC )->Encode(true, reinterpret_cast<const HDRColorA*>(pColor));
+    if(flags & BC_FLAGS_FAST)
+        reinterpret_cast< D3DX_BC6H* >( pBC )->EncodeFast(true, reinterpret_cast<const HDRColorA*>(pColor));
+    else
+        reinterpret_cast< D3DX_BC6H* >( pBC )->Encode(true, reinterpret_cast<const HDRColorA*>(pColor));
+}
+
+_Use_decl_annotations_
+void D3DXEncodeBC6HUBatch(uint8_t *pBC, size_t nBlocks, const XMVECTOR *pColor, DWORD flags)
+{
+    assert( pBC && pColor );
+    static_assert( sizeof(D3DX_BC6H) == 16, "D3DX_BC6H should be 16 bytes" );
+    if(flags & BC_FLAGS_FAST)
+        D3DX_BC6H::EncodeFastBatch(reinterpret_cast< D3DX_BC6H* >( pBC ), nBlocks, false, reinterpret_cast<const HDRColorA*>(pColor));
+    else
+    {
+        for(size_t i = 0; i < nBlocks; ++i)
+            D3DXEncodeBC6HU(pBC + i * 16, pColor + i * NUM_PIXELS_PER_BLOCK, flags);
+    }
+}
+
+_Use_decl_annotations_
+void D3DXEncodeBC6HSBatch(uint8_t *pBC, size_t nBlocks, const XMVECTOR *pColor, DWORD flags)
+{
+    assert( pBC && pColor );
+    static_assert( sizeof(D3DX_BC6H) == 16, "D3DX_BC6H should be 16 bytes" );
+    if(flags & BC_FLAGS_FAST)
+        D3DX_BC6H::EncodeFastBatch(reinterpret_cast< D3DX_BC6H* >( pBC ), nBlocks, true, reinterpret_cast<const HDRColorA*>(pColor));
+    else
+    {
+        for(size_t i = 0; i < nBlocks; ++i)
+            D3DXEncodeBC6HS(pBC + i * 16, pColor + i * NUM_PIXELS_PER_BLOCK, flags);
+    }
 }
 
 
@@ -2863,12 +3486,140 @@ void D3DXDecodeBC7(XMVECTOR *pColor, const uint8_t *pBC)
     reinterpret_cast< const D3DX_BC7* >( pBC )->Decode(reinterpret_cast<HDRColorA*>(pColor));
 }
 
+_Use_decl_annotations_
+void D3DXDecodeBC7RowRGBA8(uint8_t *pDest, size_t rowPitch, const uint8_t *pBC, size_t width, size_t height)
+{
+    assert( pDest && pBC && width > 0 && height > 0 && height <= 4 );
+    static_assert( sizeof(D3DX_BC7) == 16, "D3DX_BC7 should be 16 bytes" );
+
+    // Each 8-bit level as D3DXDecodeBC7 & D3DXStoreRGBA8 give it
+    uint8_t aLevels[256];
+    for(size_t i = 0; i < 256; i += 4)
+    {
+        const HDRColorA level( LDRColorA( uint8_t(i), uint8_t(i + 1), uint8_t(i + 2), uint8_t(i + 3) ) );
+        const uint32_t c = D3DXStoreRGBA8( XMLoadFloat4( reinterpret_cast<const XMFLOAT4*>( &level ) ) );
+        aLevels[i    ] = uint8_t( c );
+        aLevels[i + 1] = uint8_t( c >> 8 );
+        aLevels[i + 2] = uint8_t( c >> 16 );
+        aLevels[i + 3] = uint8_t( c >> 24 );
+    }
+
+    auto pBC7 = reinterpret_cast< const D3DX_BC7* >( pBC );
+
+    for(size_t x = 0; x < width; x += 4, ++pBC7)
+    {
+        uint32_t aTexels[NUM_PIXELS_PER_BLOCK];
+
+        LDRColorA aColor[NUM_PIXELS_PER_BLOCK];
+        if ( pBC7->DecodeLDR( aColor ) )
+        {
+            for(size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i)
+            {
+                aTexels[i] = uint32_t( aLevels[aColor[i].r] ) | ( uint32_t( aLevels[aColor[i].g] ) << 8 )
+                             | ( uint32_t( aLevels[aColor[i].b] ) << 16 ) | ( uint32_t( aLevels[aColor[i].a] ) << 24 );
+            }
+        }
+        else
+        {
+            HDRColorA aError[NUM_PIXELS_PER_BLOCK];
+            FillWithErrorColors( aError );
+
+            for(size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i)
+            {
+                aTexels[i] = D3DXStoreRGBA8( XMLoadFloat4( reinterpret_cast<const XMFLOAT4*>( &aError[i] ) ) );
+            }
+        }
+
+        const size_t pw = std::min<size_t>( 4, width - x );
+        for(size_t y = 0; y < height; ++y)
+        {
+            memcpy( pDest + y * rowPitch + x * 4, &aTexels[y * 4], pw * sizeof(uint32_t) );
+        }
+    }
+}
+
 _Use_decl_annotations_
 void D3DXEncodeBC7(uint8_t *pBC, const XMVECTOR *pColor, DWORD flags)
 {
     assert( pBC && pColor );
     static_assert( sizeof(D3DX_BC7) == 16, "D3DX_BC7 should be 16 bytes" );
-    reinterpret_cast< D3DX_BC7* >( pBC )->Encode( !(flags& BC_FLAGS_USE_3SUBSETS), reinterpret_cast<const HDRColorA*>(pColor));
+    reinterpret_cast< D3DX_BC7* >( pBC )->Encode( flags, reinterpret_cast<const HDRColorA*>(pColor));
+}
+
+// Squared RGBA error, in 8 bit units, of a BC7 block against the colors it was encoded from
+static float ErrorBC7(_In_reads_(16) const uint8_t *pBC, _In_reads_(NUM_PIXELS_PER_BLOCK) const HDRColorA *pColor)
+{
+    HDRColorA aDecoded[NUM_PIXELS_PER_BLOCK];
+    reinterpret_cast< const D3DX_BC7* >( pBC )->Decode(aDecoded);
+
+    float fErr = 0.0f;
+    for(size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i)
+    {
+        HDRColorA diff = aDecoded[i] - pColor[i];
+        fErr += diff * diff;
+    }
+
+    return fErr * (255.0f * 255.0f);
+}
+
+_Use_decl_annotations_
+void D3DXOptimizeBC7(uint8_t *pBC, const uint8_t *pWindow, size_t nWindow, const XMVECTOR *pColor, float lambda, float maxError)
+{
+    assert( pBC && pColor && (pWindow || !nWindow) );
+    assert( nWindow <= BC_RDO_WINDOW );
+    static_assert( sizeof(D3DX_BC7) == 16, "D3DX_BC7 should be 16 bytes" );
+
+    static const size_t aFields[] = { 4, 4, 4, 4 };
+    const RDOBlock rdo = { pBC, pWindow, nWindow, sizeof(D3DX_BC7), aFields, _countof(aFields), lambda };
+
+    auto pColorA = reinterpret_cast<const HDRColorA*>(pColor);
+
+    uint8_t aOrig[16];
+    memcpy(aOrig, pBC, sizeof(aOrig));
+
+    const float fErr = ErrorBC7(aOrig, pColorA);
+    const float fLimit = std::max(fErr, maxError * maxError * (NUM_PIXELS_PER_BLOCK * 4));
+
+    uint8_t aBest[16];
+    memcpy(aBest, aOrig, sizeof(aBest));
+    float fBestCost = rdo.Cost(fErr);
+
+    // Each block in the window, nearest first, is tried whole and as the back 4, 8 or 12 bytes
+    // of this one. The back of a block is mostly index bits, which can go with other endpoints.
+    for(size_t j = nWindow; j-- > 0; )
+    {
+        const uint8_t *pPrev = pWindow + j * sizeof(D3DX_BC7);
+
+        bool bSeen = false;
+        for(size_t k = j + 1; k < nWindow && !bSeen; ++k)
+            bSeen = RDOBlock::SameBytes(pWindow + k * sizeof(D3DX_BC7), pPrev, sizeof(D3DX_BC7));
+
+        if(bSeen)
+            continue;
+
+        for(size_t uSplit = 0; uSplit < sizeof(D3DX_BC7); uSplit += 4)
+        {
+            if(memcmp(aOrig + uSplit, pPrev + uSplit, sizeof(D3DX_BC7) - uSplit) == 0)
+                break;
+
+            memcpy(pBC, aOrig, uSplit);
+            memcpy(pBC + uSplit, pPrev + uSplit, sizeof(D3DX_BC7) - uSplit);
+
+            // The rate is cheaper to find than the error, and may rule the block out by itself
+            float fRate = lambda * (float) rdo.Bits();
+            if(fRate >= fBestCost)
+                continue;
+
+            float fCandErr = ErrorBC7(pBC, pColorA);
+            if(fCandErr <= fLimit && fCandErr + fRate < fBestCost)
+            {
+                fBestCost = fCandErr + fRate;
+                memcpy(aBest, pBC, sizeof(aBest));
+            }
+        }
+    }
+
+    memcpy(pBC, aBest, sizeof(aBest));
 }
 
 } // namespace
@@ -0,0 +1,1185 @@
+//-------------------------------------------------------------------------------------
+// BCSIMD.cpp
+//
+// Block-compression (BC) encoders that process several blocks at once, one block
+// (or one BC5 channel) per SIMD lane, and the texel expansion of the row decoders
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248926
+//-------------------------------------------------------------------------------------
+
+#include "directxtexp.h"
+
+#include "BC.h"
+
+#ifdef _XM_SSE_INTRINSICS_
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace DirectX
+{
+
+#ifdef _XM_SSE_INTRINSICS_
+
+//-------------------------------------------------------------------------------------
+// Constants
+//-------------------------------------------------------------------------------------
+
+// Must match the perceptual weightings in BC.cpp
+static const float g_LuminanceR    = 0.2125f / 0.7154f;
+static const float g_LuminanceB    = 0.0721f / 0.7154f;
+static const float g_LuminanceInvR = 0.7154f / 0.2125f;
+static const float g_LuminanceInvB = 0.7154f / 0.0721f;
+
+
+//-------------------------------------------------------------------------------------
+// Lanes
+//
+// A value of type F holds the same quantity for 4 (SSE4.1) or 8 (AVX2) blocks. The
+// encoders are written once against these & select per lane rather than branch.
+//-------------------------------------------------------------------------------------
+struct LanesSSE4
+{
+    typedef __m128  F;
+    typedef __m128i I;
+
+    static const size_t COUNT = 4;
+
+    static F Splat( float f )               { return _mm_set1_ps( f ); }
+    static F AllOnes()                      { return _mm_castsi128_ps( _mm_set1_epi32( -1 ) ); }
+    static F Add( F a, F b )                { return _mm_add_ps( a, b ); }
+    static F Sub( F a, F b )                { return _mm_sub_ps( a, b ); }
+    static F Mul( F a, F b )                { return _mm_mul_ps( a, b ); }
+    static F Div( F a, F b )                { return _mm_div_ps( a, b ); }
+    static F Min( F a, F b )                { return _mm_min_ps( a, b ); }
+    static F Max( F a, F b )                { return _mm_max_ps( a, b ); }
+    static F Less( F a, F b )               { return _mm_cmplt_ps( a, b ); }
+    static F Equal( F a, F b )              { return _mm_cmpeq_ps( a, b ); }
+    static F LessEqual( F a, F b )          { return _mm_cmple_ps( a, b ); }
+    static F Greater( F a, F b )            { return _mm_cmpgt_ps( a, b ); }
+    static F GreaterEqual( F a, F b )       { return _mm_cmpge_ps( a, b ); }
+    static F And( F a, F b )                { return _mm_and_ps( a, b ); }
+    static F AndNot( F a, F b )             { return _mm_andnot_ps( a, b ); }    // ~a & b
+    static F Or( F a, F b )                 { return _mm_or_ps( a, b ); }
+    static F Select( F a, F b, F mask )     { return _mm_blendv_ps( a, b, mask ); }
+    static int Bits( F mask )               { return _mm_movemask_ps( mask ); }
+
+    static I Truncate( F a )                { return _mm_cvttps_epi32( a ); }
+    static F ToFloat( I a )                 { return _mm_cvtepi32_ps( a ); }
+    static F AsFloat( I a )                 { return _mm_castsi128_ps( a ); }
+    static I AsInt( F a )                   { return _mm_castps_si128( a ); }
+    static I SplatInt( int i )              { return _mm_set1_epi32( i ); }
+    static I OrInt( I a, I b )              { return _mm_or_si128( a, b ); }
+    static I AndInt( I a, I b )             { return _mm_and_si128( a, b ); }
+    static I XorInt( I a, I b )             { return _mm_xor_si128( a, b ); }
+    static I EqualInt( I a, I b )           { return _mm_cmpeq_epi32( a, b ); }
+    static I GreaterInt( I a, I b )         { return _mm_cmpgt_epi32( a, b ); }
+    static I SelectInt( I a, I b, I mask )  { return _mm_blendv_epi8( a, b, mask ); }
+    template<int n> static I ShiftLeft( I a )   { return _mm_slli_epi32( a, n ); }
+    template<int n> static I ShiftRight( I a )  { return _mm_srli_epi32( a, n ); }
+    static void Store( uint32_t* p, I a )   { _mm_storeu_si128( reinterpret_cast<__m128i*>( p ), a ); }
+
+    // Loads one value per lane, already laid out lane by lane
+    static F Load( _In_reads_(COUNT) const float* p )  { return _mm_loadu_ps( p ); }
+
+    // Transposes pixel i of each lane's block into r, g, b & a
+    static void Load( _In_reads_(COUNT) const XMVECTOR* const* pBlocks, size_t i, F& r, F& g, F& b, F& a )
+    {
+        r = pBlocks[0][i];
+        g = pBlocks[1][i];
+        b = pBlocks[2][i];
+        a = pBlocks[3][i];
+        _MM_TRANSPOSE4_PS( r, g, b, a );
+    }
+
+    static void Finish() {}
+};
+
+struct LanesAVX2
+{
+    typedef __m256  F;
+    typedef __m256i I;
+
+    static const size_t COUNT = 8;
+
+    static F Splat( float f )               { return _mm256_set1_ps( f ); }
+    static F AllOnes()                      { return _mm256_castsi256_ps( _mm256_set1_epi32( -1 ) ); }
+    static F Add( F a, F b )                { return _mm256_add_ps( a, b ); }
+    static F Sub( F a, F b )                { return _mm256_sub_ps( a, b ); }
+    static F Mul( F a, F b )                { return _mm256_mul_ps( a, b ); }
+    static F Div( F a, F b )                { return _mm256_div_ps( a, b ); }
+    static F Min( F a, F b )                { return _mm256_min_ps( a, b ); }
+    static F Max( F a, F b )                { return _mm256_max_ps( a, b ); }
+    static F Less( F a, F b )               { return _mm256_cmp_ps( a, b, _CMP_LT_OQ ); }
+    static F Equal( F a, F b )              { return _mm256_cmp_ps( a, b, _CMP_EQ_OQ ); }
+    static F LessEqual( F a, F b )          { return _mm256_cmp_ps( a, b, _CMP_LE_OQ ); }
+    static F Greater( F a, F b )            { return _mm256_cmp_ps( a, b, _CMP_GT_OQ ); }
+    static F GreaterEqual( F a, F b )       { return _mm256_cmp_ps( a, b, _CMP_GE_OQ ); }
+    static F And( F a, F b )                { return _mm256_and_ps( a, b ); }
+    static F AndNot( F a, F b )             { return _mm256_andnot_ps( a, b ); } // ~a & b
+    static F Or( F a, F b )                 { return _mm256_or_ps( a, b ); }
+    static F Select( F a, F b, F mask )     { return _mm256_blendv_ps( a, b, mask ); }
+    static int Bits( F mask )               { return _mm256_movemask_ps( mask ); }
+
+    static I Truncate( F a )                { return _mm256_cvttps_epi32( a ); }
+    static F ToFloat( I a )                 { return _mm256_cvtepi32_ps( a ); }
+    static F AsFloat( I a )                 { return _mm256_castsi256_ps( a ); }
+    static I AsInt( F a )                   { return _mm256_castps_si256( a ); }
+    static I SplatInt( int i )              { return _mm256_set1_epi32( i ); }
+    static I OrInt( I a, I b )              { return _mm256_or_si256( a, b ); }
+    static I AndInt( I a, I b )             { return _mm256_and_si256( a, b ); }
+    static I XorInt( I a, I b )             { return _mm256_xor_si256( a, b ); }
+    static I EqualInt( I a, I b )           { return _mm256_cmpeq_epi32( a, b ); }
+    static I GreaterInt( I a, I b )         { return _mm256_cmpgt_epi32( a, b ); }
+    static I SelectInt( I a, I b, I mask )  { return _mm256_blendv_epi8( a, b, mask ); }
+    template<int n> static I ShiftLeft( I a )   { return _mm256_slli_epi32( a, n ); }
+    template<int n> static I ShiftRight( I a )  { return _mm256_srli_epi32( a, n ); }
+    static void Store( uint32_t* p, I a )   { _mm256_storeu_si256( reinterpret_cast<__m256i*>( p ), a ); }
+
+    static F Load( _In_reads_(COUNT) const float* p )  { return _mm256_loadu_ps( p ); }
+
+    static void Load( _In_reads_(COUNT) const XMVECTOR* const* pBlocks, size_t i, F& r, F& g, F& b, F& a )
+    {
+        __m128 r0 = pBlocks[0][i], g0 = pBlocks[1][i], b0 = pBlocks[2][i], a0 = pBlocks[3][i];
+        __m128 r1 = pBlocks[4][i], g1 = pBlocks[5][i], b1 = pBlocks[6][i], a1 = pBlocks[7][i];
+        _MM_TRANSPOSE4_PS( r0, g0, b0, a0 );
+        _MM_TRANSPOSE4_PS( r1, g1, b1, a1 );
+        r = _mm256_insertf128_ps( _mm256_castps128_ps256( r0 ), r1, 1 );
+        g = _mm256_insertf128_ps( _mm256_castps128_ps256( g0 ), g1, 1 );
+        b = _mm256_insertf128_ps( _mm256_castps128_ps256( b0 ), b1, 1 );
+        a = _mm256_insertf128_ps( _mm256_castps128_ps256( a0 ), a1, 1 );
+    }
+
+    // Avoids AVX to SSE transition penalties in the (non-VEX) code that follows
+    static void Finish() { _mm256_zeroupper(); }
+};
+
+
+//-------------------------------------------------------------------------------------
+// Returns the widest lane type this CPU & OS support (8, 4, or 0 for none)
+//-------------------------------------------------------------------------------------
+static size_t DetectLanes()
+{
+    int info[4];
+    __cpuid( info, 0 );
+    const int maxLeaf = info[0];
+    if ( maxLeaf < 1 )
+        return 0;
+
+    __cpuid( info, 1 );
+    const bool sse41 = ( info[2] & (1 << 19) ) != 0;
+    const bool avx = ( info[2] & (1 << 27) ) && ( info[2] & (1 << 28) ) && ( (_xgetbv( 0 ) & 6) == 6 );
+
+    if ( avx && maxLeaf >= 7 )
+    {
+        __cpuidex( info, 7, 0 );
+        if ( info[1] & (1 << 5) )
+            return 8;
+    }
+
+    return ( sse41 ) ? 4 : 0;
+}
+
+// Detected during static initialization, as VS2013 doesn't make function-local statics thread-safe
+static const size_t s_lanes = DetectLanes();
+
+static size_t GetLanes() { return s_lanes; }
+
+
+//-------------------------------------------------------------------------------------
+// BC1 encoding of one block per lane
+//
+// This is EncodeBC1 & OptimizeRGB from BC.cpp for 4-color blocks without dithering,
+// performing the same float operations in the same order, so it produces the same
+// blocks bit for bit, BC_FLAGS_FAST's single least squares fit included. Lanes whose
+// block needs the 3-color (transparent) mode are reported in the returned mask & left
+// to the scalar encoder.
+//-------------------------------------------------------------------------------------
+template<class L>
+static int EncodeBC1Lanes( _Out_writes_(L::COUNT) uint32_t* pRGB0, _Out_writes_(L::COUNT) uint32_t* pRGB1, _Out_writes_(L::COUNT) uint32_t* pBitmap,
+                           _In_reads_(L::COUNT) const XMVECTOR* const* pBlocks, _In_ float alphaRef, _In_ DWORD flags )
+{
+    typedef typename L::F F;
+    typedef typename L::I I;
+
+    const F zero = L::Splat( 0.f );
+    const F half = L::Splat( 0.5f );
+    const F one = L::Splat( 1.f );
+    const F three = L::Splat( 3.f );
+    const F third = L::Splat( 1.f / 3.f );
+
+    const bool uniform = ( flags & BC_FLAGS_UNIFORM ) != 0;
+    const F lumR = L::Splat( uniform ? 1.f : g_LuminanceR );
+    const F lumB = L::Splat( uniform ? 1.f : g_LuminanceB );
+    const F lumInvR = L::Splat( uniform ? 1.f : g_LuminanceInvR );
+    const F lumInvB = L::Splat( uniform ? 1.f : g_LuminanceInvB );
+
+    // Weighted source colors, & the same quantized to 5:6:5
+    F srcR[NUM_PIXELS_PER_BLOCK], srcG[NUM_PIXELS_PER_BLOCK], srcB[NUM_PIXELS_PER_BLOCK];
+    F ptR[NUM_PIXELS_PER_BLOCK], ptG[NUM_PIXELS_PER_BLOCK], ptB[NUM_PIXELS_PER_BLOCK];
+
+    const F alphaKey = L::Splat( alphaRef );
+    F keyed = zero;
+
+    for( size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i )
+    {
+        F r, g, b, a;
+        L::Load( pBlocks, i, r, g, b, a );
+
+        keyed = L::Or( keyed, L::Less( a, alphaKey ) );
+
+        ptR[i] = L::Mul( L::Mul( L::ToFloat( L::Truncate( L::Add( L::Mul( r, L::Splat( 31.f ) ), half ) ) ), L::Splat( 1.f / 31.f ) ), lumR );
+        ptG[i] = L::Mul( L::ToFloat( L::Truncate( L::Add( L::Mul( g, L::Splat( 63.f ) ), half ) ) ), L::Splat( 1.f / 63.f ) );
+        ptB[i] = L::Mul( L::Mul( L::ToFloat( L::Truncate( L::Add( L::Mul( b, L::Splat( 31.f ) ), half ) ) ), L::Splat( 1.f / 31.f ) ), lumB );
+
+        srcR[i] = L::Mul( r, lumR );
+        srcG[i] = g;
+        srcB[i] = L::Mul( b, lumB );
+    }
+
+    // Nothing to do if every block needs the 3-color mode
+    const int allLanes = (1 << L::COUNT) - 1;
+    if ( L::Bits( keyed ) == allLanes )
+        return allLanes;
+
+    // --- OptimizeRGB -----------------------------------------------------------------
+
+    // Find Min and Max points, as starting point
+    F xR = lumR, xG = one, xB = lumB;
+    F yR = zero, yG = zero, yB = zero;
+
+    for( size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i )
+    {
+        xR = L::Min( ptR[i], xR );
+        xG = L::Min( ptG[i], xG );
+        xB = L::Min( ptB[i], xB );
+        yR = L::Max( ptR[i], yR );
+        yG = L::Max( ptG[i], yG );
+        yB = L::Max( ptB[i], yB );
+    }
+
+    // Diagonal axis
+    F abR = L::Sub( yR, xR );
+    F abG = L::Sub( yG, xG );
+    F abB = L::Sub( yB, xB );
+    F fAB = L::Add( L::Add( L::Mul( abR, abR ), L::Mul( abG, abG ) ), L::Mul( abB, abB ) );
+
+    // Single color lanes keep Min and Max as they are
+    F singleColor = L::Less( fAB, L::Splat( FLT_MIN ) );
+
+    // Try all four axis directions, to determine which diagonal best fits data
+    F fABInv = L::Div( one, fAB );
+    F dirR = L::Mul( abR, fABInv );
+    F dirG = L::Mul( abG, fABInv );
+    F dirB = L::Mul( abB, fABInv );
+
+    F midR = L::Mul( L::Add( xR, yR ), half );
+    F midG = L::Mul( L::Add( xG, yG ), half );
+    F midB = L::Mul( L::Add( xB, yB ), half );
+
+    F fDir0 = zero, fDir1 = zero, fDir2 = zero, fDir3 = zero;
+
+    for( size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i )
+    {
+        F r = L::Mul( L::Sub( ptR[i], midR ), dirR );
+        F g = L::Mul( L::Sub( ptG[i], midG ), dirG );
+        F b = L::Mul( L::Sub( ptB[i], midB ), dirB );
+
+        F f = L::Add( L::Add( r, g ), b );
+        fDir0 = L::Add( fDir0, L::Mul( f, f ) );
+
+        f = L::Sub( L::Add( r, g ), b );
+        fDir1 = L::Add( fDir1, L::Mul( f, f ) );
+
+        f = L::Add( L::Sub( r, g ), b );
+        fDir2 = L::Add( fDir2, L::Mul( f, f ) );
+
+        f = L::Sub( L::Sub( r, g ), b );
+        fDir3 = L::Add( fDir3, L::Mul( f, f ) );
+    }
+
+    // Bit 1 of the best direction swaps green, bit 0 swaps blue
+    const F ones = L::AllOnes();
+    F fDirMax = fDir0;
+    F swapG = zero;
+    F swapB = zero;
+
+    F m = L::Greater( fDir1, fDirMax );
+    fDirMax = L::Select( fDirMax, fDir1, m );
+    swapG = L::Select( swapG, zero, m );
+    swapB = L::Select( swapB, ones, m );
+
+    m = L::Greater( fDir2, fDirMax );
+    fDirMax = L::Select( fDirMax, fDir2, m );
+    swapG = L::Select( swapG, ones, m );
+    swapB = L::Select( swapB, zero, m );
+
+    m = L::Greater( fDir3, fDirMax );
+    swapG = L::Select( swapG, ones, m );
+    swapB = L::Select( swapB, ones, m );
+
+    swapG = L::AndNot( singleColor, swapG );
+    swapB = L::AndNot( singleColor, swapB );
+
+    F t = xG;
+    xG = L::Select( xG, yG, swapG );
+    yG = L::Select( yG, t, swapG );
+
+    t = xB;
+    xB = L::Select( xB, yB, swapB );
+    yB = L::Select( yB, t, swapB );
+
+    // Single & two color lanes don't root-find
+    F active = L::AndNot( L::Less( fAB, L::Splat( 1.0f / 4096.0f ) ), ones );
+
+    // The fast tier assigns each point to its nearest step between the range
+    // endpoints once, then solves for the endpoints that best fit those steps.
+    if ( ( flags & BC_FLAGS_FAST ) && L::Bits( active ) )
+    {
+        F fScale = L::Div( three, fAB );
+        dirR = L::Mul( L::Sub( yR, xR ), fScale );
+        dirG = L::Mul( L::Sub( yG, xG ), fScale );
+        dirB = L::Mul( L::Sub( yB, xB ), fScale );
+
+        F fCC = zero, fCD = zero, fDD = zero;
+        F cpR = zero, cpG = zero, cpB = zero;
+        F dpR = zero, dpG = zero, dpB = zero;
+
+        for( size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i )
+        {
+            F fDot = L::Add( L::Add( L::Mul( L::Sub( ptR[i], xR ), dirR ),
+                                     L::Mul( L::Sub( ptG[i], xG ), dirG ) ),
+                                     L::Mul( L::Sub( ptB[i], xB ), dirB ) );
+
+            F step = L::ToFloat( L::Truncate( L::Select( L::Select( L::Add( fDot, half ), zero, L::LessEqual( fDot, zero ) ),
+                                                         three, L::GreaterEqual( fDot, three ) ) ) );
+
+            F c = L::Mul( L::Sub( three, step ), third );
+            F d = L::Mul( step, third );
+
+            fCC = L::Add( fCC, L::Mul( c, c ) );
+            fCD = L::Add( fCD, L::Mul( c, d ) );
+            fDD = L::Add( fDD, L::Mul( d, d ) );
+            cpR = L::Add( cpR, L::Mul( c, ptR[i] ) );
+            cpG = L::Add( cpG, L::Mul( c, ptG[i] ) );
+            cpB = L::Add( cpB, L::Mul( c, ptB[i] ) );
+            dpR = L::Add( dpR, L::Mul( d, ptR[i] ) );
+            dpG = L::Add( dpG, L::Mul( d, ptG[i] ) );
+            dpB = L::Add( dpB, L::Mul( d, ptB[i] ) );
+        }
+
+        // Least squares solution; every point on the same step leaves the range fit
+        F fDet = L::Sub( L::Mul( fCC, fDD ), L::Mul( fCD, fCD ) );
+        F solve = L::And( active, L::Greater( fDet, L::Splat( 1.0f / 4096.0f ) ) );
+        F fDetInv = L::Div( one, fDet );
+
+        xR = L::Select( xR, L::Mul( L::Sub( L::Mul( fDD, cpR ), L::Mul( fCD, dpR ) ), fDetInv ), solve );
+        xG = L::Select( xG, L::Mul( L::Sub( L::Mul( fDD, cpG ), L::Mul( fCD, dpG ) ), fDetInv ), solve );
+        xB = L::Select( xB, L::Mul( L::Sub( L::Mul( fDD, cpB ), L::Mul( fCD, dpB ) ), fDetInv ), solve );
+
+        yR = L::Select( yR, L::Mul( L::Sub( L::Mul( fCC, dpR ), L::Mul( fCD, cpR ) ), fDetInv ), solve );
+        yG = L::Select( yG, L::Mul( L::Sub( L::Mul( fCC, dpG ), L::Mul( fCD, cpG ) ), fDetInv ), solve );
+        yB = L::Select( yB, L::Mul( L::Sub( L::Mul( fCC, dpB ), L::Mul( fCD, cpB ) ), fDetInv ), solve );
+
+        active = zero;
+    }
+
+    // Use Newton's Method to find local minima of sum-of-squares error
+    static const float fEpsilon = (0.25f / 64.0f) * (0.25f / 64.0f);
+    const F eighth = L::Splat( 1.0f / 8.0f );
+
+    for( size_t iIteration = 0; iIteration < 8 && L::Bits( active ); iIteration++ )
+    {
+        // Calculate color direction
+        dirR = L::Sub( yR, xR );
+        dirG = L::Sub( yG, xG );
+        dirB = L::Sub( yB, xB );
+
+        F fLen = L::Add( L::Add( L::Mul( dirR, dirR ), L::Mul( dirG, dirG ) ), L::Mul( dirB, dirB ) );
+
+        active = L::AndNot( L::Less( fLen, L::Splat( 1.0f / 4096.0f ) ), active );
+        if ( !L::Bits( active ) )
+            break;
+
+        F fScale = L::Div( three, fLen );
+        dirR = L::Mul( dirR, fScale );
+        dirG = L::Mul( dirG, fScale );
+        dirB = L::Mul( dirB, fScale );
+
+        // Evaluate function, and derivatives
+        F d2X = zero, d2Y = zero;
+        F dXR = zero, dXG = zero, dXB = zero;
+        F dYR = zero, dYG = zero, dYB = zero;
+
+        for( size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i )
+        {
+            F fDot = L::Add( L::Add( L::Mul( L::Sub( ptR[i], xR ), dirR ),
+                                     L::Mul( L::Sub( ptG[i], xG ), dirG ) ),
+                                     L::Mul( L::Sub( ptB[i], xB ), dirB ) );
+
+            F step = L::ToFloat( L::Truncate( L::Select( L::Select( L::Add( fDot, half ), zero, L::LessEqual( fDot, zero ) ),
+                                                         three, L::GreaterEqual( fDot, three ) ) ) );
+
+            // k/3 & (3-k)/3 round to exactly the table weights OptimizeRGB uses
+            F c = L::Mul( L::Sub( three, step ), third );
+            F d = L::Mul( step, third );
+
+            F diffR = L::Sub( L::Add( L::Mul( xR, c ), L::Mul( yR, d ) ), ptR[i] );
+            F diffG = L::Sub( L::Add( L::Mul( xG, c ), L::Mul( yG, d ) ), ptG[i] );
+            F diffB = L::Sub( L::Add( L::Mul( xB, c ), L::Mul( yB, d ) ), ptB[i] );
+
+            F fC = L::Mul( c, eighth );
+            F fD = L::Mul( d, eighth );
+
+            d2X = L::Add( d2X, L::Mul( fC, c ) );
+            dXR = L::Add( dXR, L::Mul( fC, diffR ) );
+            dXG = L::Add( dXG, L::Mul( fC, diffG ) );
+            dXB = L::Add( dXB, L::Mul( fC, diffB ) );
+
+            d2Y = L::Add( d2Y, L::Mul( fD, d ) );
+            dYR = L::Add( dYR, L::Mul( fD, diffR ) );
+            dYG = L::Add( dYG, L::Mul( fD, diffG ) );
+            dYB = L::Add( dYB, L::Mul( fD, diffB ) );
+        }
+
+        // Move endpoints
+        F moveX = L::And( active, L::Greater( d2X, zero ) );
+        F f = L::Div( L::Splat( -1.0f ), d2X );
+        xR = L::Select( xR, L::Add( xR, L::Mul( dXR, f ) ), moveX );
+        xG = L::Select( xG, L::Add( xG, L::Mul( dXG, f ) ), moveX );
+        xB = L::Select( xB, L::Add( xB, L::Mul( dXB, f ) ), moveX );
+
+        F moveY = L::And( active, L::Greater( d2Y, zero ) );
+        f = L::Div( L::Splat( -1.0f ), d2Y );
+        yR = L::Select( yR, L::Add( yR, L::Mul( dYR, f ) ), moveY );
+        yG = L::Select( yG, L::Add( yG, L::Mul( dYG, f ) ), moveY );
+        yB = L::Select( yB, L::Add( yB, L::Mul( dYB, f ) ), moveY );
+
+        const F eps = L::Splat( fEpsilon );
+        F converged = L::And( L::And( L::Less( L::Mul( dXR, dXR ), eps ), L::Less( L::Mul( dXG, dXG ), eps ) ),
+                              L::And( L::Less( L::Mul( dXB, dXB ), eps ), L::Less( L::Mul( dYR, dYR ), eps ) ) );
+        converged = L::And( converged, L::And( L::Less( L::Mul( dYG, dYG ), eps ), L::Less( L::Mul( dYB, dYB ), eps ) ) );
+
+        active = L::AndNot( converged, active );
+    }
+
+    // --- Quantize endpoints ----------------------------------------------------------
+    I wA, wB;
+    {
+        const F r31 = L::Splat( 31.f );
+        const F g63 = L::Splat( 63.f );
+
+        F r = L::Min( L::Max( L::Mul( xR, lumInvR ), zero ), one );
+        F g = L::Min( L::Max( xG, zero ), one );
+        F b = L::Min( L::Max( L::Mul( xB, lumInvB ), zero ), one );
+        wA = L::OrInt( L::OrInt( L::template ShiftLeft<11>( L::Truncate( L::Add( L::Mul( r, r31 ), half ) ) ),
+                                 L::template ShiftLeft<5>( L::Truncate( L::Add( L::Mul( g, g63 ), half ) ) ) ),
+                                 L::Truncate( L::Add( L::Mul( b, r31 ), half ) ) );
+
+        r = L::Min( L::Max( L::Mul( yR, lumInvR ), zero ), one );
+        g = L::Min( L::Max( yG, zero ), one );
+        b = L::Min( L::Max( L::Mul( yB, lumInvB ), zero ), one );
+        wB = L::OrInt( L::OrInt( L::template ShiftLeft<11>( L::Truncate( L::Add( L::Mul( r, r31 ), half ) ) ),
+                                 L::template ShiftLeft<5>( L::Truncate( L::Add( L::Mul( g, g63 ), half ) ) ) ),
+                                 L::Truncate( L::Add( L::Mul( b, r31 ), half ) ) );
+    }
+
+    // Solid lanes encode as wA, wA with every index 0
+    I solid = L::EqualInt( wA, wB );
+
+    // 4-color blocks need rgb[0] > rgb[1]
+    I swapEnds = L::GreaterInt( wB, wA );
+    swapEnds = L::OrInt( swapEnds, solid );
+
+    I rgb0 = L::SelectInt( wA, wB, swapEnds );
+    I rgb1 = L::SelectInt( wB, wA, swapEnds );
+
+    // Decode the endpoints as the hardware will
+    const I mask5 = L::SplatInt( 31 );
+    const I mask6 = L::SplatInt( 63 );
+    const F inv31 = L::Splat( 1.0f / 31.0f );
+    const F inv63 = L::Splat( 1.0f / 63.0f );
+
+    F s0R = L::Mul( L::Mul( L::ToFloat( L::AndInt( L::template ShiftRight<11>( rgb0 ), mask5 ) ), inv31 ), lumR );
+    F s0G = L::Mul( L::ToFloat( L::AndInt( L::template ShiftRight<5>( rgb0 ), mask6 ) ), inv63 );
+    F s0B = L::Mul( L::Mul( L::ToFloat( L::AndInt( rgb0, mask5 ) ), inv31 ), lumB );
+    F s1R = L::Mul( L::Mul( L::ToFloat( L::AndInt( L::template ShiftRight<11>( rgb1 ), mask5 ) ), inv31 ), lumR );
+    F s1G = L::Mul( L::ToFloat( L::AndInt( L::template ShiftRight<5>( rgb1 ), mask6 ) ), inv63 );
+    F s1B = L::Mul( L::Mul( L::ToFloat( L::AndInt( rgb1, mask5 ) ), inv31 ), lumB );
+
+    // Calculate color direction
+    dirR = L::Sub( s1R, s0R );
+    dirG = L::Sub( s1G, s0G );
+    dirB = L::Sub( s1B, s0B );
+
+    F fScale = L::Div( three, L::Add( L::Add( L::Mul( dirR, dirR ), L::Mul( dirG, dirG ) ), L::Mul( dirB, dirB ) ) );
+    fScale = L::AndNot( L::AsFloat( solid ), fScale );
+
+    dirR = L::Mul( dirR, fScale );
+    dirG = L::Mul( dirG, fScale );
+    dirB = L::Mul( dirB, fScale );
+
+    // Encode colors; steps 0, 1, 2 & 3 along the axis are indices 0, 2, 3 & 1
+    const I one_i = L::SplatInt( 1 );
+    I dw = L::SplatInt( 0 );
+
+    for( size_t j = NUM_PIXELS_PER_BLOCK; j-- > 0; )
+    {
+        F fDot = L::Add( L::Add( L::Mul( L::Sub( srcR[j], s0R ), dirR ),
+                                 L::Mul( L::Sub( srcG[j], s0G ), dirG ) ),
+                                 L::Mul( L::Sub( srcB[j], s0B ), dirB ) );
+
+        I step = L::Truncate( L::Select( L::Select( L::Add( fDot, half ), zero, L::LessEqual( fDot, zero ) ),
+                                         three, L::GreaterEqual( fDot, three ) ) );
+
+        I hi = L::template ShiftRight<1>( step );
+        I index = L::OrInt( L::template ShiftLeft<1>( L::AndInt( L::XorInt( step, hi ), one_i ) ), hi );
+
+        dw = L::OrInt( L::template ShiftLeft<2>( dw ), index );
+    }
+
+    dw = L::SelectInt( dw, L::SplatInt( 0 ), solid );
+
+    L::Store( pRGB0, rgb0 );
+    L::Store( pRGB1, rgb1 );
+    L::Store( pBitmap, dw );
+
+    return L::Bits( keyed );
+}
+
+
+//-------------------------------------------------------------------------------------
+// Solid blocks go to the scalar encoder's single color fit
+static bool IsSolidRGB( _In_reads_(NUM_PIXELS_PER_BLOCK) const XMVECTOR *pColor )
+{
+    for( size_t i = 1; i < NUM_PIXELS_PER_BLOCK; ++i )
+    {
+        if ( !XMVector3Equal( pColor[i], pColor[0] ) )
+            return false;
+    }
+
+    return true;
+}
+
+template<class L>
+static void EncodeBC1Batch( _Out_writes_(nBlocks * 8) uint8_t *pBC, _In_ size_t nBlocks,
+                            _In_reads_(nBlocks * NUM_PIXELS_PER_BLOCK) const XMVECTOR *pColor, _In_ float alphaRef, _In_ DWORD flags )
+{
+    const size_t lanes = L::COUNT;
+
+    for( size_t first = 0; first < nBlocks; first += lanes )
+    {
+        const size_t count = std::min<size_t>( lanes, nBlocks - first );
+
+        // A partial batch repeats its last block in the unused lanes
+        const XMVECTOR* pBlocks[L::COUNT];
+        for( size_t lane = 0; lane < L::COUNT; ++lane )
+        {
+            pBlocks[lane] = pColor + ( first + std::min<size_t>( lane, count - 1 ) ) * NUM_PIXELS_PER_BLOCK;
+        }
+
+        uint32_t rgb0[L::COUNT];
+        uint32_t rgb1[L::COUNT];
+        uint32_t bitmap[L::COUNT];
+        int keyed = EncodeBC1Lanes<L>( rgb0, rgb1, bitmap, pBlocks, alphaRef, flags );
+
+        L::Finish();
+
+        for( size_t lane = 0; lane < count; ++lane )
+        {
+            uint8_t* pDest = pBC + ( first + lane ) * sizeof(D3DX_BC1);
+
+            if ( ( keyed & (1 << lane) ) || IsSolidRGB( pBlocks[lane] ) )
+            {
+                D3DXEncodeBC1( pDest, pBlocks[lane], alphaRef, flags );
+            }
+            else
+            {
+                auto pBC1 = reinterpret_cast<D3DX_BC1*>( pDest );
+                pBC1->rgb[0] = static_cast<uint16_t>( rgb0[lane] );
+                pBC1->rgb[1] = static_cast<uint16_t>( rgb1[lane] );
+                pBC1->bitmap = bitmap[lane];
+            }
+        }
+    }
+}
+
+
+//-------------------------------------------------------------------------------------
+// BC4 encoding of one channel of one block per lane
+//
+// This is FindEndPointsBC4U/S, OptimizeAlpha & FindClosestUNORM/SNORM from BC4BC5.cpp
+// & BC.h, performing the same float operations in the same order, so it produces the
+// same blocks bit for bit. Each lane picks 6 or 8 step interpolation for itself, and
+// the step weights are divided out rather than looked up, which gives the same values
+// as the tables. Lanes with a texel that isn't finite are reported in the returned
+// mask & left to the scalar encoder.
+//-------------------------------------------------------------------------------------
+#pragma warning(push)
+#pragma warning(disable : 4127)
+
+template<class L>
+static typename L::I FloatToSNormLanes( typename L::F f )
+{
+    const typename L::F one = L::Splat( 1.f );
+    const typename L::F half = L::Splat( 0.5f );
+
+    f = L::Select( f, one, L::Greater( f, one ) );
+    f = L::Select( f, L::Splat( -1.f ), L::Less( f, L::Splat( -1.f ) ) );
+    f = L::Mul( f, L::Splat( 127.f ) );
+    f = L::Select( L::Sub( f, half ), L::Add( f, half ), L::GreaterEqual( f, L::Splat( 0.f ) ) );
+    return L::Truncate( f );
+}
+
+template<class L, bool bSigned>
+static int EncodeBC4Lanes( _Out_writes_(L::COUNT) uint32_t* pEndpoints, _Out_writes_(L::COUNT) uint32_t* pIndicesLo,
+                           _Out_writes_(L::COUNT) uint32_t* pIndicesHi, _In_reads_(NUM_PIXELS_PER_BLOCK * L::COUNT) const float* pTexels )
+{
+    typedef typename L::F F;
+    typedef typename L::I I;
+
+    const F zero = L::Splat( 0.f );
+    const F half = L::Splat( 0.5f );
+    const F one = L::Splat( 1.f );
+    const F ones = L::AllOnes();
+    const F signBit = L::Splat( -0.f );
+
+    // The boundary of codec for signed/unsigned format
+    const F minNorm = L::Splat( bSigned ? -1.f : 0.f );
+    const F maxNorm = one;
+
+    // Find max/min of input texels
+    F pt[NUM_PIXELS_PER_BLOCK];
+    F finite = ones;
+    F blockMin = zero, blockMax = zero;
+
+    for( size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i )
+    {
+        pt[i] = L::Load( pTexels + i * L::COUNT );
+        finite = L::And( finite, L::LessEqual( L::AndNot( signBit, pt[i] ), L::Splat( FLT_MAX ) ) );
+
+        blockMin = ( i ) ? L::Select( blockMin, pt[i], L::Less( pt[i], blockMin ) ) : pt[i];
+        blockMax = ( i ) ? L::Select( blockMax, pt[i], L::Greater( pt[i], blockMax ) ) : pt[i];
+    }
+
+    // A solid block is exact with both endpoints on its value
+    F solid = L::Equal( blockMin, blockMax );
+
+    // If there are boundary values in input texels, 6 step interpolation keeps them exact
+    F six = L::Or( L::Equal( blockMin, minNorm ), L::Equal( blockMax, maxNorm ) );
+
+    // --- OptimizeAlpha ---------------------------------------------------------------
+
+    const F fSteps = L::Select( L::Splat( 7.f ), L::Splat( 5.f ), six );
+
+    // Find Min and Max points, as starting point; 6 step lanes skip the boundary values
+    F fX = maxNorm;
+    F fY = minNorm;
+
+    for( size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i )
+    {
+        F takeX = L::AndNot( L::AndNot( L::Greater( pt[i], minNorm ), six ), L::Less( pt[i], fX ) );
+        F takeY = L::AndNot( L::AndNot( L::Less( pt[i], maxNorm ), six ), L::Greater( pt[i], fY ) );
+        fX = L::Select( fX, pt[i], takeX );
+        fY = L::Select( fY, pt[i], takeY );
+    }
+
+    fY = L::Select( fY, maxNorm, L::And( six, L::Equal( fX, fY ) ) );
+
+    // Use Newton's Method to find local minima of sum-of-squares error.
+    F active = L::AndNot( solid, finite );
+
+    for( size_t iIteration = 0; iIteration < 8 && L::Bits( active ); iIteration++ )
+    {
+        F fRange = L::Sub( fY, fX );
+
+        active = L::AndNot( L::Less( fRange, L::Splat( 1.0f / 256.0f ) ), active );
+        if ( !L::Bits( active ) )
+            break;
+
+        F fScale = L::Div( fSteps, fRange );
+
+        // Evaluate function, and derivatives
+        F dX = zero, dY = zero, d2X = zero, d2Y = zero;
+
+        for( size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i )
+        {
+            F fDot = L::Mul( L::Sub( pt[i], fX ), fScale );
+
+            F low = L::LessEqual( fDot, zero );
+            F high = L::AndNot( low, L::GreaterEqual( fDot, fSteps ) );
+
+            // 6 step lanes send the points past either end to the fixed MIN & MAX values
+            F skip = L::Or( L::And( low, L::LessEqual( pt[i], L::Mul( fX, half ) ) ),
+                            L::And( high, L::GreaterEqual( pt[i], L::Mul( L::Add( fY, one ), half ) ) ) );
+            skip = L::And( six, skip );
+
+            F step = L::ToFloat( L::Truncate( L::Select( L::Select( L::Add( fDot, half ), zero, low ), fSteps, high ) ) );
+
+            F c = L::Div( L::Sub( fSteps, step ), fSteps );
+            F d = L::Div( step, fSteps );
+
+            F fDiff = L::Sub( L::Add( L::Mul( c, fX ), L::Mul( d, fY ) ), pt[i] );
+
+            dX  = L::Select( L::Add( dX, L::Mul( c, fDiff ) ), dX, skip );
+            d2X = L::Select( L::Add( d2X, L::Mul( c, c ) ), d2X, skip );
+            dY  = L::Select( L::Add( dY, L::Mul( d, fDiff ) ), dY, skip );
+            d2Y = L::Select( L::Add( d2Y, L::Mul( d, d ) ), d2Y, skip );
+        }
+
+        // Move endpoints
+        fX = L::Select( fX, L::Sub( fX, L::Div( dX, d2X ) ), L::And( active, L::Greater( d2X, zero ) ) );
+        fY = L::Select( fY, L::Sub( fY, L::Div( dY, d2Y ) ), L::And( active, L::Greater( d2Y, zero ) ) );
+
+        F swap = L::And( active, L::Greater( fX, fY ) );
+        F t = fX;
+        fX = L::Select( fX, fY, swap );
+        fY = L::Select( fY, t, swap );
+
+        const F eps = L::Splat( 1.0f / 64.0f );
+        active = L::AndNot( L::And( L::Less( L::Mul( dX, dX ), eps ), L::Less( L::Mul( dY, dY ), eps ) ), active );
+    }
+
+    fX = L::Select( L::Select( fX, maxNorm, L::Greater( fX, maxNorm ) ), minNorm, L::Less( fX, minNorm ) );
+    fY = L::Select( L::Select( fY, maxNorm, L::Greater( fY, maxNorm ) ), minNorm, L::Less( fY, minNorm ) );
+
+    // --- Quantize endpoints ----------------------------------------------------------
+
+    I iStart, iEnd, iSolid;
+    if ( bSigned )
+    {
+        iStart = FloatToSNormLanes<L>( fX );
+        iEnd = FloatToSNormLanes<L>( fY );
+        iSolid = FloatToSNormLanes<L>( blockMin );
+    }
+    else
+    {
+        const F f255 = L::Splat( 255.f );
+        iStart = L::Truncate( L::Mul( fX, f255 ) );
+        iEnd = L::Truncate( L::Mul( fY, f255 ) );
+
+        F fVal = L::Select( one, blockMin, L::Less( blockMin, one ) );
+        fVal = L::Select( zero, fVal, L::Less( zero, fVal ) );
+        iSolid = L::Truncate( L::Add( L::Mul( fVal, f255 ), half ) );
+    }
+
+    // 8 step blocks start at the high end, 6 step blocks at the low end
+    I red0 = L::SelectInt( iEnd, iStart, L::AsInt( six ) );
+    I red1 = L::SelectInt( iStart, iEnd, L::AsInt( six ) );
+    red0 = L::SelectInt( red0, iSolid, L::AsInt( solid ) );
+    red1 = L::SelectInt( red1, iSolid, L::AsInt( solid ) );
+
+    // --- FindClosestUNORM/SNORM ------------------------------------------------------
+
+    // Decode the endpoints as DecodeFromIndex does
+    const F fNorm = L::Splat( bSigned ? 127.0f : 255.0f );
+    const F fRed0 = L::Div( L::ToFloat( red0 ), fNorm );
+    const F fRed1 = L::Div( L::ToFloat( red1 ), fNorm );
+    const F mode8 = L::AsFloat( L::GreaterInt( red0, red1 ) );
+
+    F gradient[8];
+    gradient[0] = fRed0;
+    gradient[1] = fRed1;
+    for( size_t uIndex = 2; uIndex < 8; ++uIndex )
+    {
+        const float u = float( uIndex - 1 );
+
+        F g8 = L::Div( L::Add( L::Mul( fRed0, L::Splat( 7.f - u ) ), L::Mul( fRed1, L::Splat( u ) ) ), L::Splat( 7.f ) );
+        F g6 = ( uIndex == 6 ) ? minNorm
+             : ( uIndex == 7 ) ? maxNorm
+             : L::Div( L::Add( L::Mul( fRed0, L::Splat( 5.f - u ) ), L::Mul( fRed1, L::Splat( u ) ) ), L::Splat( 5.f ) );
+
+        gradient[uIndex] = L::Select( g6, g8, mode8 );
+    }
+
+    // Indices of texels 0-9 & 10-15, 3 bits each
+    I lo = L::SplatInt( 0 );
+    I hi = L::SplatInt( 0 );
+
+    for( size_t i = NUM_PIXELS_PER_BLOCK; i-- > 0; )
+    {
+        F best = zero;
+        F fBestDelta = L::Splat( 100000.f );
+
+        for( size_t uIndex = 0; uIndex < 8; ++uIndex )
+        {
+            F fCurrentDelta = L::AndNot( signBit, L::Sub( gradient[uIndex], pt[i] ) );
+            F m = L::Less( fCurrentDelta, fBestDelta );
+            best = L::Select( best, L::Splat( float( uIndex ) ), m );
+            fBestDelta = L::Select( fBestDelta, fCurrentDelta, m );
+        }
+
+        if ( i >= 10 )
+            hi = L::OrInt( L::template ShiftLeft<3>( hi ), L::Truncate( best ) );
+        else
+            lo = L::OrInt( L::template ShiftLeft<3>( lo ), L::Truncate( best ) );
+    }
+
+    const I mask8 = L::SplatInt( 0xFF );
+    L::Store( pEndpoints, L::OrInt( L::AndInt( red0, mask8 ), L::template ShiftLeft<8>( L::AndInt( red1, mask8 ) ) ) );
+    L::Store( pIndicesLo, lo );
+    L::Store( pIndicesHi, hi );
+
+    return L::Bits( L::AndNot( finite, ones ) );
+}
+
+#pragma warning(pop)
+
+
+//-------------------------------------------------------------------------------------
+// Each lane takes one channel of one block, so BC5 fills the lanes with the red &
+// green halves of half as many blocks
+template<class L, bool bSigned>
+static void EncodeBC4Batch( _Out_writes_(nBlocks * channels * 8) uint8_t *pBC, _In_ size_t nBlocks,
+                            _In_reads_(nBlocks * NUM_PIXELS_PER_BLOCK) const XMVECTOR *pColor, _In_ size_t channels,
+                            _In_ BC_ENCODE pfEncode, _In_ DWORD flags )
+{
+    const size_t nChannels = nBlocks * channels;
+
+    float texels[NUM_PIXELS_PER_BLOCK * L::COUNT];
+
+    for( size_t first = 0; first < nChannels; first += L::COUNT )
+    {
+        const size_t count = std::min<size_t>( L::COUNT, nChannels - first );
+
+        // A partial batch repeats its last channel in the unused lanes
+        for( size_t lane = 0; lane < L::COUNT; ++lane )
+        {
+            const size_t j = first + std::min<size_t>( lane, count - 1 );
+            const XMVECTOR* pBlock = pColor + ( j / channels ) * NUM_PIXELS_PER_BLOCK;
+
+            for( size_t i = 0; i < NUM_PIXELS_PER_BLOCK; ++i )
+            {
+                texels[ i * L::COUNT + lane ] = XMVectorGetByIndex( pBlock[i], j % channels );
+            }
+        }
+
+        uint32_t endpoints[L::COUNT];
+        uint32_t indicesLo[L::COUNT];
+        uint32_t indicesHi[L::COUNT];
+        int scalar = EncodeBC4Lanes<L, bSigned>( endpoints, indicesLo, indicesHi, texels );
+
+        L::Finish();
+
+        for( size_t lane = 0; lane < count; ++lane )
+        {
+            uint64_t data = uint64_t( endpoints[lane] ) | ( uint64_t( indicesLo[lane] ) << 16 ) | ( uint64_t( indicesHi[lane] ) << 46 );
+            memcpy( pBC + ( first + lane ) * 8, &data, sizeof(data) );
+        }
+
+        // The scalar encoder writes whole blocks, so it goes after all the lanes are stored
+        for( size_t lane = 0; lane < count; ++lane )
+        {
+            if ( scalar & (1 << lane) )
+            {
+                const size_t block = ( first + lane ) / channels;
+                pfEncode( pBC + block * channels * 8, pColor + block * NUM_PIXELS_PER_BLOCK, flags );
+            }
+        }
+    }
+}
+
+
+
+//-------------------------------------------------------------------------------------
+// Row expansion
+//
+// Each texel of a block picks a palette entry with a byte shuffle, so a whole row of
+// a block is one instruction. Only whole blocks come here; the caller does the texels
+// past the last multiple of 4. These need SSSE3, which SSE4.1 lanes imply.
+//-------------------------------------------------------------------------------------
+static void ExpandRowRGBA8SSE( _Out_ uint8_t *pDest, _In_ size_t rowPitch, _In_reads_(nBlocks * 4) const uint32_t *pPalette,
+                               _In_reads_(nBlocks) const uint32_t *pBitmap, _In_reads_opt_(nBlocks * NUM_PIXELS_PER_BLOCK) const uint8_t *pAlpha,
+                               _In_ size_t nBlocks, _In_ size_t height )
+{
+    // Byte i of a row's mask selects byte i & 3 of the palette entry for texel i >> 2
+    const __m128i spread = _mm_setr_epi8( 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3 );
+    const __m128i offsets = _mm_setr_epi8( 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3 );
+    const __m128i rgbMask = _mm_set1_epi32( 0x00FFFFFF );
+
+    // Moves the alpha values of row y to byte 3 of each texel
+    const __m128i alphaRows[4] =
+    {
+        _mm_setr_epi8( -1, -1, -1,  0, -1, -1, -1,  1, -1, -1, -1,  2, -1, -1, -1,  3 ),
+        _mm_setr_epi8( -1, -1, -1,  4, -1, -1, -1,  5, -1, -1, -1,  6, -1, -1, -1,  7 ),
+        _mm_setr_epi8( -1, -1, -1,  8, -1, -1, -1,  9, -1, -1, -1, 10, -1, -1, -1, 11 ),
+        _mm_setr_epi8( -1, -1, -1, 12, -1, -1, -1, 13, -1, -1, -1, 14, -1, -1, -1, 15 ),
+    };
+
+    for( size_t i = 0; i < nBlocks; ++i )
+    {
+        const __m128i palette = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pPalette + i * 4 ) );
+        const __m128i alpha = ( pAlpha ) ? _mm_loadu_si128( reinterpret_cast<const __m128i*>( pAlpha + i * NUM_PIXELS_PER_BLOCK ) ) : _mm_setzero_si128();
+
+        uint32_t bitmap = pBitmap[i];
+        for( size_t y = 0; y < height; ++y, bitmap >>= 8 )
+        {
+            // The 4 indices of the row, times 4, one per byte
+            uint32_t row = bitmap & 0xFF;
+            row = ( ( row | ( row << 6 ) | ( row << 12 ) | ( row << 18 ) ) & 0x03030303 ) << 2;
+
+            __m128i mask = _mm_or_si128( _mm_shuffle_epi8( _mm_cvtsi32_si128( static_cast<int>( row ) ), spread ), offsets );
+            __m128i texels = _mm_shuffle_epi8( palette, mask );
+
+            if ( pAlpha )
+            {
+                texels = _mm_or_si128( _mm_and_si128( texels, rgbMask ), _mm_shuffle_epi8( alpha, alphaRows[y] ) );
+            }
+
+            _mm_storeu_si128( reinterpret_cast<__m128i*>( pDest + y * rowPitch + i * 16 ), texels );
+        }
+    }
+}
+
+// Unpacks 16 3-bit indices, one per byte. Index i sits in the 16 bits starting at byte
+// 3i / 8, which a multiply shifts to the top of a 16-bit lane.
+static __m128i SpreadIndices3( _In_ uint64_t indices )
+{
+    const __m128i gatherLo = _mm_setr_epi8( 0, 1, 0, 1, 0, 1, 1, 2, 1, 2, 1, 2, 2, 3, 2, 3 );
+    const __m128i gatherHi = _mm_setr_epi8( 3, 4, 3, 4, 3, 4, 4, 5, 4, 5, 4, 5, 5, 6, 5, 6 );
+    const __m128i shifts = _mm_setr_epi16( 1 << 13, 1 << 10, 1 << 7, 1 << 12, 1 << 9, 1 << 6, 1 << 11, 1 << 8 );
+
+    const __m128i bits = _mm_loadl_epi64( reinterpret_cast<const __m128i*>( &indices ) );
+    const __m128i lo = _mm_srli_epi16( _mm_mullo_epi16( _mm_shuffle_epi8( bits, gatherLo ), shifts ), 13 );
+    const __m128i hi = _mm_srli_epi16( _mm_mullo_epi16( _mm_shuffle_epi8( bits, gatherHi ), shifts ), 13 );
+    return _mm_packus_epi16( lo, hi );
+}
+
+static void ExpandRowUNORM8SSE( _Out_ uint8_t *pDest, _In_ size_t rowPitch, _In_reads_(nBlocks * channels * 8) const uint8_t *pPalette,
+                                _In_reads_(nBlocks * channels) const uint64_t *pIndices, _In_ size_t channels, _In_ size_t nBlocks, _In_ size_t height )
+{
+    if ( channels == 1 )
+    {
+        for( size_t i = 0; i < nBlocks; ++i )
+        {
+            const __m128i palette = _mm_loadl_epi64( reinterpret_cast<const __m128i*>( pPalette + i * 8 ) );
+            __m128i texels = _mm_shuffle_epi8( palette, SpreadIndices3( pIndices[i] ) );
+
+            uint8_t* pRow = pDest + i * 4;
+            for( size_t y = 0; y < height; ++y, pRow += rowPitch )
+            {
+                *reinterpret_cast<uint32_t*>( pRow ) = static_cast<uint32_t>( _mm_cvtsi128_si32( texels ) );
+                texels = _mm_srli_si128( texels, 4 );
+            }
+        }
+    }
+    else
+    {
+        // Red levels are palette bytes 0-7 & green levels bytes 8-15
+        const __m128i greenOffset = _mm_set1_epi8( 8 );
+
+        for( size_t i = 0; i < nBlocks; ++i )
+        {
+            const __m128i palette = _mm_loadu_si128( reinterpret_cast<const __m128i*>( pPalette + i * 16 ) );
+            const __m128i r = SpreadIndices3( pIndices[i * 2] );
+            const __m128i g = _mm_add_epi8( SpreadIndices3( pIndices[i * 2 + 1] ), greenOffset );
+
+            // Rows 0 & 1, then rows 2 & 3
+            const __m128i top = _mm_shuffle_epi8( palette, _mm_unpacklo_epi8( r, g ) );
+            const __m128i bottom = _mm_shuffle_epi8( palette, _mm_unpackhi_epi8( r, g ) );
+
+            uint8_t* pRow = pDest + i * 8;
+            _mm_storel_epi64( reinterpret_cast<__m128i*>( pRow ), top );
+            if ( height > 1 )
+                _mm_storel_epi64( reinterpret_cast<__m128i*>( pRow + rowPitch ), _mm_srli_si128( top, 8 ) );
+            if ( height > 2 )
+                _mm_storel_epi64( reinterpret_cast<__m128i*>( pRow + rowPitch * 2 ), bottom );
+            if ( height > 3 )
+                _mm_storel_epi64( reinterpret_cast<__m128i*>( pRow + rowPitch * 3 ), _mm_srli_si128( bottom, 8 ) );
+        }
+    }
+}
+
+#endif // _XM_SSE_INTRINSICS_
+
+
+//-------------------------------------------------------------------------------------
+// Scalar row expansion, for CPUs without SSSE3 & for partial blocks
+//-------------------------------------------------------------------------------------
+static void ExpandBlockRGBA8( _Out_ uint8_t *pDest, _In_ size_t rowPitch, _In_reads_(4) const uint32_t *pPalette, _In_ uint32_t bitmap,
+                              _In_reads_opt_(NUM_PIXELS_PER_BLOCK) const uint8_t *pAlpha, _In_ size_t width, _In_ size_t height )
+{
+    for( size_t y = 0; y < height; ++y )
+    {
+        uint32_t* pRow = reinterpret_cast<uint32_t*>( pDest + y * rowPitch );
+        for( size_t x = 0; x < width; ++x )
+        {
+            const size_t i = y * 4 + x;
+            uint32_t c = pPalette[ ( bitmap >> ( 2 * i ) ) & 3 ];
+            if ( pAlpha )
+                c = ( c & 0x00FFFFFF ) | ( uint32_t( pAlpha[i] ) << 24 );
+            pRow[x] = c;
+        }
+    }
+}
+
+static void ExpandBlockUNORM8( _Out_ uint8_t *pDest, _In_ size_t rowPitch, _In_reads_(channels * 8) const uint8_t *pPalette,
+                               _In_reads_(channels) const uint64_t *pIndices, _In_ size_t channels, _In_ size_t width, _In_ size_t height )
+{
+    for( size_t y = 0; y < height; ++y )
+    {
+        uint8_t* pRow = pDest + y * rowPitch;
+        for( size_t x = 0; x < width; ++x )
+        {
+            const size_t i = y * 4 + x;
+            for( size_t c = 0; c < channels; ++c )
+                *pRow++ = pPalette[ c * 8 + size_t( ( pIndices[c] >> ( 3 * i ) ) & 7 ) ];
+        }
+    }
+}
+
+
+//=====================================================================================
+// Entry points
+//=====================================================================================
+
+//-------------------------------------------------------------------------------------
+// BC1 Compression
+//-------------------------------------------------------------------------------------
+_Use_decl_annotations_
+void D3DXEncodeBC1Batch(uint8_t *pBC, size_t nBlocks, const XMVECTOR *pColor, float alphaRef, DWORD flags)
+{
+    assert( pBC && pColor );
+    static_assert( sizeof(D3DX_BC1) == 8, "D3DX_BC1 should be 8 bytes" );
+
+#ifdef _XM_SSE_INTRINSICS_
+    // Dithering carries error from texel to texel, which the lanes don't model
+    if ( !( flags & (BC_FLAGS_DITHER_RGB | BC_FLAGS_DITHER_A | BC_FLAGS_SCALAR) ) )
+    {
+        switch( GetLanes() )
+        {
+        case 8:
+            EncodeBC1Batch<LanesAVX2>( pBC, nBlocks, pColor, alphaRef, flags );
+            return;
+
+        case 4:
+            EncodeBC1Batch<LanesSSE4>( pBC, nBlocks, pColor, alphaRef, flags );
+            return;
+        }
+    }
+#endif // _XM_SSE_INTRINSICS_
+
+    for( size_t i = 0; i < nBlocks; ++i )
+    {
+        D3DXEncodeBC1( pBC + i * sizeof(D3DX_BC1), pColor + i * NUM_PIXELS_PER_BLOCK, alphaRef, flags );
+    }
+}
+
+
+//-------------------------------------------------------------------------------------
+// BC4 & BC5 Compression
+//-------------------------------------------------------------------------------------
+static void EncodeBC4BatchLanes( _Out_writes_(nBlocks * channels * 8) uint8_t *pBC, _In_ size_t nBlocks,
+                                 _In_reads_(nBlocks * NUM_PIXELS_PER_BLOCK) const XMVECTOR *pColor, _In_ size_t channels,
+                                 _In_ bool bSigned, _In_ BC_ENCODE pfEncode, _In_ DWORD flags )
+{
+    assert( pBC && pColor );
+
+#ifdef _XM_SSE_INTRINSICS_
+    switch( ( flags & BC_FLAGS_SCALAR ) ? 0 : GetLanes() )
+    {
+    case 8:
+        if ( bSigned )
+            EncodeBC4Batch<LanesAVX2, true>( pBC, nBlocks, pColor, channels, pfEncode, flags );
+        else
+            EncodeBC4Batch<LanesAVX2, false>( pBC, nBlocks, pColor, channels, pfEncode, flags );
+        return;
+
+    case 4:
+        if ( bSigned )
+            EncodeBC4Batch<LanesSSE4, true>( pBC, nBlocks, pColor, channels, pfEncode, flags );
+        else
+            EncodeBC4Batch<LanesSSE4, false>( pBC, nBlocks, pColor, channels, pfEncode, flags );
+        return;
+    }
+#else
+    UNREFERENCED_PARAMETER( bSigned );
+#endif // _XM_SSE_INTRINSICS_
+
+    for( size_t i = 0; i < nBlocks; ++i )
+    {
+        pfEncode( pBC + i * channels * 8, pColor + i * NUM_PIXELS_PER_BLOCK, flags );
+    }
+}
+
+_Use_decl_annotations_
+void D3DXEncodeBC4UBatch(uint8_t *pBC, size_t nBlocks, const XMVECTOR *pColor, DWORD flags)
+{
+    EncodeBC4BatchLanes( pBC, nBlocks, pColor, 1, false, D3DXEncodeBC4U, flags );
+}
+
+_Use_decl_annotations_
+void D3DXEncodeBC4SBatch(uint8_t *pBC, size_t nBlocks, const XMVECTOR *pColor, DWORD flags)
+{
+    EncodeBC4BatchLanes( pBC, nBlocks, pColor, 1, true, D3DXEncodeBC4S, flags );
+}
+
+_Use_decl_annotations_
+void D3DXEncodeBC5UBatch(uint8_t *pBC, size_t nBlocks, const XMVECTOR *pColor, DWORD flags)
+{
+    EncodeBC4BatchLanes( pBC, nBlocks, pColor, 2, false, D3DXEncodeBC5U, flags );
+}
+
+_Use_decl_annotations_
+void D3DXEncodeBC5SBatch(uint8_t *pBC, size_t nBlocks, const XMVECTOR *pColor, DWORD flags)
+{
+    EncodeBC4BatchLanes( pBC, nBlocks, pColor, 2, true, D3DXEncodeBC5S, flags );
+}
+
+
+//-------------------------------------------------------------------------------------
+// Row expansion
+//-------------------------------------------------------------------------------------
+_Use_decl_annotations_
+void D3DXExpandRowRGBA8(uint8_t *pDest, size_t rowPitch, const uint32_t *pPalette, const uint32_t *pBitmap, const uint8_t *pAlpha, size_t width, size_t height)
+{
+    assert( pDest && pPalette && pBitmap && width > 0 && height > 0 && height <= 4 );
+
+    size_t i = 0;
+
+#ifdef _XM_SSE_INTRINSICS_
+    if ( GetLanes() )
+    {
+        i = width >> 2;
+        ExpandRowRGBA8SSE( pDest, rowPitch, pPalette, pBitmap, pAlpha, i, height );
+    }
+#endif // _XM_SSE_INTRINSICS_
+
+    for( ; i * 4 < width; ++i )
+    {
+        ExpandBlockRGBA8( pDest + i * 16, rowPitch, pPalette + i * 4, pBitmap[i], pAlpha ? pAlpha + i * NUM_PIXELS_PER_BLOCK : nullptr,
+                          std::min<size_t>( 4, width - i * 4 ), height );
+    }
+}
+
+_Use_decl_annotations_
+void D3DXExpandRowUNORM8(uint8_t *pDest, size_t rowPitch, const uint8_t *pPalette, const uint64_t *pIndices, size_t channels, size_t width, size_t height)
+{
+    assert( pDest && pPalette && pIndices && width > 0 && height > 0 && height <= 4 );
+    assert( channels == 1 || channels == 2 );
+
+    size_t i = 0;
+
+#ifdef _XM_SSE_INTRINSICS_
+    if ( GetLanes() )
+    {
+        i = width >> 2;
+        ExpandRowUNORM8SSE( pDest, rowPitch, pPalette, pIndices, channels, i, height );
+    }
+#endif // _XM_SSE_INTRINSICS_
+
+    for( ; i * 4 < width; ++i )
+    {
+        ExpandBlockUNORM8( pDest + i * 4 * channels, rowPitch, pPalette + i * 8 * channels, pIndices + i * channels, channels,
+                           std::min<size_t>( 4, width - i * 4 ), height );
+    }
+}
+
+}; // namespace
@@ -271,6 +271,9 @@ namespace DirectX
         size_t __cdecl GetPixelsSize() const { return _size; }
 
         bool __cdecl IsAlphaAllOpaque() const;
+        bool __cdecl IsAlphaAllOpaque( _In_ size_t nthreads ) const;
+            // Checks rows of all the images on up to nthreads threads (0 uses one per hardware thread), stopping at
+            // the first texel that isn't opaque; the version without a count only uses the calling thread
 
     private:
         size_t      _nimages;
@@ -359,6 +362,40 @@ namespace DirectX
                                    _In_z_ LPCWSTR szFile, _In_opt_ const GUID* targetFormat = nullptr,
                                    _In_opt_ std::function<void __cdecl(IPropertyBag2*)> setCustomProps = nullptr );
 
+    // Derived texture cache
+    //   A directory of DDS files, each holding the result of processing a source image and named after
+    //   a hash of the source file's bytes and the parameters that produced it. Loading an entry marks it
+    //   as recently used, and saving one evicts the least recently used entries beyond maxBytes. Eviction
+    //   only considers files named like entries (32 hex digits and .dds), so the directory may be shared with
+    //   other files; temporary files left by interrupted saves count against maxBytes and are deleted after an hour.
+    struct TexCacheKey
+    {
+        uint64_t hash[2];
+    };
+
+    struct TexCacheParams
+    {
+        DXGI_FORMAT format;     // Target format (DXGI_FORMAT_UNKNOWN if chosen by the caller's processing)
+        size_t      mipLevels;  // Target number of mips (0 for a full chain)
+        DWORD       filter;     // TEX_FILTER_* flags used for conversion, resizing, and mipmap generation
+        DWORD       srgb;       // TEX_FILTER_SRGB_* flags
+        LPCVOID     pExtra;     // Any other settings that change the result, compared byte for byte
+        size_t      extraSize;
+    };
+
+    HRESULT __cdecl ComputeTexCacheKey( _In_reads_bytes_(size) LPCVOID pSource, _In_ size_t size, _In_ const TexCacheParams& params,
+                                        _Out_ TexCacheKey& key );
+    HRESULT __cdecl ComputeTexCacheKeyFromFile( _In_z_ LPCWSTR szFile, _In_ const TexCacheParams& params, _Out_ TexCacheKey& key );
+
+    HRESULT __cdecl LoadFromTexCache( _In_z_ LPCWSTR szDirectory, _In_ const TexCacheKey& key,
+                                      _Out_opt_ TexMetadata* metadata, _Out_ ScratchImage& image );
+        // Returns HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND) if there's no entry for the key
+
+    HRESULT __cdecl SaveToTexCache( _In_z_ LPCWSTR szDirectory, _In_ const TexCacheKey& key,
+                                    _In_reads_(nimages) const Image* images, _In_ size_t nimages, _In_ const TexMetadata& metadata,
+                                    _In_ uint64_t maxBytes );
+        // maxBytes of 0 disables eviction
+
     //---------------------------------------------------------------------------------
     // Texture conversion, resizing, mipmap generation, and block compression
 
@@ -481,6 +518,9 @@ namespace DirectX
     {
         TEX_COMPRESS_DEFAULT        = 0,
 
+        TEX_COMPRESS_THREADS_MASK   = 0xFF,
+            // Number of threads TEX_COMPRESS_PARALLEL uses, set with CompressThreads(); by default one per hardware thread
+
         TEX_COMPRESS_RGB_DITHER     = 0x10000,
             // Enables dithering RGB colors for BC1-3 compression
 
@@ -496,14 +536,27 @@ namespace DirectX
         TEX_COMPRESS_BC7_USE_3SUBSETS = 0x80000,
             // Enables exhaustive search for BC7 compress for mode 0 and 2; by default skips trying these modes
 
+        TEX_COMPRESS_FAST           = 0x100000,
+            // Fits BC1-3 color endpoints to the range of the colors with one least squares refit, rather than searching
+            // for them (about 1.5x faster on both the scalar & SIMD paths); BC3 alpha uses the range of the values;
+            // BC6H fits one line through each block and only tries the single region modes
+
+        TEX_COMPRESS_BC7_QUALITY_MASK = 0xE00000,
+            // BC7 quality level for the CPU compressor, set with BC7CompressQuality(); by default uses the highest level
+
         TEX_COMPRESS_SRGB_IN        = 0x1000000,
         TEX_COMPRESS_SRGB_OUT       = 0x2000000,
         TEX_COMPRESS_SRGB           = ( TEX_COMPRESS_SRGB_IN | TEX_COMPRESS_SRGB_OUT ),
             // if the input format type is IsSRGB(), then SRGB_IN is on by default
             // if the output format type is IsSRGB(), then SRGB_OUT is on by default
 
+        TEX_COMPRESS_SCALAR         = 0x4000000,
+            // Encodes BC1 and BC4/5 one block at a time; by default several blocks are encoded at once with SSE4.1 or AVX2 when
+            // the CPU supports them, with identical results. Useful for measuring the speedup
+
         TEX_COMPRESS_PARALLEL       = 0x10000000,
-            // Compress is free to use multithreading to improve performance (by default it does not use multithreading)
+            // Compress is free to use multithreading to improve performance (by default it does not use multithreading);
+            // all the images of one call are compressed together, with the result the same for any number of threads
     };
 
     HRESULT __cdecl Compress( _In_ const Image& srcImage, _In_ DXGI_FORMAT format, _In_ DWORD compress, _In_ float alphaRef,
@@ -512,16 +565,69 @@ namespace DirectX
                               _In_ DXGI_FORMAT format, _In_ DWORD compress, _In_ float alphaRef, _Out_ ScratchImage& cImages );
         // Note that alphaRef is only used by BC1. 0.5f is a typical value to use
 
+    HRESULT __cdecl Compress( _In_ const Image& srcImage, _In_ DXGI_FORMAT format, _In_ DWORD compress, _In_ float alphaRef,
+                              _In_ float rdoLambda, _In_ float rdoMaxError, _Out_ ScratchImage& cImage );
+    HRESULT __cdecl Compress( _In_reads_(nimages) const Image* srcImages, _In_ size_t nimages, _In_ const TexMetadata& metadata,
+                              _In_ DXGI_FORMAT format, _In_ DWORD compress, _In_ float alphaRef,
+                              _In_ float rdoLambda, _In_ float rdoMaxError, _Out_ ScratchImage& cImages );
+        // Rate-distortion optimized BC1, BC3 & BC7 (other formats are compressed as above), which repeats endpoints & indices
+        // of nearby blocks so the result compresses better with LZ. rdoLambda is the squared error, in 8 bit units, traded
+        // for each bit saved (0 turns it off), and rdoMaxError the RMS error per block in 8 bit units it may go up to
+
+    HRESULT __cdecl GenerateCompressedMipMaps( _In_ const Image& baseImage, _In_ DWORD filter, _In_ size_t levels, _In_ DXGI_FORMAT format,
+                                               _In_ DWORD compress, _In_ float alphaRef, _Out_ ScratchImage& cImages );
+    HRESULT __cdecl GenerateCompressedMipMaps( _In_ const Image& baseImage, _In_ DWORD filter, _In_ size_t levels, _In_ DXGI_FORMAT format,
+                                               _In_ DWORD compress, _In_ float alphaRef, _In_ float rdoLambda, _In_ float rdoMaxError,
+                                               _Out_ ScratchImage& cImages );
+        // Generates mips of a power-of-2 2D image with the box filter & compresses them in one pass over the rows, without
+        // building the uncompressed mip chain: only a few rows of each level are held besides baseImage & cImages. filter
+        // is TEX_FILTER_DEFAULT or TEX_FILTER_BOX with the sRGB flags; the result is the same as from GenerateMipMaps with
+        // that filter and TEX_FILTER_FORCE_NON_WIC, then Compress
+
+    const size_t BC7_QUALITY_LEVELS = 7;
+
+    DWORD __cdecl BC7CompressQuality( _In_ size_t level );
+        // Compress flags for a BC7 quality level, from 0 (quickest) to BC7_QUALITY_LEVELS - 1 (the full search).
+        // The lower levels try fewer modes, pick a few partition shapes by estimate & cut the endpoint search short
+
+    DWORD __cdecl CompressThreads( _In_ size_t count );
+        // Compress flags to limit TEX_COMPRESS_PARALLEL to count threads, from 1 to 255; 0 uses one per hardware thread.
+        // The same bits limit TEX_DECOMPRESS_PARALLEL
+
     HRESULT __cdecl Compress( _In_ ID3D11Device* pDevice, _In_ const Image& srcImage, _In_ DXGI_FORMAT format, _In_ DWORD compress,
                               _In_ float alphaWeight, _Out_ ScratchImage& image );
     HRESULT __cdecl Compress( _In_ ID3D11Device* pDevice, _In_ const Image* srcImages, _In_ size_t nimages, _In_ const TexMetadata& metadata,
                               _In_ DXGI_FORMAT format, _In_ DWORD compress, _In_ float alphaWeight, _Out_ ScratchImage& cImages );
         // DirectCompute-based compression (alphaWeight is only used by BC7. 1.0 is the typical value to use)
 
+    enum TEX_DECOMPRESS_FLAGS
+    {
+        TEX_DECOMPRESS_DEFAULT      = 0,
+
+        TEX_DECOMPRESS_THREADS_MASK = 0xFF,
+            // Number of threads TEX_DECOMPRESS_PARALLEL uses, set with CompressThreads(); by default one per hardware thread
+
+        TEX_DECOMPRESS_PARALLEL     = 0x10000000,
+            // Decompress is free to use multithreading to improve performance (by default it does not use multithreading);
+            // rows of blocks of all the images of one call are decoded together, with the same result for any number of threads
+    };
+
     HRESULT __cdecl Decompress( _In_ const Image& cImage, _In_ DXGI_FORMAT format, _Out_ ScratchImage& image );
     HRESULT __cdecl Decompress( _In_reads_(nimages) const Image* cImages, _In_ size_t nimages, _In_ const TexMetadata& metadata,
                                 _In_ DXGI_FORMAT format, _Out_ ScratchImage& images );
 
+    HRESULT __cdecl Decompress( _In_ const Image& cImage, _In_ DXGI_FORMAT format, _In_ DWORD flags, _Out_ ScratchImage& image );
+    HRESULT __cdecl Decompress( _In_reads_(nimages) const Image* cImages, _In_ size_t nimages, _In_ const TexMetadata& metadata,
+                                _In_ DXGI_FORMAT format, _In_ DWORD flags, _Out_ ScratchImage& images );
+
+    HRESULT __cdecl SelectBCFormat( _In_ const Image& srcImage, _In_ DWORD compress, _In_ float alphaRef,
+                                    _In_ float minPSNR, _In_ float maxError, _Out_ DXGI_FORMAT& format,
+                                    _Out_opt_ float* psnr = nullptr, _Out_opt_ float* error = nullptr );
+        // Picks the smallest of BC1, BC3 & BC7 for srcImage by trial encoding a sample of its blocks with compress & alphaRef
+        // as for Compress: the first whose PSNR is at least minPSNR dB, with no block's RMS error above maxError in 8 bit units
+        // (0 skips either test). BC1 is only tried when alpha is fully opaque or transparent, and BC3 only when it isn't all
+        // opaque. The _SRGB format is picked for sRGB output. Returns S_FALSE & the closest format when none meets the target
+
     //---------------------------------------------------------------------------------
     // Normal map operations
 
@@ -592,6 +698,23 @@ namespace DirectX
 
     HRESULT __cdecl ComputeMSE( _In_ const Image& image1, _In_ const Image& image2, _Out_ float& mse, _Out_writes_opt_(4) float* mseV, _In_ DWORD flags = 0 );
 
+    struct ImageMetrics
+    {
+        float   mse[4];         // Mean-squared-error of each channel (R, G, B, A)
+        float   psnr[4];        // Peak signal-to-noise ratio in dB for a peak of 1.0; infinite for a channel that matches
+        float   maxError[4];    // Largest absolute difference of any texel
+        float   ssim[4];        // Structural similarity over windows of 8x8 texels, 1.0 for a channel that matches
+    };
+
+    HRESULT __cdecl ComputeMetrics( _In_ const Image& image1, _In_ const Image& image2, _Out_ ImageMetrics& metrics,
+                                    _In_ DWORD flags = 0, _In_ size_t nthreads = 1 );
+    HRESULT __cdecl ComputeMetrics( _In_reads_(nimages) const Image* images1, _In_reads_(nimages) const Image* images2, _In_ size_t nimages,
+                                    _In_ const TexMetadata& metadata, _Out_writes_(metadata.mipLevels) ImageMetrics* metrics,
+                                    _In_ DWORD flags = 0, _In_ size_t nthreads = 1 );
+        // Computes all the metrics in one pass over the rows, spread over up to nthreads threads (0 uses one per hardware
+        // thread). The second version compares two sets of images laid out as metadata describes, with the results of all
+        // the array items or slices of a mip level together. flags are CMSE_FLAGS, and BC images are decompressed first
+
     //---------------------------------------------------------------------------------
     // WIC utility code
 
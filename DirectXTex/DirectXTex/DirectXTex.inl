@@ -94,6 +94,28 @@ inline bool __cdecl IsSRGB(DXGI_FORMAT fmt)
 }
 
 
+//=====================================================================================
+// Texture compression
+//=====================================================================================
+_Use_decl_annotations_
+inline DWORD __cdecl BC7CompressQuality( size_t level )
+{
+    if ( level >= BC7_QUALITY_LEVELS )
+        level = BC7_QUALITY_LEVELS - 1;
+
+    return static_cast<DWORD>( level + 1 ) << 21;
+}
+
+_Use_decl_annotations_
+inline DWORD __cdecl CompressThreads( size_t count )
+{
+    if ( count > TEX_COMPRESS_THREADS_MASK )
+        count = TEX_COMPRESS_THREADS_MASK;
+
+    return static_cast<DWORD>( count );
+}
+
+
 //=====================================================================================
 // Image I/O
 //=====================================================================================
@@ -0,0 +1,484 @@
+//-------------------------------------------------------------------------------------
+// DirectXTexCache.cpp
+//
+// DirectX Texture Library - Content-addressed cache of derived textures
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248926
+//-------------------------------------------------------------------------------------
+
+#include "directxtexp.h"
+
+namespace
+{
+    const uint64_t CACHE_KEY_VERSION = 1;
+
+    struct CacheEntry
+    {
+        uint64_t lastUsed;
+        uint64_t size;
+        wchar_t  name[MAX_PATH];
+    };
+
+    inline uint64_t fmix64( uint64_t k )
+    {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdull;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ull;
+        k ^= k >> 33;
+        return k;
+    }
+
+    // MurmurHash3 (x64, 128-bit)
+    void Hash128( _In_reads_bytes_(size) const void* pData, size_t size, uint64_t seed, _Out_writes_(2) uint64_t* result )
+    {
+        const uint64_t c1 = 0x87c37b91114253d5ull;
+        const uint64_t c2 = 0x4cf5ad432745937full;
+
+        auto data = reinterpret_cast<const uint8_t*>( pData );
+        uint64_t h1 = seed;
+        uint64_t h2 = seed;
+
+        const size_t nblocks = size / 16;
+        for( size_t i = 0; i < nblocks; ++i )
+        {
+            uint64_t k1, k2;
+            memcpy( &k1, data + i * 16, sizeof(uint64_t) );
+            memcpy( &k2, data + i * 16 + 8, sizeof(uint64_t) );
+
+            k1 *= c1; k1 = _rotl64( k1, 31 ); k1 *= c2; h1 ^= k1;
+            h1 = _rotl64( h1, 27 ); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+            k2 *= c2; k2 = _rotl64( k2, 33 ); k2 *= c1; h2 ^= k2;
+            h2 = _rotl64( h2, 31 ); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+        }
+
+        const uint8_t* tail = data + nblocks * 16;
+        const size_t remaining = size & 15;
+
+        uint64_t k1 = 0;
+        uint64_t k2 = 0;
+
+        for( size_t i = remaining; i > 8; --i )
+            k2 ^= uint64_t( tail[ i - 1 ] ) << ( 8 * ( i - 9 ) );
+
+        if ( remaining > 8 )
+        {
+            k2 *= c2; k2 = _rotl64( k2, 33 ); k2 *= c1; h2 ^= k2;
+        }
+
+        for( size_t i = std::min<size_t>( remaining, 8 ); i > 0; --i )
+            k1 ^= uint64_t( tail[ i - 1 ] ) << ( 8 * ( i - 1 ) );
+
+        if ( remaining > 0 )
+        {
+            k1 *= c1; k1 = _rotl64( k1, 31 ); k1 *= c2; h1 ^= k1;
+        }
+
+        h1 ^= uint64_t( size );
+        h2 ^= uint64_t( size );
+
+        h1 += h2;
+        h2 += h1;
+
+        h1 = fmix64( h1 );
+        h2 = fmix64( h2 );
+
+        h1 += h2;
+        h2 += h1;
+
+        result[0] = h1;
+        result[1] = h2;
+    }
+
+    bool MakeCachePath( _In_z_ LPCWSTR szDirectory, _In_z_ LPCWSTR szName, _Out_writes_(MAX_PATH) wchar_t* path )
+    {
+        size_t len = wcslen( szDirectory );
+        bool slash = ( len > 0 ) && ( szDirectory[ len - 1 ] == L'\\' || szDirectory[ len - 1 ] == L'/' );
+
+        return swprintf_s( path, MAX_PATH, slash ? L"%ls%ls" : L"%ls\\%ls", szDirectory, szName ) > 0;
+    }
+
+    void MakeCacheName( const DirectX::TexCacheKey& key, _In_z_ LPCWSTR szExtension, _Out_writes_(MAX_PATH) wchar_t* name )
+    {
+        swprintf_s( name, MAX_PATH, L"%016llx%016llx%ls", key.hash[0], key.hash[1], szExtension );
+    }
+
+    inline uint64_t FileTimeToUInt64( const FILETIME& ft )
+    {
+        return ( uint64_t( ft.dwHighDateTime ) << 32 ) | ft.dwLowDateTime;
+    }
+
+    // Cache files are named after their key as 32 hex digits, followed by .dds for entries or by
+    // .dds.<process>.<thread>.tmp while SaveToTexCache writes them
+    enum CACHE_FILE
+    {
+        CACHE_FILE_OTHER,
+        CACHE_FILE_ENTRY,
+        CACHE_FILE_TEMP,
+    };
+
+    bool MatchDigits( _Inout_ LPCWSTR& p, bool hex )
+    {
+        LPCWSTR start = p;
+        while ( ( *p >= L'0' && *p <= L'9' ) || ( hex && *p >= L'a' && *p <= L'f' ) )
+            ++p;
+        return p != start;
+    }
+
+    CACHE_FILE ClassifyCacheFile( _In_z_ LPCWSTR szName )
+    {
+        LPCWSTR p = szName;
+        if ( !MatchDigits( p, true ) || ( p - szName ) != 32 || _wcsnicmp( p, L".dds", 4 ) != 0 )
+            return CACHE_FILE_OTHER;
+
+        p += 4;
+        if ( !*p )
+            return CACHE_FILE_ENTRY;
+
+        if ( *p++ != L'.' || !MatchDigits( p, false ) || *p++ != L'.' || !MatchDigits( p, false ) || _wcsicmp( p, L".tmp" ) != 0 )
+            return CACHE_FILE_OTHER;
+
+        return CACHE_FILE_TEMP;
+    }
+
+    // A temporary file this much older than now (in FILETIME units) is left from an interrupted save
+    const uint64_t STALE_TEMP_AGE = 3600ull * 10000000ull;
+
+    //---------------------------------------------------------------------------------
+    // Deletes the least recently used entries until the cache fits in maxBytes. Entries
+    // that are in use by another process fail to delete and are simply skipped. Only files
+    // named like cache files are touched, so other files in the directory are left alone.
+    // Temporary files count against maxBytes too, and stale ones are always deleted.
+    //---------------------------------------------------------------------------------
+    void TrimCache( _In_z_ LPCWSTR szDirectory, uint64_t maxBytes, _In_z_ LPCWSTR szKeep )
+    {
+        wchar_t pattern[MAX_PATH];
+        if ( !MakeCachePath( szDirectory, L"*.dds*", pattern ) )
+            return;
+
+        FILETIME now;
+        GetSystemTimeAsFileTime( &now );
+        const uint64_t staleBefore = FileTimeToUInt64( now ) - STALE_TEMP_AGE;
+
+        std::vector<CacheEntry> entries;
+        uint64_t total = 0;
+
+        WIN32_FIND_DATAW findData = {};
+#if (_WIN32_WINNT >= _WIN32_WINNT_WIN7)
+        HANDLE hFind = FindFirstFileExW( pattern, FindExInfoBasic, &findData, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH );
+#else
+        HANDLE hFind = FindFirstFileExW( pattern, FindExInfoStandard, &findData, FindExSearchNameMatch, nullptr, 0 );
+#endif
+        if ( hFind == INVALID_HANDLE_VALUE )
+            return;
+
+        do
+        {
+            if ( findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY )
+                continue;
+
+            CACHE_FILE type = ClassifyCacheFile( findData.cFileName );
+            if ( type == CACHE_FILE_OTHER )
+                continue;
+
+            CacheEntry entry;
+            entry.lastUsed = FileTimeToUInt64( findData.ftLastWriteTime );
+            entry.size = ( uint64_t( findData.nFileSizeHigh ) << 32 ) | findData.nFileSizeLow;
+            wcscpy_s( entry.name, findData.cFileName );
+
+            if ( type == CACHE_FILE_TEMP && entry.lastUsed < staleBefore )
+            {
+                wchar_t path[MAX_PATH];
+                if ( MakeCachePath( szDirectory, entry.name, path ) && DeleteFileW( path ) )
+                    continue;
+            }
+
+            total += entry.size;
+            entries.push_back( entry );
+        } while ( FindNextFileW( hFind, &findData ) );
+
+        FindClose( hFind );
+
+        if ( total <= maxBytes )
+            return;
+
+        std::sort( entries.begin(), entries.end(),
+                   []( const CacheEntry& a, const CacheEntry& b ) { return a.lastUsed < b.lastUsed; } );
+
+        for( auto it = entries.cbegin(); it != entries.cend() && total > maxBytes; ++it )
+        {
+            if ( _wcsicmp( it->name, szKeep ) == 0 )
+                continue;
+
+            wchar_t path[MAX_PATH];
+            if ( MakeCachePath( szDirectory, it->name, path ) && DeleteFileW( path ) )
+            {
+                total -= it->size;
+            }
+        }
+    }
+}
+
+namespace DirectX
+{
+
+//=====================================================================================
+// Entry-points
+//=====================================================================================
+
+//-------------------------------------------------------------------------------------
+// Computes the cache key for a source file's contents and processing parameters
+//-------------------------------------------------------------------------------------
+_Use_decl_annotations_
+HRESULT ComputeTexCacheKey( LPCVOID pSource, size_t size, const TexCacheParams& params, TexCacheKey& key )
+{
+    memset( &key, 0, sizeof(key) );
+
+    if ( ( !pSource && size > 0 ) || ( !params.pExtra && params.extraSize > 0 ) )
+        return E_INVALIDARG;
+
+    uint64_t block[9];
+    Hash128( pSource, size, 0, &block[0] );
+    Hash128( params.pExtra, params.extraSize, 0, &block[2] );
+    block[4] = uint64_t( size );
+    block[5] = uint64_t( params.format );
+    block[6] = uint64_t( params.mipLevels );
+    block[7] = uint64_t( params.filter );
+    block[8] = uint64_t( params.srgb );
+
+    Hash128( block, sizeof(block), CACHE_KEY_VERSION, key.hash );
+
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT ComputeTexCacheKeyFromFile( LPCWSTR szFile, const TexCacheParams& params, TexCacheKey& key )
+{
+    memset( &key, 0, sizeof(key) );
+
+    if ( !szFile )
+        return E_INVALIDARG;
+
+#if (_WIN32_WINNT >= _WIN32_WINNT_WIN8)
+    ScopedHandle hFile( safe_handle( CreateFile2( szFile, GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING, 0 ) ) );
+#else
+    ScopedHandle hFile( safe_handle( CreateFileW( szFile, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING,
+                                                  FILE_FLAG_SEQUENTIAL_SCAN, 0 ) ) );
+#endif
+    if ( !hFile )
+    {
+        return HRESULT_FROM_WIN32( GetLastError() );
+    }
+
+    LARGE_INTEGER fileSize = {0};
+
+#if (_WIN32_WINNT >= _WIN32_WINNT_VISTA)
+    FILE_STANDARD_INFO fileInfo;
+    if ( !GetFileInformationByHandleEx( hFile.get(), FileStandardInfo, &fileInfo, sizeof(fileInfo) ) )
+    {
+        return HRESULT_FROM_WIN32( GetLastError() );
+    }
+    fileSize = fileInfo.EndOfFile;
+#else
+    if ( !GetFileSizeEx( hFile.get(), &fileSize ) )
+    {
+        return HRESULT_FROM_WIN32( GetLastError() );
+    }
+#endif
+
+    if ( fileSize.HighPart > 0 )
+    {
+        return HRESULT_FROM_WIN32( ERROR_FILE_TOO_LARGE );
+    }
+
+    std::unique_ptr<uint8_t[]> data( new (std::nothrow) uint8_t[ fileSize.LowPart + 1 ] );
+    if ( !data )
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    DWORD bytesRead = 0;
+    if ( !ReadFile( hFile.get(), data.get(), fileSize.LowPart, &bytesRead, 0 ) )
+    {
+        return HRESULT_FROM_WIN32( GetLastError() );
+    }
+
+    if ( bytesRead != fileSize.LowPart )
+    {
+        return E_FAIL;
+    }
+
+    return ComputeTexCacheKey( data.get(), bytesRead, params, key );
+}
+
+
+//-------------------------------------------------------------------------------------
+// Load a cached texture, marking it as the most recently used entry
+//-------------------------------------------------------------------------------------
+_Use_decl_annotations_
+HRESULT LoadFromTexCache( LPCWSTR szDirectory, const TexCacheKey& key, TexMetadata* metadata, ScratchImage& image )
+{
+    if ( !szDirectory )
+        return E_INVALIDARG;
+
+    image.Release();
+
+    wchar_t name[MAX_PATH];
+    wchar_t path[MAX_PATH];
+    MakeCacheName( key, L".dds", name );
+    if ( !MakeCachePath( szDirectory, name, path ) )
+        return E_INVALIDARG;
+
+    // shared for delete, so other processes can still evict the entry while it's being read
+#if (_WIN32_WINNT >= _WIN32_WINNT_WIN8)
+    ScopedHandle hFile( safe_handle( CreateFile2( path, GENERIC_READ | FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_DELETE,
+                                                  OPEN_EXISTING, 0 ) ) );
+#else
+    ScopedHandle hFile( safe_handle( CreateFileW( path, GENERIC_READ | FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_DELETE, 0,
+                                                  OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0 ) ) );
+#endif
+    if ( !hFile )
+    {
+        return HRESULT_FROM_WIN32( GetLastError() );
+    }
+
+    LARGE_INTEGER fileSize = {0};
+
+#if (_WIN32_WINNT >= _WIN32_WINNT_VISTA)
+    FILE_STANDARD_INFO fileInfo;
+    if ( !GetFileInformationByHandleEx( hFile.get(), FileStandardInfo, &fileInfo, sizeof(fileInfo) ) )
+    {
+        return HRESULT_FROM_WIN32( GetLastError() );
+    }
+    fileSize = fileInfo.EndOfFile;
+#else
+    if ( !GetFileSizeEx( hFile.get(), &fileSize ) )
+    {
+        return HRESULT_FROM_WIN32( GetLastError() );
+    }
+#endif
+
+    if ( fileSize.HighPart > 0 )
+    {
+        return HRESULT_FROM_WIN32( ERROR_FILE_TOO_LARGE );
+    }
+
+    std::unique_ptr<uint8_t[]> data( new (std::nothrow) uint8_t[ fileSize.LowPart + 1 ] );
+    if ( !data )
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    DWORD bytesRead = 0;
+    if ( !ReadFile( hFile.get(), data.get(), fileSize.LowPart, &bytesRead, 0 ) )
+    {
+        return HRESULT_FROM_WIN32( GetLastError() );
+    }
+
+    HRESULT hr = ( bytesRead == fileSize.LowPart ) ? LoadFromDDSMemory( data.get(), bytesRead, DDS_FLAGS_NONE, metadata, image ) : E_FAIL;
+    if ( FAILED(hr) )
+    {
+        // a damaged entry is dropped, so the caller's result replaces it
+        hFile.reset();
+        (void)DeleteFileW( path );
+        return hr;
+    }
+
+    // least recently used is tracked with the last write time, as last access times are often disabled
+    FILETIME now;
+    GetSystemTimeAsFileTime( &now );
+    (void)SetFileTime( hFile.get(), nullptr, nullptr, &now );
+
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------------------------
+// Save a texture to the cache, then evict old entries beyond the size limit
+//-------------------------------------------------------------------------------------
+_Use_decl_annotations_
+HRESULT SaveToTexCache( LPCWSTR szDirectory, const TexCacheKey& key, const Image* images, size_t nimages, const TexMetadata& metadata,
+                        uint64_t maxBytes )
+{
+    if ( !szDirectory || !images || !nimages )
+        return E_INVALIDARG;
+
+    if ( !CreateDirectoryW( szDirectory, nullptr ) )
+    {
+        DWORD error = GetLastError();
+        if ( error != ERROR_ALREADY_EXISTS )
+            return HRESULT_FROM_WIN32( error );
+    }
+
+    // the extended header keeps the metadata (including alpha mode) intact when loaded back
+    Blob blob;
+    HRESULT hr = SaveToDDSMemory( images, nimages, metadata, DDS_FLAGS_FORCE_DX10_EXT | DDS_FLAGS_FORCE_DX10_EXT_MISC2, blob );
+    if ( FAILED(hr) )
+        return hr;
+
+    if ( blob.GetBufferSize() > UINT32_MAX )
+        return HRESULT_FROM_WIN32( ERROR_FILE_TOO_LARGE );
+
+    wchar_t name[MAX_PATH];
+    wchar_t path[MAX_PATH];
+    MakeCacheName( key, L".dds", name );
+    if ( !MakeCachePath( szDirectory, name, path ) )
+        return E_INVALIDARG;
+
+    // written under a unique name & then renamed, so readers never see a partial entry
+    wchar_t tempName[MAX_PATH];
+    wchar_t tempPath[MAX_PATH];
+    swprintf_s( tempName, L"%ls.%lu.%lu.tmp", name, GetCurrentProcessId(), GetCurrentThreadId() );
+    if ( !MakeCachePath( szDirectory, tempName, tempPath ) )
+        return E_INVALIDARG;
+
+    {
+#if (_WIN32_WINNT >= _WIN32_WINNT_WIN8)
+        ScopedHandle hFile( safe_handle( CreateFile2( tempPath, GENERIC_WRITE, 0, CREATE_ALWAYS, 0 ) ) );
+#else
+        ScopedHandle hFile( safe_handle( CreateFileW( tempPath, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, 0, 0 ) ) );
+#endif
+        if ( !hFile )
+        {
+            return HRESULT_FROM_WIN32( GetLastError() );
+        }
+
+        DWORD bytesWritten = 0;
+        if ( !WriteFile( hFile.get(), blob.GetBufferPointer(), static_cast<DWORD>( blob.GetBufferSize() ), &bytesWritten, 0 ) )
+        {
+            hr = HRESULT_FROM_WIN32( GetLastError() );
+        }
+        else if ( bytesWritten != blob.GetBufferSize() )
+        {
+            hr = E_FAIL;
+        }
+    }
+
+    if ( SUCCEEDED(hr) && !MoveFileExW( tempPath, path, MOVEFILE_REPLACE_EXISTING ) )
+    {
+        hr = HRESULT_FROM_WIN32( GetLastError() );
+    }
+
+    if ( FAILED(hr) )
+    {
+        (void)DeleteFileW( tempPath );
+        return hr;
+    }
+
+    if ( maxBytes > 0 )
+    {
+        TrimCache( szDirectory, maxBytes, name );
+    }
+
+    return S_OK;
+}
+
+}; // namespace
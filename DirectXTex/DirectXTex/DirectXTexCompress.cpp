@@ -15,17 +15,16 @@
 
 #include "directxtexp.h"
 
-#ifdef _OPENMP
-#include <omp.h>
-#pragma warning(disable : 4616 6993)
-#endif
-
 #include "bc.h"
+#include "filters.h"
+#include "parallel.h"
 
 
 namespace DirectX
 {
 
+extern bool _CalculateMipLevels( _In_ size_t width, _In_ size_t height, _Inout_ size_t& mipLevels );
+
 inline static DWORD _GetBCFlags( _In_ DWORD compress )
 {
     static_assert( TEX_COMPRESS_RGB_DITHER == BC_FLAGS_DITHER_RGB, "TEX_COMPRESS_* flags should match BC_FLAGS_*" );
@@ -33,7 +32,10 @@ inline static DWORD _GetBCFlags( _In_ DWORD compress )
     static_assert( TEX_COMPRESS_DITHER == (BC_FLAGS_DITHER_RGB | BC_FLAGS_DITHER_A), "TEX_COMPRESS_* flags should match BC_FLAGS_*"  );
     static_assert( TEX_COMPRESS_UNIFORM == BC_FLAGS_UNIFORM, "TEX_COMPRESS_* flags should match BC_FLAGS_*"  );
     static_assert( TEX_COMPRESS_BC7_USE_3SUBSETS == BC_FLAGS_USE_3SUBSETS, "TEX_COMPRESS_* flags should match BC_FLAGS_*"  );
-    return ( compress & (BC_FLAGS_DITHER_RGB|BC_FLAGS_DITHER_A|BC_FLAGS_UNIFORM|BC_FLAGS_USE_3SUBSETS) );
+    static_assert( TEX_COMPRESS_FAST == BC_FLAGS_FAST, "TEX_COMPRESS_* flags should match BC_FLAGS_*"  );
+    static_assert( TEX_COMPRESS_BC7_QUALITY_MASK == BC_FLAGS_BC7_QUALITY_MASK, "TEX_COMPRESS_* flags should match BC_FLAGS_*"  );
+    static_assert( TEX_COMPRESS_SCALAR == BC_FLAGS_SCALAR, "TEX_COMPRESS_* flags should match BC_FLAGS_*"  );
+    return ( compress & (BC_FLAGS_DITHER_RGB|BC_FLAGS_DITHER_A|BC_FLAGS_UNIFORM|BC_FLAGS_USE_3SUBSETS|BC_FLAGS_FAST|BC_FLAGS_BC7_QUALITY_MASK|BC_FLAGS_SCALAR) );
 }
 
 inline static DWORD _GetSRGBFlags( _In_ DWORD compress )
@@ -44,8 +46,17 @@ inline static DWORD _GetSRGBFlags( _In_ DWORD compress )
     return ( compress & TEX_COMPRESS_SRGB );
 }
 
-inline static bool _DetermineEncoderSettings( _In_ DXGI_FORMAT format, _Out_ BC_ENCODE& pfEncode, _Out_ size_t& blocksize, _Out_ DWORD& cflags )
+inline static size_t _GetThreadCount( _In_ DWORD compress )
+{
+    return ( compress & TEX_COMPRESS_THREADS_MASK );
+}
+
+inline static bool _DetermineEncoderSettings( _In_ DXGI_FORMAT format, _Out_ BC_ENCODE& pfEncode, _Out_ BC_ENCODE_BATCH& pfEncodeBatch,
+                                              _Out_ size_t& blocksize, _Out_ DWORD& cflags )
 {
+    // Formats without a single block encoder are encoded in batches (BC1 through D3DXEncodeBC1Batch)
+    pfEncodeBatch = nullptr;
+
     switch(format)
     {
     case DXGI_FORMAT_BC1_UNORM:
@@ -54,12 +65,12 @@ inline static bool _DetermineEncoderSettings( _In_ DXGI_FORMAT format, _Out_ BC_
     case DXGI_FORMAT_BC2_UNORM_SRGB:    pfEncode = D3DXEncodeBC2;   blocksize = 16;  cflags = 0; break;
     case DXGI_FORMAT_BC3_UNORM:
     case DXGI_FORMAT_BC3_UNORM_SRGB:    pfEncode = D3DXEncodeBC3;   blocksize = 16;  cflags = 0; break;
-    case DXGI_FORMAT_BC4_UNORM:         pfEncode = D3DXEncodeBC4U;  blocksize = 8;   cflags = TEX_FILTER_RGB_COPY_RED; break;
-    case DXGI_FORMAT_BC4_SNORM:         pfEncode = D3DXEncodeBC4S;  blocksize = 8;   cflags = TEX_FILTER_RGB_COPY_RED; break;
-    case DXGI_FORMAT_BC5_UNORM:         pfEncode = D3DXEncodeBC5U;  blocksize = 16;  cflags = TEX_FILTER_RGB_COPY_RED | TEX_FILTER_RGB_COPY_GREEN; break;
-    case DXGI_FORMAT_BC5_SNORM:         pfEncode = D3DXEncodeBC5S;  blocksize = 16;  cflags = TEX_FILTER_RGB_COPY_RED | TEX_FILTER_RGB_COPY_GREEN; break;
-    case DXGI_FORMAT_BC6H_UF16:         pfEncode = D3DXEncodeBC6HU; blocksize = 16;  cflags = 0; break;
-    case DXGI_FORMAT_BC6H_SF16:         pfEncode = D3DXEncodeBC6HS; blocksize = 16;  cflags = 0; break;
+    case DXGI_FORMAT_BC4_UNORM:         pfEncode = nullptr;         pfEncodeBatch = D3DXEncodeBC4UBatch; blocksize = 8;   cflags = TEX_FILTER_RGB_COPY_RED; break;
+    case DXGI_FORMAT_BC4_SNORM:         pfEncode = nullptr;         pfEncodeBatch = D3DXEncodeBC4SBatch; blocksize = 8;   cflags = TEX_FILTER_RGB_COPY_RED; break;
+    case DXGI_FORMAT_BC5_UNORM:         pfEncode = nullptr;         pfEncodeBatch = D3DXEncodeBC5UBatch; blocksize = 16;  cflags = TEX_FILTER_RGB_COPY_RED | TEX_FILTER_RGB_COPY_GREEN; break;
+    case DXGI_FORMAT_BC5_SNORM:         pfEncode = nullptr;         pfEncodeBatch = D3DXEncodeBC5SBatch; blocksize = 16;  cflags = TEX_FILTER_RGB_COPY_RED | TEX_FILTER_RGB_COPY_GREEN; break;
+    case DXGI_FORMAT_BC6H_UF16:         pfEncode = nullptr;         pfEncodeBatch = D3DXEncodeBC6HUBatch; blocksize = 16;  cflags = 0; break;
+    case DXGI_FORMAT_BC6H_SF16:         pfEncode = nullptr;         pfEncodeBatch = D3DXEncodeBC6HSBatch; blocksize = 16;  cflags = 0; break;
     case DXGI_FORMAT_BC7_UNORM:
     case DXGI_FORMAT_BC7_UNORM_SRGB:    pfEncode = D3DXEncodeBC7;   blocksize = 16;  cflags = 0; break;
     default:                            pfEncode = nullptr;         blocksize = 0;   cflags = 0; return false;
@@ -70,133 +81,95 @@ inline static bool _DetermineEncoderSettings( _In_ DXGI_FORMAT format, _Out_ BC_
 
 
 //-------------------------------------------------------------------------------------
-static HRESULT _CompressBC( _In_ const Image& image, _In_ const Image& result, _In_ DWORD bcflags,
-                            _In_ DWORD srgb, _In_ float alphaRef )
+// Direct mapped cache of recently encoded blocks, keyed by a hash of their texels.
+// Repeats (flat areas, tiled or padded atlas entries) are copied instead of encoded
+// again. A hit compares all of the texels, and the encoders give the same bytes for
+// the same texels, so the output doesn't change.
+//-------------------------------------------------------------------------------------
+class _BlockCache
 {
-    if ( !image.pixels || !result.pixels )
-        return E_POINTER;
-
-    assert( image.width == result.width );
-    assert( image.height == result.height );
-
-    const DXGI_FORMAT format = image.format;
-    size_t sbpp = BitsPerPixel( format );
-    if ( !sbpp )
-        return E_FAIL;
-
-    if ( sbpp < 8 )
+public:
+    _BlockCache()
     {
-        // We don't support compressing from monochrome (DXGI_FORMAT_R1_UNORM)
-        return HRESULT_FROM_WIN32( ERROR_NOT_SUPPORTED );
+        for( size_t i = 0; i < ENTRIES; ++i )
+            m_entries[ i ].valid = false;
     }
 
-    // Round to bytes
-    sbpp = ( sbpp + 7 ) / 8;
-
-    uint8_t *pDest = result.pixels;
-
-    // Determine BC format encoder
-    BC_ENCODE pfEncode;
-    size_t blocksize;
-    DWORD cflags;
-    if ( !_DetermineEncoderSettings( result.format, pfEncode, blocksize, cflags ) )
-        return HRESULT_FROM_WIN32( ERROR_NOT_SUPPORTED );
-
-    XMVECTOR temp[16];
-    const uint8_t *pSrc = image.pixels;
-    const uint8_t *pEnd = image.pixels + image.slicePitch;
-    const size_t rowPitch = image.rowPitch;
-    for( size_t h=0; h < image.height; h += 4 )
+    static uint32_t Hash( _In_reads_(NUM_PIXELS_PER_BLOCK) const XMVECTOR* block )
     {
-        const uint8_t *sptr = pSrc;
-        uint8_t* dptr = pDest;
-        size_t ph = std::min<size_t>( 4, image.height - h );
-        size_t w = 0;
-        for( size_t count = 0; (count < result.rowPitch) && (w < image.width); count += blocksize, w += 4 )
+        // Four FNV-1a lanes so the multiplies overlap, then a final mix for the low bits
+        const uint32_t* words = reinterpret_cast<const uint32_t*>( block );
+        uint32_t h0 = 2166136261u, h1 = h0, h2 = h0, h3 = h0;
+        for( size_t i = 0; i < NUM_PIXELS_PER_BLOCK * 4; i += 4 )
         {
-            size_t pw = std::min<size_t>( 4, image.width - w );
-            assert( pw > 0 && ph > 0 );
-
-            ptrdiff_t bytesLeft = pEnd - sptr;
-            assert( bytesLeft > 0 );
-            size_t bytesToRead = std::min<size_t>( rowPitch, bytesLeft );
-            if ( !_LoadScanline( &temp[0], pw, sptr, bytesToRead, format ) )
-                return E_FAIL;
-
-            if ( ph > 1 )
-            {
-                bytesToRead = std::min<size_t>( rowPitch, bytesLeft - rowPitch );
-                if ( !_LoadScanline( &temp[4], pw, sptr + rowPitch, bytesToRead, format ) )
-                    return E_FAIL;
-
-                if ( ph > 2 )
-                {
-                    bytesToRead = std::min<size_t>( rowPitch, bytesLeft - rowPitch * 2 );
-                    if ( !_LoadScanline( &temp[8], pw, sptr + rowPitch*2, bytesToRead, format ) )
-                        return E_FAIL;
+            h0 = ( h0 ^ words[ i ] ) * 16777619u;
+            h1 = ( h1 ^ words[ i + 1 ] ) * 16777619u;
+            h2 = ( h2 ^ words[ i + 2 ] ) * 16777619u;
+            h3 = ( h3 ^ words[ i + 3 ] ) * 16777619u;
+        }
 
-                    if ( ph > 3 )
-                    {
-                        bytesToRead = std::min<size_t>( rowPitch, bytesLeft - rowPitch * 3 );
-                        if ( !_LoadScanline( &temp[12], pw, sptr + rowPitch*3, bytesToRead, format ) )
-                            return E_FAIL;
-                    }
-                }
-            }
+        uint32_t h = h0 ^ _rotl( h1, 8 ) ^ _rotl( h2, 16 ) ^ _rotl( h3, 24 );
+        h ^= h >> 16;
+        h *= 0x85ebca6b;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35;
+        h ^= h >> 16;
+        return h;
+    }
 
-            if ( pw != 4 || ph != 4 )
-            {
-                // Replicate pixels for partial block
-                static const size_t uSrc[] = { 0, 0, 0, 1 };
+    const uint8_t* Find( _In_ uint32_t hash, _In_reads_(NUM_PIXELS_PER_BLOCK) const XMVECTOR* block ) const
+    {
+        const Entry& entry = m_entries[ hash & ( ENTRIES - 1 ) ];
+        if ( !entry.valid || entry.hash != hash || memcmp( entry.texels, block, sizeof(entry.texels) ) != 0 )
+            return nullptr;
 
-                if ( pw < 4 )
-                {
-                    for( size_t t = 0; t < ph && t < 4; ++t )
-                    {
-                        for( size_t s = pw; s < 4; ++s )
-                        {
-#pragma prefast(suppress: 26000, "PREFAST false positive")
-                            temp[ (t << 2) | s ] = temp[ (t << 2) | uSrc[s] ]; 
-                        }
-                    }
-                }
+        return entry.bc;
+    }
 
-                if ( ph < 4 )
-                {
-                    for( size_t t = ph; t < 4; ++t )
-                    {
-                        for( size_t s = 0; s < 4; ++s )
-                        {
-#pragma prefast(suppress: 26000, "PREFAST false positive")
-                            temp[ (t << 2) | s ] = temp[ (uSrc[t] << 2) | s ]; 
-                        }
-                    }
-                }
-            }
+    void Insert( _In_ uint32_t hash, _In_reads_(NUM_PIXELS_PER_BLOCK) const XMVECTOR* block,
+                 _In_reads_bytes_(blocksize) const uint8_t* pBC, _In_ size_t blocksize )
+    {
+        Entry& entry = m_entries[ hash & ( ENTRIES - 1 ) ];
+        assert( blocksize <= sizeof(entry.bc) );
 
-            _ConvertScanline( temp, 16, result.format, format, cflags | srgb );
-            
-            if ( pfEncode )
-                pfEncode( dptr, temp, bcflags );
-            else
-                D3DXEncodeBC1( dptr, temp, alphaRef, bcflags );
+        entry.valid = true;
+        entry.hash = hash;
+        memcpy( entry.texels, block, sizeof(entry.texels) );
+        memcpy( entry.bc, pBC, blocksize );
+    }
 
-            sptr += sbpp*4;
-            dptr += blocksize;
-        }
+private:
+    static const size_t ENTRIES = 256;
 
-        pSrc += rowPitch*4;
-        pDest += result.rowPitch;
-    }
+    struct Entry
+    {
+        uint8_t     texels[ sizeof(XMVECTOR) * NUM_PIXELS_PER_BLOCK ];
+        uint8_t     bc[ 16 ];
+        uint32_t    hash;
+        bool        valid;
+    };
 
-    return S_OK;
-}
+    Entry m_entries[ ENTRIES ];
+};
 
 
 //-------------------------------------------------------------------------------------
-#ifdef _OPENMP
-static HRESULT _CompressBC_Parallel( _In_ const Image& image, _In_ const Image& result, _In_ DWORD bcflags,
-                                     _In_ DWORD srgb, _In_ float alphaRef )
+struct _CompressBCImage
+{
+    const Image*    src;
+    const Image*    dest;
+    size_t          sbpp;
+    BC_ENCODE       pfEncode;
+    BC_ENCODE_BATCH pfEncodeBatch;
+    size_t          blocksize;
+    DWORD           cflags;
+    BC_OPTIMIZE     pfOptimize;
+    float           rdoLambda;
+    float           rdoMaxError;
+};
+
+static HRESULT _SetupCompressBC( _In_ const Image& image, _In_ const Image& result, _In_ float rdoLambda, _In_ float rdoMaxError,
+                                 _Out_ _CompressBCImage& job )
 {
     if ( !image.pixels || !result.pixels )
         return E_POINTER;
@@ -204,8 +177,7 @@ static HRESULT _CompressBC_Parallel( _In_ const Image& image, _In_ const Image&
     assert( image.width == result.width );
     assert( image.height == result.height );
 
-    const DXGI_FORMAT format = image.format;
-    size_t sbpp = BitsPerPixel( format );
+    size_t sbpp = BitsPerPixel( image.format );
     if ( !sbpp )
         return E_FAIL;
 
@@ -215,69 +187,141 @@ static HRESULT _CompressBC_Parallel( _In_ const Image& image, _In_ const Image&
         return HRESULT_FROM_WIN32( ERROR_NOT_SUPPORTED );
     }
 
+    // Determine BC format encoder
+    if ( !_DetermineEncoderSettings( result.format, job.pfEncode, job.pfEncodeBatch, job.blocksize, job.cflags ) )
+        return HRESULT_FROM_WIN32( ERROR_NOT_SUPPORTED );
+
+    job.src = &image;
+    job.dest = &result;
+
     // Round to bytes
-    sbpp = ( sbpp + 7 ) / 8;
+    job.sbpp = ( sbpp + 7 ) / 8;
 
-    const uint8_t *pEnd = image.pixels + image.slicePitch;
+    // Rate-distortion optimization, for the formats that have it
+    job.pfOptimize = nullptr;
+    job.rdoLambda = rdoLambda;
+    job.rdoMaxError = rdoMaxError;
 
-    // Determine BC format encoder
-    BC_ENCODE pfEncode;
-    size_t blocksize;
-    DWORD cflags;
-    if ( !_DetermineEncoderSettings( result.format, pfEncode, blocksize, cflags ) )
-        return HRESULT_FROM_WIN32( ERROR_NOT_SUPPORTED );
+    if ( rdoLambda > 0.f )
+    {
+        switch( result.format )
+        {
+        case DXGI_FORMAT_BC1_UNORM:
+        case DXGI_FORMAT_BC1_UNORM_SRGB:    job.pfOptimize = D3DXOptimizeBC1; break;
+        case DXGI_FORMAT_BC3_UNORM:
+        case DXGI_FORMAT_BC3_UNORM_SRGB:    job.pfOptimize = D3DXOptimizeBC3; break;
+        case DXGI_FORMAT_BC7_UNORM:
+        case DXGI_FORMAT_BC7_UNORM_SRGB:    job.pfOptimize = D3DXOptimizeBC7; break;
+        default:                            break;
+        }
+    }
+
+    return S_OK;
+}
 
-    // Refactored version of loop to support parallel independance
-    const size_t nBlocks = std::max<size_t>(1, (image.width + 3) / 4 ) * std::max<size_t>(1, (image.height + 3) / 4 );
 
-    bool fail = false;
+//-------------------------------------------------------------------------------------
+// Rate-distortion optimizes an encoded block against the blocks before it in its row,
+// which keeps each row the same whatever thread encodes it
+//-------------------------------------------------------------------------------------
+static void _OptimizeBCBlock( _In_ const _CompressBCImage& job, _In_ const uint8_t* pRow, _Inout_ uint8_t* pBC,
+                              _In_reads_(NUM_PIXELS_PER_BLOCK) const XMVECTOR* block )
+{
+    assert( job.pfOptimize && pRow <= pBC );
+
+    const size_t nWindow = std::min<size_t>( BC_RDO_WINDOW, size_t( pBC - pRow ) / job.blocksize );
+    job.pfOptimize( pBC, pBC - nWindow * job.blocksize, nWindow, block, job.rdoLambda, job.rdoMaxError );
+}
 
-#pragma omp parallel for
-    for( int nb=0; nb < static_cast<int>( nBlocks ); ++nb )
+
+//-------------------------------------------------------------------------------------
+static void _EncodeBCBatch( _In_ const _CompressBCImage& job, _In_ const uint8_t* pRow,
+                            _Out_writes_(nBlocks * job.blocksize) uint8_t* pBC, _In_ size_t nBlocks,
+                            _In_reads_(nBlocks * NUM_PIXELS_PER_BLOCK) const XMVECTOR* pColor,
+                            _In_reads_(nBlocks) const uint32_t* pHashes, _In_ float alphaRef, _In_ DWORD bcflags,
+                            _Inout_opt_ _BlockCache* cache )
+{
+    const size_t blocksize = job.blocksize;
+
+    if ( job.pfEncodeBatch )
+        job.pfEncodeBatch( pBC, nBlocks, pColor, bcflags );
+    else
+        D3DXEncodeBC1Batch( pBC, nBlocks, pColor, alphaRef, bcflags );
+
+    // The cache keeps the blocks as encoded, before any optimization
+    if ( cache )
     {
-        int nbWidth = std::max<int>(1, int( (image.width + 3) / 4 ) );
+        for( size_t i = 0; i < nBlocks; ++i )
+            cache->Insert( pHashes[ i ], &pColor[ i * NUM_PIXELS_PER_BLOCK ], pBC + i * blocksize, blocksize );
+    }
+
+    if ( job.pfOptimize )
+    {
+        for( size_t i = 0; i < nBlocks; ++i )
+            _OptimizeBCBlock( job, pRow, pBC + i * blocksize, &pColor[ i * NUM_PIXELS_PER_BLOCK ] );
+    }
+}
 
-        int y = nb / nbWidth;
-        int x = ( nb - (y*nbWidth) ) * 4;
-        y *= 4;
 
-        assert( (x >= 0) && (x < int(image.width)) );
-        assert( (y >= 0) && (y < int(image.height)) );
+//-------------------------------------------------------------------------------------
+// Compresses the row of blocks starting at pixel row h
+//-------------------------------------------------------------------------------------
+static bool _CompressBCRow( _In_ const _CompressBCImage& job, _In_ size_t h, _In_ DWORD bcflags,
+                            _In_ DWORD srgb, _In_ float alphaRef, _Inout_opt_ _BlockCache* cache )
+{
+    const Image& image = *job.src;
+    const Image& result = *job.dest;
+    const DXGI_FORMAT format = image.format;
+    const BC_ENCODE pfEncode = job.pfEncode;
+    const size_t blocksize = job.blocksize;
 
-        size_t rowPitch = image.rowPitch;
-        const uint8_t *pSrc = image.pixels + (y*rowPitch) + (x*sbpp);
+    assert( h < image.height );
 
-        uint8_t *pDest = result.pixels + (nb*blocksize);
+    XMVECTOR temp[NUM_PIXELS_PER_BLOCK * BC_BATCH_BLOCKS];
+    const uint8_t *pEnd = image.pixels + image.slicePitch;
+    const size_t rowPitch = image.rowPitch;
 
-        size_t ph = std::min<size_t>( 4, image.height - y );
-        size_t pw = std::min<size_t>( 4, image.width - x );
+    const uint8_t *sptr = image.pixels + ( h * rowPitch );
+    uint8_t* dptr = result.pixels + ( h / 4 ) * result.rowPitch;
+    const uint8_t* pRow = dptr;
+    size_t ph = std::min<size_t>( 4, image.height - h );
+    size_t w = 0;
+
+    // BC1, BC4 & BC5 blocks along the row are gathered & encoded in batches
+    uint8_t* pBatch = dptr;
+    size_t nBatch = 0;
+    uint32_t hashes[BC_BATCH_BLOCKS];
+
+    for( size_t count = 0; (count < result.rowPitch) && (w < image.width); count += blocksize, w += 4 )
+    {
+        size_t pw = std::min<size_t>( 4, image.width - w );
         assert( pw > 0 && ph > 0 );
 
-        ptrdiff_t bytesLeft = pEnd - pSrc;
+        XMVECTOR* block = ( pfEncode ) ? temp : &temp[ nBatch * NUM_PIXELS_PER_BLOCK ];
+
+        ptrdiff_t bytesLeft = pEnd - sptr;
         assert( bytesLeft > 0 );
         size_t bytesToRead = std::min<size_t>( rowPitch, bytesLeft );
-
-        XMVECTOR temp[16];
-        if ( !_LoadScanline( &temp[0], pw, pSrc, bytesToRead, format ) )
-            fail = true;
+        if ( !_LoadScanline( &block[0], pw, sptr, bytesToRead, format ) )
+            return false;
 
         if ( ph > 1 )
         {
             bytesToRead = std::min<size_t>( rowPitch, bytesLeft - rowPitch );
-            if ( !_LoadScanline( &temp[4], pw, pSrc + rowPitch, bytesToRead, format ) )
-                fail = true;
+            if ( !_LoadScanline( &block[4], pw, sptr + rowPitch, bytesToRead, format ) )
+                return false;
 
             if ( ph > 2 )
             {
                 bytesToRead = std::min<size_t>( rowPitch, bytesLeft - rowPitch * 2 );
-                if ( !_LoadScanline( &temp[8], pw, pSrc + rowPitch*2, bytesToRead, format ) )
-                    fail = true;
+                if ( !_LoadScanline( &block[8], pw, sptr + rowPitch*2, bytesToRead, format ) )
+                    return false;
 
                 if ( ph > 3 )
                 {
                     bytesToRead = std::min<size_t>( rowPitch, bytesLeft - rowPitch * 3 );
-                    if ( !_LoadScanline( &temp[12], pw, pSrc + rowPitch*3, bytesToRead, format ) )
-                        fail = true;
+                    if ( !_LoadScanline( &block[12], pw, sptr + rowPitch*3, bytesToRead, format ) )
+                        return false;
                 }
             }
         }
@@ -293,7 +337,8 @@ static HRESULT _CompressBC_Parallel( _In_ const Image& image, _In_ const Image&
                 {
                     for( size_t s = pw; s < 4; ++s )
                     {
-                        temp[ (t << 2) | s ] = temp[ (t << 2) | uSrc[s] ]; 
+#pragma prefast(suppress: 26000, "PREFAST false positive")
+                        block[ (t << 2) | s ] = block[ (t << 2) | uSrc[s] ]; 
                     }
                 }
             }
@@ -304,24 +349,446 @@ static HRESULT _CompressBC_Parallel( _In_ const Image& image, _In_ const Image&
                 {
                     for( size_t s = 0; s < 4; ++s )
                     {
-                        temp[ (t << 2) | s ] = temp[ (uSrc[t] << 2) | s ]; 
+#pragma prefast(suppress: 26000, "PREFAST false positive")
+                        block[ (t << 2) | s ] = block[ (uSrc[t] << 2) | s ]; 
                     }
                 }
             }
         }
 
-        _ConvertScanline( temp, 16, result.format, format, cflags | srgb );
-            
-        if ( pfEncode )
-            pfEncode( pDest, temp, bcflags );
+        _ConvertScanline( block, 16, result.format, format, job.cflags | srgb );
+
+        const uint32_t hash = ( cache ) ? _BlockCache::Hash( block ) : 0;
+        const uint8_t* pCached = ( cache ) ? cache->Find( hash, block ) : nullptr;
+
+        if ( pCached )
+        {
+            memcpy( dptr, pCached, blocksize );
+
+            // The copy breaks up the batch, so what's gathered so far is encoded now.
+            // This goes after the copy, as it can replace the cache entry that was hit.
+            if ( nBatch > 0 )
+            {
+                _EncodeBCBatch( job, pRow, pBatch, nBatch, temp, hashes, alphaRef, bcflags, cache );
+                nBatch = 0;
+            }
+
+            pBatch = dptr + blocksize;
+
+            if ( job.pfOptimize )
+                _OptimizeBCBlock( job, pRow, dptr, block );
+        }
+        else if ( pfEncode )
+        {
+            pfEncode( dptr, block, bcflags );
+
+            if ( cache )
+                cache->Insert( hash, block, dptr, blocksize );
+
+            if ( job.pfOptimize )
+                _OptimizeBCBlock( job, pRow, dptr, block );
+        }
         else
-            D3DXEncodeBC1( pDest, temp, alphaRef, bcflags );
+        {
+            hashes[ nBatch ] = hash;
+            if ( ++nBatch == BC_BATCH_BLOCKS )
+            {
+                _EncodeBCBatch( job, pRow, pBatch, nBatch, temp, hashes, alphaRef, bcflags, cache );
+                pBatch = dptr + blocksize;
+                nBatch = 0;
+            }
+        }
+
+        sptr += job.sbpp*4;
+        dptr += blocksize;
+    }
+
+    if ( nBatch > 0 )
+        _EncodeBCBatch( job, pRow, pBatch, nBatch, temp, hashes, alphaRef, bcflags, cache );
+
+    return true;
+}
+
+
+//-------------------------------------------------------------------------------------
+static HRESULT _CompressBC( _In_ const Image& image, _In_ const Image& result, _In_ DWORD bcflags,
+                            _In_ DWORD srgb, _In_ float alphaRef, _In_ float rdoLambda, _In_ float rdoMaxError )
+{
+    _CompressBCImage job;
+    HRESULT hr = _SetupCompressBC( image, result, rdoLambda, rdoMaxError, job );
+    if ( FAILED(hr) )
+        return hr;
+
+    // Without the memory for a cache every block is just encoded
+    std::unique_ptr<_BlockCache> cache( new (std::nothrow) _BlockCache );
+
+    for( size_t h=0; h < image.height; h += 4 )
+    {
+        if ( !_CompressBCRow( job, h, bcflags, srgb, alphaRef, cache.get() ) )
+            return E_FAIL;
+    }
+
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------------------------
+// Compresses every row of blocks of every image on the thread pool at once, so the
+// small mip levels & array slices share the threads with the big ones. Each thread
+// has its own block cache, and each row is encoded exactly as _CompressBC would,
+// whatever the number of threads.
+//-------------------------------------------------------------------------------------
+static HRESULT _CompressBC_Parallel( _In_reads_(nimages) const Image* srcImages, _In_reads_(nimages) const Image* destImages,
+                                     _In_ size_t nimages, _In_ DWORD compress, _In_ float alphaRef,
+                                     _In_ float rdoLambda, _In_ float rdoMaxError )
+{
+    std::vector<_CompressBCImage> jobs( nimages );
+    std::vector<std::pair<uint32_t, uint32_t>> rows;
+    for( size_t index = 0; index < nimages; ++index )
+    {
+        HRESULT hr = _SetupCompressBC( srcImages[ index ], destImages[ index ], rdoLambda, rdoMaxError, jobs[ index ] );
+        if ( FAILED(hr) )
+            return hr;
+
+        for( size_t h = 0; h < srcImages[ index ].height; h += 4 )
+            rows.push_back( std::make_pair( static_cast<uint32_t>( index ), static_cast<uint32_t>( h ) ) );
     }
 
+    const DWORD bcflags = _GetBCFlags( compress );
+    const DWORD srgb = _GetSRGBFlags( compress );
+
+    const size_t nthreads = _GetThreadCount( compress );
+    std::vector<std::unique_ptr<_BlockCache>> caches( _ParallelThreadCount( nthreads, rows.size() ) );
+
+    std::atomic<bool> fail( false );
+
+    _ParallelFor( nthreads, rows.size(), [&]( size_t task, size_t thread )
+    {
+        if ( !caches[ thread ] )
+            caches[ thread ].reset( new (std::nothrow) _BlockCache );
+
+        if ( !_CompressBCRow( jobs[ rows[ task ].first ], rows[ task ].second, bcflags, srgb, alphaRef, caches[ thread ].get() ) )
+            fail = true;
+    } );
+
     return (fail) ? E_FAIL : S_OK;
 }
 
-#endif // _OPENMP
+
+//-------------------------------------------------------------------------------------
+// Streaming mip generation & compression. Each row of a level is box filtered into the
+// next level as soon as its pair is in, and each row of blocks is compressed as soon
+// as its 4 rows are in, so the levels below the first only keep 4 rows each. Those are
+// stored in the source format, as GenerateMipMaps stores its levels, so the result is
+// the same as GenerateMipMaps with the box filter followed by Compress.
+//-------------------------------------------------------------------------------------
+struct _MipStreamLevel
+{
+    size_t      width;
+    size_t      height;
+    size_t      rowPitch;
+    uint8_t*    rows;
+};
+
+struct _MipStream
+{
+    const Image*                    src;        // image of level first
+    const Image*                    dest;       // compressed images, by level
+    const Image*                    tail;       // gets the rows of level last + 1, if not null
+    size_t                          first;
+    size_t                          last;
+    DWORD                           filter;
+    DWORD                           bcflags;
+    DWORD                           srgb;
+    float                           alphaRef;
+    _CompressBCImage                job;        // for level first
+    std::vector<_MipStreamLevel>    levels;
+    std::unique_ptr<uint8_t[]>      buffer;
+    ScopedAlignedArrayXMVECTOR      scanline;
+    std::unique_ptr<_BlockCache>    cache;
+};
+
+static HRESULT _SetupMipStream( _In_ const Image& src, _In_ const Image* dest, _In_ size_t first, _In_ size_t last,
+                                _In_opt_ const Image* tail, _In_ DWORD filter, _In_ DWORD compress, _In_ float alphaRef,
+                                _In_ float rdoLambda, _In_ float rdoMaxError, _Out_ _MipStream& stream )
+{
+    assert( first <= last );
+
+    HRESULT hr = _SetupCompressBC( src, dest[ first ], rdoLambda, rdoMaxError, stream.job );
+    if ( FAILED(hr) )
+        return hr;
+
+    stream.src = &src;
+    stream.dest = dest;
+    stream.tail = tail;
+    stream.first = first;
+    stream.last = last;
+    stream.filter = filter;
+    stream.bcflags = _GetBCFlags( compress );
+    stream.srgb = _GetSRGBFlags( compress );
+    stream.alphaRef = alphaRef;
+
+    stream.levels.resize( last - first + 1 );
+
+    size_t width = src.width;
+    size_t height = src.height;
+    size_t bytes = 0;
+    for( size_t level = first; level <= last; ++level )
+    {
+        _MipStreamLevel& lvl = stream.levels[ level - first ];
+        lvl.width = width;
+        lvl.height = height;
+
+        size_t slicePitch;
+        ComputePitch( src.format, width, height, lvl.rowPitch, slicePitch, CP_FLAGS_NONE );
+
+        if ( level > first )
+            bytes += lvl.rowPitch * 4;
+
+        if ( height > 1 )
+            height >>= 1;
+
+        if ( width > 1 )
+            width >>= 1;
+    }
+
+    if ( bytes > 0 )
+    {
+        stream.buffer.reset( new (std::nothrow) uint8_t[ bytes ] );
+        if ( !stream.buffer )
+            return E_OUTOFMEMORY;
+    }
+
+    uint8_t* rows = stream.buffer.get();
+    for( size_t level = first + 1; level <= last; ++level )
+    {
+        _MipStreamLevel& lvl = stream.levels[ level - first ];
+        lvl.rows = rows;
+        rows += lvl.rowPitch * 4;
+    }
+    stream.levels[ 0 ].rows = nullptr;
+
+    // Two source rows & the filtered row
+    stream.scanline.reset( reinterpret_cast<XMVECTOR*>( _aligned_malloc( (sizeof(XMVECTOR)*src.width*3), 16 ) ) );
+    if ( !stream.scanline )
+        return E_OUTOFMEMORY;
+
+    // Without the memory for a cache every block is just encoded
+    stream.cache.reset( new (std::nothrow) _BlockCache );
+
+    return S_OK;
+}
+
+static const uint8_t* _MipStreamRow( _In_ const _MipStream& stream, _In_ size_t level, _In_ size_t y )
+{
+    if ( level == stream.first )
+        return stream.src->pixels + y * stream.src->rowPitch;
+
+    const _MipStreamLevel& lvl = stream.levels[ level - stream.first ];
+    return lvl.rows + ( y & 3 ) * lvl.rowPitch;
+}
+
+//-------------------------------------------------------------------------------------
+// Takes row y of a level, which must come after rows 0 to y-1 of its row of blocks
+//-------------------------------------------------------------------------------------
+static bool _MipStreamPush( _Inout_ _MipStream& stream, _In_ size_t level, _In_ size_t y )
+{
+    const _MipStreamLevel& lvl = stream.levels[ level - stream.first ];
+    const DXGI_FORMAT format = stream.src->format;
+
+    assert( y < lvl.height );
+
+    // Compress the row of blocks once its last row is in
+    if ( ( y & 3 ) == 3 || y + 1 == lvl.height )
+    {
+        const size_t h = y & ~size_t(3);
+
+        if ( level == stream.first )
+        {
+            if ( !_CompressBCRow( stream.job, h, stream.bcflags, stream.srgb, stream.alphaRef, stream.cache.get() ) )
+                return false;
+        }
+        else
+        {
+            const Image& dest = stream.dest[ level ];
+            const size_t ph = y + 1 - h;
+
+            const Image src = { lvl.width, ph, format, lvl.rowPitch, lvl.rowPitch * ph, lvl.rows };
+            const Image result = { lvl.width, ph, dest.format, dest.rowPitch, dest.rowPitch,
+                                   dest.pixels + ( h >> 2 ) * dest.rowPitch };
+
+            _CompressBCImage job;
+            if ( FAILED( _SetupCompressBC( src, result, stream.job.rdoLambda, stream.job.rdoMaxError, job ) ) )
+                return false;
+
+            if ( !_CompressBCRow( job, 0, stream.bcflags, stream.srgb, stream.alphaRef, stream.cache.get() ) )
+                return false;
+        }
+    }
+
+    // Box filter each pair of rows (or the one row) into the next level
+    if ( level == stream.last && !stream.tail )
+        return true;
+
+    if ( !( y & 1 ) && lvl.height > 1 )
+        return true;
+
+    XMVECTOR* target = stream.scanline.get();
+    XMVECTOR* urow0 = target + stream.src->width;
+    XMVECTOR* urow1 = target + stream.src->width*2;
+
+    if ( lvl.height > 1 )
+    {
+        if ( !_LoadScanlineLinear( urow0, lvl.width, _MipStreamRow( stream, level, y - 1 ), lvl.rowPitch, format, stream.filter ) )
+            return false;
+
+        if ( !_LoadScanlineLinear( urow1, lvl.width, _MipStreamRow( stream, level, y ), lvl.rowPitch, format, stream.filter ) )
+            return false;
+    }
+    else
+    {
+        if ( !_LoadScanlineLinear( urow0, lvl.width, _MipStreamRow( stream, level, y ), lvl.rowPitch, format, stream.filter ) )
+            return false;
+
+        urow1 = urow0;
+    }
+
+    const XMVECTOR* urow2 = ( lvl.width > 1 ) ? urow0 + 1 : urow0;
+    const XMVECTOR* urow3 = ( lvl.width > 1 ) ? urow1 + 1 : urow1;
+
+    const size_t nwidth = ( lvl.width > 1 ) ? ( lvl.width >> 1 ) : 1;
+    for( size_t x = 0; x < nwidth; ++x )
+    {
+        size_t x2 = x << 1;
+
+        AVERAGE4( target[ x ], urow0[ x2 ], urow1[ x2 ], urow2[ x2 ], urow3[ x2 ] );
+    }
+
+    const size_t ny = y >> 1;
+
+    if ( level == stream.last )
+    {
+        const Image& tail = *stream.tail;
+        return _StoreScanlineLinear( tail.pixels + ny * tail.rowPitch, tail.rowPitch, format, target, nwidth, stream.filter );
+    }
+
+    const _MipStreamLevel& next = stream.levels[ level + 1 - stream.first ];
+    if ( !_StoreScanlineLinear( next.rows + ( ny & 3 ) * next.rowPitch, next.rowPitch, format, target, nwidth, stream.filter ) )
+        return false;
+
+    return _MipStreamPush( stream, level + 1, ny );
+}
+
+//-------------------------------------------------------------------------------------
+// Streams the whole base image through every level on this thread
+//-------------------------------------------------------------------------------------
+static HRESULT _GenerateCompressedMips( _In_ const Image& baseImage, _In_reads_(levels) const Image* dest, _In_ size_t levels,
+                                        _In_ DWORD filter, _In_ DWORD compress, _In_ float alphaRef,
+                                        _In_ float rdoLambda, _In_ float rdoMaxError )
+{
+    _MipStream stream;
+    HRESULT hr = _SetupMipStream( baseImage, dest, 0, levels - 1, nullptr, filter, compress, alphaRef, rdoLambda, rdoMaxError, stream );
+    if ( FAILED(hr) )
+        return hr;
+
+    for( size_t y = 0; y < baseImage.height; ++y )
+    {
+        if ( !_MipStreamPush( stream, 0, y ) )
+            return E_FAIL;
+    }
+
+    return S_OK;
+}
+
+//-------------------------------------------------------------------------------------
+// Splits the base image into bands of rows that make whole rows of blocks down to some
+// level, and streams the bands on the thread pool. The rows they filter into the level
+// after that are gathered in a small image, which is then streamed through the rest of
+// the levels. The bands don't share any rows, so the result is the same as
+// _GenerateCompressedMips gives, whatever the number of threads.
+//-------------------------------------------------------------------------------------
+static HRESULT _GenerateCompressedMips_Parallel( _In_ const Image& baseImage, _In_reads_(levels) const Image* dest, _In_ size_t levels,
+                                                 _In_ DWORD filter, _In_ DWORD compress, _In_ float alphaRef,
+                                                 _In_ float rdoLambda, _In_ float rdoMaxError )
+{
+    const size_t nthreads = _ParallelThreadCount( _GetThreadCount( compress ), baseImage.height / 4 );
+
+    // Bands of 4 << split rows, with a few per thread, that still give whole rows of blocks in level split
+    size_t split = 0;
+    while ( split + 1 < levels && ( baseImage.height >> ( split + 1 ) ) >= nthreads * 16 )
+        ++split;
+
+    const size_t band = size_t(4) << split;
+    const size_t nbands = baseImage.height / band;
+
+    if ( nthreads <= 1 || nbands <= 1 )
+        return _GenerateCompressedMips( baseImage, dest, levels, filter, compress, alphaRef, rdoLambda, rdoMaxError );
+
+    ScratchImage tail;
+    const Image* timg = nullptr;
+    if ( split + 1 < levels )
+    {
+        HRESULT hr = tail.Initialize2D( baseImage.format, std::max<size_t>( 1, baseImage.width >> ( split + 1 ) ),
+                                        baseImage.height >> ( split + 1 ), 1, 1 );
+        if ( FAILED(hr) )
+            return hr;
+
+        timg = tail.GetImage( 0, 0, 0 );
+        if ( !timg )
+            return E_POINTER;
+    }
+
+    std::vector<std::unique_ptr<_MipStream>> streams( _ParallelThreadCount( nthreads, nbands ) );
+
+    std::atomic<bool> fail( false );
+
+    _ParallelFor( nthreads, nbands, [&]( size_t task, size_t thread )
+    {
+        if ( fail )
+            return;
+
+        auto& stream = streams[ thread ];
+        if ( !stream )
+        {
+            stream.reset( new (std::nothrow) _MipStream );
+            if ( !stream
+                 || FAILED( _SetupMipStream( baseImage, dest, 0, split, timg, filter, compress, alphaRef, rdoLambda, rdoMaxError, *stream ) ) )
+            {
+                stream.reset();
+                fail = true;
+                return;
+            }
+        }
+
+        for( size_t y = task * band; y < ( task + 1 ) * band; ++y )
+        {
+            if ( !_MipStreamPush( *stream, 0, y ) )
+            {
+                fail = true;
+                return;
+            }
+        }
+    } );
+
+    if ( fail )
+        return E_FAIL;
+
+    if ( !timg )
+        return S_OK;
+
+    _MipStream stream;
+    HRESULT hr = _SetupMipStream( *timg, dest, split + 1, levels - 1, nullptr, filter, compress, alphaRef, rdoLambda, rdoMaxError, stream );
+    if ( FAILED(hr) )
+        return hr;
+
+    for( size_t y = 0; y < timg->height; ++y )
+    {
+        if ( !_MipStreamPush( stream, split + 1, y ) )
+            return E_FAIL;
+    }
+
+    return S_OK;
+}
 
 
 //-------------------------------------------------------------------------------------
@@ -373,7 +840,40 @@ static DXGI_FORMAT _DefaultDecompress( _In_ DXGI_FORMAT format )
 
 
 //-------------------------------------------------------------------------------------
-static HRESULT _DecompressBC( _In_ const Image& cImage, _In_ const Image& result )
+// Row decoder that writes the destination format directly, or null when the texels
+// need converting
+static BC_DECODE_ROW _DirectDecompress( _In_ DXGI_FORMAT cformat, _In_ DXGI_FORMAT format )
+{
+    switch( cformat )
+    {
+    case DXGI_FORMAT_BC1_UNORM:         return ( format == DXGI_FORMAT_R8G8B8A8_UNORM ) ? D3DXDecodeBC1RowRGBA8 : nullptr;
+    case DXGI_FORMAT_BC1_UNORM_SRGB:    return ( format == DXGI_FORMAT_R8G8B8A8_UNORM_SRGB ) ? D3DXDecodeBC1RowRGBA8 : nullptr;
+    case DXGI_FORMAT_BC2_UNORM:         return ( format == DXGI_FORMAT_R8G8B8A8_UNORM ) ? D3DXDecodeBC2RowRGBA8 : nullptr;
+    case DXGI_FORMAT_BC2_UNORM_SRGB:    return ( format == DXGI_FORMAT_R8G8B8A8_UNORM_SRGB ) ? D3DXDecodeBC2RowRGBA8 : nullptr;
+    case DXGI_FORMAT_BC3_UNORM:         return ( format == DXGI_FORMAT_R8G8B8A8_UNORM ) ? D3DXDecodeBC3RowRGBA8 : nullptr;
+    case DXGI_FORMAT_BC3_UNORM_SRGB:    return ( format == DXGI_FORMAT_R8G8B8A8_UNORM_SRGB ) ? D3DXDecodeBC3RowRGBA8 : nullptr;
+    case DXGI_FORMAT_BC4_UNORM:         return ( format == DXGI_FORMAT_R8_UNORM ) ? D3DXDecodeBC4URowR8 : nullptr;
+    case DXGI_FORMAT_BC5_UNORM:         return ( format == DXGI_FORMAT_R8G8_UNORM ) ? D3DXDecodeBC5URowR8G8 : nullptr;
+    case DXGI_FORMAT_BC7_UNORM:         return ( format == DXGI_FORMAT_R8G8B8A8_UNORM ) ? D3DXDecodeBC7RowRGBA8 : nullptr;
+    case DXGI_FORMAT_BC7_UNORM_SRGB:    return ( format == DXGI_FORMAT_R8G8B8A8_UNORM_SRGB ) ? D3DXDecodeBC7RowRGBA8 : nullptr;
+    default:                            return nullptr;
+    }
+}
+
+
+//-------------------------------------------------------------------------------------
+struct _DecompressBCImage
+{
+    const Image*    src;
+    const Image*    dest;
+    DXGI_FORMAT     cformat;
+    BC_DECODE       pfDecode;
+    BC_DECODE_ROW   pfDecodeRow;
+    size_t          sbpp;
+    size_t          dbpp;
+};
+
+static HRESULT _SetupDecompressBC( _In_ const Image& cImage, _In_ const Image& result, _Out_ _DecompressBCImage& job )
 {
     if ( !cImage.pixels || !result.pixels )
         return E_POINTER;
@@ -395,10 +895,6 @@ static HRESULT _DecompressBC( _In_ const Image& cImage, _In_ const Image& result
     // Round to bytes
     dbpp = ( dbpp + 7 ) / 8;
 
-    uint8_t *pDest = result.pixels;
-    if ( !pDest )
-        return E_POINTER;
-
     // Promote "typeless" BC formats
     DXGI_FORMAT cformat;
     switch( cImage.format )
@@ -436,62 +932,138 @@ static HRESULT _DecompressBC( _In_ const Image& cImage, _In_ const Image& result
         return HRESULT_FROM_WIN32( ERROR_NOT_SUPPORTED );
     }
 
-    XMVECTOR temp[16];
-    const uint8_t *pSrc = cImage.pixels;
-    const size_t rowPitch = result.rowPitch;
-    for( size_t h=0; h < cImage.height; h += 4 )
-    {
-        const uint8_t *sptr = pSrc;
-        uint8_t* dptr = pDest;
-        size_t ph = std::min<size_t>( 4, cImage.height - h );
-        size_t w = 0;
-        for( size_t count = 0; (count < cImage.rowPitch) && (w < cImage.width); count += sbpp, w += 4 )
-        {
-            pfDecode( temp, sptr );
-            _ConvertScanline( temp, 16, format, cformat, 0 );
+    job.src = &cImage;
+    job.dest = &result;
+    job.cformat = cformat;
+    job.pfDecode = pfDecode;
+    job.pfDecodeRow = _DirectDecompress( cformat, format );
+    job.sbpp = sbpp;
+    job.dbpp = dbpp;
+
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------------------------
+// Decompresses the row of blocks starting at texel row h
+//-------------------------------------------------------------------------------------
+static bool _DecompressBCRow( _In_ const _DecompressBCImage& job, _In_ size_t h )
+{
+    const Image& cImage = *job.src;
+    const Image& result = *job.dest;
+    const DXGI_FORMAT format = result.format;
+    const size_t rowPitch = result.rowPitch;
+
+    const uint8_t *sptr = cImage.pixels + ( h >> 2 ) * cImage.rowPitch;
+    uint8_t *dptr = result.pixels + h * rowPitch;
+    size_t ph = std::min<size_t>( 4, cImage.height - h );
+
+    // Decode straight to 8-bit texels when the destination needs no conversion
+    if ( job.pfDecodeRow )
+    {
+        job.pfDecodeRow( dptr, rowPitch, sptr, cImage.width, ph );
+        return true;
+    }
+
+    XMVECTOR temp[16];
+    size_t w = 0;
+    for( size_t count = 0; (count < cImage.rowPitch) && (w < cImage.width); count += job.sbpp, w += 4 )
+    {
+        job.pfDecode( temp, sptr );
+        _ConvertScanline( temp, 16, format, job.cformat, 0 );
+
+        size_t pw = std::min<size_t>( 4, cImage.width - w );
+        assert( pw > 0 && ph > 0 );
+
+        if ( !_StoreScanline( dptr, rowPitch, format, &temp[0], pw ) )
+            return false;
+
+        if ( ph > 1 )
+        {
+            if ( !_StoreScanline( dptr + rowPitch, rowPitch, format, &temp[4], pw ) )
+                return false;
+
+            if ( ph > 2 )
+            {
+                if ( !_StoreScanline( dptr + rowPitch*2, rowPitch, format, &temp[8], pw ) )
+                    return false;
+
+                if ( ph > 3 )
+                {
+                    if ( !_StoreScanline( dptr + rowPitch*3, rowPitch, format, &temp[12], pw ) )
+                        return false;
+                }
+            }
+        }
+
+        sptr += job.sbpp;
+        dptr += job.dbpp*4;
+    }
+
+    return true;
+}
 
-            size_t pw = std::min<size_t>( 4, cImage.width - w );
-            assert( pw > 0 && ph > 0 );
 
-            if ( !_StoreScanline( dptr, rowPitch, format, &temp[0], pw ) )
-                return E_FAIL;
+//-------------------------------------------------------------------------------------
+static HRESULT _DecompressBC( _In_ const Image& cImage, _In_ const Image& result )
+{
+    _DecompressBCImage job;
+    HRESULT hr = _SetupDecompressBC( cImage, result, job );
+    if ( FAILED(hr) )
+        return hr;
 
-            if ( ph > 1 )
-            {
-                if ( !_StoreScanline( dptr + rowPitch, rowPitch, format, &temp[4], pw ) )
-                    return E_FAIL;
+    for( size_t h=0; h < cImage.height; h += 4 )
+    {
+        if ( !_DecompressBCRow( job, h ) )
+            return E_FAIL;
+    }
 
-                if ( ph > 2 )
-                {
-                    if ( !_StoreScanline( dptr + rowPitch*2, rowPitch, format, &temp[8], pw ) )
-                        return E_FAIL;
+    return S_OK;
+}
 
-                    if ( ph > 3 )
-                    {
-                        if ( !_StoreScanline( dptr + rowPitch*3, rowPitch, format, &temp[12], pw ) )
-                            return E_FAIL;
-                    }
-                }
-            }
 
-            sptr += sbpp;
-            dptr += dbpp*4;
-        }
+//-------------------------------------------------------------------------------------
+// Decompresses every row of blocks of every image on the thread pool at once, like
+// _CompressBC_Parallel. The rows are independent, so the result is the same as
+// _DecompressBC gives.
+//-------------------------------------------------------------------------------------
+static HRESULT _DecompressBC_Parallel( _In_reads_(nimages) const Image* cImages, _In_reads_(nimages) const Image* destImages,
+                                       _In_ size_t nimages, _In_ DWORD flags )
+{
+    std::vector<_DecompressBCImage> jobs( nimages );
+    std::vector<std::pair<uint32_t, uint32_t>> rows;
+    for( size_t index = 0; index < nimages; ++index )
+    {
+        HRESULT hr = _SetupDecompressBC( cImages[ index ], destImages[ index ], jobs[ index ] );
+        if ( FAILED(hr) )
+            return hr;
 
-        pSrc += cImage.rowPitch;
-        pDest += rowPitch*4;
+        for( size_t h = 0; h < cImages[ index ].height; h += 4 )
+            rows.push_back( std::make_pair( static_cast<uint32_t>( index ), static_cast<uint32_t>( h ) ) );
     }
 
-    return S_OK;
+    std::atomic<bool> fail( false );
+
+    _ParallelFor( flags & TEX_DECOMPRESS_THREADS_MASK, rows.size(), [&]( size_t task, size_t )
+    {
+        if ( !_DecompressBCRow( jobs[ rows[ task ].first ], rows[ task ].second ) )
+            fail = true;
+    } );
+
+    return (fail) ? E_FAIL : S_OK;
 }
 
 
 //-------------------------------------------------------------------------------------
-bool _IsAlphaAllOpaqueBC( _In_ const Image& cImage )
+// Scans the row of blocks starting at texel row h for non-opaque alpha
+//-------------------------------------------------------------------------------------
+bool _IsAlphaAllOpaqueBC( _In_ const Image& cImage, _In_ size_t h )
 {
     if ( !cImage.pixels )
         return false;
 
+    assert( h < cImage.height );
+
     // Promote "typeless" BC formats
     DXGI_FORMAT cformat;
     switch( cImage.format )
@@ -525,50 +1097,98 @@ bool _IsAlphaAllOpaqueBC( _In_ const Image& cImage )
     static const XMVECTORF32 threshold = { 0.99f, 0.99f, 0.99f, 0.99f };
 
     XMVECTOR temp[16];
-    const uint8_t *pPixels = cImage.pixels;
-    for( size_t h = 0; h < cImage.height; h += 4 )
+    const uint8_t *ptr = cImage.pixels + ( h >> 2 ) * cImage.rowPitch;
+    size_t ph = std::min<size_t>( 4, cImage.height - h );
+    size_t w = 0;
+    for( size_t count = 0; (count < cImage.rowPitch) && (w < cImage.width); count += sbpp, w += 4 )
     {
-        const uint8_t *ptr = pPixels;
-        size_t ph = std::min<size_t>( 4, cImage.height - h );
-        size_t w = 0;
-        for( size_t count = 0; (count < cImage.rowPitch) && (w < cImage.width); count += sbpp, w += 4 )
-        {
-            pfDecode( temp, ptr );
+        pfDecode( temp, ptr );
 
-            size_t pw = std::min<size_t>( 4, cImage.width - w );
-            assert( pw > 0 && ph > 0 );
+        size_t pw = std::min<size_t>( 4, cImage.width - w );
+        assert( pw > 0 && ph > 0 );
 
-            if ( pw == 4 && ph == 4 )
+        if ( pw == 4 && ph == 4 )
+        {
+            // Full blocks
+            for( size_t j = 0; j < 16; ++j )
+            {
+                XMVECTOR alpha = XMVectorSplatW( temp[j] );
+                if ( XMVector4Less( alpha, threshold ) )
+                    return false;
+            }
+        }
+        else
+        {
+            // Handle partial blocks
+            for( size_t y = 0; y < ph; ++y )
             {
-                // Full blocks
-                for( size_t j = 0; j < 16; ++j )
+                for( size_t x = 0; x < pw; ++x )
                 {
-                    XMVECTOR alpha = XMVectorSplatW( temp[j] );
+                    XMVECTOR alpha = XMVectorSplatW( temp[ y * 4 + x ] );
                     if ( XMVector4Less( alpha, threshold ) )
                         return false;
                 }
             }
-            else
+        }
+
+        ptr += sbpp;
+    }
+
+    return true;
+}
+
+
+//-------------------------------------------------------------------------------------
+// How an image uses alpha, which limits the BC formats that can hold it: BC1 only
+// keeps texels that are opaque or fully transparent
+//-------------------------------------------------------------------------------------
+enum _AlphaUsage
+{
+    ALPHA_USAGE_OPAQUE = 0,
+    ALPHA_USAGE_1BIT,
+    ALPHA_USAGE_BLENDED,
+};
+
+static HRESULT _GetAlphaUsage( _In_ const Image& image, _Out_ _AlphaUsage& usage )
+{
+    usage = ALPHA_USAGE_OPAQUE;
+
+    if ( !HasAlpha( image.format ) )
+        return S_OK;
+
+    ScopedAlignedArrayXMVECTOR scanline( reinterpret_cast<XMVECTOR*>( _aligned_malloc( (sizeof(XMVECTOR)*image.width), 16 ) ) );
+    if ( !scanline )
+        return E_OUTOFMEMORY;
+
+    static const XMVECTORF32 opaque = { 0.99f, 0.99f, 0.99f, 0.99f };
+    static const XMVECTORF32 transparent = { 0.01f, 0.01f, 0.01f, 0.01f };
+
+    const uint8_t *pSrc = image.pixels;
+    for( size_t h = 0; h < image.height; ++h )
+    {
+        if ( !_LoadScanline( scanline.get(), image.width, pSrc, image.rowPitch, image.format ) )
+            return E_FAIL;
+
+        const XMVECTOR* ptr = scanline.get();
+        for( size_t w = 0; w < image.width; ++w )
+        {
+            XMVECTOR alpha = XMVectorSplatW( *ptr++ );
+            if ( XMVector4Less( alpha, opaque ) )
             {
-                // Handle partial blocks
-                for( size_t y = 0; y < ph; ++y )
+                if ( XMVector4Greater( alpha, transparent ) )
                 {
-                    for( size_t x = 0; x < pw; ++x )
-                    {
-                        XMVECTOR alpha = XMVectorSplatW( temp[ y * 4 + x ] );
-                        if ( XMVector4Less( alpha, threshold ) )
-                            return false;
-                    }
+                    usage = ALPHA_USAGE_BLENDED;
+                    return S_OK;
                 }
-            }
 
-            ptr += sbpp;
+                usage = ALPHA_USAGE_1BIT;
+            }
         }
 
-        pPixels += cImage.rowPitch;
+        pSrc += image.rowPitch;
     }
 
-    return true;
+    return S_OK;
 }
 
 
@@ -581,10 +1201,20 @@ bool _IsAlphaAllOpaqueBC( _In_ const Image& cImage )
 //-------------------------------------------------------------------------------------
 _Use_decl_annotations_
 HRESULT Compress( const Image& srcImage, DXGI_FORMAT format, DWORD compress, float alphaRef, ScratchImage& image )
+{
+    return Compress( srcImage, format, compress, alphaRef, 0.f, 0.f, image );
+}
+
+_Use_decl_annotations_
+HRESULT Compress( const Image& srcImage, DXGI_FORMAT format, DWORD compress, float alphaRef,
+                  float rdoLambda, float rdoMaxError, ScratchImage& image )
 {
     if ( IsCompressed(srcImage.format) || !IsCompressed(format) )
         return E_INVALIDARG;
 
+    if ( rdoLambda < 0.f || rdoMaxError < 0.f )
+        return E_INVALIDARG;
+
     if ( IsTypeless(format)
          || IsTypeless(srcImage.format) || IsPlanar(srcImage.format) || IsPalettized(srcImage.format) )
         return HRESULT_FROM_WIN32( ERROR_NOT_SUPPORTED );
@@ -604,15 +1234,11 @@ HRESULT Compress( const Image& srcImage, DXGI_FORMAT format, DWORD compress, flo
     // Compress single image
     if (compress & TEX_COMPRESS_PARALLEL)
     {
-#ifndef _OPENMP
-        return E_NOTIMPL;
-#else
-        hr = _CompressBC_Parallel( srcImage, *img, _GetBCFlags( compress ), _GetSRGBFlags( compress ), alphaRef );
-#endif // _OPENMP
+        hr = _CompressBC_Parallel( &srcImage, img, 1, compress, alphaRef, rdoLambda, rdoMaxError );
     }
     else
     {
-        hr = _CompressBC( srcImage, *img, _GetBCFlags( compress ), _GetSRGBFlags( compress ), alphaRef );
+        hr = _CompressBC( srcImage, *img, _GetBCFlags( compress ), _GetSRGBFlags( compress ), alphaRef, rdoLambda, rdoMaxError );
     }
 
     if ( FAILED(hr) )
@@ -624,6 +1250,13 @@ HRESULT Compress( const Image& srcImage, DXGI_FORMAT format, DWORD compress, flo
 _Use_decl_annotations_
 HRESULT Compress( const Image* srcImages, size_t nimages, const TexMetadata& metadata,
                   DXGI_FORMAT format, DWORD compress, float alphaRef, ScratchImage& cImages )
+{
+    return Compress( srcImages, nimages, metadata, format, compress, alphaRef, 0.f, 0.f, cImages );
+}
+
+_Use_decl_annotations_
+HRESULT Compress( const Image* srcImages, size_t nimages, const TexMetadata& metadata,
+                  DXGI_FORMAT format, DWORD compress, float alphaRef, float rdoLambda, float rdoMaxError, ScratchImage& cImages )
 {
     if ( !srcImages || !nimages )
         return E_INVALIDARG;
@@ -631,6 +1264,9 @@ HRESULT Compress( const Image* srcImages, size_t nimages, const TexMetadata& met
     if ( IsCompressed(metadata.format) || !IsCompressed(format) )
         return E_INVALIDARG;
 
+    if ( rdoLambda < 0.f || rdoMaxError < 0.f )
+        return E_INVALIDARG;
+
     if ( IsTypeless(format)
          || IsTypeless(metadata.format) || IsPlanar(metadata.format) || IsPalettized(metadata.format) )
         return HRESULT_FROM_WIN32( ERROR_NOT_SUPPORTED );
@@ -668,25 +1304,9 @@ HRESULT Compress( const Image* srcImages, size_t nimages, const TexMetadata& met
             return E_FAIL;
         }
 
-        if ( (compress & TEX_COMPRESS_PARALLEL) )
-        {
-#ifndef _OPENMP
-            return E_NOTIMPL;
-#else
-            if ( compress & TEX_COMPRESS_PARALLEL )
-            {
-                hr = _CompressBC_Parallel( src, dest[ index ], _GetBCFlags( compress ), _GetSRGBFlags( compress ), alphaRef );
-                if ( FAILED(hr) )
-                {
-                    cImages.Release();
-                    return  hr;
-                }
-            }
-#endif // _OPENMP
-        }
-        else
+        if ( !(compress & TEX_COMPRESS_PARALLEL) )
         {
-            hr = _CompressBC( src, dest[ index ], _GetBCFlags( compress ), _GetSRGBFlags( compress ), alphaRef );
+            hr = _CompressBC( src, dest[ index ], _GetBCFlags( compress ), _GetSRGBFlags( compress ), alphaRef, rdoLambda, rdoMaxError );
             if ( FAILED(hr) )
             {
                 cImages.Release();
@@ -695,15 +1315,97 @@ HRESULT Compress( const Image* srcImages, size_t nimages, const TexMetadata& met
         }
     }
 
+    if ( compress & TEX_COMPRESS_PARALLEL )
+    {
+        // All images & mip levels are scheduled together
+        hr = _CompressBC_Parallel( srcImages, dest, nimages, compress, alphaRef, rdoLambda, rdoMaxError );
+        if ( FAILED(hr) )
+        {
+            cImages.Release();
+            return hr;
+        }
+    }
+
     return S_OK;
 }
 
 
+//-------------------------------------------------------------------------------------
+// Mip-map generation & compression in one pass
+//-------------------------------------------------------------------------------------
+_Use_decl_annotations_
+HRESULT GenerateCompressedMipMaps( const Image& baseImage, DWORD filter, size_t levels, DXGI_FORMAT format,
+                                   DWORD compress, float alphaRef, ScratchImage& cImages )
+{
+    return GenerateCompressedMipMaps( baseImage, filter, levels, format, compress, alphaRef, 0.f, 0.f, cImages );
+}
+
+_Use_decl_annotations_
+HRESULT GenerateCompressedMipMaps( const Image& baseImage, DWORD filter, size_t levels, DXGI_FORMAT format,
+                                   DWORD compress, float alphaRef, float rdoLambda, float rdoMaxError, ScratchImage& cImages )
+{
+    if ( !baseImage.pixels )
+        return E_POINTER;
+
+    if ( IsCompressed(baseImage.format) || !IsCompressed(format) )
+        return E_INVALIDARG;
+
+    if ( rdoLambda < 0.f || rdoMaxError < 0.f )
+        return E_INVALIDARG;
+
+    if ( !_CalculateMipLevels( baseImage.width, baseImage.height, levels ) )
+        return E_INVALIDARG;
+
+    if ( IsTypeless(format)
+         || IsTypeless(baseImage.format) || IsPlanar(baseImage.format) || IsPalettized(baseImage.format) )
+        return HRESULT_FROM_WIN32( ERROR_NOT_SUPPORTED );
+
+    // Only the box filter streams, which needs power-of-2 sizes
+    const DWORD filter_select = ( filter & TEX_FILTER_MASK );
+    if ( filter_select && filter_select != TEX_FILTER_BOX )
+        return HRESULT_FROM_WIN32( ERROR_NOT_SUPPORTED );
+
+    if ( ( baseImage.width & ( baseImage.width - 1 ) ) || ( baseImage.height & ( baseImage.height - 1 ) ) )
+        return HRESULT_FROM_WIN32( ERROR_NOT_SUPPORTED );
+
+    HRESULT hr = cImages.Initialize2D( format, baseImage.width, baseImage.height, 1, levels );
+    if ( FAILED(hr) )
+        return hr;
+
+    const Image* dest = cImages.GetImages();
+    if ( !dest || cImages.GetImageCount() != levels )
+    {
+        cImages.Release();
+        return E_POINTER;
+    }
+
+    if ( compress & TEX_COMPRESS_PARALLEL )
+    {
+        hr = _GenerateCompressedMips_Parallel( baseImage, dest, levels, filter, compress, alphaRef, rdoLambda, rdoMaxError );
+    }
+    else
+    {
+        hr = _GenerateCompressedMips( baseImage, dest, levels, filter, compress, alphaRef, rdoLambda, rdoMaxError );
+    }
+
+    if ( FAILED(hr) )
+        cImages.Release();
+
+    return hr;
+}
+
+
 //-------------------------------------------------------------------------------------
 // Decompression
 //-------------------------------------------------------------------------------------
 _Use_decl_annotations_
 HRESULT Decompress( const Image& cImage, DXGI_FORMAT format, ScratchImage& image )
+{
+    return Decompress( cImage, format, TEX_DECOMPRESS_DEFAULT, image );
+}
+
+_Use_decl_annotations_
+HRESULT Decompress( const Image& cImage, DXGI_FORMAT format, DWORD flags, ScratchImage& image )
 {
     if ( !IsCompressed(cImage.format) || IsCompressed(format) )
         return E_INVALIDARG;
@@ -740,7 +1442,10 @@ HRESULT Decompress( const Image& cImage, DXGI_FORMAT format, ScratchImage& image
     }
 
     // Decompress single image
-    hr = _DecompressBC( cImage, *img );
+    if ( flags & TEX_DECOMPRESS_PARALLEL )
+        hr = _DecompressBC_Parallel( &cImage, img, 1, flags );
+    else
+        hr = _DecompressBC( cImage, *img );
     if ( FAILED(hr) )
         image.Release();
 
@@ -750,6 +1455,13 @@ HRESULT Decompress( const Image& cImage, DXGI_FORMAT format, ScratchImage& image
 _Use_decl_annotations_
 HRESULT Decompress( const Image* cImages, size_t nimages, const TexMetadata& metadata,
                     DXGI_FORMAT format, ScratchImage& images )
+{
+    return Decompress( cImages, nimages, metadata, format, TEX_DECOMPRESS_DEFAULT, images );
+}
+
+_Use_decl_annotations_
+HRESULT Decompress( const Image* cImages, size_t nimages, const TexMetadata& metadata,
+                    DXGI_FORMAT format, DWORD flags, ScratchImage& images )
 {
     if ( !cImages || !nimages )
         return E_INVALIDARG;
@@ -814,6 +1526,9 @@ HRESULT Decompress( const Image* cImages, size_t nimages, const TexMetadata& met
             return E_FAIL;
         }
 
+        if ( flags & TEX_DECOMPRESS_PARALLEL )
+            continue;
+
         hr = _DecompressBC( src, dest[ index ] );
         if ( FAILED(hr) )
         {
@@ -822,7 +1537,228 @@ HRESULT Decompress( const Image* cImages, size_t nimages, const TexMetadata& met
         }
     }
 
+    if ( flags & TEX_DECOMPRESS_PARALLEL )
+    {
+        hr = _DecompressBC_Parallel( cImages, dest, nimages, flags );
+        if ( FAILED(hr) )
+        {
+            images.Release();
+            return hr;
+        }
+    }
+
     return S_OK;
 }
 
+
+//-------------------------------------------------------------------------------------
+// Format selection
+//-------------------------------------------------------------------------------------
+_Use_decl_annotations_
+HRESULT SelectBCFormat( const Image& srcImage, DWORD compress, float alphaRef, float minPSNR, float maxError,
+                        DXGI_FORMAT& format, float* psnr, float* error )
+{
+    format = DXGI_FORMAT_UNKNOWN;
+
+    if ( !srcImage.pixels )
+        return E_POINTER;
+
+    if ( !srcImage.width || !srcImage.height || minPSNR < 0.f || maxError < 0.f )
+        return E_INVALIDARG;
+
+    if ( IsCompressed(srcImage.format) || IsTypeless(srcImage.format)
+         || IsPlanar(srcImage.format) || IsPalettized(srcImage.format) || IsVideo(srcImage.format) )
+        return HRESULT_FROM_WIN32( ERROR_NOT_SUPPORTED );
+
+    // BC1 can't hold blended alpha, and BC3 spends half of each block on alpha
+    _AlphaUsage usage;
+    HRESULT hr = _GetAlphaUsage( srcImage, usage );
+    if ( FAILED(hr) )
+        return hr;
+
+    // Copy a grid of whole blocks spread evenly over the image (or the image itself when
+    // it's smaller than a block) into the sample that's trial encoded
+    static const size_t s_SampleGrid = 64;
+
+    const size_t cw = std::min<size_t>( 4, srcImage.width );
+    const size_t ch = std::min<size_t>( 4, srcImage.height );
+    const size_t nbx = std::max<size_t>( 1, srcImage.width / 4 );
+    const size_t nby = std::max<size_t>( 1, srcImage.height / 4 );
+    const size_t sx = std::min<size_t>( nbx, s_SampleGrid );
+    const size_t sy = std::min<size_t>( nby, s_SampleGrid );
+
+    ScratchImage sample;
+    hr = sample.Initialize2D( srcImage.format, sx * cw, sy * ch, 1, 1 );
+    if ( FAILED(hr) )
+        return hr;
+
+    const Image* simg = sample.GetImage( 0, 0, 0 );
+    if ( !simg )
+        return E_POINTER;
+
+    for( size_t j = 0; j < sy; ++j )
+    {
+        for( size_t i = 0; i < sx; ++i )
+        {
+            Rect rect( ( ( 2 * i + 1 ) * nbx / ( 2 * sx ) ) * 4, ( ( 2 * j + 1 ) * nby / ( 2 * sy ) ) * 4, cw, ch );
+
+            hr = CopyRectangle( srcImage, rect, *simg, TEX_FILTER_DEFAULT, i * cw, j * ch );
+            if ( FAILED(hr) )
+                return hr;
+        }
+    }
+
+    // The trial encodes are decoded to 8-bit texels, which hold BC1, BC3 & BC7 exactly, and
+    // compared in the color space each side is in, as ComputeMSE would
+    const bool srgb = IsSRGB( srcImage.format ) || ( compress & TEX_COMPRESS_SRGB_OUT );
+    const DXGI_FORMAT dformat = ( srgb ) ? DXGI_FORMAT_R8G8B8A8_UNORM_SRGB : DXGI_FORMAT_R8G8B8A8_UNORM;
+    const bool srgbIn = IsSRGB( srcImage.format ) || ( compress & TEX_COMPRESS_SRGB_IN );
+    const bool ignoreAlpha = ( usage == ALPHA_USAGE_OPAQUE );
+
+    const float channels = ( ignoreAlpha ) ? 3.f : 4.f;
+
+    // The sample's texels are loaded once for all the candidates, with one error accumulator
+    // per block of a row of blocks & a scanline for the decoded texels
+    static const XMVECTORF32 s_Gamma22 = { 2.2f, 2.2f, 2.2f, 1.f };
+
+    const size_t width = simg->width;
+    const size_t height = simg->height;
+
+    ScopedAlignedArrayXMVECTOR texels( reinterpret_cast<XMVECTOR*>( _aligned_malloc( sizeof(XMVECTOR) * ( width * height + width + sx ), 16 ) ) );
+    if ( !texels )
+        return E_OUTOFMEMORY;
+
+    XMVECTOR* scanline = texels.get() + width * height;
+    XMVECTOR* acc = scanline + width;
+
+    for( size_t y = 0; y < height; ++y )
+    {
+        XMVECTOR* row = texels.get() + y * width;
+        if ( !_LoadScanline( row, width, simg->pixels + y * simg->rowPitch, simg->rowPitch, simg->format ) )
+            return E_FAIL;
+
+        if ( srgbIn )
+        {
+            for( size_t x = 0; x < width; ++x )
+                row[ x ] = XMVectorPow( row[ x ], s_Gamma22 );
+        }
+    }
+
+    const XMVECTOR texelCount = XMVectorReplicate( float(cw * ch) );
+
+    DWORD dflags = TEX_DECOMPRESS_DEFAULT;
+    if ( compress & TEX_COMPRESS_PARALLEL )
+        dflags |= TEX_DECOMPRESS_PARALLEL | ( compress & TEX_COMPRESS_THREADS_MASK );
+
+    // Candidates from the smallest up
+    static const DXGI_FORMAT s_Candidates[] = { DXGI_FORMAT_BC1_UNORM, DXGI_FORMAT_BC3_UNORM, DXGI_FORMAT_BC7_UNORM };
+
+    float bestMSE = FLT_MAX;
+    float bestPSNR = 0.f;
+    float bestError = 0.f;
+
+    for( size_t k = 0; k < _countof(s_Candidates); ++k )
+    {
+        const DXGI_FORMAT candidate = s_Candidates[ k ];
+
+        if ( candidate == DXGI_FORMAT_BC1_UNORM && usage == ALPHA_USAGE_BLENDED )
+            continue;
+
+        if ( candidate == DXGI_FORMAT_BC3_UNORM && usage == ALPHA_USAGE_OPAQUE )
+            continue;
+
+        const DXGI_FORMAT cformat = ( srgb ) ? MakeSRGB( candidate ) : candidate;
+
+        ScratchImage cimage;
+        hr = Compress( *simg, cformat, compress, alphaRef, cimage );
+        if ( FAILED(hr) )
+            return hr;
+
+        const Image* cimg = cimage.GetImage( 0, 0, 0 );
+        if ( !cimg )
+            return E_POINTER;
+
+        ScratchImage dimage;
+        hr = Decompress( *cimg, dformat, dflags, dimage );
+        if ( FAILED(hr) )
+            return hr;
+
+        const Image* dimg = dimage.GetImage( 0, 0, 0 );
+        if ( !dimg )
+            return E_POINTER;
+
+        // Every block is compared on its own, for the worst one as well as the mean, in one pass
+        // over the decoded texels
+        float sum = 0.f;
+        float worst = 0.f;
+        for( size_t j = 0; j < sy; ++j )
+        {
+            for( size_t i = 0; i < sx; ++i )
+                acc[ i ] = g_XMZero;
+
+            for( size_t y = j * ch; y < ( j + 1 ) * ch; ++y )
+            {
+                if ( !_LoadScanline( scanline, width, dimg->pixels + y * dimg->rowPitch, dimg->rowPitch, dimg->format ) )
+                    return E_FAIL;
+
+                const XMVECTOR* row = texels.get() + y * width;
+                for( size_t x = 0; x < width; ++x )
+                {
+                    XMVECTOR v2 = scanline[ x ];
+                    if ( srgb )
+                        v2 = XMVectorPow( v2, s_Gamma22 );
+
+                    XMVECTOR v = XMVectorSubtract( row[ x ], v2 );
+                    if ( ignoreAlpha )
+                        v = XMVectorSelect( v, g_XMZero, g_XMMaskW );
+
+                    acc[ x / cw ] = XMVectorMultiplyAdd( v, v, acc[ x / cw ] );
+                }
+            }
+
+            for( size_t i = 0; i < sx; ++i )
+            {
+                XMFLOAT4 mseV;
+                XMStoreFloat4( &mseV, XMVectorDivide( acc[ i ], texelCount ) );
+                const float mse = mseV.x + mseV.y + mseV.z + mseV.w;
+
+                sum += mse;
+                worst = std::max( worst, mse );
+            }
+        }
+
+        // PSNR of the mean per channel, with an exact match at 100 dB, and the worst block's
+        // RMS error in 8 bit units
+        const float mean = sum / ( float(sx * sy) * channels );
+        const float cpsnr = 10.f * log10f( 1.f / std::max( mean, 1e-10f ) );
+        const float cerror = 255.f * sqrtf( worst / channels );
+
+        if ( ( minPSNR <= 0.f || cpsnr >= minPSNR ) && ( maxError <= 0.f || cerror <= maxError ) )
+        {
+            format = cformat;
+            if ( psnr )
+                *psnr = cpsnr;
+            if ( error )
+                *error = cerror;
+            return S_OK;
+        }
+
+        if ( mean < bestMSE )
+        {
+            format = cformat;
+            bestMSE = mean;
+            bestPSNR = cpsnr;
+            bestError = cerror;
+        }
+    }
+
+    // None meets the target, so go with the closest
+    if ( psnr )
+        *psnr = bestPSNR;
+    if ( error )
+        *error = bestError;
+
+    return S_FALSE;
+}
+
 }; // namespace
@@ -15,12 +15,14 @@
 
 #include "directxtexp.h"
 
+#include "parallel.h"
+
 namespace DirectX
 {
 
 extern bool _CalculateMipLevels( _In_ size_t width, _In_ size_t height, _Inout_ size_t& mipLevels );
 extern bool _CalculateMipLevels3D( _In_ size_t width, _In_ size_t height, _In_ size_t depth, _Inout_ size_t& mipLevels );
-extern bool _IsAlphaAllOpaqueBC( _In_ const Image& cImage );
+extern bool _IsAlphaAllOpaqueBC( _In_ const Image& cImage, _In_ size_t h );
 
 //-------------------------------------------------------------------------------------
 // Determines number of image array entries and pixel size
@@ -737,58 +739,181 @@ const Image* ScratchImage::GetImage(size_t mip, size_t item, size_t slice) const
     return &_image[index];
 }
 
-bool ScratchImage::IsAlphaAllOpaque() const
+//-------------------------------------------------------------------------------------
+// Opaque alpha checks
+//-------------------------------------------------------------------------------------
+
+// Formats whose alpha is checked in place: the smallest stored alpha that _LoadScanline
+// turns into 0.99 or more, and a mask set on the bits of each 8 bytes that aren't alpha
+struct _DirectAlpha
 {
-    if ( !_image )
-        return false;
+    size_t      bits;
+    uint16_t    threshold;
+    uint64_t    mask;
+};
 
-    if ( !HasAlpha( _metadata.format ) )
+static bool _GetDirectAlpha( _In_ DXGI_FORMAT format, _Out_ _DirectAlpha& direct )
+{
+    switch( format )
+    {
+    case DXGI_FORMAT_R8G8B8A8_UNORM:
+    case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+    case DXGI_FORMAT_B8G8R8A8_UNORM:
+    case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+        direct.bits = 8;  direct.threshold = 253;   direct.mask = 0x00FFFFFF00FFFFFFull;
         return true;
 
-    if ( IsCompressed( _metadata.format ) )
+    case DXGI_FORMAT_R8G8B8A8_UINT:
+        direct.bits = 8;  direct.threshold = 1;     direct.mask = 0x00FFFFFF00FFFFFFull;
+        return true;
+
+    case DXGI_FORMAT_A8_UNORM:
+        direct.bits = 8;  direct.threshold = 253;   direct.mask = 0;
+        return true;
+
+    case DXGI_FORMAT_R16G16B16A16_UNORM:
+        direct.bits = 16; direct.threshold = 64880; direct.mask = 0x0000FFFFFFFFFFFFull;
+        return true;
+
+    case DXGI_FORMAT_R16G16B16A16_UINT:
+        direct.bits = 16; direct.threshold = 1;     direct.mask = 0x0000FFFFFFFFFFFFull;
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// Compares the alpha values of a row to the threshold, 16 bytes at a time with saturating
+// subtracts that stay zero for values at or above it
+static bool _IsAlphaAllOpaqueRow( _In_ const _DirectAlpha& direct, _In_reads_bytes_(bytes) const uint8_t* pRow, _In_ size_t bytes )
+{
+    size_t i = 0;
+
+#ifdef _XM_SSE_INTRINSICS_
+    const int maskLo = static_cast<int>( direct.mask & 0xFFFFFFFF );
+    const int maskHi = static_cast<int>( direct.mask >> 32 );
+    const __m128i mask = _mm_set_epi32( maskHi, maskLo, maskHi, maskLo );
+    const __m128i threshold = ( direct.bits == 8 ) ? _mm_set1_epi8( static_cast<char>( direct.threshold ) )
+                                                   : _mm_set1_epi16( static_cast<short>( direct.threshold ) );
+    __m128i below = _mm_setzero_si128();
+
+    for( ; i + 16 <= bytes; i += 16 )
+    {
+        __m128i v = _mm_or_si128( _mm_loadu_si128( reinterpret_cast<const __m128i*>( pRow + i ) ), mask );
+        below = _mm_or_si128( below, ( direct.bits == 8 ) ? _mm_subs_epu8( threshold, v ) : _mm_subs_epu16( threshold, v ) );
+    }
+
+    if ( _mm_movemask_epi8( _mm_cmpeq_epi8( below, _mm_setzero_si128() ) ) != 0xFFFF )
+        return false;
+#endif // _XM_SSE_INTRINSICS_
+
+    if ( direct.bits == 8 )
     {
-        for( size_t index = 0; index < _nimages; ++index )
+        for( ; i < bytes; ++i )
         {
-            if ( !_IsAlphaAllOpaqueBC( _image[ index ] ) )
+            if ( !( ( direct.mask >> ( ( i & 7 ) * 8 ) ) & 0xFF ) && pRow[ i ] < direct.threshold )
                 return false;
         }
     }
     else
     {
-        ScopedAlignedArrayXMVECTOR scanline( reinterpret_cast<XMVECTOR*>( _aligned_malloc( (sizeof(XMVECTOR)*_metadata.width), 16 ) ) );
-        if ( !scanline )
-            return false;
+        for( ; i + 1 < bytes; i += 2 )
+        {
+            if ( !( ( direct.mask >> ( ( i & 7 ) * 8 ) ) & 0xFFFF ) && *reinterpret_cast<const uint16_t*>( pRow + i ) < direct.threshold )
+                return false;
+        }
+    }
 
-        static const XMVECTORF32 threshold = { 0.99f, 0.99f, 0.99f, 0.99f };
+    return true;
+}
+
+bool ScratchImage::IsAlphaAllOpaque() const
+{
+    return IsAlphaAllOpaque( 1 );
+}
+
+bool ScratchImage::IsAlphaAllOpaque( size_t nthreads ) const
+{
+    if ( !_image )
+        return false;
+
+    if ( !HasAlpha( _metadata.format ) )
+        return true;
+
+    // Every row of every image is a task, and for BC formats every row of blocks
+    const bool compressed = IsCompressed( _metadata.format );
+    const size_t step = ( compressed ) ? 4 : 1;
+
+    std::vector<std::pair<uint32_t, uint32_t>> rows;
+    for( size_t index = 0; index < _nimages; ++index )
+    {
+        for( size_t h = 0; h < _image[ index ].height; h += step )
+            rows.push_back( std::make_pair( static_cast<uint32_t>( index ), static_cast<uint32_t>( h ) ) );
+    }
+
+    _DirectAlpha direct = {};
+    const bool isDirect = !compressed && _GetDirectAlpha( _metadata.format, direct );
+
+    // Other formats are loaded to floats a row at a time, into a scanline per thread
+    std::vector<ScopedAlignedArrayXMVECTOR> scanlines( _ParallelThreadCount( nthreads, rows.size() ) );
+
+    static const XMVECTORF32 threshold = { 0.99f, 0.99f, 0.99f, 0.99f };
+
+    // Once a texel that isn't opaque turns up, the rows still to go are skipped
+    std::atomic<bool> opaque( true );
+
+    _ParallelFor( nthreads, rows.size(), [&]( size_t task, size_t thread )
+    {
+        if ( !opaque )
+            return;
 
-        for( size_t index = 0; index < _nimages; ++index )
-        {
 #pragma warning( suppress : 6011 )
-            const Image& img = _image[ index ];
+        const Image& img = _image[ rows[ task ].first ];
+        const size_t h = rows[ task ].second;
 
-            const uint8_t *pPixels = img.pixels;
-            assert( pPixels );
+        assert( img.pixels );
 
-            for( size_t h = 0; h < img.height; ++h )
-            {
-                if ( !_LoadScanline( scanline.get(), img.width, pPixels, img.rowPitch, img.format ) )
-                    return false;
+        if ( compressed )
+        {
+            if ( !_IsAlphaAllOpaqueBC( img, h ) )
+                opaque = false;
+            return;
+        }
 
-                XMVECTOR* ptr = scanline.get();
-                for( size_t w = 0; w < img.width; ++w )
-                {
-                    XMVECTOR alpha = XMVectorSplatW( *ptr );
-                    if ( XMVector4Less( alpha, threshold ) )
-                        return false;
-                    ++ptr;
-                }
+        const uint8_t *pPixels = img.pixels + h * img.rowPitch;
+
+        if ( isDirect )
+        {
+            if ( !_IsAlphaAllOpaqueRow( direct, pPixels, ( img.width * BitsPerPixel( img.format ) ) >> 3 ) )
+                opaque = false;
+            return;
+        }
+
+        auto& scanline = scanlines[ thread ];
+        if ( !scanline )
+            scanline.reset( reinterpret_cast<XMVECTOR*>( _aligned_malloc( (sizeof(XMVECTOR)*_metadata.width), 16 ) ) );
+
+        if ( !scanline || !_LoadScanline( scanline.get(), img.width, pPixels, img.rowPitch, img.format ) )
+        {
+            opaque = false;
+            return;
+        }
 
-                pPixels += img.rowPitch;
+        XMVECTOR* ptr = scanline.get();
+        for( size_t w = 0; w < img.width; ++w )
+        {
+            XMVECTOR alpha = XMVectorSplatW( *ptr );
+            if ( XMVector4Less( alpha, threshold ) )
+            {
+                opaque = false;
+                return;
             }
+            ++ptr;
         }
-    }
+    } );
 
-    return true;
+    return opaque;
 }
 
 }; // namespace
@@ -749,6 +749,7 @@ static HRESULT _Generate2DMipsBoxFilter( _In_ size_t levels, _In_ DWORD filter,
         if ( height <= 1 )
         {
             urow1 = urow0;
+            urow3 = urow1 + 1;
         }
 
         if ( width <= 1 )
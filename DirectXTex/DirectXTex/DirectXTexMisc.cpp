@@ -15,10 +15,37 @@
 
 #include "directxtexp.h"
 
+#include "parallel.h"
+
 namespace DirectX
 {
 static const XMVECTORF32 g_Gamma22 = { 2.2f, 2.2f, 2.2f, 1.f };
 
+//-------------------------------------------------------------------------------------
+// CMSE flags implied from an image format, with srgb the gamma flag for that image
+static DWORD _GetImpliedMSEFlags( _In_ DXGI_FORMAT format, _In_ DWORD srgb )
+{
+    switch( format )
+    {
+    case DXGI_FORMAT_B8G8R8X8_UNORM:
+        return CMSE_IGNORE_ALPHA;
+
+    case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
+        return srgb | CMSE_IGNORE_ALPHA;
+
+    case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+    case DXGI_FORMAT_BC1_UNORM_SRGB:
+    case DXGI_FORMAT_BC2_UNORM_SRGB:
+    case DXGI_FORMAT_BC3_UNORM_SRGB:
+    case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+    case DXGI_FORMAT_BC7_UNORM_SRGB:
+        return srgb;
+
+    default:
+        return 0;
+    }
+}
+
 //-------------------------------------------------------------------------------------
 static HRESULT _ComputeMSE( _In_ const Image& image1, _In_ const Image& image2,
                             _Out_ float& mse, _Out_writes_opt_(4) float* mseV,
@@ -37,45 +64,7 @@ static HRESULT _ComputeMSE( _In_ const Image& image1, _In_ const Image& image2,
         return E_OUTOFMEMORY;
 
     // Flags implied from image formats
-    switch( image1.format )
-    {
-    case DXGI_FORMAT_B8G8R8X8_UNORM:
-        flags |= CMSE_IGNORE_ALPHA;
-        break;
-
-    case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
-        flags |= CMSE_IMAGE1_SRGB | CMSE_IGNORE_ALPHA;
-        break;
-
-    case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
-    case DXGI_FORMAT_BC1_UNORM_SRGB:
-    case DXGI_FORMAT_BC2_UNORM_SRGB:
-    case DXGI_FORMAT_BC3_UNORM_SRGB:
-    case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
-    case DXGI_FORMAT_BC7_UNORM_SRGB:
-        flags |= CMSE_IMAGE1_SRGB;
-        break;
-    }
-
-    switch( image2.format )
-    {
-    case DXGI_FORMAT_B8G8R8X8_UNORM:
-        flags |= CMSE_IGNORE_ALPHA;
-        break;
-
-    case DXGI_FORMAT_B8G8R8X8_UNORM_SRGB:
-        flags |= CMSE_IMAGE2_SRGB | CMSE_IGNORE_ALPHA;
-        break;
-
-    case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
-    case DXGI_FORMAT_BC1_UNORM_SRGB:
-    case DXGI_FORMAT_BC2_UNORM_SRGB:
-    case DXGI_FORMAT_BC3_UNORM_SRGB:
-    case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
-    case DXGI_FORMAT_BC7_UNORM_SRGB:
-        flags |= CMSE_IMAGE2_SRGB;
-        break;
-    }
+    flags |= _GetImpliedMSEFlags( image1.format, CMSE_IMAGE1_SRGB ) | _GetImpliedMSEFlags( image2.format, CMSE_IMAGE2_SRGB );
 
     const uint8_t *pSrc1 = image1.pixels;
     const size_t rowPitch1 = image1.rowPitch;
@@ -115,7 +104,7 @@ static HRESULT _ComputeMSE( _In_ const Image& image1, _In_ const Image& image2,
             }
             if ( flags & CMSE_IMAGE2_X2_BIAS )
             {
-                v1 = XMVectorMultiplyAdd( v2, two, g_XMNegativeOne );
+                v2 = XMVectorMultiplyAdd( v2, two, g_XMNegativeOne );
             }
 
             // sum[ (I1 - I2)^2 ]
@@ -163,6 +152,195 @@ static HRESULT _ComputeMSE( _In_ const Image& image1, _In_ const Image& image2,
 }
 
 
+//-------------------------------------------------------------------------------------
+// Image metrics
+//-------------------------------------------------------------------------------------
+
+// SSIM is taken over windows of 8x8 texels, with the usual constants for a range of 1.0
+static const size_t METRICS_WINDOW = 8;
+static const XMVECTORF32 g_SSIM_C1 = { 0.0001f, 0.0001f, 0.0001f, 0.0001f };
+static const XMVECTORF32 g_SSIM_C2 = { 0.0009f, 0.0009f, 0.0009f, 0.0009f };
+
+// Running sums kept for each window, with a channel in each element
+enum _METRICS_SUMS
+{
+    METRICS_SUM_X = 0,
+    METRICS_SUM_Y,
+    METRICS_SUM_XX,
+    METRICS_SUM_YY,
+    METRICS_SUM_XY,
+    METRICS_SUM_DD,
+    METRICS_SUM_COUNT,
+};
+
+// Totals for one band of METRICS_WINDOW rows of an image pair
+struct _MetricsBand
+{
+    double  sqr[4];
+    double  ssim[4];
+    float   maxError[4];
+};
+
+static XMVECTOR _GetMetricsIgnoreMask( _In_ DWORD flags )
+{
+    XMVECTOR mask = XMVectorFalseInt();
+    if ( flags & CMSE_IGNORE_RED )
+        mask = XMVectorOrInt( mask, g_XMMaskX );
+    if ( flags & CMSE_IGNORE_GREEN )
+        mask = XMVectorOrInt( mask, g_XMMaskY );
+    if ( flags & CMSE_IGNORE_BLUE )
+        mask = XMVectorOrInt( mask, g_XMMaskZ );
+    if ( flags & CMSE_IGNORE_ALPHA )
+        mask = XMVectorOrInt( mask, g_XMMaskW );
+    return mask;
+}
+
+// A texel as it is compared: gamma removed, bias applied & ignored channels set to zero
+inline static XMVECTOR XM_CALLCONV _MetricsTexel( _In_ FXMVECTOR v, _In_ FXMVECTOR ignore, _In_ DWORD flags, _In_ DWORD srgb, _In_ DWORD bias )
+{
+    XMVECTOR t = v;
+    if ( flags & srgb )
+    {
+        t = XMVectorPow( t, g_Gamma22 );
+    }
+    if ( flags & bias )
+    {
+        t = XMVectorSubtract( XMVectorAdd( t, t ), g_XMOne );
+    }
+    return XMVectorSelect( t, g_XMZero, ignore );
+}
+
+//-------------------------------------------------------------------------------------
+// Sums the squared & largest differences and the SSIM of each window over the rows
+// [y, y + METRICS_WINDOW) of an image pair. scratch holds a scanline of each image
+// followed by the running sums of each window in the band.
+static bool _ComputeMetricsBand( _In_ const Image& image1, _In_ const Image& image2, _In_ size_t y, _In_ DWORD flags,
+                                 _Inout_ XMVECTOR* scratch, _Out_ _MetricsBand& band )
+{
+    assert( image1.width == image2.width && image1.height == image2.height && y < image1.height );
+
+    memset( &band, 0, sizeof(band) );
+
+    const size_t width = image1.width;
+    const size_t windows = ( width + METRICS_WINDOW - 1 ) / METRICS_WINDOW;
+    const size_t rows = std::min<size_t>( METRICS_WINDOW, image1.height - y );
+
+    XMVECTOR* row1 = scratch;
+    XMVECTOR* row2 = scratch + width;
+    XMVECTOR* sums = scratch + width * 2;
+    for( size_t i = 0; i < windows * METRICS_SUM_COUNT; ++i )
+    {
+        sums[ i ] = g_XMZero;
+    }
+
+    const XMVECTOR ignore = _GetMetricsIgnoreMask( flags );
+    XMVECTOR maxError = g_XMZero;
+
+    for( size_t r = 0; r < rows; ++r )
+    {
+        if ( !_LoadScanline( row1, width, image1.pixels + ( y + r ) * image1.rowPitch, image1.rowPitch, image1.format ) )
+            return false;
+
+        if ( !_LoadScanline( row2, width, image2.pixels + ( y + r ) * image2.rowPitch, image2.rowPitch, image2.format ) )
+            return false;
+
+        XMVECTOR* sum = sums;
+        for( size_t x = 0; x < width; x += METRICS_WINDOW, sum += METRICS_SUM_COUNT )
+        {
+            XMVECTOR sx = sum[ METRICS_SUM_X ];
+            XMVECTOR sy = sum[ METRICS_SUM_Y ];
+            XMVECTOR sxx = sum[ METRICS_SUM_XX ];
+            XMVECTOR syy = sum[ METRICS_SUM_YY ];
+            XMVECTOR sxy = sum[ METRICS_SUM_XY ];
+            XMVECTOR sdd = sum[ METRICS_SUM_DD ];
+
+            const size_t end = std::min<size_t>( x + METRICS_WINDOW, width );
+            for( size_t i = x; i < end; ++i )
+            {
+                XMVECTOR v1 = _MetricsTexel( row1[ i ], ignore, flags, CMSE_IMAGE1_SRGB, CMSE_IMAGE1_X2_BIAS );
+                XMVECTOR v2 = _MetricsTexel( row2[ i ], ignore, flags, CMSE_IMAGE2_SRGB, CMSE_IMAGE2_X2_BIAS );
+                XMVECTOR d = XMVectorSubtract( v1, v2 );
+
+                sx = XMVectorAdd( sx, v1 );
+                sy = XMVectorAdd( sy, v2 );
+                sxx = XMVectorMultiplyAdd( v1, v1, sxx );
+                syy = XMVectorMultiplyAdd( v2, v2, syy );
+                sxy = XMVectorMultiplyAdd( v1, v2, sxy );
+                sdd = XMVectorMultiplyAdd( d, d, sdd );
+                maxError = XMVectorMax( maxError, XMVectorAbs( d ) );
+            }
+
+            sum[ METRICS_SUM_X ] = sx;
+            sum[ METRICS_SUM_Y ] = sy;
+            sum[ METRICS_SUM_XX ] = sxx;
+            sum[ METRICS_SUM_YY ] = syy;
+            sum[ METRICS_SUM_XY ] = sxy;
+            sum[ METRICS_SUM_DD ] = sdd;
+        }
+    }
+
+    // SSIM of each window, weighted by the number of texels in it for windows cut off by the edges
+    const XMVECTOR* sum = sums;
+    for( size_t x = 0; x < width; x += METRICS_WINDOW, sum += METRICS_SUM_COUNT )
+    {
+        const XMVECTOR n = XMVectorReplicate( float( rows * ( std::min<size_t>( x + METRICS_WINDOW, width ) - x ) ) );
+        const XMVECTOR inv = XMVectorReciprocal( n );
+
+        XMVECTOR mx = XMVectorMultiply( sum[ METRICS_SUM_X ], inv );
+        XMVECTOR my = XMVectorMultiply( sum[ METRICS_SUM_Y ], inv );
+
+        // var = E[x^2] - E[x]^2, cov = E[xy] - E[x]E[y]
+        XMVECTOR vx = XMVectorNegativeMultiplySubtract( mx, mx, XMVectorMultiply( sum[ METRICS_SUM_XX ], inv ) );
+        XMVECTOR vy = XMVectorNegativeMultiplySubtract( my, my, XMVectorMultiply( sum[ METRICS_SUM_YY ], inv ) );
+        XMVECTOR cxy = XMVectorNegativeMultiplySubtract( mx, my, XMVectorMultiply( sum[ METRICS_SUM_XY ], inv ) );
+
+        // SSIM = (2 mx my + C1)(2 cxy + C2) / ((mx^2 + my^2 + C1)(vx + vy + C2))
+        XMVECTOR num = XMVectorMultiply( XMVectorMultiplyAdd( XMVectorAdd( mx, mx ), my, g_SSIM_C1 ),
+                                         XMVectorAdd( XMVectorAdd( cxy, cxy ), g_SSIM_C2 ) );
+        XMVECTOR den = XMVectorMultiply( XMVectorAdd( XMVectorMultiplyAdd( mx, mx, XMVectorMultiply( my, my ) ), g_SSIM_C1 ),
+                                         XMVectorAdd( XMVectorAdd( vx, vy ), g_SSIM_C2 ) );
+
+        float ssim[4];
+        XMStoreFloat4( reinterpret_cast<XMFLOAT4*>( ssim ), XMVectorMultiply( XMVectorDivide( num, den ), n ) );
+
+        float sqr[4];
+        XMStoreFloat4( reinterpret_cast<XMFLOAT4*>( sqr ), sum[ METRICS_SUM_DD ] );
+
+        for( size_t c = 0; c < 4; ++c )
+        {
+            band.ssim[ c ] += ssim[ c ];
+            band.sqr[ c ] += sqr[ c ];
+        }
+    }
+
+    XMStoreFloat4( reinterpret_cast<XMFLOAT4*>( band.maxError ), maxError );
+
+    return true;
+}
+
+//-------------------------------------------------------------------------------------
+// Points images at a decompressed copy in temp if they are BC compressed
+static HRESULT _DecompressForMetrics( _Inout_ const Image*& images, _In_ size_t nimages, _In_ const TexMetadata& metadata,
+                                      _In_ DWORD flags, _Inout_ ScratchImage& temp )
+{
+    if ( !IsCompressed( images[0].format ) )
+        return S_OK;
+
+    TexMetadata mdata2 = metadata;
+    mdata2.format = images[0].format;
+
+    HRESULT hr = Decompress( images, nimages, mdata2, DXGI_FORMAT_UNKNOWN, flags, temp );
+    if ( FAILED(hr) )
+        return hr;
+
+    if ( temp.GetImageCount() != nimages )
+        return E_FAIL;
+
+    images = temp.GetImages();
+    return ( images ) ? S_OK : E_POINTER;
+}
+
+
 //=====================================================================================
 // Entry points
 //=====================================================================================
@@ -351,4 +529,161 @@ HRESULT ComputeMSE( const Image& image1, const Image& image2, float& mse, float*
     }
 }
 
+
+//-------------------------------------------------------------------------------------
+// Computes the MSE, PSNR, largest error & SSIM of each channel between two images
+//-------------------------------------------------------------------------------------
+_Use_decl_annotations_
+HRESULT ComputeMetrics( const Image& image1, const Image& image2, ImageMetrics& metrics, DWORD flags, size_t nthreads )
+{
+    TexMetadata mdata = {};
+    mdata.width = image1.width;
+    mdata.height = image1.height;
+    mdata.depth = mdata.arraySize = mdata.mipLevels = 1;
+    mdata.format = image1.format;
+    mdata.dimension = TEX_DIMENSION_TEXTURE2D;
+
+    return ComputeMetrics( &image1, &image2, 1, mdata, &metrics, flags, nthreads );
+}
+
+_Use_decl_annotations_
+HRESULT ComputeMetrics( const Image* images1, const Image* images2, size_t nimages, const TexMetadata& metadata,
+                        ImageMetrics* metrics, DWORD flags, size_t nthreads )
+{
+    if ( !images1 || !images2 || !nimages || !metrics || !metadata.mipLevels )
+        return E_INVALIDARG;
+
+    memset( metrics, 0, sizeof(ImageMetrics) * metadata.mipLevels );
+
+    // Mip level of each image
+    std::vector<size_t> levels( nimages, size_t(-1) );
+    size_t depth = metadata.depth;
+    for( size_t mip = 0; mip < metadata.mipLevels; ++mip )
+    {
+        for( size_t item = 0; item < metadata.arraySize; ++item )
+        {
+            for( size_t slice = 0; slice < depth; ++slice )
+            {
+                size_t index = metadata.ComputeIndex( mip, item, slice );
+                if ( index >= nimages )
+                    return E_INVALIDARG;
+
+                levels[ index ] = mip;
+            }
+        }
+
+        if ( depth > 1 )
+            depth >>= 1;
+    }
+
+    for( size_t index = 0; index < nimages; ++index )
+    {
+        const Image& img1 = images1[ index ];
+        const Image& img2 = images2[ index ];
+
+        if ( !img1.pixels || !img2.pixels )
+            return E_POINTER;
+
+        if ( levels[ index ] == size_t(-1) || img1.width != img2.width || img1.height != img2.height
+             || IsCompressed( img1.format ) != IsCompressed( images1[0].format )
+             || IsCompressed( img2.format ) != IsCompressed( images2[0].format ) )
+            return E_INVALIDARG;
+
+        if ( IsPlanar( img1.format ) || IsPlanar( img2.format )
+             || IsPalettized( img1.format ) || IsPalettized( img2.format ) )
+            return HRESULT_FROM_WIN32( ERROR_NOT_SUPPORTED );
+    }
+
+    // BC images are compared in the format they decompress to by default
+    const DWORD dflags = ( nthreads == 1 ) ? TEX_DECOMPRESS_DEFAULT : ( TEX_DECOMPRESS_PARALLEL | CompressThreads( nthreads ) );
+
+    ScratchImage temp1;
+    HRESULT hr = _DecompressForMetrics( images1, nimages, metadata, dflags, temp1 );
+    if ( FAILED(hr) )
+        return hr;
+
+    ScratchImage temp2;
+    hr = _DecompressForMetrics( images2, nimages, metadata, dflags, temp2 );
+    if ( FAILED(hr) )
+        return hr;
+
+    // Every band of METRICS_WINDOW rows of every image is a task
+    std::vector<std::pair<uint32_t, uint32_t>> bands;
+    size_t scratchSize = 0;
+    for( size_t index = 0; index < nimages; ++index )
+    {
+        const size_t width = images1[ index ].width;
+        scratchSize = std::max<size_t>( scratchSize, width * 2 + ( ( width + METRICS_WINDOW - 1 ) / METRICS_WINDOW ) * METRICS_SUM_COUNT );
+
+        for( size_t y = 0; y < images1[ index ].height; y += METRICS_WINDOW )
+            bands.push_back( std::make_pair( static_cast<uint32_t>( index ), static_cast<uint32_t>( y ) ) );
+    }
+
+    std::vector<_MetricsBand> results( bands.size() );
+    std::vector<ScopedAlignedArrayXMVECTOR> scratch( _ParallelThreadCount( nthreads, bands.size() ) );
+
+    std::atomic<bool> fail( false );
+
+    _ParallelFor( nthreads, bands.size(), [&]( size_t task, size_t thread )
+    {
+        if ( fail )
+            return;
+
+        auto& buffer = scratch[ thread ];
+        if ( !buffer )
+            buffer.reset( reinterpret_cast<XMVECTOR*>( _aligned_malloc( sizeof(XMVECTOR) * scratchSize, 16 ) ) );
+
+        const Image& img1 = images1[ bands[ task ].first ];
+        const Image& img2 = images2[ bands[ task ].first ];
+
+        // Flags implied from image formats
+        DWORD iflags = flags | _GetImpliedMSEFlags( img1.format, CMSE_IMAGE1_SRGB ) | _GetImpliedMSEFlags( img2.format, CMSE_IMAGE2_SRGB );
+
+        if ( !buffer || !_ComputeMetricsBand( img1, img2, bands[ task ].second, iflags, buffer.get(), results[ task ] ) )
+            fail = true;
+    } );
+
+    if ( fail )
+        return E_FAIL;
+
+    // Bands are added up in order so the result is the same for any number of threads
+    std::vector<_MetricsBand> totals( metadata.mipLevels );
+
+    std::vector<double> texels( metadata.mipLevels, 0.0 );
+    for( size_t index = 0; index < nimages; ++index )
+    {
+        texels[ levels[ index ] ] += double( images1[ index ].width ) * double( images1[ index ].height );
+    }
+
+    for( size_t task = 0; task < bands.size(); ++task )
+    {
+        const _MetricsBand& band = results[ task ];
+        _MetricsBand& total = totals[ levels[ bands[ task ].first ] ];
+
+        for( size_t c = 0; c < 4; ++c )
+        {
+            total.sqr[ c ] += band.sqr[ c ];
+            total.ssim[ c ] += band.ssim[ c ];
+            total.maxError[ c ] = std::max( total.maxError[ c ], band.maxError[ c ] );
+        }
+    }
+
+    for( size_t mip = 0; mip < metadata.mipLevels; ++mip )
+    {
+        if ( !texels[ mip ] )
+            continue;
+
+        for( size_t c = 0; c < 4; ++c )
+        {
+            // PSNR = 10 log10( 1 / MSE ), which is infinite for channels that match
+            metrics[ mip ].mse[ c ] = float( totals[ mip ].sqr[ c ] / texels[ mip ] );
+            metrics[ mip ].psnr[ c ] = -10.f * log10f( metrics[ mip ].mse[ c ] );
+            metrics[ mip ].maxError[ c ] = totals[ mip ].maxError[ c ];
+            metrics[ mip ].ssim[ c ] = float( totals[ mip ].ssim[ c ] / texels[ mip ] );
+        }
+    }
+
+    return S_OK;
+}
+
 }; // namespace
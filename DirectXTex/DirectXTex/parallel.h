@@ -0,0 +1,165 @@
+//-------------------------------------------------------------------------------------
+// parallel.h
+//
+// Utility header with a work-stealing parallel loop built on C++11 threads
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//-------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <thread>
+#include <vector>
+
+namespace DirectX
+{
+
+//---------------------------------------------------------------------------------
+// A contiguous range of tasks owned by one thread. The owner takes tasks from the
+// front; other threads steal half of what's left from the back.
+class _TaskQueue
+{
+public:
+    _TaskQueue() : m_range( 0 ) {}
+
+    void Reset( size_t first, size_t end )
+    {
+        assert( first <= end && end <= UINT32_MAX );
+        m_range.store( Pack( first, end ) );
+    }
+
+    bool Pop( _Out_ size_t& task )
+    {
+        uint64_t range = m_range.load();
+        for(;;)
+        {
+            size_t first = First( range );
+            size_t end = End( range );
+            if ( first >= end )
+                return false;
+
+            if ( m_range.compare_exchange_weak( range, Pack( first + 1, end ) ) )
+            {
+                task = first;
+                return true;
+            }
+        }
+    }
+
+    // Moves the back half of the victim's tasks to this queue, which must be empty
+    bool Steal( _Inout_ _TaskQueue& victim )
+    {
+        uint64_t range = victim.m_range.load();
+        for(;;)
+        {
+            size_t first = First( range );
+            size_t end = End( range );
+            if ( first >= end )
+                return false;
+
+            size_t split = end - ( end - first + 1 ) / 2;
+            if ( victim.m_range.compare_exchange_weak( range, Pack( first, split ) ) )
+            {
+                Reset( split, end );
+                return true;
+            }
+        }
+    }
+
+private:
+    static uint64_t Pack( size_t first, size_t end ) { return uint64_t( first ) | ( uint64_t( end ) << 32 ); }
+    static size_t First( uint64_t range ) { return size_t( range & UINT32_MAX ); }
+    static size_t End( uint64_t range ) { return size_t( range >> 32 ); }
+
+    std::atomic<uint64_t> m_range;
+
+    // Keeps each thread's queue on its own cache line
+    uint8_t m_pad[ 64 - sizeof(std::atomic<uint64_t>) ];
+};
+
+
+//---------------------------------------------------------------------------------
+// Number of threads _ParallelFor will use; 0 asks for one per hardware thread
+inline size_t _ParallelThreadCount( size_t nthreads, size_t ntasks )
+{
+    if ( !nthreads )
+        nthreads = std::max<size_t>( 1, std::thread::hardware_concurrency() );
+
+    return std::max<size_t>( 1, std::min<size_t>( nthreads, ntasks ) );
+}
+
+
+//---------------------------------------------------------------------------------
+// Calls fn( task, thread ) once for every task in [0, ntasks), spread over nthreads
+// threads including the calling one. thread is below _ParallelThreadCount( nthreads,
+// ntasks ), with 0 for the calling thread, so the caller can keep per-thread state.
+// Each thread starts on an equal share of the tasks and then steals from the others
+// until none are left, so the tasks must not depend on the order they run in.
+template<class Fn>
+void _ParallelFor( size_t nthreads, size_t ntasks, Fn fn )
+{
+    nthreads = _ParallelThreadCount( nthreads, ntasks );
+
+    std::unique_ptr<_TaskQueue[]> queues;
+    if ( nthreads > 1 )
+        queues.reset( new (std::nothrow) _TaskQueue[ nthreads ] );
+
+    if ( !queues )
+    {
+        for( size_t task = 0; task < ntasks; ++task )
+            fn( task, 0 );
+        return;
+    }
+
+    for( size_t i = 0; i < nthreads; ++i )
+        queues[ i ].Reset( ntasks * i / nthreads, ntasks * ( i + 1 ) / nthreads );
+
+    auto worker = [&]( size_t self )
+    {
+        for(;;)
+        {
+            size_t task;
+            while ( queues[ self ].Pop( task ) )
+                fn( task, self );
+
+            bool stolen = false;
+            for( size_t i = 1; i < nthreads && !stolen; ++i )
+                stolen = queues[ self ].Steal( queues[ ( self + i ) % nthreads ] );
+
+            if ( !stolen )
+                return;
+        }
+    };
+
+    // If a thread can't be started, the others steal its share
+    std::vector<std::thread> threads;
+    for( size_t i = 1; i < nthreads; ++i )
+    {
+        try
+        {
+            threads.emplace_back( worker, i );
+        }
+        catch( ... )
+        {
+            break;
+        }
+    }
+
+    worker( 0 );
+
+    for( auto it = threads.begin(); it != threads.end(); ++it )
+        it->join();
+}
+
+}; // namespace
@@ -64,8 +64,21 @@ enum OPTIONS    // Note: dwOptions below assumes 64 or less options.
     OPT_COMPRESS_UNIFORM,
     OPT_COMPRESS_MAX,
     OPT_COMPRESS_DITHER,
+    OPT_COMPRESS_FAST,
+    OPT_COMPRESS_SCALAR,
+    OPT_COMPRESS_BC7_QUALITY,
+    OPT_COMPRESS_RDO,
+    OPT_COMPRESS_RDO_MAX_ERROR,
+    OPT_COMPRESS_AUTO,
+    OPT_COMPRESS_AUTO_MAX_ERROR,
     OPT_WIC_QUALITY,
     OPT_WIC_LOSSLESS,
+    OPT_CACHE,
+    OPT_CACHE_SIZE,
+    OPT_THREADS,
+    OPT_STREAM,
+    OPT_METRICS,
+    OPT_THREAD_SWEEP,
     OPT_MAX
 };
 
@@ -77,6 +90,24 @@ struct SConversion
     wchar_t szDest[MAX_PATH];
 };
 
+// Settings that change the converted image, other than those in TexCacheParams
+struct SCacheSettings
+{
+    DWORD64 dwOptions;
+    size_t width;
+    size_t height;
+    DWORD dwCompress;
+    DWORD dwNormalMap;
+    DWORD FileType;
+    DWORD maxSize;
+    float alphaWeight;
+    float nmapAmplitude;
+    float rdoLambda;
+    float rdoMaxError;
+    float autoPSNR;
+    float autoMaxError;
+};
+
 struct SValue
 {
     LPCWSTR pName;
@@ -124,8 +155,21 @@ SValue g_pOptions[] =
     { L"bcuniform",     OPT_COMPRESS_UNIFORM },
     { L"bcmax",         OPT_COMPRESS_MAX },
     { L"bcdither",      OPT_COMPRESS_DITHER },
+    { L"bcfast",        OPT_COMPRESS_FAST },
+    { L"nosimd",        OPT_COMPRESS_SCALAR },
+    { L"bc7q",          OPT_COMPRESS_BC7_QUALITY },
+    { L"rdo",           OPT_COMPRESS_RDO },
+    { L"rdomaxerr",     OPT_COMPRESS_RDO_MAX_ERROR },
+    { L"bcauto",        OPT_COMPRESS_AUTO },
+    { L"bcautoerr",     OPT_COMPRESS_AUTO_MAX_ERROR },
     { L"wicq",          OPT_WIC_QUALITY },
     { L"wiclossless",   OPT_WIC_LOSSLESS },
+    { L"cache",         OPT_CACHE },
+    { L"cachemb",       OPT_CACHE_SIZE },
+    { L"threads",       OPT_THREADS },
+    { L"stream",        OPT_STREAM },
+    { L"metrics",       OPT_METRICS },
+    { L"threadsweep",   OPT_THREAD_SWEEP },
     { nullptr,          0             }
 };
 
@@ -491,18 +535,38 @@ void PrintUsage()
     wprintf( L"\n                       (DDS output only)\n");
     wprintf( L"   -dx10               Force use of 'DX10' extended header\n");
     wprintf( L"\n   -nologo             suppress copyright message\n");
-    wprintf( L"   -timing             Display elapsed processing time\n\n");
-#ifdef _OPENMP
-    wprintf( L"   -singleproc         Do not use multi-threaded compression\n");
-#endif
+    wprintf( L"   -timing             Display elapsed processing time & compression throughput\n");
+    wprintf( L"   -nosimd             Encode BC1 & BC4/5 one block at a time, to compare -timing\n"
+             L"                       throughput with the SSE4.1/AVX2 batch encoders\n\n");
+    wprintf( L"   -singleproc         Do not use multi-threaded compression or decompression\n");
+    wprintf( L"   -threads <count>    Number of threads for (de)compression (defaults to one per hardware thread)\n");
+    wprintf( L"   -threadsweep        Time the CPU decompression & compression of each texture with 1, 2, 4, ...\n"
+             L"                       threads up to one per hardware thread, reporting Mpixels/s & the speedup\n"
+             L"                       over one thread\n");
     wprintf( L"   -nogpu              Do not use DirectCompute-based codecs\n");
+    wprintf( L"   -stream             Generate mips with the box filter while compressing, so the uncompressed\n"
+             L"                       mip chain is never built; the source image is still held in full\n"
+             L"                       (power-of-2 2D textures, CPU codec)\n");
     wprintf( L"   -bcuniform          Use uniform rather than perceptual weighting for BC1-3\n");
     wprintf( L"   -bcdither           Use dithering for BC1-3\n");
     wprintf( L"   -bcmax              Use exchaustive compression (BC7 only)\n");
+    wprintf( L"   -bcfast             Use fast, lower quality compression for BC1-3 & BC6H\n");
+    wprintf( L"   -bc7q <level>       BC7 CPU compression quality from 0 (quickest) to 6 (the default)\n");
+    wprintf( L"   -rdo <lambda>       Trade quality for smaller files after LZ compression (BC1, BC3 & BC7 CPU codec)\n"
+             L"                       with lambda the squared error per bit saved, such as 16\n");
+    wprintf( L"   -rdomaxerr <rms>    Maximum RMS error per block -rdo may go up to, in 8 bit units (defaults to 8)\n");
+    wprintf( L"   -bcauto <psnr>      Pick the smallest of BC1, BC3 & BC7 for each texture that keeps\n"
+             L"                       its PSNR at psnr dB or better, such as 40 (in place of -f);\n"
+             L"                       BC7 picks are encoded with the CPU codec they were trialed with\n");
+    wprintf( L"   -bcautoerr <rms>    Maximum RMS error per block for -bcauto, in 8 bit units\n");
+    wprintf( L"   -metrics            Report PSNR, MSE, max error & SSIM of each channel & mip of the result\n"
+             L"                       against the texture before conversion or compression to its format\n");
     wprintf( L"   -wicq <quality>     When writing images with WIC use quality (0.0 to 1.0)\n");
     wprintf( L"   -wiclossless        When writing images with WIC use lossless mode\n");
     wprintf( L"   -aw <weight>        BC7 GPU compressor weighting for alpha error metric\n"
              L"                       (defaults to 1.0)\n" );
+    wprintf( L"   -cache <directory>  reuse results of earlier runs with the same source & options\n");
+    wprintf( L"   -cachemb <n>        maximum size of the cache in megabytes (defaults to 1024)\n");
 
     wprintf( L"\n");
     wprintf( L"   <format>: ");
@@ -645,6 +709,261 @@ void FitPowerOf2( size_t origx, size_t origy, size_t& targetx, size_t& targety,
 }
 
 
+//--------------------------------------------------------------------------------------
+// Writes the converted image next to (or under the prefix of) its source file
+//--------------------------------------------------------------------------------------
+HRESULT SaveResult( const ScratchImage& image, const TexMetadata& info, SConversion& conv, const wchar_t* szPrefix, const wchar_t* szSuffix,
+                    DWORD FileType, DWORD64 dwOptions, float wicQuality, bool wicLossless )
+{
+    HRESULT hr = E_FAIL;
+
+    auto img = image.GetImage(0,0,0);
+    assert( img );
+    size_t nimg = image.GetImageCount();
+
+    PrintInfo( info );
+    wprintf( L"\n");
+
+    // Figure out dest filename
+    wchar_t *pchSlash, *pchDot;
+
+    wcscpy_s(conv.szDest, MAX_PATH, szPrefix);
+
+    pchSlash = wcsrchr(conv.szSrc, L'\\');
+    if(pchSlash != 0)
+        wcscat_s(conv.szDest, MAX_PATH, pchSlash + 1);
+    else
+        wcscat_s(conv.szDest, MAX_PATH, conv.szSrc);
+
+    pchSlash = wcsrchr(conv.szDest, '\\');
+    pchDot = wcsrchr(conv.szDest, '.');
+
+    if(pchDot > pchSlash)
+        *pchDot = 0;
+
+    wcscat_s(conv.szDest, MAX_PATH, szSuffix);
+
+    // Write texture
+    wprintf( L"writing %ls", conv.szDest);
+    fflush(stdout);
+
+    switch( FileType )
+    {
+    case CODEC_DDS:
+        hr = SaveToDDSFile( img, nimg, info,
+                            (dwOptions & (DWORD64(1) << OPT_USE_DX10) ) ? (DDS_FLAGS_FORCE_DX10_EXT|DDS_FLAGS_FORCE_DX10_EXT_MISC2) : DDS_FLAGS_NONE, 
+                            conv.szDest );
+        break;
+
+    case CODEC_TGA:
+        hr = SaveToTGAFile( img[0], conv.szDest );
+        break;
+
+    default:
+        {
+            WICCodecs codec = (FileType == CODEC_HDP || FileType == CODEC_JXR) ? WIC_CODEC_WMP : static_cast<WICCodecs>(FileType);
+            hr = SaveToWICFile( img, nimg, WIC_FLAGS_ALL_FRAMES, GetWICCodec(codec), conv.szDest, nullptr,
+                [&](IPropertyBag2* props)
+            {
+                switch (FileType)
+                {
+                case WIC_CODEC_JPEG:
+                    if (wicLossless || wicQuality >= 0.f)
+                    {
+                        PROPBAG2 options = {};
+                        VARIANT varValues = {};
+                        options.pstrName = L"ImageQuality";
+                        varValues.vt = VT_R4;
+                        varValues.fltVal = (wicLossless) ? 1.f : wicQuality;
+                        (void)props->Write(1, &options, &varValues);
+                    }
+                    break;
+
+                case WIC_CODEC_TIFF:
+                    {
+                        PROPBAG2 options = {};
+                        VARIANT varValues = {};
+                        if (wicLossless)
+                        {
+                            options.pstrName = L"TiffCompressionMethod";
+                            varValues.vt = VT_UI1;
+                            varValues.bVal = WICTiffCompressionNone;
+                        }
+                        else if (wicQuality >= 0.f)
+                        {
+                            options.pstrName = L"CompressionQuality";
+                            varValues.vt = VT_R4;
+                            varValues.fltVal = wicQuality;
+                        }
+                        (void)props->Write(1, &options, &varValues);
+                    }
+                    break;
+
+                case WIC_CODEC_WMP:
+                case CODEC_HDP:
+                case CODEC_JXR:
+                    {
+                        PROPBAG2 options = {};
+                        VARIANT varValues = {};
+                        if (wicLossless)
+                        {
+                            options.pstrName = L"Lossless";
+                            varValues.vt = VT_BOOL;
+                            varValues.bVal = TRUE;
+                        }
+                        else if (wicQuality >= 0.f)
+                        {
+                            options.pstrName = L"ImageQuality";
+                            varValues.vt = VT_R4;
+                            varValues.fltVal = wicQuality;
+                        }
+                        (void)props->Write(1, &options, &varValues);
+                    }
+                    break;
+                }
+            });
+        }
+        break;
+    }
+
+    return hr;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Adds a texture that -bcauto picked the format of to the totals, along with the size
+// it would have been as BC7
+//--------------------------------------------------------------------------------------
+struct SAutoTotals
+{
+    size_t count[3];    // BC1, BC3, BC7
+    uint64_t bytes;
+    uint64_t bc7Bytes;
+};
+
+void TallyAutoFormat( const ScratchImage& image, DXGI_FORMAT format, SAutoTotals& totals )
+{
+    size_t index;
+    switch( format )
+    {
+    case DXGI_FORMAT_BC1_UNORM:
+    case DXGI_FORMAT_BC1_UNORM_SRGB:    index = 0; break;
+    case DXGI_FORMAT_BC3_UNORM:
+    case DXGI_FORMAT_BC3_UNORM_SRGB:    index = 1; break;
+    case DXGI_FORMAT_BC7_UNORM:
+    case DXGI_FORMAT_BC7_UNORM_SRGB:    index = 2; break;
+    default:                            return;
+    }
+
+    ++totals.count[ index ];
+    totals.bytes += image.GetPixelsSize();
+    totals.bc7Bytes += ( index == 0 ) ? image.GetPixelsSize() * 2 : image.GetPixelsSize();
+}
+
+
+//--------------------------------------------------------------------------------------
+// Times fn( nthreads ) for 1, 2, 4, ... threads up to one per hardware thread, reporting the
+// throughput over pixels & the speedup over one thread
+template<class Fn>
+void PrintThreadSweep( LPCWSTR name, size_t pixels, const LARGE_INTEGER& qpcFreq, Fn fn )
+{
+    if ( !qpcFreq.QuadPart || !pixels )
+        return;
+
+    SYSTEM_INFO sysInfo;
+    GetSystemInfo( &sysInfo );
+
+    size_t maxThreads = sysInfo.dwNumberOfProcessors;
+    if ( maxThreads < 1 )
+        maxThreads = 1;
+    if ( maxThreads > TEX_COMPRESS_THREADS_MASK )
+        maxThreads = TEX_COMPRESS_THREADS_MASK;
+
+    double baseRate = 0;
+    size_t nthreads = 1;
+    for(;;)
+    {
+        LARGE_INTEGER qpcBegin, qpcEnd;
+        if ( !QueryPerformanceCounter( &qpcBegin ) )
+            return;
+
+        HRESULT hr = fn( nthreads );
+        if ( FAILED(hr) )
+        {
+            wprintf( L"\n   %ls with %Iu threads FAILED (%x)", name, nthreads, hr );
+            return;
+        }
+
+        if ( !QueryPerformanceCounter( &qpcEnd ) )
+            return;
+
+        double seconds = double(qpcEnd.QuadPart - qpcBegin.QuadPart) / double(qpcFreq.QuadPart);
+        double rate = ( seconds > 0 ) ? double(pixels) / seconds / 1000000.0 : 0;
+        if ( nthreads == 1 )
+            baseRate = rate;
+
+        wprintf( L"\n   %ls with %3Iu threads: %8.1f Mpixels/s, %5.2fx", name, nthreads, rate, ( baseRate > 0 ) ? rate / baseRate : 0 );
+
+        if ( nthreads >= maxThreads )
+            break;
+
+        nthreads = ( nthreads * 2 < maxThreads ) ? nthreads * 2 : maxThreads;
+    }
+}
+
+
+void PrintMetrics( const ScratchImage& result, const ScratchImage& reference, size_t nthreads )
+{
+    auto& info = result.GetMetadata();
+    auto& rinfo = reference.GetMetadata();
+
+    if ( info.width != rinfo.width || info.height != rinfo.height || info.depth != rinfo.depth
+         || info.arraySize != rinfo.arraySize || info.mipLevels != rinfo.mipLevels || info.dimension != rinfo.dimension )
+    {
+        wprintf( L"\n   metrics skipped: result (%Iux%Iux%Iu, %Iu items, %Iu mips) doesn't line up with the reference (%Iux%Iux%Iu, %Iu items, %Iu mips)",
+                 info.width, info.height, info.depth, info.arraySize, info.mipLevels,
+                 rinfo.width, rinfo.height, rinfo.depth, rinfo.arraySize, rinfo.mipLevels );
+        return;
+    }
+
+    std::unique_ptr<ImageMetrics[]> metrics( new (std::nothrow) ImageMetrics[ info.mipLevels ] );
+    if ( !metrics )
+    {
+        wprintf( L" FAILED [metrics] (%x)", E_OUTOFMEMORY );
+        return;
+    }
+
+    // A channel the result doesn't store isn't compared
+    DWORD flags = HasAlpha( info.format ) ? CMSE_DEFAULT : CMSE_IGNORE_ALPHA;
+
+    HRESULT hr = ComputeMetrics( reference.GetImages(), result.GetImages(), result.GetImageCount(), rinfo, metrics.get(), flags, nthreads );
+    if ( FAILED(hr) )
+    {
+        wprintf( L" FAILED [metrics] (%x)", hr );
+        return;
+    }
+
+    wprintf( L"\n   metrics for R/G/B/A:" );
+    size_t width = info.width;
+    size_t height = info.height;
+    for( size_t mip = 0; mip < info.mipLevels; ++mip )
+    {
+        const ImageMetrics& m = metrics[ mip ];
+        wprintf( L"\n   mip %Iu (%Iux%Iu) PSNR %.2f/%.2f/%.2f/%.2f dB, MSE %.3g/%.3g/%.3g/%.3g, max error %.4f/%.4f/%.4f/%.4f, SSIM %.4f/%.4f/%.4f/%.4f",
+                 mip, width, height,
+                 m.psnr[0], m.psnr[1], m.psnr[2], m.psnr[3],
+                 m.mse[0], m.mse[1], m.mse[2], m.mse[3],
+                 m.maxError[0], m.maxError[1], m.maxError[2], m.maxError[3],
+                 m.ssim[0], m.ssim[1], m.ssim[2], m.ssim[3] );
+
+        if ( width > 1 )
+            width >>= 1;
+        if ( height > 1 )
+            height >>= 1;
+    }
+}
+
+
 //--------------------------------------------------------------------------------------
 // Entry-point
 //--------------------------------------------------------------------------------------
@@ -666,16 +985,24 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
     float alphaWeight = 1.f;
     DWORD dwNormalMap = 0;
     float nmapAmplitude = 1.f;
+    float rdoLambda = 0.f;
+    float rdoMaxError = 8.f;
+    float autoPSNR = 0.f;
+    float autoMaxError = 0.f;
     float wicQuality = -1.f;
     bool wicLossless = false;
+    DWORD cacheMB = 1024;
+    size_t threadCount = 0;
 
     wchar_t szPrefix   [MAX_PATH];
     wchar_t szSuffix   [MAX_PATH];
     wchar_t szOutputDir[MAX_PATH];
+    wchar_t szCacheDir [MAX_PATH];
 
     szPrefix[0]    = 0;
     szSuffix[0]    = 0;
     szOutputDir[0] = 0;
+    szCacheDir[0]  = 0;
 
     // Initialize COM (needed for WIC)
     HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
@@ -729,7 +1056,15 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
             case OPT_ALPHA_WEIGHT:
             case OPT_NORMAL_MAP:
             case OPT_NORMAL_MAP_AMPLITUDE:
+            case OPT_COMPRESS_BC7_QUALITY:
+            case OPT_COMPRESS_RDO:
+            case OPT_COMPRESS_RDO_MAX_ERROR:
+            case OPT_COMPRESS_AUTO:
+            case OPT_COMPRESS_AUTO_MAX_ERROR:
             case OPT_WIC_QUALITY:
+            case OPT_CACHE:
+            case OPT_CACHE_SIZE:
+            case OPT_THREADS:
                 if (!*pValue)
                 {
                     if ((iArg + 1 >= argc))
@@ -976,6 +1311,74 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
                 dwCompress |= TEX_COMPRESS_DITHER;
                 break;
 
+            case OPT_COMPRESS_FAST:
+                dwCompress |= TEX_COMPRESS_FAST;
+                break;
+
+            case OPT_COMPRESS_SCALAR:
+                dwCompress |= TEX_COMPRESS_SCALAR;
+                break;
+
+            case OPT_COMPRESS_BC7_QUALITY:
+                {
+                    size_t level = 0;
+                    if (swscanf_s(pValue, L"%Iu", &level) != 1
+                        || level >= BC7_QUALITY_LEVELS)
+                    {
+                        wprintf(L"Invalid value specified with -bc7q (%ls)\n", pValue);
+                        printf("\n");
+                        PrintUsage();
+                        return 1;
+                    }
+
+                    dwCompress = (dwCompress & ~TEX_COMPRESS_BC7_QUALITY_MASK) | BC7CompressQuality(level);
+                }
+                break;
+
+            case OPT_COMPRESS_RDO:
+                if (swscanf_s(pValue, L"%f", &rdoLambda) != 1
+                    || rdoLambda < 0.f)
+                {
+                    wprintf(L"Invalid value specified with -rdo (%ls)\n", pValue);
+                    wprintf(L"\n");
+                    PrintUsage();
+                    return 1;
+                }
+                break;
+
+            case OPT_COMPRESS_RDO_MAX_ERROR:
+                if (swscanf_s(pValue, L"%f", &rdoMaxError) != 1
+                    || rdoMaxError < 0.f)
+                {
+                    wprintf(L"Invalid value specified with -rdomaxerr (%ls)\n", pValue);
+                    wprintf(L"\n");
+                    PrintUsage();
+                    return 1;
+                }
+                break;
+
+            case OPT_COMPRESS_AUTO:
+                if (swscanf_s(pValue, L"%f", &autoPSNR) != 1
+                    || autoPSNR < 0.f)
+                {
+                    wprintf(L"Invalid value specified with -bcauto (%ls)\n", pValue);
+                    wprintf(L"\n");
+                    PrintUsage();
+                    return 1;
+                }
+                break;
+
+            case OPT_COMPRESS_AUTO_MAX_ERROR:
+                if (swscanf_s(pValue, L"%f", &autoMaxError) != 1
+                    || autoMaxError < 0.f)
+                {
+                    wprintf(L"Invalid value specified with -bcautoerr (%ls)\n", pValue);
+                    wprintf(L"\n");
+                    PrintUsage();
+                    return 1;
+                }
+                break;
+
             case OPT_WIC_QUALITY:
                 if (swscanf_s(pValue, L"%f", &wicQuality) != 1
                     || (wicQuality < 0.f)
@@ -991,6 +1394,32 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
             case OPT_WIC_LOSSLESS:
                 wicLossless = true;
                 break;
+
+            case OPT_CACHE:
+                wcscpy_s(szCacheDir, MAX_PATH, pValue);
+                break;
+
+            case OPT_CACHE_SIZE:
+                if (swscanf_s(pValue, L"%lu", &cacheMB) != 1)
+                {
+                    wprintf( L"Invalid value specified with -cachemb (%ls)\n", pValue);
+                    wprintf( L"\n");
+                    PrintUsage();
+                    return 1;
+                }
+                break;
+
+            case OPT_THREADS:
+                if (swscanf_s(pValue, L"%Iu", &threadCount) != 1
+                    || threadCount < 1
+                    || threadCount > TEX_COMPRESS_THREADS_MASK)
+                {
+                    wprintf( L"Invalid value specified with -threads (%ls)\n", pValue);
+                    wprintf( L"\n");
+                    PrintUsage();
+                    return 1;
+                }
+                break;
             }
         }
         else
@@ -1010,6 +1439,22 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
         return 0;
     }
 
+    if ( dwOptions & (DWORD64(1) << OPT_COMPRESS_AUTO) )
+    {
+        if ( format != DXGI_FORMAT_UNKNOWN )
+        {
+            wprintf( L"Can't use -f and -bcauto at same time\n\n");
+            PrintUsage();
+            return 1;
+        }
+    }
+    else if ( dwOptions & (DWORD64(1) << OPT_COMPRESS_AUTO_MAX_ERROR) )
+    {
+        wprintf( L"-bcautoerr requires -bcauto\n\n" );
+        PrintUsage();
+        return 1;
+    }
+
     if(~dwOptions & (DWORD64(1) << OPT_NOLOGO))
         PrintLogo();
 
@@ -1039,6 +1484,35 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
         mipLevels = 1;
     }
 
+    // Cache entries are keyed on the source file's bytes & every option that changes the converted image
+    SCacheSettings cacheSettings;
+    memset( &cacheSettings, 0, sizeof(cacheSettings) );
+    cacheSettings.dwOptions = dwOptions & ~( (DWORD64(1) << OPT_PREFIX) | (DWORD64(1) << OPT_SUFFIX) | (DWORD64(1) << OPT_OUTPUTDIR)
+                                           | (DWORD64(1) << OPT_NOLOGO) | (DWORD64(1) << OPT_TIMING) | (DWORD64(1) << OPT_FORCE_SINGLEPROC)
+                                           | (DWORD64(1) << OPT_THREADS) | (DWORD64(1) << OPT_WIC_QUALITY) | (DWORD64(1) << OPT_WIC_LOSSLESS)
+                                           | (DWORD64(1) << OPT_CACHE) | (DWORD64(1) << OPT_CACHE_SIZE) | (DWORD64(1) << OPT_METRICS)
+                                           | (DWORD64(1) << OPT_THREAD_SWEEP) );
+    cacheSettings.width = width;
+    cacheSettings.height = height;
+    cacheSettings.dwCompress = dwCompress;
+    cacheSettings.dwNormalMap = dwNormalMap;
+    cacheSettings.FileType = FileType;
+    cacheSettings.maxSize = maxSize;
+    cacheSettings.alphaWeight = alphaWeight;
+    cacheSettings.nmapAmplitude = nmapAmplitude;
+    cacheSettings.rdoLambda = rdoLambda;
+    cacheSettings.rdoMaxError = rdoMaxError;
+    cacheSettings.autoPSNR = autoPSNR;
+    cacheSettings.autoMaxError = autoMaxError;
+
+    TexCacheParams cacheParams = {};
+    cacheParams.format = format;
+    cacheParams.mipLevels = mipLevels;
+    cacheParams.filter = dwFilter | dwFilterOpts;
+    cacheParams.srgb = dwSRGB;
+    cacheParams.pExtra = &cacheSettings;
+    cacheParams.extraSize = sizeof(cacheSettings);
+
     LARGE_INTEGER qpcFreq;
     if ( !QueryPerformanceFrequency( &qpcFreq ) )
     {
@@ -1055,6 +1529,7 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
     // Convert images
     bool nonpow2warn = false;
     bool non4bc = false;
+    SAutoTotals autoTotals = {};
     ComPtr<ID3D11Device> pDevice;
 
     for( auto pConv = conversion.begin(); pConv != conversion.end(); ++pConv )
@@ -1070,6 +1545,36 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
         wchar_t fname[_MAX_FNAME];
         _wsplitpath_s( pConv->szSrc, nullptr, 0, nullptr, 0, fname, _MAX_FNAME, ext, _MAX_EXT );
 
+        // Reuse the result of an earlier conversion of the same source with the same options
+        TexCacheKey cacheKey = {};
+        bool cacheable = false;
+        if ( szCacheDir[0] )
+        {
+            cacheable = SUCCEEDED( ComputeTexCacheKeyFromFile( pConv->szSrc, cacheParams, cacheKey ) );
+
+            TexMetadata cinfo;
+            ScratchImage cimage;
+            // -metrics needs the texture before conversion, so always converts again
+            if ( cacheable && !( dwOptions & (DWORD64(1) << OPT_METRICS) )
+                 && SUCCEEDED( LoadFromTexCache( szCacheDir, cacheKey, &cinfo, cimage ) ) )
+            {
+                wprintf( L" (cached)" );
+
+                hr = SaveResult( cimage, cinfo, *pConv, szPrefix, szSuffix, FileType, dwOptions, wicQuality, wicLossless );
+                if ( FAILED(hr) )
+                {
+                    wprintf( L" FAILED (%x)\n", hr);
+                }
+                else
+                {
+                    if ( dwOptions & (DWORD64(1) << OPT_COMPRESS_AUTO) )
+                        TallyAutoFormat( cimage, cinfo.format, autoTotals );
+                    wprintf( L"\n");
+                }
+                continue;
+            }
+        }
+
         TexMetadata info;
         std::unique_ptr<ScratchImage> image( new (std::nothrow) ScratchImage );
 
@@ -1237,7 +1742,26 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
                 return 1;
             }
 
-            hr = Decompress( img, nimg, info, DXGI_FORMAT_UNKNOWN /* picks good default */, *timage );
+            if ( dwOptions & (DWORD64(1) << OPT_THREAD_SWEEP) )
+            {
+                size_t pixels = 0;
+                for( size_t i = 0; i < nimg; ++i )
+                {
+                    pixels += img[i].width * img[i].height;
+                }
+
+                PrintThreadSweep( L"decompress", pixels, qpcFreq, [&]( size_t nthreads ) -> HRESULT
+                {
+                    ScratchImage simage;
+                    return Decompress( img, nimg, info, DXGI_FORMAT_UNKNOWN, TEX_DECOMPRESS_PARALLEL | CompressThreads( nthreads ), simage );
+                });
+            }
+
+            DWORD dflags = TEX_DECOMPRESS_DEFAULT;
+            if ( !(dwOptions & (DWORD64(1) << OPT_FORCE_SINGLEPROC) ) )
+                dflags |= TEX_DECOMPRESS_PARALLEL | CompressThreads( threadCount );
+
+            hr = Decompress( img, nimg, info, DXGI_FORMAT_UNKNOWN /* picks good default */, dflags, *timage );
             if ( FAILED(hr) )
             {
                 wprintf( L" FAILED [decompress] (%x)\n", hr);
@@ -1351,6 +1875,10 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
         }
 
         // --- Convert -----------------------------------------------------------------
+        // For -metrics, the texture before conversion or compression to the output format; later steps are
+        // applied to it as well so it lines up with the result
+        std::unique_ptr<ScratchImage> reference;
+
         if ( dwOptions & (DWORD64(1) << OPT_NORMAL_MAP) )
         {
             std::unique_ptr<ScratchImage> timage( new (std::nothrow) ScratchImage );
@@ -1422,6 +1950,11 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
 
             image.swap( timage );
             cimage.reset();
+
+            if ( dwOptions & (DWORD64(1) << OPT_METRICS) )
+            {
+                reference.swap( timage );
+            }
         }
 
         // --- Generate mips -----------------------------------------------------------
@@ -1535,7 +2068,23 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
             }
         }
 
-        if ( ( !tMips || info.mipLevels != tMips ) && ( info.width > 1 || info.height > 1 || info.depth > 1 ) )
+        // -stream leaves the mips to be made along with the compression, when the box filter can be used;
+        // that avoids the uncompressed mip chain, but the source image stays loaded until it is compressed
+        bool streamMips = false;
+        if ( ( dwOptions & (DWORD64(1) << OPT_STREAM) )
+             && ( !tMips || info.mipLevels != tMips ) && ( info.width > 1 || info.height > 1 )
+             && ( IsCompressed( tformat ) || ( dwOptions & (DWORD64(1) << OPT_COMPRESS_AUTO) ) )
+             && ( FileType == CODEC_DDS )
+             && ( info.dimension == TEX_DIMENSION_TEXTURE2D ) && ( info.arraySize == 1 )
+             && ispow2(info.width) && ispow2(info.height)
+             && ( dwFilter == TEX_FILTER_DEFAULT || dwFilter == TEX_FILTER_BOX )
+             && !( dwOptions & (DWORD64(1) << OPT_PREMUL_ALPHA) ) )
+        {
+            streamMips = true;
+            cimage.reset();
+        }
+
+        if ( !streamMips && ( !tMips || info.mipLevels != tMips ) && ( info.width > 1 || info.height > 1 || info.depth > 1 ) )
         {
             std::unique_ptr<ScratchImage> timage( new (std::nothrow) ScratchImage );
             if ( !timage )
@@ -1572,6 +2121,26 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
 
             image.swap( timage );
             cimage.reset();
+
+            if ( reference )
+            {
+                // timage now holds the texture before mips, which isn't needed anymore
+                if ( info.dimension == TEX_DIMENSION_TEXTURE3D )
+                {
+                    hr = GenerateMipMaps3D( reference->GetImages(), reference->GetImageCount(), reference->GetMetadata(), dwFilter | dwFilterOpts, tMips, *timage );
+                }
+                else
+                {
+                    hr = GenerateMipMaps( reference->GetImages(), reference->GetImageCount(), reference->GetMetadata(), dwFilter | dwFilterOpts, tMips, *timage );
+                }
+                if ( FAILED(hr) )
+                {
+                    wprintf( L" FAILED [mipmaps] (%x)\n", hr);
+                    return 1;
+                }
+
+                reference.swap( timage );
+            }
         }
 
         // --- Premultiplied alpha (if requested) --------------------------------------
@@ -1617,9 +2186,52 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
 
                 image.swap( timage );
                 cimage.reset();
+
+                if ( reference && HasAlpha( reference->GetMetadata().format ) )
+                {
+                    hr = PremultiplyAlpha( reference->GetImages(), reference->GetImageCount(), reference->GetMetadata(), dwSRGB, *timage );
+                    if ( FAILED(hr) )
+                    {
+                        wprintf( L" FAILED [premultiply alpha] (%x)\n", hr);
+                        continue;
+                    }
+
+                    reference.swap( timage );
+                }
             }
         }
 
+        // --- Pick BC format ----------------------------------------------------------
+        bool autoFormat = false;
+        if ( (dwOptions & (DWORD64(1) << OPT_COMPRESS_AUTO)) && (FileType == CODEC_DDS) )
+        {
+            DWORD cflags = dwCompress;
+            if ( !(dwOptions & (DWORD64(1) << OPT_FORCE_SINGLEPROC) ) )
+            {
+                cflags |= TEX_COMPRESS_PARALLEL | CompressThreads( threadCount );
+            }
+
+            auto img = image->GetImage(0,0,0);
+            assert( img );
+
+            DXGI_FORMAT aformat;
+            float psnr = 0.f;
+            float error = 0.f;
+            hr = SelectBCFormat( *img, cflags | dwSRGB, 0.5f, autoPSNR, autoMaxError, aformat, &psnr, &error );
+            if ( FAILED(hr) )
+            {
+                wprintf( L" FAILED [bcauto] (%x)\n", hr);
+                continue;
+            }
+
+            const wchar_t* aname = LookupByValue( aformat, g_pFormats );
+            wprintf( L" [%ls %.1f dB, max block error %.1f%ls]", aname ? aname : L"?", psnr, error,
+                     ( hr == S_FALSE ) ? L", misses target" : L"" );
+
+            tformat = aformat;
+            autoFormat = true;
+        }
+
         // --- Compress ----------------------------------------------------------------
         if ( IsCompressed( tformat ) && (FileType == CODEC_DDS) )
         {
@@ -1663,12 +2275,18 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
                 bool bc6hbc7=false;
                 switch( tformat )
                 {
-                case DXGI_FORMAT_BC6H_TYPELESS:
-                case DXGI_FORMAT_BC6H_UF16:
-                case DXGI_FORMAT_BC6H_SF16:
                 case DXGI_FORMAT_BC7_TYPELESS:
                 case DXGI_FORMAT_BC7_UNORM:
                 case DXGI_FORMAT_BC7_UNORM_SRGB:
+                    // The DirectCompute codec has no rate-distortion optimization, and an auto picked
+                    // format was trialed with the CPU codec, whose quality the pick relies on
+                    if ( rdoLambda > 0.f || autoFormat )
+                        break;
+                    // fall through
+
+                case DXGI_FORMAT_BC6H_TYPELESS:
+                case DXGI_FORMAT_BC6H_UF16:
+                case DXGI_FORMAT_BC6H_SF16:
                     bc6hbc7=true;
 
                     {
@@ -1693,25 +2311,53 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
                 }
 
                 DWORD cflags = dwCompress;
-#ifdef _OPENMP
                 if ( !(dwOptions & (DWORD64(1) << OPT_FORCE_SINGLEPROC) ) )
                 {
-                    cflags |= TEX_COMPRESS_PARALLEL;
+                    cflags |= TEX_COMPRESS_PARALLEL | CompressThreads( threadCount );
                 }
-#endif
 
                 if ( (img->width % 4) != 0 || (img->height % 4) != 0 )
                 { 
                     non4bc = true;
                 }
 
-                if ( bc6hbc7 && pDevice )
+                if ( (dwOptions & (DWORD64(1) << OPT_THREAD_SWEEP)) && !( bc6hbc7 && pDevice && !streamMips ) )
+                {
+                    size_t pixels = 0;
+                    for( size_t i = 0; i < nimg; ++i )
+                    {
+                        pixels += img[i].width * img[i].height;
+                    }
+
+                    PrintThreadSweep( L"compress", pixels, qpcFreq, [&]( size_t nthreads ) -> HRESULT
+                    {
+                        DWORD sflags = dwCompress | TEX_COMPRESS_PARALLEL | CompressThreads( nthreads ) | dwSRGB;
+
+                        ScratchImage simage;
+                        if ( streamMips )
+                            return GenerateCompressedMipMaps( *img, dwFilter | dwFilterOpts, tMips, tformat, sflags, 0.5f, rdoLambda, rdoMaxError, simage );
+
+                        return Compress( img, nimg, info, tformat, sflags, 0.5f, rdoLambda, rdoMaxError, simage );
+                    });
+                }
+
+                LARGE_INTEGER qpcCompress;
+                if ( !QueryPerformanceCounter( &qpcCompress ) )
+                {
+                    qpcCompress.QuadPart = 0;
+                }
+
+                if ( streamMips )
+                {
+                    hr = GenerateCompressedMipMaps( *img, dwFilter | dwFilterOpts, tMips, tformat, cflags | dwSRGB, 0.5f, rdoLambda, rdoMaxError, *timage );
+                }
+                else if ( bc6hbc7 && pDevice )
                 {
                     hr = Compress( pDevice.Get(), img, nimg, info, tformat, dwCompress | dwSRGB, alphaWeight, *timage );
                 }
                 else
                 {
-                    hr = Compress( img, nimg, info, tformat, cflags | dwSRGB, 0.5f, *timage );
+                    hr = Compress( img, nimg, info, tformat, cflags | dwSRGB, 0.5f, rdoLambda, rdoMaxError, *timage );
                 }
                 if ( FAILED(hr) )
                 {
@@ -1719,9 +2365,32 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
                     continue;
                 }
 
+                if ( (dwOptions & (DWORD64(1) << OPT_TIMING)) && qpcFreq.QuadPart && qpcCompress.QuadPart )
+                {
+                    LARGE_INTEGER qpcEnd;
+                    if ( QueryPerformanceCounter( &qpcEnd ) )
+                    {
+                        size_t pixels = 0;
+                        for( size_t i = 0; i < nimg; ++i )
+                        {
+                            pixels += img[i].width * img[i].height;
+                        }
+
+                        double seconds = double(qpcEnd.QuadPart - qpcCompress.QuadPart) / double(qpcFreq.QuadPart);
+                        if ( seconds > 0 )
+                        {
+                            wprintf( L" [compress %.1f Mpixels/s]", double(pixels) / seconds / 1000000.0 );
+                        }
+                    }
+                }
+
                 auto& tinfo = timage->GetMetadata();
 
                 info.format = tinfo.format;
+                if ( streamMips )
+                {
+                    info.mipLevels = tinfo.mipLevels;
+                }
                 assert( info.width == tinfo.width );
                 assert( info.height == tinfo.height );
                 assert( info.depth == tinfo.depth );
@@ -1732,6 +2401,32 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
                 assert( info.dimension == tinfo.dimension );
 
                 image.swap( timage );
+
+                if ( ( dwOptions & (DWORD64(1) << OPT_METRICS) ) && !reference )
+                {
+                    if ( streamMips )
+                    {
+                        // The same box filtered mips GenerateCompressedMipMaps made while compressing
+                        std::unique_ptr<ScratchImage> mimage( new (std::nothrow) ScratchImage );
+                        if ( !mimage )
+                        {
+                            wprintf( L" ERROR: Memory allocation failed\n" );
+                            return 1;
+                        }
+
+                        hr = GenerateMipMaps( timage->GetImages(), timage->GetImageCount(), timage->GetMetadata(),
+                                              dwFilter | dwFilterOpts | TEX_FILTER_FORCE_NON_WIC, tMips, *mimage );
+                        if ( FAILED(hr) )
+                        {
+                            wprintf( L" FAILED [mipmaps] (%x)\n", hr);
+                            continue;
+                        }
+
+                        timage.swap( mimage );
+                    }
+
+                    reference.swap( timage );
+                }
             }
         }
         else
@@ -1743,7 +2438,9 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
         if ( HasAlpha( info.format )
              && info.format != DXGI_FORMAT_A8_UNORM )
         {
-            if ( image->IsAlphaAllOpaque() )
+            size_t nthreads = ( dwOptions & (DWORD64(1) << OPT_FORCE_SINGLEPROC) ) ? 1 : threadCount;
+
+            if ( image->IsAlphaAllOpaque( nthreads ) )
             {
                 info.SetAlphaMode(TEX_ALPHA_MODE_OPAQUE);
             }
@@ -1766,123 +2463,35 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
         }
 
         // --- Save result -------------------------------------------------------------
+        if ( cacheable )
         {
-            auto img = image->GetImage(0,0,0);
-            assert( img );
-            size_t nimg = image->GetImageCount();
-
-            PrintInfo( info );
-            wprintf( L"\n");
-
-            // Figure out dest filename
-            wchar_t *pchSlash, *pchDot;
-
-            wcscpy_s(pConv->szDest, MAX_PATH, szPrefix);
-
-            pchSlash = wcsrchr(pConv->szSrc, L'\\');
-            if(pchSlash != 0)
-                wcscat_s(pConv->szDest, MAX_PATH, pchSlash + 1);
-            else
-                wcscat_s(pConv->szDest, MAX_PATH, pConv->szSrc);
-
-            pchSlash = wcsrchr(pConv->szDest, '\\');
-            pchDot = wcsrchr(pConv->szDest, '.');
-
-            if(pchDot > pchSlash)
-                *pchDot = 0;
-
-            wcscat_s(pConv->szDest, MAX_PATH, szSuffix);
-
-            // Write texture
-            wprintf( L"writing %ls", pConv->szDest);
-            fflush(stdout);
-
-            switch( FileType )
+            hr = SaveToTexCache( szCacheDir, cacheKey, image->GetImages(), image->GetImageCount(), info, uint64_t(cacheMB) * 1024 * 1024 );
+            if ( FAILED(hr) )
             {
-            case CODEC_DDS:
-                hr = SaveToDDSFile( img, nimg, info,
-                                    (dwOptions & (DWORD64(1) << OPT_USE_DX10) ) ? (DDS_FLAGS_FORCE_DX10_EXT|DDS_FLAGS_FORCE_DX10_EXT_MISC2) : DDS_FLAGS_NONE, 
-                                    pConv->szDest );
-                break;
-
-            case CODEC_TGA:
-                hr = SaveToTGAFile( img[0], pConv->szDest );
-                break;
-
-            default:
-                {
-                    WICCodecs codec = (FileType == CODEC_HDP || FileType == CODEC_JXR) ? WIC_CODEC_WMP : static_cast<WICCodecs>(FileType);
-                    hr = SaveToWICFile( img, nimg, WIC_FLAGS_ALL_FRAMES, GetWICCodec(codec), pConv->szDest, nullptr,
-                        [&](IPropertyBag2* props)
-                    {
-                        switch (FileType)
-                        {
-                        case WIC_CODEC_JPEG:
-                            if (wicLossless || wicQuality >= 0.f)
-                            {
-                                PROPBAG2 options = {};
-                                VARIANT varValues = {};
-                                options.pstrName = L"ImageQuality";
-                                varValues.vt = VT_R4;
-                                varValues.fltVal = (wicLossless) ? 1.f : wicQuality;
-                                (void)props->Write(1, &options, &varValues);
-                            }
-                            break;
+                wprintf( L"\nWARNING: Failed to update texture cache (%x)\n", hr );
+            }
+        }
 
-                        case WIC_CODEC_TIFF:
-                            {
-                                PROPBAG2 options = {};
-                                VARIANT varValues = {};
-                                if (wicLossless)
-                                {
-                                    options.pstrName = L"TiffCompressionMethod";
-                                    varValues.vt = VT_UI1;
-                                    varValues.bVal = WICTiffCompressionNone;
-                                }
-                                else if (wicQuality >= 0.f)
-                                {
-                                    options.pstrName = L"CompressionQuality";
-                                    varValues.vt = VT_R4;
-                                    varValues.fltVal = wicQuality;
-                                }
-                                (void)props->Write(1, &options, &varValues);
-                            }
-                            break;
+        hr = SaveResult( *image, info, *pConv, szPrefix, szSuffix, FileType, dwOptions, wicQuality, wicLossless );
+        if ( FAILED(hr) )
+        {
+            wprintf( L" FAILED (%x)\n", hr);
+            continue;
+        }
 
-                        case WIC_CODEC_WMP:
-                        case CODEC_HDP:
-                        case CODEC_JXR:
-                            {
-                                PROPBAG2 options = {};
-                                VARIANT varValues = {};
-                                if (wicLossless)
-                                {
-                                    options.pstrName = L"Lossless";
-                                    varValues.vt = VT_BOOL;
-                                    varValues.bVal = TRUE;
-                                }
-                                else if (wicQuality >= 0.f)
-                                {
-                                    options.pstrName = L"ImageQuality";
-                                    varValues.vt = VT_R4;
-                                    varValues.fltVal = wicQuality;
-                                }
-                                (void)props->Write(1, &options, &varValues);
-                            }
-                            break;
-                        }
-                    });
-                }
-                break;
-            }
+        if ( dwOptions & (DWORD64(1) << OPT_COMPRESS_AUTO) )
+            TallyAutoFormat( *image, info.format, autoTotals );
 
-            if(FAILED(hr))
-            {
-                wprintf( L" FAILED (%x)\n", hr);
-                continue;
-            }
-            wprintf( L"\n");
+        if ( reference )
+        {
+            PrintMetrics( *image, *reference, ( dwOptions & (DWORD64(1) << OPT_FORCE_SINGLEPROC) ) ? 1 : threadCount );
+        }
+        else if ( dwOptions & (DWORD64(1) << OPT_METRICS) )
+        {
+            wprintf( L"\n   metrics skipped: the texture was neither converted nor compressed, so there is nothing to compare" );
         }
+
+        wprintf( L"\n");
     }
 
     if ( nonpow2warn )
@@ -1891,6 +2500,16 @@ int __cdecl wmain(_In_ int argc, _In_z_count_(argc) wchar_t* argv[])
     if ( non4bc )
         wprintf( L"\n WARNING: Direct3D requires BC image to be multiple of 4 in width & height\n" );
 
+    if ( autoTotals.bc7Bytes > 0 )
+    {
+        wprintf( L"\n -bcauto picked BC1 for %Iu, BC3 for %Iu & BC7 for %Iu textures\n",
+                 autoTotals.count[0], autoTotals.count[1], autoTotals.count[2] );
+        wprintf( L" %.2f MB in all, saving %.2f MB (%.1f%%) over BC7\n",
+                 double(autoTotals.bytes) / (1024.0 * 1024.0),
+                 double(autoTotals.bc7Bytes - autoTotals.bytes) / (1024.0 * 1024.0),
+                 100.0 * double(autoTotals.bc7Bytes - autoTotals.bytes) / double(autoTotals.bc7Bytes) );
+    }
+
     if(dwOptions & (DWORD64(1) << OPT_TIMING))
     {
         LARGE_INTEGER qpcEnd;
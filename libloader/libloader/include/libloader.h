@@ -60,6 +60,8 @@ typedef struct
   libload_obj_model_part_t* parts;
   libload_obj_vertex_t* vertices;
   uint32_t* indices;
+
+  void* mapped_file;  // non-null when vertices point directly into a mapped file
 } libload_obj_model_t;
 
 bool libload_obj_load(const char* filename, libload_obj_model_t** out_model);
@@ -67,6 +69,130 @@ bool libload_obj_compute_normals(libload_obj_model_t* model);
 bool libload_obj_compute_tangent_space(libload_obj_model_t* model);
 void libload_obj_free(libload_obj_model_t* model);
 
+typedef enum
+{
+  LIBLOAD_OBJ_OK = 0,
+  LIBLOAD_OBJ_ERROR_FILE,           // file couldn't be opened or read
+  LIBLOAD_OBJ_ERROR_OUT_OF_MEMORY,
+  LIBLOAD_OBJ_ERROR_PARSE,          // malformed or unsupported content
+} libload_obj_error_t;
+
+typedef struct
+{
+  libload_obj_model_t* model;       // null on failure. free with libload_obj_free
+  libload_obj_error_t error;
+} libload_obj_load_result_t;
+
+// loads many files concurrently on a pool of num_threads workers (0 to use one
+// per logical processor). each worker reuses its parsing buffers across files.
+// out_results must hold num_files entries, & is filled in the order of filenames.
+// returns true only if every file loaded.
+bool libload_obj_load_many(const char* const* filenames, uint32_t num_files, uint32_t num_threads, libload_obj_load_result_t* out_results);
+
+//=============================================================================
+// incremental reloading
+//=============================================================================
+
+// remembers the sections (runs of lines starting at each g / usemtl) of a
+// loaded file, so that a modified version can be patched in
+typedef struct libload_obj_reload_index_t libload_obj_reload_index_t;
+
+typedef struct
+{
+  uint32_t num_sections;
+  uint32_t reparsed_sections;   // sections whose text changed & were parsed again
+  uint32_t updated_vertices;    // model vertices rebuilt from changed attributes
+  bool full_reload;             // the changes couldn't be patched in place
+} libload_obj_reload_stats_t;
+
+bool libload_obj_load_for_reload(const char* filename, libload_obj_model_t** out_model, libload_obj_reload_index_t** out_index);
+
+// updates model to match the current contents of filename, re-parsing only the
+// sections that changed. changes that keep every section's v/vn/vt counts & face
+// topology (e.g. moved vertices, renamed materials) are patched in place;
+// anything else reloads the whole file into the same model. model must be
+// unmodified since loading, apart from recomputed normals & tangents (which
+// should be recomputed again after reloading). out_stats is optional.
+bool libload_obj_reload(const char* filename, libload_obj_model_t* model, libload_obj_reload_index_t* index, libload_obj_reload_stats_t* out_stats);
+void libload_obj_free_reload_index(libload_obj_reload_index_t* index);
+
+//=============================================================================
+// vertex welding
+//=============================================================================
+
+typedef struct
+{
+  float position_tolerance;   // max per-component position difference
+  float normal_tolerance;     // max per-component normal, tangent & bitangent difference
+  float texcoord_tolerance;   // max per-component texcoord difference
+  uint32_t num_threads;       // 0 to use one thread per logical processor
+} libload_obj_weld_options_t;
+
+typedef struct
+{
+  uint32_t source_vertices;
+  uint32_t welded_vertices;
+  float elapsed_ms;
+} libload_obj_weld_stats_t;
+
+// merges vertices that are equal within the given tolerances & remaps indices.
+// parts are welded independently & in parallel, so vertices are only merged
+// with other vertices used by the same part. indices before the first usemtl
+// form a part of their own. out_stats is optional.
+bool libload_obj_weld_vertices(libload_obj_model_t* model, const libload_obj_weld_options_t* options, libload_obj_weld_stats_t* out_stats);
+
+//=============================================================================
+// draw batching
+//=============================================================================
+
+typedef struct
+{
+  uint32_t source_draws;      // number of parts before batching
+  uint32_t batched_draws;     // number of parts after batching
+} libload_obj_batch_stats_t;
+
+// reorders indices so that all parts sharing a material form one contiguous
+// part. materials keep the order of their first use in the file & parts keep
+// their relative order, so the result is identical across reloads. indices not
+// covered by any part are moved to the front of the index buffer. out_stats is optional.
+bool libload_obj_batch_by_material(libload_obj_model_t* model, libload_obj_batch_stats_t* out_stats);
+
+//=============================================================================
+// geometry instancing
+//=============================================================================
+
+typedef struct
+{
+  libload_float3_t rotation[3];   // rows of the rotation matrix
+  libload_float3_t translation;   // world = rotation * local + translation
+} libload_rigid_transform_t;
+
+typedef struct
+{
+  char name[64];                  // name of the original part
+  char material_name[64];         // material of the original part
+  uint32_t mesh_index;            // index of the shared mesh in model->parts
+  libload_rigid_transform_t transform;
+} libload_obj_instance_t;
+
+typedef struct
+{
+  libload_obj_model_t* model;     // one part per unique mesh
+  uint32_t num_instances;         // one instance per part of the source model, plus
+                                  // one in front for any indices before its first part
+  libload_obj_instance_t* instances;
+
+  uint64_t source_bytes;          // vertex + index bytes of the source model
+  uint64_t instanced_bytes;       // vertex + index + instance bytes after instancing
+} libload_obj_instanced_model_t;
+
+// finds parts whose geometry matches up to a rigid transform & collapses them
+// into a single shared mesh. tolerance is the maximum allowed deviation of
+// positions, relative to the radius of the part (normals & texcoords use it as is).
+// indices before the first usemtl form an unnamed part of their own.
+bool libload_obj_find_instances(const libload_obj_model_t* model, float tolerance, libload_obj_instanced_model_t** out_instanced);
+void libload_obj_free_instanced(libload_obj_instanced_model_t* instanced);
+
 typedef struct
 {
   char name[64];        // name
@@ -92,6 +218,157 @@ typedef struct
 // can pass in 0 for num_materials and leave out_materials null to compute the number of materials needed.
 bool libload_mtl_load(const char* filename, uint32_t* inout_num_materials, libload_mtl_t* out_materials);
 
+//=============================================================================
+// support for binary PLY model files
+//=============================================================================
+
+// loads a binary little endian PLY file into the same model representation
+// used for OBJ files. vertices are only used in place (from a copy-on-write
+// mapping of the file) if the vertex element has exactly these 14 float
+// properties, in this order & 4 byte aligned in the file:
+//   x y z nx ny nz tx ty tz bx by bz u v
+// the texcoords may also be named s/t, texture_u/texture_v or texture_s/texture_t.
+// any other layout is copied, converting known properties & skipping the rest.
+// polygons are triangulated as fans. free with libload_obj_free.
+bool libload_ply_load(const char* filename, libload_obj_model_t** out_model);
+
+//=============================================================================
+// lossless geometry compression
+//=============================================================================
+
+// encodes the model's vertices, indices & parts into a compact byte stream.
+// indices are predicted from recently used edges & vertices, & each vertex
+// channel is delta coded & packed in byte planes. decoding reproduces the
+// model exactly. free the data with libload_obj_free_encoded.
+bool libload_obj_encode(const libload_obj_model_t* model, uint8_t** out_data, uint64_t* out_num_bytes);
+bool libload_obj_decode(const uint8_t* data, uint64_t num_bytes, libload_obj_model_t** out_model);
+void libload_obj_free_encoded(uint8_t* data);
+
+//=============================================================================
+// spatial tiling & streaming
+//=============================================================================
+
+typedef struct
+{
+  libload_float3_t min, max;
+} libload_bounds_t;
+
+typedef struct
+{
+  libload_bounds_t bounds;        // bounds of the tile's vertices
+  uint64_t offset;                // page aligned location of the tile's data in the file
+  uint64_t num_bytes;
+  uint32_t num_vertices;
+  uint32_t num_indices;
+  uint32_t num_parts;
+  libload_obj_model_t* model;     // non-null while the tile is resident
+} libload_tile_t;
+
+typedef struct
+{
+  char material_file[512];
+  libload_bounds_t bounds;        // bounds of the whole model
+  uint32_t num_tiles;
+  libload_tile_t* tiles;
+  uint32_t num_resident;          // number of tiles currently loaded
+  uint64_t resident_bytes;        // tile data bytes currently loaded
+  void* file;
+} libload_tile_file_t;
+
+// splits the model's triangles into a uniform tiles_x * tiles_y * tiles_z grid
+// over its bounds (each triangle goes to the tile containing its centroid) &
+// writes each tile as a separately loadable, page aligned chunk. fails if the
+// grid has more than 2^20 tiles.
+bool libload_obj_write_tiles(const libload_obj_model_t* model, uint32_t tiles_x, uint32_t tiles_y, uint32_t tiles_z, const char* filename);
+
+// opens a tile file, reading only the tile table. no tiles are resident initially.
+bool libload_tile_file_open(const char* filename, libload_tile_file_t** out_tile_file);
+
+// loads all tiles overlapping the region that aren't resident yet. each
+// resident tile is a regular model in tiles[i].model.
+bool libload_tile_file_load_region(libload_tile_file_t* tile_file, const libload_bounds_t* region);
+
+// unloads the resident tiles overlapping (or not overlapping) the region.
+// calling unload_outside & load_region with the same region as the camera
+// moves keeps only the tiles around it resident.
+void libload_tile_file_unload_region(libload_tile_file_t* tile_file, const libload_bounds_t* region);
+void libload_tile_file_unload_outside(libload_tile_file_t* tile_file, const libload_bounds_t* region);
+
+void libload_tile_file_close(libload_tile_file_t* tile_file);
+
+//=============================================================================
+// cooked scene bundles
+//=============================================================================
+
+#define LIBLOAD_BUNDLE_NO_TEXTURE UINT32_MAX
+
+typedef struct
+{
+  uint32_t base_index;
+  uint32_t num_indices;
+  uint32_t material;              // index into the bundle's materials
+} libload_bundle_part_t;
+
+typedef struct
+{
+  char name[64];
+  libload_float3_t Kd;            // diffuse, for materials without a diffuse texture
+  float d;                        // dissolve (aka. alpha)
+  uint32_t diffuse_texture;       // index into the bundle's textures, or LIBLOAD_BUNDLE_NO_TEXTURE
+  uint32_t normal_texture;        // index into the bundle's textures, or LIBLOAD_BUNDLE_NO_TEXTURE
+} libload_bundle_material_t;
+
+typedef struct
+{
+  uint32_t format;                // DXGI_FORMAT of the texels, usually block compressed
+  uint32_t width;
+  uint32_t height;
+  uint32_t num_mips;
+  uint32_t first_mip;             // index of the top level in the bundle's mips
+} libload_bundle_texture_t;
+
+typedef struct
+{
+  uint64_t offset;                // location of the texels in the file
+  uint32_t row_pitch;             // bytes per row (of blocks, for compressed formats)
+  uint32_t slice_pitch;           // bytes in the whole level
+} libload_bundle_mip_t;
+
+typedef struct
+{
+  uint32_t num_vertices;
+  uint32_t num_indices;
+  uint32_t num_parts;
+  uint32_t num_materials;
+  uint32_t num_textures;
+  uint32_t num_mips;
+
+  // all point into the mapped file & are valid until the bundle is closed
+  const libload_obj_vertex_t* vertices;
+  const uint32_t* indices;
+  const libload_bundle_part_t* parts;
+  const libload_bundle_material_t* materials;
+  const libload_bundle_texture_t* textures;
+  const libload_bundle_mip_t* mips;
+
+  const uint8_t* data;            // the whole file. level i's texels are at data + mips[i].offset
+  uint64_t num_bytes;
+} libload_bundle_t;
+
+// writes a scene as one bundle file, with every section on a page boundary.
+// the model's parts are matched to materials by name, falling back to the
+// first material, so num_materials must be at least 1. mip_texels[i] holds
+// the texels of mips[i]; the offsets in mips are ignored & assigned on write.
+bool libload_bundle_write(const char* filename, const libload_obj_model_t* model,
+  const libload_bundle_material_t* materials, uint32_t num_materials,
+  const libload_bundle_texture_t* textures, uint32_t num_textures,
+  const libload_bundle_mip_t* mips, const void* const* mip_texels, uint32_t num_mips);
+
+// maps a bundle file & validates its tables. nothing is parsed or decoded;
+// the returned pointers can be handed straight to the renderer.
+bool libload_bundle_open(const char* filename, libload_bundle_t** out_bundle);
+void libload_bundle_close(libload_bundle_t* bundle);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -0,0 +1,157 @@
+//=============================================================================
+// libloader_batch.c - Merging of parts into per-material draw batches
+// Reza Nourai, 2016
+//=============================================================================
+
+#include "..\include\libloader.h"
+#include "libloader_util.h"
+
+#include <malloc.h>
+#include <string.h>
+#include <stdlib.h>
+
+typedef struct
+{
+  const libload_obj_model_part_t* part;
+  uint32_t index;       // position of the part in the model
+  uint32_t first_use;   // position of the first part using the same material
+} batch_entry_t;
+
+static int compare_by_material(const void* a, const void* b)
+{
+  const batch_entry_t* ea = (const batch_entry_t*)a;
+  const batch_entry_t* eb = (const batch_entry_t*)b;
+  int cmp = strcmp(ea->part->material_name, eb->part->material_name);
+
+  if (cmp != 0)
+    return cmp;
+
+  return (ea->index < eb->index) ? -1 : (ea->index > eb->index) ? 1 : 0;
+}
+
+static int compare_by_first_use(const void* a, const void* b)
+{
+  const batch_entry_t* ea = (const batch_entry_t*)a;
+  const batch_entry_t* eb = (const batch_entry_t*)b;
+
+  if (ea->first_use != eb->first_use)
+    return (ea->first_use < eb->first_use) ? -1 : 1;
+
+  return (ea->index < eb->index) ? -1 : (ea->index > eb->index) ? 1 : 0;
+}
+
+bool libload_obj_batch_by_material(libload_obj_model_t* model, libload_obj_batch_stats_t* out_stats)
+{
+  bool result = false;
+  batch_entry_t* entries = 0;
+  bool* covered = 0;
+  uint32_t* indices = 0;
+  libload_obj_model_part_t* parts = 0;
+  uint32_t num_indices = 0;
+  uint32_t num_parts = 0;
+  uint32_t i, j, k;
+
+  if (!model)
+    goto cleanup;
+
+  if (out_stats)
+  {
+    out_stats->source_draws = model->num_parts;
+    out_stats->batched_draws = model->num_parts;
+  }
+
+  if (model->num_parts < 2)
+  {
+    // nothing to merge
+    result = true;
+    goto cleanup;
+  }
+
+  entries = (batch_entry_t*)malloc(sizeof(batch_entry_t) * model->num_parts);
+  covered = (bool*)malloc(sizeof(bool) * (model->num_indices + 1));
+  indices = (uint32_t*)malloc(sizeof(uint32_t) * (model->num_indices + 1));
+  parts = (libload_obj_model_part_t*)malloc(sizeof(libload_obj_model_part_t) * model->num_parts);
+  if (!entries || !covered || !indices || !parts)
+    goto cleanup;
+
+  for (i = 0; i < model->num_parts; ++i)
+  {
+    entries[i].part = &model->parts[i];
+    entries[i].index = i;
+  }
+
+  // group parts by material, then order the groups by the first part using
+  // each material. both sorts break ties on part index, so the final order
+  // only depends on the file contents.
+  qsort(entries, model->num_parts, sizeof(batch_entry_t), compare_by_material);
+
+  for (i = 0; i < model->num_parts; i = j)
+  {
+    for (j = i; j < model->num_parts && strcmp(entries[j].part->material_name, entries[i].part->material_name) == 0; ++j)
+      entries[j].first_use = entries[i].index;
+  }
+
+  qsort(entries, model->num_parts, sizeof(batch_entry_t), compare_by_first_use);
+
+  // keep any indices that aren't part of a part at the front of the buffer
+  memset(covered, 0, sizeof(bool) * (model->num_indices + 1));
+  for (i = 0; i < model->num_parts; ++i)
+  {
+    for (k = 0; k < model->parts[i].num_indices; ++k)
+      covered[model->parts[i].base_index + k] = true;
+  }
+
+  for (i = 0; i < model->num_indices; ++i)
+  {
+    if (!covered[i])
+      indices[num_indices++] = model->indices[i];
+  }
+
+  // overlapping parts can't be merged without growing the index buffer
+  k = num_indices;
+  for (i = 0; i < model->num_parts; ++i)
+    k += model->parts[i].num_indices;
+
+  if (k != model->num_indices)
+    goto cleanup;
+
+  for (i = 0; i < model->num_parts; i = j)
+  {
+    libload_obj_model_part_t* batch = &parts[num_parts++];
+
+    // the batch takes the name of the first part merged into it
+    *batch = *entries[i].part;
+    batch->base_index = num_indices;
+
+    for (j = i; j < model->num_parts && entries[j].first_use == entries[i].first_use; ++j)
+    {
+      const libload_obj_model_part_t* part = entries[j].part;
+      memcpy(&indices[num_indices], &model->indices[part->base_index], sizeof(uint32_t) * part->num_indices);
+      num_indices += part->num_indices;
+    }
+
+    batch->num_indices = num_indices - batch->base_index;
+  }
+
+  memcpy(model->indices, indices, sizeof(uint32_t) * num_indices);
+  memcpy(model->parts, parts, sizeof(libload_obj_model_part_t) * num_parts);
+  model->num_indices = num_indices;
+  model->num_parts = num_parts;
+
+  if (out_stats)
+    out_stats->batched_draws = num_parts;
+
+  result = true;
+
+cleanup:
+  if (parts)
+    free(parts);
+  if (indices)
+    free(indices);
+  if (covered)
+    free(covered);
+  if (entries)
+    free(entries);
+
+  return result;
+}
@@ -0,0 +1,292 @@
+//=============================================================================
+// libloader_bundle.c - Cooked scene bundles (mesh, materials & textures)
+// Reza Nourai, 2016
+//=============================================================================
+
+#include "..\include\libloader.h"
+#include "libloader_util.h"
+
+#include <stdio.h>
+#include <malloc.h>
+#include <string.h>
+
+#define BUNDLE_MAGIC 0x42534c4c  // 'LLSB'
+#define BUNDLE_VERSION 1
+#define BUNDLE_PAGE_SIZE 4096
+#define BUNDLE_MIP_ALIGNMENT 16
+
+// file layout: header, then vertices, indices, parts, materials, textures,
+// the texels of every level & finally the mip table, each starting on a page
+// boundary. a texture's levels after the top one are only 16 byte aligned.
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_vertices;
+  uint32_t num_indices;
+  uint32_t num_parts;
+  uint32_t num_materials;
+  uint32_t num_textures;
+  uint32_t num_mips;
+  uint64_t vertices_offset;
+  uint64_t indices_offset;
+  uint64_t parts_offset;
+  uint64_t materials_offset;
+  uint64_t textures_offset;
+  uint64_t mips_offset;
+  uint64_t num_bytes;
+} bundle_header_t;
+
+static bool write_padding(FILE* file, uint64_t* inout_offset, uint64_t alignment)
+{
+  static const uint8_t zeros[BUNDLE_PAGE_SIZE] = {0};
+  uint64_t padding = (alignment - (*inout_offset % alignment)) % alignment;
+
+  if (padding > 0 && fwrite(zeros, 1, (size_t)padding, file) != padding)
+    return false;
+
+  *inout_offset += padding;
+  return true;
+}
+
+static bool write_section(FILE* file, uint64_t* inout_offset, uint64_t* out_section_offset, const void* data, size_t element_size, uint32_t count)
+{
+  if (!write_padding(file, inout_offset, BUNDLE_PAGE_SIZE))
+    return false;
+
+  *out_section_offset = *inout_offset;
+
+  if (count > 0 && fwrite(data, element_size, count, file) != count)
+    return false;
+
+  *inout_offset += element_size * (uint64_t)count;
+  return true;
+}
+
+static bool section_in_range(uint64_t offset, uint64_t num_bytes, uint64_t file_bytes)
+{
+  return offset <= file_bytes && num_bytes <= file_bytes - offset;
+}
+
+bool libload_bundle_write(const char* filename, const libload_obj_model_t* model,
+  const libload_bundle_material_t* materials, uint32_t num_materials,
+  const libload_bundle_texture_t* textures, uint32_t num_textures,
+  const libload_bundle_mip_t* mips, const void* const* mip_texels, uint32_t num_mips)
+{
+  bool result = false;
+  FILE* file = 0;
+  bundle_header_t header;
+  libload_bundle_part_t* parts = 0;
+  libload_bundle_mip_t* placed_mips = 0;
+  uint32_t num_parts = 0;
+  uint64_t offset = 0;
+  uint32_t i, j;
+
+  if (!filename || !model || !materials || num_materials == 0 || (num_textures > 0 && !textures) ||
+      (num_mips > 0 && (!mips || !mip_texels)))
+    goto cleanup;
+
+  for (i = 0; i < num_textures; ++i)
+  {
+    if (textures[i].num_mips == 0 || (uint64_t)textures[i].first_mip + textures[i].num_mips > num_mips)
+      goto cleanup;
+  }
+
+  // a model without parts is drawn as one part with the first material
+  num_parts = model->num_parts > 0 ? model->num_parts : 1;
+
+  parts = (libload_bundle_part_t*)malloc(sizeof(libload_bundle_part_t) * (num_parts + 1));
+  placed_mips = (libload_bundle_mip_t*)malloc(sizeof(libload_bundle_mip_t) * (num_mips + 1));
+  if (!parts || !placed_mips)
+    goto cleanup;
+
+  if (model->num_parts > 0)
+  {
+    for (i = 0; i < model->num_parts; ++i)
+    {
+      parts[i].base_index = model->parts[i].base_index;
+      parts[i].num_indices = model->parts[i].num_indices;
+      parts[i].material = 0;
+
+      for (j = 0; j < num_materials; ++j)
+      {
+        if (strcmp(materials[j].name, model->parts[i].material_name) == 0)
+        {
+          parts[i].material = j;
+          break;
+        }
+      }
+    }
+  }
+  else
+  {
+    parts[0].base_index = 0;
+    parts[0].num_indices = model->num_indices;
+    parts[0].material = 0;
+  }
+
+  if (num_mips > 0)
+    memcpy(placed_mips, mips, sizeof(libload_bundle_mip_t) * num_mips);
+
+  memset(&header, 0, sizeof(header));
+  header.magic = BUNDLE_MAGIC;
+  header.version = BUNDLE_VERSION;
+  header.num_vertices = model->num_vertices;
+  header.num_indices = model->num_indices;
+  header.num_parts = num_parts;
+  header.num_materials = num_materials;
+  header.num_textures = num_textures;
+  header.num_mips = num_mips;
+
+  if (fopen_s(&file, filename, "wb") != 0)
+    goto cleanup;
+
+  // the header is written again once the sections are laid out
+  if (fwrite(&header, sizeof(header), 1, file) != 1)
+    goto cleanup;
+
+  offset = sizeof(header);
+
+  if (!write_section(file, &offset, &header.vertices_offset, model->vertices, sizeof(libload_obj_vertex_t), model->num_vertices) ||
+      !write_section(file, &offset, &header.indices_offset, model->indices, sizeof(uint32_t), model->num_indices) ||
+      !write_section(file, &offset, &header.parts_offset, parts, sizeof(libload_bundle_part_t), num_parts) ||
+      !write_section(file, &offset, &header.materials_offset, materials, sizeof(libload_bundle_material_t), num_materials) ||
+      !write_section(file, &offset, &header.textures_offset, textures, sizeof(libload_bundle_texture_t), num_textures))
+    goto cleanup;
+
+  for (i = 0; i < num_textures; ++i)
+  {
+    for (j = textures[i].first_mip; j < textures[i].first_mip + textures[i].num_mips; ++j)
+    {
+      if (!write_padding(file, &offset, j == textures[i].first_mip ? BUNDLE_PAGE_SIZE : BUNDLE_MIP_ALIGNMENT))
+        goto cleanup;
+
+      placed_mips[j].offset = offset;
+
+      if (placed_mips[j].slice_pitch > 0 && fwrite(mip_texels[j], placed_mips[j].slice_pitch, 1, file) != 1)
+        goto cleanup;
+
+      offset += placed_mips[j].slice_pitch;
+    }
+  }
+
+  if (!write_section(file, &offset, &header.mips_offset, placed_mips, sizeof(libload_bundle_mip_t), num_mips))
+    goto cleanup;
+
+  header.num_bytes = offset;
+
+  if (_fseeki64(file, 0, SEEK_SET) != 0 ||
+      fwrite(&header, sizeof(header), 1, file) != 1)
+    goto cleanup;
+
+  result = true;
+
+cleanup:
+  if (file)
+    fclose(file);
+  if (placed_mips)
+    free(placed_mips);
+  if (parts)
+    free(parts);
+
+  return result;
+}
+
+bool libload_bundle_open(const char* filename, libload_bundle_t** out_bundle)
+{
+  bool result = false;
+  libload_bundle_t* bundle = 0;
+  const bundle_header_t* header = 0;
+  uint8_t* data = 0;
+  uint64_t num_bytes = 0;
+  uint32_t i;
+
+  if (!filename || !out_bundle)
+    goto cleanup;
+
+  data = (uint8_t*)map_file(filename, &num_bytes);
+  if (!data || num_bytes < sizeof(bundle_header_t))
+    goto cleanup;
+
+  header = (const bundle_header_t*)data;
+  if (header->magic != BUNDLE_MAGIC || header->version != BUNDLE_VERSION || header->num_bytes != num_bytes)
+    goto cleanup;
+
+  if (!section_in_range(header->vertices_offset, sizeof(libload_obj_vertex_t) * (uint64_t)header->num_vertices, num_bytes) ||
+      !section_in_range(header->indices_offset, sizeof(uint32_t) * (uint64_t)header->num_indices, num_bytes) ||
+      !section_in_range(header->parts_offset, sizeof(libload_bundle_part_t) * (uint64_t)header->num_parts, num_bytes) ||
+      !section_in_range(header->materials_offset, sizeof(libload_bundle_material_t) * (uint64_t)header->num_materials, num_bytes) ||
+      !section_in_range(header->textures_offset, sizeof(libload_bundle_texture_t) * (uint64_t)header->num_textures, num_bytes) ||
+      !section_in_range(header->mips_offset, sizeof(libload_bundle_mip_t) * (uint64_t)header->num_mips, num_bytes))
+    goto cleanup;
+
+  bundle = (libload_bundle_t*)malloc(sizeof(libload_bundle_t));
+  if (!bundle)
+    goto cleanup;
+
+  memset(bundle, 0, sizeof(libload_bundle_t));
+  bundle->num_vertices = header->num_vertices;
+  bundle->num_indices = header->num_indices;
+  bundle->num_parts = header->num_parts;
+  bundle->num_materials = header->num_materials;
+  bundle->num_textures = header->num_textures;
+  bundle->num_mips = header->num_mips;
+  bundle->vertices = (const libload_obj_vertex_t*)(data + header->vertices_offset);
+  bundle->indices = (const uint32_t*)(data + header->indices_offset);
+  bundle->parts = (const libload_bundle_part_t*)(data + header->parts_offset);
+  bundle->materials = (const libload_bundle_material_t*)(data + header->materials_offset);
+  bundle->textures = (const libload_bundle_texture_t*)(data + header->textures_offset);
+  bundle->mips = (const libload_bundle_mip_t*)(data + header->mips_offset);
+  bundle->data = data;
+  bundle->num_bytes = num_bytes;
+  data = 0;
+
+  // only the tables are checked. index values aren't, as that would touch
+  // every page of the index buffer before it's needed
+  for (i = 0; i < bundle->num_parts; ++i)
+  {
+    const libload_bundle_part_t* part = &bundle->parts[i];
+    if ((uint64_t)part->base_index + part->num_indices > bundle->num_indices || part->material >= bundle->num_materials)
+      goto cleanup;
+  }
+
+  for (i = 0; i < bundle->num_materials; ++i)
+  {
+    const libload_bundle_material_t* material = &bundle->materials[i];
+    if ((material->diffuse_texture != LIBLOAD_BUNDLE_NO_TEXTURE && material->diffuse_texture >= bundle->num_textures) ||
+        (material->normal_texture != LIBLOAD_BUNDLE_NO_TEXTURE && material->normal_texture >= bundle->num_textures))
+      goto cleanup;
+  }
+
+  for (i = 0; i < bundle->num_textures; ++i)
+  {
+    const libload_bundle_texture_t* texture = &bundle->textures[i];
+    if (texture->num_mips == 0 || (uint64_t)texture->first_mip + texture->num_mips > bundle->num_mips)
+      goto cleanup;
+  }
+
+  for (i = 0; i < bundle->num_mips; ++i)
+  {
+    if (!section_in_range(bundle->mips[i].offset, bundle->mips[i].slice_pitch, num_bytes))
+      goto cleanup;
+  }
+
+  *out_bundle = bundle;
+  bundle = 0;
+  result = true;
+
+cleanup:
+  libload_bundle_close(bundle);
+  unmap_file(data);
+
+  return result;
+}
+
+void libload_bundle_close(libload_bundle_t* bundle)
+{
+  if (bundle)
+  {
+    unmap_file((void*)bundle->data);
+    free(bundle);
+  }
+}
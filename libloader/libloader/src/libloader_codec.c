@@ -0,0 +1,658 @@
+//=============================================================================
+// libloader_codec.c - Lossless geometry compression
+// Reza Nourai, 2016
+//=============================================================================
+
+#include "..\include\libloader.h"
+#include "libloader_util.h"
+
+#include <malloc.h>
+#include <string.h>
+
+#define CODEC_MAGIC 0x434d4c4c  // 'LLMC'
+#define CODEC_VERSION 1
+
+#define EDGE_FIFO_SIZE 16
+#define VERTEX_FIFO_SIZE 16
+#define NO_EDGE 15              // edge slot value meaning "no edge match"
+#define VERTEX_NEXT 0           // vertex nibble: next never seen vertex
+#define VERTEX_EXPLICIT 15      // vertex nibble: index follows as a varint
+                                // 1..14: vertex fifo slots 0..13
+
+#define BLOCK_SIZE 16           // values per bit packed block
+#define NUM_CHANNELS (sizeof(libload_obj_vertex_t) / sizeof(uint32_t))
+
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_vertices;
+  uint32_t num_indices;
+  uint32_t num_parts;
+  uint32_t material_file_length;
+} codec_header_t;
+
+typedef struct
+{
+  const uint8_t* data;
+  const uint8_t* end;
+} reader_t;
+
+//=============================================================================
+// helpers
+//=============================================================================
+
+static uint32_t zigzag(int32_t v)
+{
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v)
+{
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static uint8_t* write_varint(uint8_t* out, uint32_t v)
+{
+  while (v >= 0x80)
+  {
+    *out++ = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  *out++ = (uint8_t)v;
+  return out;
+}
+
+static bool read_varint(reader_t* reader, uint32_t* out_value)
+{
+  uint32_t value = 0;
+  uint32_t shift = 0;
+
+  while (reader->data < reader->end && shift < 35)
+  {
+    uint8_t b = *reader->data++;
+    value |= (uint32_t)(b & 0x7F) << shift;
+    if (!(b & 0x80))
+    {
+      *out_value = value;
+      return true;
+    }
+    shift += 7;
+  }
+
+  return false;
+}
+
+static bool read_bytes(reader_t* reader, void* dest, size_t num_bytes)
+{
+  if ((size_t)(reader->end - reader->data) < num_bytes)
+    return false;
+
+  memcpy(dest, reader->data, num_bytes);
+  reader->data += num_bytes;
+  return true;
+}
+
+//=============================================================================
+// index compression
+//
+// each triangle is described by one code byte: the high nibble is the slot of
+// a recently seen edge matching its first two indices (or NO_EDGE) & the low
+// nibble predicts the third index. triangles without an edge match add a
+// second byte predicting their first two indices. predictions are either the
+// next never referenced vertex (the common case for vertices in first use
+// order), a slot of a small fifo of recent vertices, or an explicit delta.
+//=============================================================================
+
+typedef struct
+{
+  uint32_t edges[EDGE_FIFO_SIZE][2];
+  uint32_t edge_offset;
+  uint32_t vertices[VERTEX_FIFO_SIZE];
+  uint32_t vertex_offset;
+  uint32_t next;                // next never referenced vertex
+  uint32_t last;                // last explicitly coded index
+} index_state_t;
+
+static void push_edge(index_state_t* state, uint32_t a, uint32_t b)
+{
+  state->edges[state->edge_offset][0] = a;
+  state->edges[state->edge_offset][1] = b;
+  state->edge_offset = (state->edge_offset + 1) % EDGE_FIFO_SIZE;
+}
+
+static void push_vertex(index_state_t* state, uint32_t v)
+{
+  state->vertices[state->vertex_offset] = v;
+  state->vertex_offset = (state->vertex_offset + 1) % VERTEX_FIFO_SIZE;
+}
+
+// slots are numbered from the most recent entry
+static uint32_t find_edge(const index_state_t* state, uint32_t a, uint32_t b)
+{
+  uint32_t i;
+
+  for (i = 0; i < NO_EDGE; ++i)
+  {
+    uint32_t slot = (state->edge_offset + EDGE_FIFO_SIZE - 1 - i) % EDGE_FIFO_SIZE;
+    if (state->edges[slot][0] == a && state->edges[slot][1] == b)
+      return i;
+  }
+
+  return NO_EDGE;
+}
+
+static uint32_t encode_vertex(index_state_t* state, uint32_t v, uint8_t** inout_data)
+{
+  uint32_t i;
+
+  if (v == state->next)
+  {
+    ++state->next;
+    push_vertex(state, v);
+    return VERTEX_NEXT;
+  }
+
+  for (i = 0; i < VERTEX_EXPLICIT - 1; ++i)
+  {
+    if (state->vertices[(state->vertex_offset + VERTEX_FIFO_SIZE - 1 - i) % VERTEX_FIFO_SIZE] == v)
+      return 1 + i;
+  }
+
+  *inout_data = write_varint(*inout_data, zigzag((int32_t)(v - state->last)));
+  state->last = v;
+  push_vertex(state, v);
+  return VERTEX_EXPLICIT;
+}
+
+static bool decode_vertex(index_state_t* state, uint32_t code, reader_t* data, uint32_t* out_v)
+{
+  uint32_t delta;
+
+  if (code == VERTEX_NEXT)
+  {
+    *out_v = state->next++;
+    push_vertex(state, *out_v);
+    return true;
+  }
+
+  if (code != VERTEX_EXPLICIT)
+  {
+    *out_v = state->vertices[(state->vertex_offset + VERTEX_FIFO_SIZE - code) % VERTEX_FIFO_SIZE];
+    return true;
+  }
+
+  if (!read_varint(data, &delta))
+    return false;
+
+  *out_v = state->last + (uint32_t)unzigzag(delta);
+  state->last = *out_v;
+  push_vertex(state, *out_v);
+  return true;
+}
+
+static void reset_index_state(index_state_t* state)
+{
+  // fill with values that can never match a real index
+  memset(state, 0xFF, sizeof(index_state_t));
+  state->edge_offset = 0;
+  state->vertex_offset = 0;
+  state->next = 0;
+  state->last = 0;
+}
+
+// codes & explicit indices go to separate streams so the decoder reads codes sequentially
+static void encode_indices(const uint32_t* indices, uint32_t num_indices, uint8_t** inout_codes, uint8_t** inout_data)
+{
+  index_state_t state;
+  uint32_t num_triangles = num_indices / 3;
+  uint32_t t, i;
+
+  reset_index_state(&state);
+
+  for (t = 0; t < num_triangles; ++t)
+  {
+    uint32_t a = indices[t * 3 + 0];
+    uint32_t b = indices[t * 3 + 1];
+    uint32_t c = indices[t * 3 + 2];
+    uint32_t edge = find_edge(&state, a, b);
+
+    if (edge != NO_EDGE)
+    {
+      *(*inout_codes)++ = (uint8_t)((edge << 4) | encode_vertex(&state, c, inout_data));
+    }
+    else
+    {
+      uint8_t* code = (*inout_codes)++;
+      uint8_t* code2 = (*inout_codes)++;
+      uint32_t ca = encode_vertex(&state, a, inout_data);
+      uint32_t cb = encode_vertex(&state, b, inout_data);
+      uint32_t cc = encode_vertex(&state, c, inout_data);
+      *code = (uint8_t)((NO_EDGE << 4) | ca);
+      *code2 = (uint8_t)((cb << 4) | cc);
+    }
+
+    // neighbors share edges in the opposite direction
+    push_edge(&state, b, a);
+    push_edge(&state, c, b);
+    push_edge(&state, a, c);
+  }
+
+  // any trailing indices that don't form a triangle are stored as is
+  for (i = num_triangles * 3; i < num_indices; ++i)
+    *inout_data = write_varint(*inout_data, indices[i]);
+}
+
+static bool decode_indices(reader_t* codes, reader_t* data, uint32_t* indices, uint32_t num_indices, uint32_t num_vertices)
+{
+  index_state_t state;
+  uint32_t num_triangles = num_indices / 3;
+  uint32_t t, i;
+
+  reset_index_state(&state);
+
+  for (t = 0; t < num_triangles; ++t)
+  {
+    uint32_t* tri = &indices[t * 3];
+    uint32_t code, edge;
+
+    if (codes->data == codes->end)
+      return false;
+
+    code = *codes->data++;
+    edge = code >> 4;
+
+    if (edge != NO_EDGE)
+    {
+      uint32_t slot = (state.edge_offset + EDGE_FIFO_SIZE - 1 - edge) % EDGE_FIFO_SIZE;
+      tri[0] = state.edges[slot][0];
+      tri[1] = state.edges[slot][1];
+      if (!decode_vertex(&state, code & 0xF, data, &tri[2]))
+        return false;
+    }
+    else
+    {
+      uint32_t code2;
+
+      if (codes->data == codes->end)
+        return false;
+
+      code2 = *codes->data++;
+      if (!decode_vertex(&state, code & 0xF, data, &tri[0]) ||
+          !decode_vertex(&state, code2 >> 4, data, &tri[1]) ||
+          !decode_vertex(&state, code2 & 0xF, data, &tri[2]))
+        return false;
+    }
+
+    if (tri[0] >= num_vertices || tri[1] >= num_vertices || tri[2] >= num_vertices)
+      return false;
+
+    push_edge(&state, tri[1], tri[0]);
+    push_edge(&state, tri[2], tri[1]);
+    push_edge(&state, tri[0], tri[2]);
+  }
+
+  for (i = num_triangles * 3; i < num_indices; ++i)
+  {
+    if (!read_varint(data, &indices[i]) || indices[i] >= num_vertices)
+      return false;
+  }
+
+  return true;
+}
+
+//=============================================================================
+// vertex compression
+//
+// each 32bit channel of the vertex is delta coded against the previous vertex
+// & zigzagged, so small changes become small numbers. the deltas are then
+// split into 4 byte planes, & each plane is packed in blocks of 16 values
+// using the smallest of 0, 2, 4 or 8 bits that holds every value in the block.
+// the high planes of coherent data are mostly zero & pack down to nothing.
+// block modes are stored 4 to a byte ahead of the packed blocks of a plane.
+//=============================================================================
+
+static const uint32_t mode_bits[4] = { 0, 2, 4, 8 };
+
+static uint8_t* encode_plane(const uint8_t* plane, uint32_t count, uint8_t* out)
+{
+  uint32_t num_blocks = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  uint8_t* modes = out;
+  uint32_t b, i;
+
+  memset(modes, 0, (num_blocks + 3) / 4);
+  out += (num_blocks + 3) / 4;
+
+  for (b = 0; b < num_blocks; ++b)
+  {
+    uint8_t block[BLOCK_SIZE] = {0};
+    uint32_t n = (count - b * BLOCK_SIZE < BLOCK_SIZE) ? count - b * BLOCK_SIZE : BLOCK_SIZE;
+    uint8_t max_value = 0;
+    uint32_t mode = 0;
+
+    memcpy(block, &plane[b * BLOCK_SIZE], n);
+    for (i = 0; i < BLOCK_SIZE; ++i)
+      max_value |= block[i];
+
+    while (mode < 3 && (max_value >> mode_bits[mode]) != 0)
+      ++mode;
+
+    modes[b / 4] |= (uint8_t)(mode << ((b % 4) * 2));
+
+    if (mode == 1)
+    {
+      for (i = 0; i < BLOCK_SIZE; i += 4)
+        *out++ = (uint8_t)(block[i] | (block[i + 1] << 2) | (block[i + 2] << 4) | (block[i + 3] << 6));
+    }
+    else if (mode == 2)
+    {
+      for (i = 0; i < BLOCK_SIZE; i += 2)
+        *out++ = (uint8_t)(block[i] | (block[i + 1] << 4));
+    }
+    else if (mode == 3)
+    {
+      memcpy(out, block, BLOCK_SIZE);
+      out += BLOCK_SIZE;
+    }
+  }
+
+  return out;
+}
+
+// plane must have room for a whole number of blocks
+static bool decode_plane(reader_t* reader, uint8_t* plane, uint32_t count)
+{
+  uint32_t num_blocks = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  const uint8_t* modes = reader->data;
+  const uint8_t* in = 0;
+  uint32_t b, i;
+
+  if ((size_t)(reader->end - reader->data) < (num_blocks + 3) / 4)
+    return false;
+
+  in = modes + (num_blocks + 3) / 4;
+
+  for (b = 0; b < num_blocks; ++b)
+  {
+    uint32_t mode = (modes[b / 4] >> ((b % 4) * 2)) & 3;
+    uint8_t* block = &plane[b * BLOCK_SIZE];
+
+    if ((size_t)(reader->end - in) < mode_bits[mode] * 2)
+      return false;
+
+    switch (mode)
+    {
+    case 0:
+      memset(block, 0, BLOCK_SIZE);
+      break;
+
+    case 1:
+      for (i = 0; i < BLOCK_SIZE; i += 4, ++in)
+      {
+        block[i + 0] = *in & 3;
+        block[i + 1] = (*in >> 2) & 3;
+        block[i + 2] = (*in >> 4) & 3;
+        block[i + 3] = *in >> 6;
+      }
+      break;
+
+    case 2:
+      for (i = 0; i < BLOCK_SIZE; i += 2, ++in)
+      {
+        block[i + 0] = *in & 0xF;
+        block[i + 1] = *in >> 4;
+      }
+      break;
+
+    default:
+      memcpy(block, in, BLOCK_SIZE);
+      in += BLOCK_SIZE;
+      break;
+    }
+  }
+
+  reader->data = in;
+  return true;
+}
+
+static uint8_t* encode_vertices(const libload_obj_vertex_t* vertices, uint32_t num_vertices, uint8_t* planes, uint8_t* out)
+{
+  const uint32_t* channels = (const uint32_t*)vertices;
+  uint32_t c, p, i;
+
+  for (c = 0; c < NUM_CHANNELS; ++c)
+  {
+    uint32_t prev = 0;
+
+    for (i = 0; i < num_vertices; ++i)
+    {
+      uint32_t v = channels[(size_t)i * NUM_CHANNELS + c];
+      uint32_t delta = zigzag((int32_t)(v - prev));
+      prev = v;
+
+      for (p = 0; p < 4; ++p)
+        planes[(size_t)p * num_vertices + i] = (uint8_t)(delta >> (p * 8));
+    }
+
+    for (p = 0; p < 4; ++p)
+      out = encode_plane(&planes[(size_t)p * num_vertices], num_vertices, out);
+  }
+
+  return out;
+}
+
+static bool decode_vertices(reader_t* reader, libload_obj_vertex_t* vertices, uint32_t num_vertices, uint8_t* planes, uint32_t plane_stride)
+{
+  uint32_t* channels = (uint32_t*)vertices;
+  uint32_t c, p, i;
+
+  for (c = 0; c < NUM_CHANNELS; ++c)
+  {
+    uint32_t prev = 0;
+
+    for (p = 0; p < 4; ++p)
+    {
+      if (!decode_plane(reader, &planes[(size_t)p * plane_stride], num_vertices))
+        return false;
+    }
+
+    for (i = 0; i < num_vertices; ++i)
+    {
+      uint32_t delta =
+        (uint32_t)planes[i] |
+        ((uint32_t)planes[plane_stride + i] << 8) |
+        ((uint32_t)planes[plane_stride * 2 + i] << 16) |
+        ((uint32_t)planes[plane_stride * 3 + i] << 24);
+
+      prev += (uint32_t)unzigzag(delta);
+      channels[(size_t)i * NUM_CHANNELS + c] = prev;
+    }
+  }
+
+  return true;
+}
+
+//=============================================================================
+// public api
+//=============================================================================
+
+bool libload_obj_encode(const libload_obj_model_t* model, uint8_t** out_data, uint64_t* out_num_bytes)
+{
+  bool result = false;
+  codec_header_t header;
+  uint8_t* buffer = 0;
+  uint8_t* codes = 0;
+  uint8_t* index_data = 0;
+  uint8_t* planes = 0;
+  uint8_t* out = 0;
+  uint8_t* codes_end = 0;
+  uint8_t* index_data_end = 0;
+  uint64_t num_blocks = 0;
+  uint64_t max_bytes = 0;
+  uint32_t section_size = 0;
+  uint32_t i;
+
+  if (!model || !out_data || !out_num_bytes)
+    goto cleanup;
+
+  // indices are range checked on decode, so don't produce streams that would fail it
+  for (i = 0; i < model->num_indices; ++i)
+  {
+    if (model->indices[i] >= model->num_vertices)
+      goto cleanup;
+  }
+
+  memset(&header, 0, sizeof(header));
+  header.magic = CODEC_MAGIC;
+  header.version = CODEC_VERSION;
+  header.num_vertices = model->num_vertices;
+  header.num_indices = model->num_indices;
+  header.num_parts = model->num_parts;
+  header.material_file_length = (uint32_t)strlen(model->material_file);
+
+  // worst case sizes of each section
+  num_blocks = (model->num_vertices + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  max_bytes =
+    sizeof(header) + header.material_file_length +
+    sizeof(libload_obj_model_part_t) * (uint64_t)model->num_parts +
+    sizeof(uint32_t) * 2 + (uint64_t)model->num_indices * 7 +
+    NUM_CHANNELS * 4 * (num_blocks * BLOCK_SIZE + num_blocks / 4 + 1);
+
+  buffer = (uint8_t*)malloc((size_t)max_bytes);
+  codes = (uint8_t*)malloc((size_t)model->num_indices + 1);
+  index_data = (uint8_t*)malloc((size_t)model->num_indices * 5 + 1);
+  planes = (uint8_t*)malloc((size_t)model->num_vertices * 4 + 1);
+  if (!buffer || !codes || !index_data || !planes)
+    goto cleanup;
+
+  out = buffer;
+  memcpy(out, &header, sizeof(header));
+  out += sizeof(header);
+  memcpy(out, model->material_file, header.material_file_length);
+  out += header.material_file_length;
+  memcpy(out, model->parts, sizeof(libload_obj_model_part_t) * model->num_parts);
+  out += sizeof(libload_obj_model_part_t) * model->num_parts;
+
+  codes_end = codes;
+  index_data_end = index_data;
+  encode_indices(model->indices, model->num_indices, &codes_end, &index_data_end);
+
+  section_size = (uint32_t)(codes_end - codes);
+  memcpy(out, &section_size, sizeof(uint32_t));
+  out += sizeof(uint32_t);
+  memcpy(out, codes, section_size);
+  out += section_size;
+
+  section_size = (uint32_t)(index_data_end - index_data);
+  memcpy(out, &section_size, sizeof(uint32_t));
+  out += sizeof(uint32_t);
+  memcpy(out, index_data, section_size);
+  out += section_size;
+
+  out = encode_vertices(model->vertices, model->num_vertices, planes, out);
+
+  *out_data = buffer;
+  *out_num_bytes = (uint64_t)(out - buffer);
+  buffer = 0;
+  result = true;
+
+cleanup:
+  if (planes)
+    free(planes);
+  if (index_data)
+    free(index_data);
+  if (codes)
+    free(codes);
+  if (buffer)
+    free(buffer);
+
+  return result;
+}
+
+bool libload_obj_decode(const uint8_t* data, uint64_t num_bytes, libload_obj_model_t** out_model)
+{
+  bool result = false;
+  reader_t reader;
+  reader_t codes;
+  reader_t index_data;
+  codec_header_t header;
+  libload_obj_model_t* model = 0;
+  uint8_t* planes = 0;
+  uint32_t plane_stride = 0;
+  uint32_t section_size = 0;
+
+  if (!data || !out_model)
+    goto cleanup;
+
+  reader.data = data;
+  reader.end = data + num_bytes;
+
+  if (!read_bytes(&reader, &header, sizeof(header)) ||
+      header.magic != CODEC_MAGIC || header.version != CODEC_VERSION ||
+      header.material_file_length >= LIBLOAD_ARRAYSIZE(model->material_file))
+    goto cleanup;
+
+  model = (libload_obj_model_t*)malloc(sizeof(libload_obj_model_t));
+  if (!model)
+    goto cleanup;
+
+  memset(model, 0, sizeof(libload_obj_model_t));
+
+  if (!read_bytes(&reader, model->material_file, header.material_file_length))
+    goto cleanup;
+
+  model->vertices = (libload_obj_vertex_t*)malloc(sizeof(libload_obj_vertex_t) * ((size_t)header.num_vertices + 1));
+  model->indices = (uint32_t*)malloc(sizeof(uint32_t) * ((size_t)header.num_indices + 1));
+  model->parts = (libload_obj_model_part_t*)malloc(sizeof(libload_obj_model_part_t) * ((size_t)header.num_parts + 1));
+
+  // planes are decoded a whole block at a time
+  plane_stride = (header.num_vertices + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+  planes = (uint8_t*)malloc((size_t)plane_stride * 4 + 1);
+  if (!model->vertices || !model->indices || !model->parts || !planes)
+    goto cleanup;
+
+  model->num_vertices = header.num_vertices;
+  model->num_indices = header.num_indices;
+  model->num_parts = header.num_parts;
+
+  if (!read_bytes(&reader, model->parts, sizeof(libload_obj_model_part_t) * model->num_parts))
+    goto cleanup;
+
+  if (!read_bytes(&reader, &section_size, sizeof(uint32_t)) || (uint64_t)(reader.end - reader.data) < section_size)
+    goto cleanup;
+
+  codes.data = reader.data;
+  codes.end = reader.data + section_size;
+  reader.data = codes.end;
+
+  if (!read_bytes(&reader, &section_size, sizeof(uint32_t)) || (uint64_t)(reader.end - reader.data) < section_size)
+    goto cleanup;
+
+  index_data.data = reader.data;
+  index_data.end = reader.data + section_size;
+  reader.data = index_data.end;
+
+  if (!decode_indices(&codes, &index_data, model->indices, model->num_indices, model->num_vertices))
+    goto cleanup;
+
+  if (!decode_vertices(&reader, model->vertices, model->num_vertices, planes, plane_stride))
+    goto cleanup;
+
+  *out_model = model;
+  model = 0;
+  result = true;
+
+cleanup:
+  libload_obj_free(model);
+
+  if (planes)
+    free(planes);
+
+  return result;
+}
+
+void libload_obj_free_encoded(uint8_t* data)
+{
+  if (data)
+    free(data);
+}
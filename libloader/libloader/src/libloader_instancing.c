@@ -0,0 +1,498 @@
+//=============================================================================
+// libloader_instancing.c - Detection of repeated geometry
+// Reza Nourai, 2016
+//=============================================================================
+
+#include "..\include\libloader.h"
+#include "libloader_util.h"
+
+#include <malloc.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+// texcoords are copied verbatim by exporters, so they make a cheap & stable
+// hash key. quantize them so tiny float noise doesn't split buckets.
+#define TEXCOORD_HASH_SCALE 4096.f
+
+typedef struct
+{
+  uint64_t hash;
+  uint32_t part;
+} part_hash_t;
+
+typedef struct
+{
+  uint32_t first_vertex;      // first entry in local_vertices
+  uint32_t num_vertices;      // number of unique vertices referenced by the part
+  libload_float3_t centroid;
+  float radius;
+} part_geometry_t;
+
+static int compare_part_hash(const void* a, const void* b)
+{
+  const part_hash_t* pa = (const part_hash_t*)a;
+  const part_hash_t* pb = (const part_hash_t*)b;
+
+  if (pa->hash != pb->hash)
+    return (pa->hash < pb->hash) ? -1 : 1;
+
+  // keep original part order within a bucket so results are deterministic
+  return (pa->part < pb->part) ? -1 : (pa->part > pb->part) ? 1 : 0;
+}
+
+static libload_float3_t sub3(libload_float3_t a, libload_float3_t b)
+{
+  libload_float3_t r;
+  r.x = a.x - b.x;
+  r.y = a.y - b.y;
+  r.z = a.z - b.z;
+  return r;
+}
+
+static float dot3(libload_float3_t a, libload_float3_t b)
+{
+  return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static libload_float3_t cross3(libload_float3_t a, libload_float3_t b)
+{
+  libload_float3_t r;
+  r.x = a.y * b.z - a.z * b.y;
+  r.y = a.z * b.x - a.x * b.z;
+  r.z = a.x * b.y - a.y * b.x;
+  return r;
+}
+
+static libload_float3_t rotate3(const libload_rigid_transform_t* t, libload_float3_t v)
+{
+  libload_float3_t r;
+  r.x = dot3(t->rotation[0], v);
+  r.y = dot3(t->rotation[1], v);
+  r.z = dot3(t->rotation[2], v);
+  return r;
+}
+
+static void set_identity(libload_rigid_transform_t* t)
+{
+  memset(t, 0, sizeof(libload_rigid_transform_t));
+  t->rotation[0].x = 1.f;
+  t->rotation[1].y = 1.f;
+  t->rotation[2].z = 1.f;
+}
+
+// builds an orthonormal frame (columns e0, e1, e2) from two vertices of the part.
+// returns false if the vertices are degenerate (part is a point or a line)
+static bool build_frame(libload_float3_t origin, libload_float3_t a, libload_float3_t b, libload_float3_t frame[3])
+{
+  float len;
+
+  frame[0] = sub3(a, origin);
+  len = sqrtf(dot3(frame[0], frame[0]));
+  if (len <= 0.f)
+    return false;
+
+  frame[0].x /= len; frame[0].y /= len; frame[0].z /= len;
+
+  frame[2] = cross3(frame[0], sub3(b, origin));
+  len = sqrtf(dot3(frame[2], frame[2]));
+  if (len <= 0.f)
+    return false;
+
+  frame[2].x /= len; frame[2].y /= len; frame[2].z /= len;
+  frame[1] = cross3(frame[2], frame[0]);
+  return true;
+}
+
+// gathers the unique vertices referenced by each part, in order of first use,
+// and rewrites the part's indices relative to that list
+static void build_part_geometry(const libload_obj_model_t* model, const libload_obj_model_part_t* parts, uint32_t num_parts,
+  uint32_t* remap, part_geometry_t* geometry, uint32_t* local_vertices, uint32_t* local_indices)
+{
+  uint32_t p, i, num_local_vertices = 0;
+
+  for (p = 0; p < num_parts; ++p)
+  {
+    const libload_obj_model_part_t* part = &parts[p];
+    part_geometry_t* geo = &geometry[p];
+    uint32_t* verts = 0;
+    float radius_sq = 0.f;
+
+    geo->first_vertex = num_local_vertices;
+    geo->num_vertices = 0;
+    verts = &local_vertices[geo->first_vertex];
+
+    for (i = part->base_index; i < part->base_index + part->num_indices; ++i)
+    {
+      uint32_t index = model->indices[i];
+      if (remap[index] == UINT32_MAX)
+      {
+        remap[index] = geo->num_vertices;
+        verts[geo->num_vertices++] = index;
+      }
+      local_indices[i] = remap[index];
+    }
+
+    num_local_vertices += geo->num_vertices;
+
+    geo->centroid.x = geo->centroid.y = geo->centroid.z = 0.f;
+    for (i = 0; i < geo->num_vertices; ++i)
+    {
+      const libload_float3_t* pos = &model->vertices[verts[i]].position;
+      geo->centroid.x += pos->x;
+      geo->centroid.y += pos->y;
+      geo->centroid.z += pos->z;
+
+      // reset the remap table for the next part
+      remap[verts[i]] = UINT32_MAX;
+    }
+
+    if (geo->num_vertices > 0)
+    {
+      geo->centroid.x /= (float)geo->num_vertices;
+      geo->centroid.y /= (float)geo->num_vertices;
+      geo->centroid.z /= (float)geo->num_vertices;
+    }
+
+    for (i = 0; i < geo->num_vertices; ++i)
+    {
+      libload_float3_t d = sub3(model->vertices[verts[i]].position, geo->centroid);
+      float len_sq = dot3(d, d);
+      if (len_sq > radius_sq)
+        radius_sq = len_sq;
+    }
+
+    geo->radius = sqrtf(radius_sq);
+  }
+}
+
+static uint64_t hash_part(const libload_obj_model_t* model, const libload_obj_model_part_t* part,
+  const part_geometry_t* geo, const uint32_t* local_vertices, const uint32_t* local_indices)
+{
+  uint64_t hash = LIBLOAD_HASH_SEED;
+  uint32_t i;
+
+  hash = hash_bytes(hash, &geo->num_vertices, sizeof(geo->num_vertices));
+  hash = hash_bytes(hash, &part->num_indices, sizeof(part->num_indices));
+  hash = hash_bytes(hash, &local_indices[part->base_index], sizeof(uint32_t) * part->num_indices);
+
+  for (i = 0; i < geo->num_vertices; ++i)
+  {
+    const libload_float2_t* uv = &model->vertices[local_vertices[geo->first_vertex + i]].texcoord;
+    int32_t q[2];
+    q[0] = (int32_t)floorf(uv->x * TEXCOORD_HASH_SCALE + 0.5f);
+    q[1] = (int32_t)floorf(uv->y * TEXCOORD_HASH_SCALE + 0.5f);
+    hash = hash_bytes(hash, q, sizeof(q));
+  }
+
+  return hash;
+}
+
+static bool vectors_match(libload_float3_t a, libload_float3_t b, float tolerance)
+{
+  return fabsf(a.x - b.x) <= tolerance && fabsf(a.y - b.y) <= tolerance && fabsf(a.z - b.z) <= tolerance;
+}
+
+// determines whether candidate is a rigidly transformed copy of reference, and if so
+// returns the transform mapping the reference geometry onto the candidate
+static bool match_parts(const libload_obj_model_t* model,
+  const libload_obj_model_part_t* ref_part, const part_geometry_t* ref,
+  const libload_obj_model_part_t* cand_part, const part_geometry_t* cand,
+  const uint32_t* local_vertices, const uint32_t* local_indices, float tolerance,
+  libload_rigid_transform_t* out_transform)
+{
+  const uint32_t* ref_verts = &local_vertices[ref->first_vertex];
+  const uint32_t* cand_verts = &local_vertices[cand->first_vertex];
+  float pos_tolerance = tolerance * ref->radius;
+  float max_dist_sq = 0.f, max_area_sq = 0.f;
+  uint32_t a = 0, b = 0, i, r, c;
+  libload_float3_t ref_frame[3], cand_frame[3];
+  libload_rigid_transform_t xform;
+
+  if (ref->num_vertices != cand->num_vertices || ref_part->num_indices != cand_part->num_indices)
+    return false;
+
+  if (fabsf(ref->radius - cand->radius) > pos_tolerance)
+    return false;
+
+  if (memcmp(&local_indices[ref_part->base_index], &local_indices[cand_part->base_index],
+    sizeof(uint32_t) * ref_part->num_indices) != 0)
+    return false;
+
+  // pick the vertex farthest from the centroid, then the one spanning the largest
+  // triangle with it, to get a well conditioned frame
+  for (i = 0; i < ref->num_vertices; ++i)
+  {
+    libload_float3_t d = sub3(model->vertices[ref_verts[i]].position, ref->centroid);
+    float dist_sq = dot3(d, d);
+    if (dist_sq > max_dist_sq)
+    {
+      max_dist_sq = dist_sq;
+      a = i;
+    }
+  }
+
+  for (i = 0; i < ref->num_vertices; ++i)
+  {
+    libload_float3_t n = cross3(
+      sub3(model->vertices[ref_verts[a]].position, ref->centroid),
+      sub3(model->vertices[ref_verts[i]].position, ref->centroid));
+    float area_sq = dot3(n, n);
+    if (area_sq > max_area_sq)
+    {
+      max_area_sq = area_sq;
+      b = i;
+    }
+  }
+
+  set_identity(&xform);
+
+  if (build_frame(ref->centroid, model->vertices[ref_verts[a]].position, model->vertices[ref_verts[b]].position, ref_frame) &&
+      build_frame(cand->centroid, model->vertices[cand_verts[a]].position, model->vertices[cand_verts[b]].position, cand_frame))
+  {
+    // rotation = cand_frame * transpose(ref_frame)
+    for (r = 0; r < 3; ++r)
+    {
+      float* row = &xform.rotation[r].x;
+      for (c = 0; c < 3; ++c)
+      {
+        row[c] =
+          (&cand_frame[0].x)[r] * (&ref_frame[0].x)[c] +
+          (&cand_frame[1].x)[r] * (&ref_frame[1].x)[c] +
+          (&cand_frame[2].x)[r] * (&ref_frame[2].x)[c];
+      }
+    }
+  }
+  // otherwise the part is a point or a line. fall back to a pure translation
+
+  xform.translation = sub3(cand->centroid, rotate3(&xform, ref->centroid));
+
+  for (i = 0; i < ref->num_vertices; ++i)
+  {
+    const libload_obj_vertex_t* rv = &model->vertices[ref_verts[i]];
+    const libload_obj_vertex_t* cv = &model->vertices[cand_verts[i]];
+    libload_float3_t pos = rotate3(&xform, rv->position);
+    pos.x += xform.translation.x;
+    pos.y += xform.translation.y;
+    pos.z += xform.translation.z;
+
+    if (!vectors_match(pos, cv->position, pos_tolerance))
+      return false;
+    if (!vectors_match(rotate3(&xform, rv->normal), cv->normal, tolerance))
+      return false;
+    if (!vectors_match(rotate3(&xform, rv->tangent), cv->tangent, tolerance))
+      return false;
+    if (!vectors_match(rotate3(&xform, rv->bitangent), cv->bitangent, tolerance))
+      return false;
+    if (fabsf(rv->texcoord.x - cv->texcoord.x) > tolerance || fabsf(rv->texcoord.y - cv->texcoord.y) > tolerance)
+      return false;
+  }
+
+  *out_transform = xform;
+  return true;
+}
+
+bool libload_obj_find_instances(const libload_obj_model_t* model, float tolerance, libload_obj_instanced_model_t** out_instanced)
+{
+  bool result = false;
+  const libload_obj_model_part_t* parts = 0;
+  libload_obj_model_part_t* all_parts = 0;
+  uint32_t num_parts = 0;
+  uint32_t first_index = 0;
+  uint32_t* remap = 0;
+  uint32_t* local_vertices = 0;
+  uint32_t* local_indices = 0;
+  part_geometry_t* geometry = 0;
+  part_hash_t* hashes = 0;
+  uint32_t* representatives = 0;
+  uint32_t* part_to_mesh = 0;
+  uint32_t num_meshes = 0;
+  uint32_t num_mesh_vertices = 0;
+  uint32_t num_mesh_indices = 0;
+  libload_obj_instanced_model_t* instanced = 0;
+  libload_obj_model_t* shared = 0;
+  uint32_t i, j, k;
+
+  if (!model || !out_instanced)
+    goto cleanup;
+
+  // indices before the first usemtl (all of them, in models without any)
+  // are treated as one more part, in front of the others
+  parts = model->parts;
+  num_parts = model->num_parts;
+
+  first_index = model->num_indices;
+  for (i = 0; i < model->num_parts; ++i)
+  {
+    if (model->parts[i].base_index < first_index)
+      first_index = model->parts[i].base_index;
+  }
+
+  if (first_index > 0 || num_parts == 0)
+  {
+    all_parts = (libload_obj_model_part_t*)malloc(sizeof(libload_obj_model_part_t) * (num_parts + 1));
+    if (!all_parts)
+      goto cleanup;
+
+    memset(&all_parts[0], 0, sizeof(libload_obj_model_part_t));
+    all_parts[0].num_indices = first_index;
+    if (num_parts > 0)
+      memcpy(&all_parts[1], model->parts, sizeof(libload_obj_model_part_t) * num_parts);
+
+    parts = all_parts;
+    ++num_parts;
+  }
+
+  remap = (uint32_t*)malloc(sizeof(uint32_t) * (model->num_vertices + 1));
+  local_vertices = (uint32_t*)malloc(sizeof(uint32_t) * (model->num_indices + 1));
+  local_indices = (uint32_t*)malloc(sizeof(uint32_t) * (model->num_indices + 1));
+  geometry = (part_geometry_t*)malloc(sizeof(part_geometry_t) * num_parts);
+  hashes = (part_hash_t*)malloc(sizeof(part_hash_t) * num_parts);
+  representatives = (uint32_t*)malloc(sizeof(uint32_t) * num_parts);
+  part_to_mesh = (uint32_t*)malloc(sizeof(uint32_t) * num_parts);
+  if (!remap || !local_vertices || !local_indices || !geometry || !hashes || !representatives || !part_to_mesh)
+    goto cleanup;
+
+  memset(remap, 0xFF, sizeof(uint32_t) * (model->num_vertices + 1));
+
+  build_part_geometry(model, parts, num_parts, remap, geometry, local_vertices, local_indices);
+
+  for (i = 0; i < num_parts; ++i)
+  {
+    hashes[i].hash = hash_part(model, &parts[i], &geometry[i], local_vertices, local_indices);
+    hashes[i].part = i;
+  }
+
+  qsort(hashes, num_parts, sizeof(part_hash_t), compare_part_hash);
+
+  instanced = (libload_obj_instanced_model_t*)malloc(sizeof(libload_obj_instanced_model_t));
+  if (!instanced)
+    goto cleanup;
+
+  memset(instanced, 0, sizeof(libload_obj_instanced_model_t));
+
+  instanced->instances = (libload_obj_instance_t*)malloc(sizeof(libload_obj_instance_t) * num_parts);
+  if (!instanced->instances)
+    goto cleanup;
+
+  instanced->num_instances = num_parts;
+
+  // walk each bucket of equal hashes, matching each part against the
+  // representatives already found in that bucket
+  for (i = 0; i < num_parts; i = j)
+  {
+    uint32_t first_mesh = num_meshes;
+
+    for (j = i; j < num_parts && hashes[j].hash == hashes[i].hash; ++j)
+    {
+      uint32_t p = hashes[j].part;
+      libload_obj_instance_t* instance = &instanced->instances[p];
+
+      for (k = first_mesh; k < num_meshes; ++k)
+      {
+        uint32_t rep = representatives[k];
+        if (match_parts(model, &parts[rep], &geometry[rep], &parts[p], &geometry[p],
+          local_vertices, local_indices, tolerance, &instance->transform))
+          break;
+      }
+
+      if (k == num_meshes)
+      {
+        // no match, so this part becomes a new shared mesh
+        representatives[num_meshes++] = p;
+        num_mesh_vertices += geometry[p].num_vertices;
+        num_mesh_indices += parts[p].num_indices;
+        set_identity(&instance->transform);
+      }
+
+      part_to_mesh[p] = k;
+    }
+  }
+
+  // build the model holding only the shared meshes
+  shared = (libload_obj_model_t*)malloc(sizeof(libload_obj_model_t));
+  if (!shared)
+    goto cleanup;
+
+  memset(shared, 0, sizeof(libload_obj_model_t));
+  instanced->model = shared;
+
+  strcpy_s(shared->material_file, LIBLOAD_ARRAYSIZE(shared->material_file), model->material_file);
+
+  shared->vertices = (libload_obj_vertex_t*)malloc(sizeof(libload_obj_vertex_t) * (num_mesh_vertices + 1));
+  shared->indices = (uint32_t*)malloc(sizeof(uint32_t) * (num_mesh_indices + 1));
+  shared->parts = (libload_obj_model_part_t*)malloc(sizeof(libload_obj_model_part_t) * num_meshes);
+  if (!shared->vertices || !shared->indices || !shared->parts)
+    goto cleanup;
+
+  for (k = 0; k < num_meshes; ++k)
+  {
+    uint32_t rep = representatives[k];
+    const part_geometry_t* geo = &geometry[rep];
+    libload_obj_model_part_t* mesh = &shared->parts[shared->num_parts++];
+
+    *mesh = parts[rep];
+    mesh->base_index = shared->num_indices;
+
+    for (i = 0; i < parts[rep].num_indices; ++i)
+      shared->indices[shared->num_indices++] = shared->num_vertices + local_indices[parts[rep].base_index + i];
+
+    for (i = 0; i < geo->num_vertices; ++i)
+      shared->vertices[shared->num_vertices++] = model->vertices[local_vertices[geo->first_vertex + i]];
+  }
+
+  for (i = 0; i < num_parts; ++i)
+  {
+    libload_obj_instance_t* instance = &instanced->instances[i];
+    strcpy_s(instance->name, LIBLOAD_ARRAYSIZE(instance->name), parts[i].name);
+    strcpy_s(instance->material_name, LIBLOAD_ARRAYSIZE(instance->material_name), parts[i].material_name);
+    instance->mesh_index = part_to_mesh[i];
+  }
+
+  // only the transforms count towards the instanced size, since that's the
+  // per-instance data a renderer needs to upload
+  instanced->source_bytes =
+    (uint64_t)model->num_vertices * sizeof(libload_obj_vertex_t) +
+    (uint64_t)model->num_indices * sizeof(uint32_t);
+  instanced->instanced_bytes =
+    (uint64_t)shared->num_vertices * sizeof(libload_obj_vertex_t) +
+    (uint64_t)shared->num_indices * sizeof(uint32_t) +
+    (uint64_t)instanced->num_instances * sizeof(libload_rigid_transform_t);
+
+  *out_instanced = instanced;
+  instanced = 0;
+  result = true;
+
+cleanup:
+  libload_obj_free_instanced(instanced);
+
+  if (part_to_mesh)
+    free(part_to_mesh);
+  if (representatives)
+    free(representatives);
+  if (hashes)
+    free(hashes);
+  if (geometry)
+    free(geometry);
+  if (local_indices)
+    free(local_indices);
+  if (local_vertices)
+    free(local_vertices);
+  if (remap)
+    free(remap);
+  if (all_parts)
+    free(all_parts);
+
+  return result;
+}
+
+void libload_obj_free_instanced(libload_obj_instanced_model_t* instanced)
+{
+  if (instanced)
+  {
+    libload_obj_free(instanced->model);
+    if (instanced->instances)
+      free(instanced->instances);
+    free(instanced);
+  }
+}
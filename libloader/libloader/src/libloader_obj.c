@@ -12,9 +12,380 @@
 #include <assert.h>
 #include <math.h>
 
-bool libload_obj_load(const char* filename, libload_obj_model_t** out_model)
+// directives are picked by their first one or two characters (lower cased),
+// so longer keywords need at most one full compare
+obj_directive_t classify_obj_line(const char* line)
 {
-  bool result = false;
+  if (line[0] == '#')
+    return OBJ_COMMENT;
+
+  switch (line[0] | 0x20)
+  {
+  case 'v':
+    if (line[1] == ' ')
+      return OBJ_VERTEX;
+    if ((line[1] | 0x20) == 'n' && line[2] == ' ')
+      return OBJ_NORMAL;
+    if ((line[1] | 0x20) == 't' && line[2] == ' ')
+      return OBJ_TEXCOORD;
+    break;
+
+  case 'f':
+    if (line[1] == ' ')
+      return OBJ_FACE;
+    break;
+
+  case 'g':
+    if (line[1] == ' ')
+      return OBJ_GROUP;
+    break;
+
+  case 's':
+    if (line[1] == ' ')
+      return OBJ_SMOOTH;
+    break;
+
+  case 'm':
+    if (_strnicmp(line, "mtllib ", 7) == 0)
+      return OBJ_MTLLIB;
+    break;
+
+  case 'u':
+    if (_strnicmp(line, "usemtl ", 7) == 0)
+      return OBJ_USEMTL;
+    break;
+  }
+
+  return OBJ_UNKNOWN;
+}
+
+mtl_directive_t classify_mtl_line(const char* line)
+{
+  if (line[0] == '#')
+    return MTL_COMMENT;
+
+  switch (line[0] | 0x20)
+  {
+  case 'n':
+    if ((line[1] | 0x20) == 's' && line[2] == ' ')
+      return MTL_NS;
+    if ((line[1] | 0x20) == 'i' && line[2] == ' ')
+      return MTL_NI;
+    if (_strnicmp(line, "newmtl ", 7) == 0)
+      return MTL_NEWMTL;
+    break;
+
+  case 'd':
+    if (line[1] == ' ')
+      return MTL_D;
+    break;
+
+  case 't':
+    if ((line[1] | 0x20) == 'r' && line[2] == ' ')
+      return MTL_TR;
+    if ((line[1] | 0x20) == 'f' && line[2] == ' ')
+      return MTL_TF;
+    break;
+
+  case 'i':
+    if (_strnicmp(line, "illum ", 6) == 0)
+      return MTL_ILLUM;
+    break;
+
+  case 'k':
+    if (line[1] != '\0' && line[2] == ' ')
+    {
+      switch (line[1] | 0x20)
+      {
+      case 'a': return MTL_KA;
+      case 'd': return MTL_KD;
+      case 's': return MTL_KS;
+      case 'e': return MTL_KE;
+      }
+    }
+    break;
+
+  case 'm':
+    if (_strnicmp(line, "map_", 4) == 0)
+    {
+      if (_strnicmp(line + 4, "Ka ", 3) == 0)
+        return MTL_MAP_KA;
+      if (_strnicmp(line + 4, "Kd ", 3) == 0)
+        return MTL_MAP_KD;
+      if (_strnicmp(line + 4, "d ", 2) == 0)
+        return MTL_MAP_D;
+      if (_strnicmp(line + 4, "bump ", 5) == 0)
+        return MTL_MAP_BUMP;
+    }
+    break;
+
+  case 'b':
+    if (_strnicmp(line, "bump ", 5) == 0)
+      return MTL_BUMP;
+    break;
+  }
+
+  return MTL_UNKNOWN;
+}
+
+uint32_t parse_face(const char* line, uint32_t num_verts, uint32_t num_vert_normals, uint32_t num_vert_texcoords, uint64_t keys[6])
+{
+  static const uint32_t triangle_order[] = { 0, 1, 2 };
+  static const uint32_t quad_order[] = { 0, 1, 2, 0, 2, 3 };
+  const uint32_t* order = 0;
+  uint32_t num_keys = 0;
+  int v[4], vn[4], vt[4];
+  int num_fields = sscanf_s(line,
+    "%d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d",
+    &v[0], &vt[0], &vn[0],
+    &v[1], &vt[1], &vn[1],
+    &v[2], &vt[2], &vn[2],
+    &v[3], &vt[3], &vn[3]);
+
+  if (num_fields == 1)
+  {
+    // %d//%d format. No texture data
+    num_fields = sscanf_s(line,
+      "%d//%d %d//%d %d//%d %d//%d",
+      &v[0], &vn[0],
+      &v[1], &vn[1],
+      &v[2], &vn[2],
+      &v[3], &vn[3]);
+
+    if (num_fields == 1)
+    {
+      // %d format. only position
+      num_fields = sscanf_s(line,
+        "%d %d %d %d", &v[0], &v[1], &v[2], &v[3]);
+
+      vn[0] = vn[1] = vn[2] = vn[3] = 1;
+    }
+
+    vt[0] = vt[1] = vt[2] = vt[3] = 1;
+  }
+
+  if (num_fields == 2)
+  {
+    // %d/%d format. No normal data
+    num_fields = sscanf_s(line,
+      "%d/%d %d/%d %d/%d %d/%d",
+      &v[0], &vt[0],
+      &v[1], &vt[1],
+      &v[2], &vt[2],
+      &v[3], &vt[3]);
+
+    vn[0] = vn[1] = vn[2] = vn[3] = 1;
+  }
+
+  if (num_fields == 3 || num_fields == 6 || num_fields == 9)  // single triangle
+  {
+    order = triangle_order;
+    num_keys = 3;
+  }
+  else if (num_fields == 4 || num_fields == 8 || num_fields == 12) // quad
+  {
+    order = quad_order;
+    num_keys = 6;
+  }
+  else
+  {
+    return 0;
+  }
+
+  // negative indices are relative to the end of the list so far
+  for (int i = 0; i < (num_keys == 6 ? 4 : 3); ++i)
+  {
+    if (v[i] < 0)
+      v[i] = num_verts + v[i] + 1;
+    if (vn[i] < 0)
+      vn[i] = num_vert_normals + vn[i] + 1;
+    if (vt[i] < 0)
+      vt[i] = num_vert_texcoords + vt[i] + 1;
+
+    if (v[i] < 1) v[i] = 1;
+    if (vn[i] < 1) vn[i] = 1;
+    if (vt[i] < 1) vt[i] = 1;
+  }
+
+  for (uint32_t i = 0; i < num_keys; ++i)
+  {
+    int j = order[i];
+    assert(((v[j] - 1) & 0xFFFFF) == (v[j] - 1)); // make sure value doesn't exceed key mask
+    assert(((vn[j] - 1) & 0xFFFFF) == (vn[j] - 1)); // make sure value doesn't exceed key mask
+    assert(((vt[j] - 1) & 0xFFFFF) == (vt[j] - 1)); // make sure value doesn't exceed key mask
+
+    keys[i] =
+      ((uint64_t)((v[j] - 1) & 0xFFFFF) << 40) |
+      ((uint64_t)((vn[j] - 1) & 0xFFFFF) << 20) |
+      ((uint64_t)((vt[j] - 1) & 0xFFFFF));
+  }
+
+  return num_keys;
+}
+
+void vertex_from_key(libload_obj_vertex_t* vertex, uint64_t key,
+  const libload_float3_t* verts, const libload_float3_t* vert_normals, const libload_float2_t* vert_texcoords)
+{
+  memset(vertex, 0, sizeof(libload_obj_vertex_t));
+  vertex->position = verts[OBJ_KEY_VERT(key)];
+  vertex->normal = vert_normals[OBJ_KEY_NORMAL(key)];
+  vertex->texcoord = vert_texcoords[OBJ_KEY_TEXCOORD(key)];
+}
+
+uint32_t split_sections(const char* buffer, const char* buffer_end, obj_section_t* out_sections)
+{
+  const char* line = buffer;
+  const char* section_start = buffer;
+  obj_section_t counts;
+  obj_directive_t section_directive = OBJ_UNKNOWN;
+  uint32_t num_sections = 0;
+  uint32_t num_verts = 0, num_vert_normals = 0, num_vert_texcoords = 0;
+
+  memset(&counts, 0, sizeof(counts));
+
+  while (line <= buffer_end)
+  {
+    const char* line_end = find_line_end(line, buffer_end);
+    obj_directive_t directive = (line < buffer_end) ? classify_obj_line(line) : OBJ_UNKNOWN;
+
+    if (line == buffer && (directive == OBJ_GROUP || directive == OBJ_USEMTL))
+      section_directive = directive;
+
+    // a group or material starts a new section, as does the end of the file
+    if (line == buffer_end || ((directive == OBJ_GROUP || directive == OBJ_USEMTL) && line > buffer))
+    {
+      if (out_sections)
+      {
+        obj_section_t* section = &out_sections[num_sections];
+        *section = counts;
+        section->offset = (uint32_t)(section_start - buffer);
+        section->length = (uint32_t)(line - section_start);
+        section->hash = hash_bytes(LIBLOAD_HASH_SEED, section_start, section->length);
+        section->first_vert = num_verts;
+        section->first_normal = num_vert_normals;
+        section->first_texcoord = num_vert_texcoords;
+        section->part = OBJ_NO_PART;
+        section->directive = section_directive;
+      }
+
+      num_verts += counts.num_verts;
+      num_vert_normals += counts.num_normals;
+      num_vert_texcoords += counts.num_texcoords;
+      memset(&counts, 0, sizeof(counts));
+
+      ++num_sections;
+      section_start = line;
+      section_directive = directive;
+
+      if (line == buffer_end)
+        break;
+    }
+
+    if (directive == OBJ_VERTEX)
+      ++counts.num_verts;
+    else if (directive == OBJ_NORMAL)
+      ++counts.num_normals;
+    else if (directive == OBJ_TEXCOORD)
+      ++counts.num_texcoords;
+
+    // skip the line & its terminators
+    line = line_end;
+    while (line < buffer_end && (*line == '\n' || *line == '\r'))
+      ++line;
+  }
+
+  return num_sections;
+}
+
+typedef struct
+{
+  // file contents. sized to the largest file read so far
+  char* buffer;
+  uint32_t buffer_capacity;
+
+  // parsing buffers. sized conservatively from the largest file parsed so far
+  uint32_t capacity;
+  libload_float3_t* verts;
+  libload_float3_t* vert_normals;
+  libload_float2_t* vert_texcoords;
+  keyvalue_pair_t* vertex_map;
+  libload_obj_vertex_t* vertices;
+  uint32_t* indices;
+  libload_obj_model_part_t* parts;
+} obj_scratch_t;
+
+static void free_scratch(obj_scratch_t* scratch)
+{
+  if (scratch->parts)
+    free(scratch->parts);
+  if (scratch->indices)
+    free(scratch->indices);
+  if (scratch->vertices)
+    free(scratch->vertices);
+  if (scratch->vertex_map)
+    free(scratch->vertex_map);
+  if (scratch->vert_texcoords)
+    free(scratch->vert_texcoords);
+  if (scratch->vert_normals)
+    free(scratch->vert_normals);
+  if (scratch->verts)
+    free(scratch->verts);
+  if (scratch->buffer)
+    free(scratch->buffer);
+
+  memset(scratch, 0, sizeof(obj_scratch_t));
+}
+
+// makes sure the parsing buffers can hold the contents of a file of buffer_size bytes
+static bool reserve_scratch(obj_scratch_t* scratch, uint32_t buffer_size)
+{
+  uint32_t size = buffer_size + 256; // slack so tiny files still fit a value of each type
+
+  if (buffer_size <= scratch->capacity)
+    return true;
+
+  if (scratch->parts)
+    free(scratch->parts);
+  if (scratch->indices)
+    free(scratch->indices);
+  if (scratch->vertices)
+    free(scratch->vertices);
+  if (scratch->vertex_map)
+    free(scratch->vertex_map);
+  if (scratch->vert_texcoords)
+    free(scratch->vert_texcoords);
+  if (scratch->vert_normals)
+    free(scratch->vert_normals);
+  if (scratch->verts)
+    free(scratch->verts);
+
+  // allocate buffers for holding values conservatively
+  // as if the whole file is just this type of value
+  scratch->verts = (libload_float3_t*)malloc(size);
+  scratch->vert_normals = (libload_float3_t*)malloc(size);
+  scratch->vert_texcoords = (libload_float2_t*)malloc(size);
+  scratch->vertex_map = (keyvalue_pair_t*)malloc(size);
+  scratch->vertices = (libload_obj_vertex_t*)malloc(size * 10);
+  scratch->indices = (uint32_t*)malloc(size);
+  scratch->parts = (libload_obj_model_part_t*)malloc(size);
+
+  if (!scratch->verts || !scratch->vert_normals || !scratch->vert_texcoords || !scratch->vertex_map ||
+      !scratch->vertices || !scratch->indices || !scratch->parts)
+  {
+    scratch->capacity = 0;
+    return false;
+  }
+
+  scratch->capacity = buffer_size;
+  return true;
+}
+
+// parses a file using (and growing as needed) the scratch buffers. only the
+// returned model is allocated per file, at its exact size. if index_out is
+// given, it's filled in with what's needed to reload the file incrementally.
+static libload_obj_error_t load_obj(const char* filename, obj_scratch_t* scratch, libload_obj_reload_index_t* index_out, libload_obj_model_t** out_model)
+{
+  libload_obj_error_t error = LIBLOAD_OBJ_ERROR_OUT_OF_MEMORY;
   uint32_t buffer_size = 0;
   char* buffer = 0;
   char* buffer_end = 0;
@@ -26,70 +397,64 @@ bool libload_obj_load(const char* filename, libload_obj_model_t** out_model)
   uint32_t num_verts = 0;
   uint32_t num_vert_normals = 0;
   uint32_t num_vert_texcoords = 0;
-  libload_obj_model_t* model = 0;
+  libload_obj_model_t parsed;
+  libload_obj_model_t* model = &parsed;
+  libload_obj_model_t* result_model = 0;
   libload_obj_model_part_t* current_part = 0;
   keyvalue_pair_t* vertex_map = 0;
   uint32_t map_size = 0;
   uint32_t map_max = 0;
   char groupname[64] = {0};
+  uint32_t section = 0;
 
   // read the entire file into memory
-  buffer = read_text_file(filename, &buffer_size);
-  if (!buffer)
+  if (!read_text_file_into(filename, &scratch->buffer, &scratch->buffer_capacity, &buffer_size))
+  {
+    error = LIBLOAD_OBJ_ERROR_FILE;
     goto cleanup;
+  }
 
+  buffer = scratch->buffer;
   buffer_end = buffer + buffer_size;
 
-  // allocate buffers for holding values conservatively
-  // as if the whole file is just this type of value
-  verts = (libload_float3_t*)malloc(buffer_size);
-  if (!verts)
-    goto cleanup;
-
-  vert_normals = (libload_float3_t*)malloc(buffer_size);
-  if (!vert_normals)
+  if (!reserve_scratch(scratch, buffer_size))
     goto cleanup;
 
-  vert_texcoords = (libload_float2_t*)malloc(buffer_size);
-  if (!vert_texcoords)
-    goto cleanup;
-
-  // allocate the model struct
-  model = (libload_obj_model_t*)malloc(sizeof(libload_obj_model_t));
-  if (!model)
-    goto cleanup;
+  verts = scratch->verts;
+  vert_normals = scratch->vert_normals;
+  vert_texcoords = scratch->vert_texcoords;
 
+  // the model is built in the scratch buffers & copied out once its size is known
   memset(model, 0, sizeof(libload_obj_model_t));
+  model->vertices = scratch->vertices;
+  model->indices = scratch->indices;
+  model->parts = scratch->parts;
 
-  model->vertices = (libload_obj_vertex_t*)malloc(buffer_size * 10);
-  if (!model->vertices)
-    goto cleanup;
-
-  model->indices = (uint32_t*)malloc(buffer_size);
-  if (!model->indices)
-    goto cleanup;
-
-  model->parts = (libload_obj_model_part_t*)malloc(buffer_size);
-  if (!model->parts)
-    goto cleanup;
-
-  memset(model->vertices, 0, buffer_size);
-
-  // allocate the vertex map for binning (to build minimal verts & good index list)
-  vertex_map = (keyvalue_pair_t*)malloc(buffer_size);
-  if (!vertex_map)
-    goto cleanup;
-
+  // vertex map for binning (to build minimal verts & good index list)
+  vertex_map = scratch->vertex_map;
   map_max = buffer_size / sizeof(keyvalue_pair_t);
 
+  if (index_out)
+  {
+    // sections are found before parsing, which modifies the buffer
+    memset(index_out, 0, sizeof(libload_obj_reload_index_t));
+    index_out->num_sections = split_sections(buffer, buffer_end, 0);
+    index_out->sections = (obj_section_t*)malloc(sizeof(obj_section_t) * index_out->num_sections);
+    index_out->vertex_keys = (uint64_t*)malloc(sizeof(uint64_t) * (scratch->capacity / sizeof(uint32_t) + 64));
+    if (!index_out->sections || !index_out->vertex_keys)
+      goto cleanup;
+
+    split_sections(buffer, buffer_end, index_out->sections);
+  }
+
   // start at top of buffer, and start parsing one line at a time
   line = buffer;
   while (line < buffer_end)
   {
+    obj_directive_t directive;
+
     // read one line in by finding the newline & turning into \0
-    line_end = line;
-    while (line_end < buffer_end && (*line_end != '\n' && *line_end != '\r'))
-      ++line_end;
+    line_end = (char*)find_line_end(line, buffer_end);
 
     while ((line_end < buffer_end) && (*line_end == '\n' || *line_end == '\r'))
     {
@@ -98,52 +463,72 @@ bool libload_obj_load(const char* filename, libload_obj_model_t** out_model)
     }
 
     // handle line
-    if (*line == '#') // comment
+    directive = classify_obj_line(line);
+    if (directive == OBJ_COMMENT) // comment
     {
     }
-    else if (_strnicmp(line, "mtllib ", 7) == 0) // material library
+    else if (directive == OBJ_MTLLIB) // material library
     {
       sscanf_s(line + 7, "%s", model->material_file,
         (uint32_t)LIBLOAD_ARRAYSIZE(model->material_file));
     }
-    else if (_strnicmp(line, "v ", 2) == 0) // vertex
+    else if (directive == OBJ_VERTEX) // vertex
     {
       if (sscanf_s(line + 2, "%f %f %f",
         &verts[num_verts].x,
         &verts[num_verts].y,
         &verts[num_verts].z) != 3)
+      {
+        error = LIBLOAD_OBJ_ERROR_PARSE;
         goto cleanup;
+      }
 
       ++num_verts;
     }
-    else if (_strnicmp(line, "vn ", 3) == 0) // vertex normals
+    else if (directive == OBJ_NORMAL) // vertex normals
     {
       if (sscanf_s(line + 3, "%f %f %f",
         &vert_normals[num_vert_normals].x,
         &vert_normals[num_vert_normals].y,
         &vert_normals[num_vert_normals].z) != 3)
+      {
+        error = LIBLOAD_OBJ_ERROR_PARSE;
         goto cleanup;
+      }
 
       ++num_vert_normals;
     }
-    else if (_strnicmp(line, "vt ", 3) == 0) // vertex tex coords
+    else if (directive == OBJ_TEXCOORD) // vertex tex coords
     {
       if (sscanf_s(line + 3, "%f %f",
         &vert_texcoords[num_vert_texcoords].x,
         &vert_texcoords[num_vert_texcoords].y) != 2)
+      {
+        error = LIBLOAD_OBJ_ERROR_PARSE;
         goto cleanup;
+      }
 
       //vert_texcoords[num_vert_texcoords].y = 1.f - vert_texcoords[num_vert_texcoords].y;
 
       ++num_vert_texcoords;
     }
-    else if (_strnicmp(line, "g ", 2) == 0) // new group
+    else if (directive == OBJ_GROUP) // new group
     {
+      if (index_out && line > buffer)
+        index_out->sections[++section].base_index = model->num_indices;
+
       sscanf_s(line + 2, "%s", groupname,
         (uint32_t)LIBLOAD_ARRAYSIZE(groupname));
     }
-    else if (_strnicmp(line, "usemtl ", 7) == 0) // use material
+    else if (directive == OBJ_USEMTL) // use material
     {
+      if (index_out)
+      {
+        if (line > buffer)
+          index_out->sections[++section].base_index = model->num_indices;
+        index_out->sections[section].part = model->num_parts;
+      }
+
       if (current_part)
         current_part->num_indices = model->num_indices - current_part->base_index;
 
@@ -156,183 +541,182 @@ bool libload_obj_load(const char* filename, libload_obj_model_t** out_model)
 
       _strlwr_s(current_part->material_name, LIBLOAD_ARRAYSIZE(current_part->material_name));
     }
-    else if (_strnicmp(line, "s ", 2) == 0) // smooth shading group
+    else if (directive == OBJ_SMOOTH) // smooth shading group
     {
       // not used when vertex normals present
     }
-    else if (_strnicmp(line, "f ", 2) == 0) // face definition
+    else if (directive == OBJ_FACE) // face definition
     {
-      int v[4], vn[4], vt[4];
-      int num_fields = sscanf_s(line + 2,
-        "%d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d",
-        &v[0], &vt[0], &vn[0],
-        &v[1], &vt[1], &vn[1],
-        &v[2], &vt[2], &vn[2],
-        &v[3], &vt[3], &vn[3]);
+      uint64_t keys[6];
+      uint32_t num_keys = parse_face(line + 2, num_verts, num_vert_normals, num_vert_texcoords, keys);
 
-      if (num_fields == 1)
+      if (num_keys == 0)
       {
-        // %d//%d format. No texture data
-        num_fields = sscanf_s(line + 2,
-          "%d//%d %d//%d %d//%d %d//%d",
-          &v[0], &vn[0],
-          &v[1], &vn[1],
-          &v[2], &vn[2],
-          &v[3], &vn[3]);
-
-        if (num_fields == 1)
-        {
-          // %d format. only position
-          num_fields = sscanf_s(line + 2,
-            "%d %d %d %d", &v[0], &v[1], &v[2], &v[3]);
-
-          vn[0] = vn[1] = vn[2] = vn[3] = 1;
-        }
-
-        vt[0] = vt[1] = vt[2] = vt[3] = 1;
-      }
-
-      if (num_fields == 2)
-      {
-        // %d/%d format. No normal data
-        num_fields = sscanf_s(line + 2,
-          "%d/%d %d/%d %d/%d %d/%d",
-          &v[0], &vt[0],
-          &v[1], &vt[1],
-          &v[2], &vt[2],
-          &v[3], &vt[3]);
-
-        vn[0] = vn[1] = vn[2] = vn[3] = 1;
+        // can have larger polys than quad?
+        assert(false);
+        error = LIBLOAD_OBJ_ERROR_PARSE;
+        goto cleanup;
       }
 
-      if (v[0] < 0)
-        v[0] = num_verts + v[0] + 1;
-      if (v[1] < 0)
-        v[1] = num_verts + v[1] + 1;
-      if (v[2] < 0)
-        v[2] = num_verts + v[2] + 1;
-      if (vn[0] < 0)
-        vn[0] = num_vert_normals + vn[0] + 1;
-      if (vn[1] < 0)
-        vn[1] = num_vert_normals + vn[1] + 1;
-      if (vn[2] < 0)
-        vn[2] = num_vert_normals + vn[2] + 1;
-      if (vt[0] < 0)
-        vt[0] = num_vert_texcoords + vt[0] + 1;
-      if (vt[1] < 0)
-        vt[1] = num_vert_texcoords + vt[1] + 1;
-      if (vt[2] < 0)
-        vt[2] = num_vert_texcoords + vt[2] + 1;
-
-      for (int i = 0; i < 4; ++i)
+      for (uint32_t k = 0; k < num_keys; ++k)
       {
-        if (v[i] < 1) v[i] = 1;
-        if (vn[i] < 1) vn[i] = 1;
-        if (vt[i] < 1) vt[i] = 1;
-      }
+        uint32_t index = 0;
 
-      if (num_fields == 3 || num_fields == 6 || num_fields == 9)  // single triangle
-      {
-        for (int i = 0; i < 3; ++i)
+        if (!keyvalue_find(vertex_map, map_size, keys[k], &index))
         {
-          assert(((v[i] - 1) & 0xFFFFF) == (v[i] - 1)); // make sure value doesn't exceed key mask
-          assert(((vn[i] - 1) & 0xFFFFF) == (vn[i] - 1)); // make sure value doesn't exceed key mask
-          assert(((vt[i] - 1) & 0xFFFFF) == (vt[i] - 1)); // make sure value doesn't exceed key mask
-
-          uint32_t index = 0;
-          uint64_t key =
-            ((uint64_t)((v[i] - 1) & 0xFFFFF) << 40) |
-            ((uint64_t)((vn[i] - 1) & 0xFFFFF) << 20) |
-            ((uint64_t)((vt[i] - 1) & 0xFFFFF));
-
-          if (!keyvalue_find(vertex_map, map_size, key, &index))
-          {
-            // insert new vertex
-            model->vertices[model->num_vertices].position = verts[v[i] - 1];
-            model->vertices[model->num_vertices].normal = vert_normals[vn[i] - 1];
-            model->vertices[model->num_vertices].texcoord = vert_texcoords[vt[i] - 1];
-            model->indices[model->num_indices] = model->num_vertices;
-            keyvalue_insert(vertex_map, &map_size, map_max, key, model->num_vertices);
-            ++model->num_vertices;
-            ++model->num_indices;
-          }
-          else
-          {
-            model->indices[model->num_indices++] = index;
-          }
+          // insert new vertex
+          vertex_from_key(&model->vertices[model->num_vertices], keys[k], verts, vert_normals, vert_texcoords);
+          if (index_out)
+            index_out->vertex_keys[model->num_vertices] = keys[k];
+          model->indices[model->num_indices] = model->num_vertices;
+          keyvalue_insert(vertex_map, &map_size, map_max, keys[k], model->num_vertices);
+          ++model->num_vertices;
+          ++model->num_indices;
         }
-      }
-      else if (num_fields == 4 || num_fields == 8 || num_fields == 12) // quad
-      {
-        if (v[3] < 0)
-          v[3] = num_verts + v[3] + 1;
-        if (vn[3] < 0)
-          vn[3] = num_vert_normals + vn[3] + 1;
-        if (vt[3] < 0)
-          vt[3] = num_vert_texcoords + vt[3] + 1;
-
-        uint32_t order[] = { 0, 1, 2, 0, 2, 3 };
-        for (int i = 0; i < 6; ++i)
+        else
         {
-          int j = order[i];
-          assert(((v[j] - 1) & 0xFFFFF) == (v[j] - 1)); // make sure value doesn't exceed key mask
-          assert(((vn[j] - 1) & 0xFFFFF) == (vn[j] - 1)); // make sure value doesn't exceed key mask
-          assert(((vt[j] - 1) & 0xFFFFF) == (vt[j] - 1)); // make sure value doesn't exceed key mask
-
-          uint32_t index = 0;
-          uint64_t key =
-            ((uint64_t)((v[j] - 1) & 0xFFFFF) << 40) |
-            ((uint64_t)((vn[j] - 1) & 0xFFFFF) << 20) |
-            ((uint64_t)((vt[j] - 1) & 0xFFFFF));
-
-          if (!keyvalue_find(vertex_map, map_size, key, &index))
-          {
-            // insert new vertex
-            model->vertices[model->num_vertices].position = verts[v[j] - 1];
-            model->vertices[model->num_vertices].normal = vert_normals[vn[j] - 1];
-            model->vertices[model->num_vertices].texcoord = vert_texcoords[vt[j] - 1];
-            model->indices[model->num_indices] = model->num_vertices;
-            keyvalue_insert(vertex_map, &map_size, map_max, key, model->num_vertices);
-            ++model->num_vertices;
-            ++model->num_indices;
-          }
-          else
-          {
-            model->indices[model->num_indices++] = index;
-          }
+          model->indices[model->num_indices++] = index;
         }
       }
-      else
-      {
-        // can have larger polys than quad?
-        assert(false);
-        goto cleanup;
-      }
     }
-
     line = line_end;
   }
 
   if (current_part)
     current_part->num_indices = model->num_indices - current_part->base_index;
 
-  *out_model = model;
-  model = 0;
+  if (index_out)
+  {
+    for (section = 0; section < index_out->num_sections; ++section)
+    {
+      uint32_t next = (section + 1 < index_out->num_sections) ? index_out->sections[section + 1].base_index : model->num_indices;
+      index_out->sections[section].num_indices = next - index_out->sections[section].base_index;
+    }
+
+    // keep the raw attributes, so that vertices can be rebuilt from their keys
+    index_out->num_verts = num_verts;
+    index_out->num_vert_normals = num_vert_normals;
+    index_out->num_vert_texcoords = num_vert_texcoords;
+    index_out->num_vertices = model->num_vertices;
+    index_out->verts = (libload_float3_t*)malloc(sizeof(libload_float3_t) * (num_verts + 1));
+    index_out->vert_normals = (libload_float3_t*)malloc(sizeof(libload_float3_t) * (num_vert_normals + 1));
+    index_out->vert_texcoords = (libload_float2_t*)malloc(sizeof(libload_float2_t) * (num_vert_texcoords + 1));
+    if (!index_out->verts || !index_out->vert_normals || !index_out->vert_texcoords)
+      goto cleanup;
+
+    memcpy(index_out->verts, verts, sizeof(libload_float3_t) * num_verts);
+    memcpy(index_out->vert_normals, vert_normals, sizeof(libload_float3_t) * num_vert_normals);
+    memcpy(index_out->vert_texcoords, vert_texcoords, sizeof(libload_float2_t) * num_vert_texcoords);
+  }
+
+  result_model = (libload_obj_model_t*)malloc(sizeof(libload_obj_model_t));
+  if (!result_model)
+    goto cleanup;
+
+  *result_model = parsed;
+  result_model->vertices = (libload_obj_vertex_t*)malloc(sizeof(libload_obj_vertex_t) * (model->num_vertices + 1));
+  result_model->indices = (uint32_t*)malloc(sizeof(uint32_t) * (model->num_indices + 1));
+  result_model->parts = (libload_obj_model_part_t*)malloc(sizeof(libload_obj_model_part_t) * (model->num_parts + 1));
+  if (!result_model->vertices || !result_model->indices || !result_model->parts)
+    goto cleanup;
+
+  memcpy(result_model->vertices, model->vertices, sizeof(libload_obj_vertex_t) * model->num_vertices);
+  memcpy(result_model->indices, model->indices, sizeof(uint32_t) * model->num_indices);
+  memcpy(result_model->parts, model->parts, sizeof(libload_obj_model_part_t) * model->num_parts);
+
+  *out_model = result_model;
+  result_model = 0;
+  error = LIBLOAD_OBJ_OK;
+
+cleanup:
+  libload_obj_free(result_model);
+
+  return error;
+}
+
+bool libload_obj_load(const char* filename, libload_obj_model_t** out_model)
+{
+  obj_scratch_t scratch;
+  libload_obj_error_t error;
+
+  memset(&scratch, 0, sizeof(scratch));
+  error = load_obj(filename, &scratch, 0, out_model);
+  free_scratch(&scratch);
+
+  return error == LIBLOAD_OBJ_OK;
+}
+
+libload_obj_error_t load_obj_indexed(const char* filename, libload_obj_reload_index_t* index, libload_obj_model_t** out_model)
+{
+  obj_scratch_t scratch;
+  libload_obj_error_t error;
+
+  memset(&scratch, 0, sizeof(scratch));
+  error = load_obj(filename, &scratch, index, out_model);
+  free_scratch(&scratch);
+
+  return error;
+}
+
+typedef struct
+{
+  const char* const* filenames;
+  libload_obj_load_result_t* results;
+  obj_scratch_t* scratch;       // one per worker
+} load_many_job_t;
+
+static void load_one(void* context, uint32_t item, uint32_t worker)
+{
+  load_many_job_t* job = (load_many_job_t*)context;
+  libload_obj_load_result_t* result = &job->results[item];
+
+  result->model = 0;
+  result->error = load_obj(job->filenames[item], &job->scratch[worker], 0, &result->model);
+}
+
+bool libload_obj_load_many(const char* const* filenames, uint32_t num_files, uint32_t num_threads, libload_obj_load_result_t* out_results)
+{
+  bool result = false;
+  load_many_job_t job;
+  uint32_t num_workers = 0;
+  uint32_t i;
+
+  if (!filenames || !out_results)
+    return false;
+
+  for (i = 0; i < num_files; ++i)
+  {
+    out_results[i].model = 0;
+    out_results[i].error = LIBLOAD_OBJ_ERROR_OUT_OF_MEMORY;
+  }
+
+  num_workers = get_num_workers(num_threads, num_files);
+
+  memset(&job, 0, sizeof(job));
+  job.filenames = filenames;
+  job.results = out_results;
+  job.scratch = (obj_scratch_t*)malloc(sizeof(obj_scratch_t) * (num_workers + 1));
+  if (!job.scratch)
+    goto cleanup;
+
+  memset(job.scratch, 0, sizeof(obj_scratch_t) * (num_workers + 1));
+
+  parallel_for(num_files, num_workers, load_one, &job);
+
   result = true;
+  for (i = 0; i < num_files; ++i)
+  {
+    if (out_results[i].error != LIBLOAD_OBJ_OK)
+      result = false;
+  }
 
 cleanup:
-  libload_obj_free(model);
-
-  if (vertex_map)
-    free(vertex_map);
-  if (vert_texcoords)
-    free(vert_texcoords);
-  if (vert_normals)
-    free(vert_normals);
-  if (verts)
-    free(verts);
-  if (buffer)
-    free(buffer);
+  if (job.scratch)
+  {
+    for (i = 0; i < num_workers; ++i)
+      free_scratch(&job.scratch[i]);
+    free(job.scratch);
+  }
 
   return result;
 }
@@ -522,8 +906,7 @@ void libload_obj_free(libload_obj_model_t* model)
 {
   if (model)
   {
-    if (model->vertices)
-      free(model->vertices);
+    free_model_vertices(model);
     if (model->indices)
       free(model->indices);
     if (model->parts)
@@ -542,6 +925,7 @@ bool libload_mtl_load(const char* filename, uint32_t* inout_num_materials, liblo
   char* line_end = 0;
   uint32_t max_materials = 0;
   libload_mtl_t* current_material = 0;
+  mtl_directive_t directive;
 
   // validate input
   if (!inout_num_materials)
@@ -569,18 +953,17 @@ bool libload_mtl_load(const char* filename, uint32_t* inout_num_materials, liblo
       ++line;
 
     // read one line in by finding the newline & turning into \0
-    line_end = line;
-    while (line_end < buffer_end && *line_end != '\n')
-      ++line_end;
+    line_end = (char*)find_char(line, buffer_end, '\n');
 
     if (line_end < buffer_end)
       *line_end = '\0';
 
     // handle line
-    if (*line == '#') // comment
+    directive = classify_mtl_line(line);
+    if (directive == MTL_COMMENT) // comment
     {
     }
-    else if (_strnicmp(line, "newmtl ", 7) == 0) // material library
+    else if (directive == MTL_NEWMTL) // material library
     {
       if (out_materials)
       {
@@ -592,35 +975,35 @@ bool libload_mtl_load(const char* filename, uint32_t* inout_num_materials, liblo
       }
       ++(*inout_num_materials);
     }
-    else if (_strnicmp(line, "Ns ", 3) == 0) // 
+    else if (directive == MTL_NS) // 
     {
       if (current_material)
       {
         sscanf_s(line + 3, "%f", &current_material->Ns);
       }
     }
-    else if (_strnicmp(line, "Ni ", 3) == 0) // 
+    else if (directive == MTL_NI) // 
     {
       if (current_material)
       {
         sscanf_s(line + 3, "%f", &current_material->Ni);
       }
     }
-    else if (_strnicmp(line, "d ", 2) == 0) // 
+    else if (directive == MTL_D) // 
     {
       if (current_material)
       {
         sscanf_s(line + 2, "%f", &current_material->d);
       }
     }
-    else if (_strnicmp(line, "Tr ", 3) == 0) // 
+    else if (directive == MTL_TR) // 
     {
       if (current_material)
       {
         sscanf_s(line + 3, "%f", &current_material->Tr);
       }
     }
-    else if (_strnicmp(line, "Tf ", 3) == 0) // 
+    else if (directive == MTL_TF) // 
     {
       if (current_material)
       {
@@ -630,14 +1013,14 @@ bool libload_mtl_load(const char* filename, uint32_t* inout_num_materials, liblo
           &current_material->Tf.z);
       }
     }
-    else if (_strnicmp(line, "illum ", 6) == 0) // 
+    else if (directive == MTL_ILLUM) // 
     {
       if (current_material)
       {
         sscanf_s(line + 6, "%d", &current_material->illum_model);
       }
     }
-    else if (_strnicmp(line, "Ka ", 3) == 0) // 
+    else if (directive == MTL_KA) // 
     {
       if (current_material)
       {
@@ -647,7 +1030,7 @@ bool libload_mtl_load(const char* filename, uint32_t* inout_num_materials, liblo
           &current_material->Ka.z);
       }
     }
-    else if (_strnicmp(line, "Kd ", 3) == 0) // 
+    else if (directive == MTL_KD) // 
     {
       if (current_material)
       {
@@ -657,7 +1040,7 @@ bool libload_mtl_load(const char* filename, uint32_t* inout_num_materials, liblo
           &current_material->Kd.z);
       }
     }
-    else if (_strnicmp(line, "Ks ", 3) == 0) // 
+    else if (directive == MTL_KS) // 
     {
       if (current_material)
       {
@@ -667,7 +1050,7 @@ bool libload_mtl_load(const char* filename, uint32_t* inout_num_materials, liblo
           &current_material->Ks.z);
       }
     }
-    else if (_strnicmp(line, "Ke ", 3) == 0) // 
+    else if (directive == MTL_KE) // 
     {
       if (current_material)
       {
@@ -677,7 +1060,7 @@ bool libload_mtl_load(const char* filename, uint32_t* inout_num_materials, liblo
           &current_material->Ke.z);
       }
     }
-    else if (_strnicmp(line, "map_Ka ", 7) == 0) // 
+    else if (directive == MTL_MAP_KA) // 
     {
       if (current_material)
       {
@@ -686,7 +1069,7 @@ bool libload_mtl_load(const char* filename, uint32_t* inout_num_materials, liblo
           (uint32_t)LIBLOAD_ARRAYSIZE(current_material->map_Ka));
       }
     }
-    else if (_strnicmp(line, "map_Kd ", 7) == 0) // 
+    else if (directive == MTL_MAP_KD) // 
     {
       if (current_material)
       {
@@ -695,7 +1078,7 @@ bool libload_mtl_load(const char* filename, uint32_t* inout_num_materials, liblo
           (uint32_t)LIBLOAD_ARRAYSIZE(current_material->map_Kd));
       }
     }
-    else if (_strnicmp(line, "map_d ", 6) == 0) // 
+    else if (directive == MTL_MAP_D) // 
     {
       if (current_material)
       {
@@ -704,7 +1087,7 @@ bool libload_mtl_load(const char* filename, uint32_t* inout_num_materials, liblo
           (uint32_t)LIBLOAD_ARRAYSIZE(current_material->map_d));
       }
     }
-    else if (_strnicmp(line, "map_bump ", 9) == 0) // 
+    else if (directive == MTL_MAP_BUMP) // 
     {
       if (current_material)
       {
@@ -713,7 +1096,7 @@ bool libload_mtl_load(const char* filename, uint32_t* inout_num_materials, liblo
           (uint32_t)LIBLOAD_ARRAYSIZE(current_material->map_bump));
       }
     }
-    else if (_strnicmp(line, "bump ", 5) == 0) // 
+    else if (directive == MTL_BUMP) // 
     {
       if (current_material)
       {
@@ -0,0 +1,597 @@
+//=============================================================================
+// libloader_ply.c - Binary PLY model file
+// Reza Nourai, 2016
+//=============================================================================
+
+#include "..\include\libloader.h"
+#include "libloader_util.h"
+
+#include <stdio.h>
+#include <malloc.h>
+#include <string.h>
+#include <assert.h>
+
+#define PLY_MAX_ELEMENTS 16
+#define PLY_MAX_PROPERTIES 32
+
+typedef enum
+{
+  PLY_INVALID,
+  PLY_CHAR,
+  PLY_UCHAR,
+  PLY_SHORT,
+  PLY_USHORT,
+  PLY_INT,
+  PLY_UINT,
+  PLY_FLOAT,
+  PLY_DOUBLE,
+} ply_type_t;
+
+typedef struct
+{
+  char name[32];
+  ply_type_t type;
+  ply_type_t count_type;  // only for lists
+  bool is_list;
+  uint32_t offset;        // offset within the element (only valid if the element has no lists)
+} ply_property_t;
+
+typedef struct
+{
+  char name[32];
+  uint32_t count;
+  uint32_t num_properties;
+  ply_property_t properties[PLY_MAX_PROPERTIES];
+  uint32_t stride;        // 0 if the element has list properties (variable size)
+} ply_element_t;
+
+// property names matching each float of libload_obj_vertex_t, in memory order.
+// the first name is the canonical one, followed by common alternatives.
+static const char* const vertex_property_names[][4] =
+{
+  { "x" }, { "y" }, { "z" },
+  { "nx" }, { "ny" }, { "nz" },
+  { "tx" }, { "ty" }, { "tz" },
+  { "bx" }, { "by" }, { "bz" },
+  { "u", "s", "texture_u", "texture_s" },
+  { "v", "t", "texture_v", "texture_t" },
+};
+
+static ply_type_t parse_type(const char* name)
+{
+  if (strcmp(name, "char") == 0 || strcmp(name, "int8") == 0) return PLY_CHAR;
+  if (strcmp(name, "uchar") == 0 || strcmp(name, "uint8") == 0) return PLY_UCHAR;
+  if (strcmp(name, "short") == 0 || strcmp(name, "int16") == 0) return PLY_SHORT;
+  if (strcmp(name, "ushort") == 0 || strcmp(name, "uint16") == 0) return PLY_USHORT;
+  if (strcmp(name, "int") == 0 || strcmp(name, "int32") == 0) return PLY_INT;
+  if (strcmp(name, "uint") == 0 || strcmp(name, "uint32") == 0) return PLY_UINT;
+  if (strcmp(name, "float") == 0 || strcmp(name, "float32") == 0) return PLY_FLOAT;
+  if (strcmp(name, "double") == 0 || strcmp(name, "float64") == 0) return PLY_DOUBLE;
+  return PLY_INVALID;
+}
+
+static uint32_t type_size(ply_type_t type)
+{
+  switch (type)
+  {
+  case PLY_CHAR:
+  case PLY_UCHAR:
+    return 1;
+  case PLY_SHORT:
+  case PLY_USHORT:
+    return 2;
+  case PLY_INT:
+  case PLY_UINT:
+  case PLY_FLOAT:
+    return 4;
+  case PLY_DOUBLE:
+    return 8;
+  default:
+    return 0;
+  }
+}
+
+// PLY data is little endian, which matches all of our target platforms
+static double read_value(const uint8_t* data, ply_type_t type)
+{
+  switch (type)
+  {
+  case PLY_CHAR: return (double)*(const int8_t*)data;
+  case PLY_UCHAR: return (double)*(const uint8_t*)data;
+  case PLY_SHORT: { int16_t v; memcpy(&v, data, sizeof(v)); return (double)v; }
+  case PLY_USHORT: { uint16_t v; memcpy(&v, data, sizeof(v)); return (double)v; }
+  case PLY_INT: { int32_t v; memcpy(&v, data, sizeof(v)); return (double)v; }
+  case PLY_UINT: { uint32_t v; memcpy(&v, data, sizeof(v)); return (double)v; }
+  case PLY_FLOAT: { float v; memcpy(&v, data, sizeof(v)); return (double)v; }
+  case PLY_DOUBLE: { double v; memcpy(&v, data, sizeof(v)); return v; }
+  default: return 0.0;
+  }
+}
+
+static uint32_t read_index(const uint8_t* data, ply_type_t type)
+{
+  switch (type)
+  {
+  case PLY_CHAR:
+  case PLY_UCHAR: return *(const uint8_t*)data;
+  case PLY_SHORT:
+  case PLY_USHORT: { uint16_t v; memcpy(&v, data, sizeof(v)); return v; }
+  case PLY_INT:
+  case PLY_UINT: { uint32_t v; memcpy(&v, data, sizeof(v)); return v; }
+  default: return UINT32_MAX;
+  }
+}
+
+// parses the text header. on success, out_data points at the first byte of binary data
+static bool parse_header(const char* buffer, const char* buffer_end,
+  ply_element_t* elements, uint32_t* out_num_elements, const uint8_t** out_data)
+{
+  const char* line = buffer;
+  const char* line_end = 0;
+  ply_element_t* element = 0;
+  uint32_t num_elements = 0;
+  bool binary_le = false;
+  char text[256];
+  char word0[32], word1[32], word2[32], word3[32];
+
+  if (buffer_end - buffer < 4 || strncmp(buffer, "ply", 3) != 0)
+    return false;
+
+  while (line < buffer_end)
+  {
+    size_t len = 0;
+
+    line_end = line;
+    while (line_end < buffer_end && *line_end != '\n')
+      ++line_end;
+
+    if (line_end == buffer_end)
+      return false; // header never ended
+
+    // copy so that the line can be safely scanned
+    len = (size_t)(line_end - line);
+    if (len > 0 && line[len - 1] == '\r')
+      --len;
+    if (len >= sizeof(text))
+      len = sizeof(text) - 1;
+    memcpy(text, line, len);
+    text[len] = '\0';
+
+    if (strncmp(text, "format ", 7) == 0)
+    {
+      binary_le = (strncmp(text + 7, "binary_little_endian", 20) == 0);
+    }
+    else if (strncmp(text, "element ", 8) == 0)
+    {
+      if (num_elements == PLY_MAX_ELEMENTS)
+        return false;
+
+      element = &elements[num_elements++];
+      memset(element, 0, sizeof(ply_element_t));
+
+      if (sscanf_s(text + 8, "%31s %u", element->name, (uint32_t)LIBLOAD_ARRAYSIZE(element->name), &element->count) != 2)
+        return false;
+    }
+    else if (strncmp(text, "property ", 9) == 0)
+    {
+      ply_property_t* prop = 0;
+
+      if (!element || element->num_properties == PLY_MAX_PROPERTIES)
+        return false;
+
+      prop = &element->properties[element->num_properties++];
+
+      if (sscanf_s(text + 9, "%31s", word0, (uint32_t)LIBLOAD_ARRAYSIZE(word0)) != 1)
+        return false;
+
+      if (strcmp(word0, "list") == 0)
+      {
+        if (sscanf_s(text + 9, "%31s %31s %31s %31s",
+          word0, (uint32_t)LIBLOAD_ARRAYSIZE(word0),
+          word1, (uint32_t)LIBLOAD_ARRAYSIZE(word1),
+          word2, (uint32_t)LIBLOAD_ARRAYSIZE(word2),
+          word3, (uint32_t)LIBLOAD_ARRAYSIZE(word3)) != 4)
+          return false;
+
+        prop->is_list = true;
+        prop->count_type = parse_type(word1);
+        prop->type = parse_type(word2);
+        strcpy_s(prop->name, LIBLOAD_ARRAYSIZE(prop->name), word3);
+
+        if (prop->count_type == PLY_INVALID || prop->count_type == PLY_FLOAT || prop->count_type == PLY_DOUBLE)
+          return false;
+      }
+      else
+      {
+        if (sscanf_s(text + 9, "%31s %31s",
+          word0, (uint32_t)LIBLOAD_ARRAYSIZE(word0),
+          word1, (uint32_t)LIBLOAD_ARRAYSIZE(word1)) != 2)
+          return false;
+
+        prop->type = parse_type(word0);
+        strcpy_s(prop->name, LIBLOAD_ARRAYSIZE(prop->name), word1);
+      }
+
+      if (prop->type == PLY_INVALID)
+        return false;
+    }
+    else if (strncmp(text, "end_header", 10) == 0)
+    {
+      break;
+    }
+    // comment, obj_info & anything unknown are ignored
+
+    line = line_end + 1;
+  }
+
+  if (!binary_le)
+    return false;
+
+  // fixed size elements get precomputed property offsets
+  for (uint32_t e = 0; e < num_elements; ++e)
+  {
+    element = &elements[e];
+    element->stride = 0;
+
+    for (uint32_t p = 0; p < element->num_properties; ++p)
+    {
+      if (element->properties[p].is_list)
+      {
+        element->stride = 0;
+        break;
+      }
+
+      element->properties[p].offset = element->stride;
+      element->stride += type_size(element->properties[p].type);
+    }
+  }
+
+  *out_num_elements = num_elements;
+  *out_data = (const uint8_t*)line_end + 1;
+  return true;
+}
+
+// returns the size of one record of a variable sized element, or 0 if it runs past the end
+static size_t record_size(const ply_element_t* element, const uint8_t* data, const uint8_t* data_end)
+{
+  const uint8_t* p = data;
+
+  for (uint32_t i = 0; i < element->num_properties; ++i)
+  {
+    const ply_property_t* prop = &element->properties[i];
+
+    if (prop->is_list)
+    {
+      uint32_t count;
+      if (p + type_size(prop->count_type) > data_end)
+        return 0;
+      count = read_index(p, prop->count_type);
+      p += type_size(prop->count_type) + (size_t)count * type_size(prop->type);
+    }
+    else
+    {
+      p += type_size(prop->type);
+    }
+
+    if (p > data_end)
+      return 0;
+  }
+
+  return (size_t)(p - data);
+}
+
+// skips over all records of an element, returning the data following it or null if it's truncated
+static const uint8_t* skip_element(const ply_element_t* element, const uint8_t* data, const uint8_t* data_end)
+{
+  if (element->stride > 0)
+  {
+    if ((uint64_t)(data_end - data) < (uint64_t)element->stride * element->count)
+      return 0;
+    return data + (size_t)element->stride * element->count;
+  }
+
+  for (uint32_t i = 0; i < element->count; ++i)
+  {
+    size_t size = record_size(element, data, data_end);
+    if (size == 0)
+      return 0;
+    data += size;
+  }
+
+  return data;
+}
+
+// returns the float of libload_obj_vertex_t a property maps onto, or -1
+static int32_t find_vertex_target(const char* name)
+{
+  for (uint32_t i = 0; i < LIBLOAD_ARRAYSIZE(vertex_property_names); ++i)
+  {
+    for (uint32_t n = 0; n < LIBLOAD_ARRAYSIZE(vertex_property_names[i]) && vertex_property_names[i][n]; ++n)
+    {
+      if (strcmp(name, vertex_property_names[i][n]) == 0)
+        return (int32_t)i;
+    }
+  }
+
+  return -1;
+}
+
+// true if the records are laid out exactly like libload_obj_vertex_t (under any
+// of the accepted property names), so they can be used in place
+static bool vertex_layout_matches(const ply_element_t* element, const uint8_t* data)
+{
+  if (element->num_properties != LIBLOAD_ARRAYSIZE(vertex_property_names) ||
+      element->stride != sizeof(libload_obj_vertex_t) ||
+      ((uintptr_t)data & (sizeof(float) - 1)) != 0)
+    return false;
+
+  for (uint32_t i = 0; i < element->num_properties; ++i)
+  {
+    if (element->properties[i].type != PLY_FLOAT ||
+        find_vertex_target(element->properties[i].name) != (int32_t)i)
+      return false;
+  }
+
+  return true;
+}
+
+static bool load_vertices(const ply_element_t* element, const uint8_t* data, libload_obj_vertex_t* vertices)
+{
+  int32_t targets[PLY_MAX_PROPERTIES];
+  uint32_t i, p;
+
+  if (element->stride == 0)
+    return false; // list properties on vertices aren't supported
+
+  // map each property onto a float of the vertex, or -1 to skip it
+  for (p = 0; p < element->num_properties; ++p)
+    targets[p] = find_vertex_target(element->properties[p].name);
+
+  memset(vertices, 0, sizeof(libload_obj_vertex_t) * element->count);
+
+  for (i = 0; i < element->count; ++i)
+  {
+    const uint8_t* record = data + (size_t)i * element->stride;
+    float* dest = &vertices[i].position.x;
+
+    for (p = 0; p < element->num_properties; ++p)
+    {
+      const ply_property_t* prop = &element->properties[p];
+      if (targets[p] < 0)
+        continue;
+
+      if (prop->type == PLY_FLOAT)
+        memcpy(&dest[targets[p]], record + prop->offset, sizeof(float));
+      else
+        dest[targets[p]] = (float)read_value(record + prop->offset, prop->type);
+    }
+  }
+
+  return true;
+}
+
+static bool load_faces(const ply_element_t* element, const uint8_t* data, const uint8_t* data_end,
+  uint32_t num_vertices, uint32_t** out_indices, uint32_t* out_num_indices)
+{
+  const ply_property_t* list = 0;
+  const uint8_t* p = 0;
+  uint32_t* indices = 0;
+  uint64_t num_indices = 0;
+  uint32_t list_offset = 0;
+  uint32_t i, k, count;
+  bool fast_path = false;
+
+  // the index list must be the first list of the face, so that it starts at a fixed offset
+  for (i = 0; i < element->num_properties; ++i)
+  {
+    if (element->properties[i].is_list)
+    {
+      if (strcmp(element->properties[i].name, "vertex_indices") == 0 || strcmp(element->properties[i].name, "vertex_index") == 0)
+        list = &element->properties[i];
+      break;
+    }
+
+    list_offset += type_size(element->properties[i].type);
+  }
+
+  if (!list || list->type == PLY_FLOAT || list->type == PLY_DOUBLE)
+    return false;
+
+  // the common layout of a face is just the index list, with a uchar count & 32bit indices
+  fast_path = (element->num_properties == 1 && list->count_type == PLY_UCHAR && type_size(list->type) == 4);
+
+  // first pass counts the triangles so the index buffer can be allocated exactly
+  p = data;
+  for (i = 0; i < element->count; ++i)
+  {
+    size_t size = fast_path ? 1 : record_size(element, p, data_end);
+    if (size == 0 || p + size > data_end)
+      return false;
+
+    if (fast_path)
+    {
+      count = *p;
+      size += (size_t)count * 4;
+      if (p + size > data_end)
+        return false;
+    }
+    else
+    {
+      count = read_index(p + list_offset, list->count_type);
+    }
+
+    if (count >= 3)
+      num_indices += (uint64_t)(count - 2) * 3;
+
+    p += size;
+  }
+
+  if (num_indices >= UINT32_MAX)
+    return false;
+
+  indices = (uint32_t*)malloc(sizeof(uint32_t) * (size_t)(num_indices + 1));
+  if (!indices)
+    return false;
+
+  // second pass fills in the indices, triangulating polygons as fans
+  num_indices = 0;
+  p = data;
+  for (i = 0; i < element->count; ++i)
+  {
+    const uint8_t* q = p;
+    uint32_t index_size = type_size(list->type);
+    uint32_t first, prev;
+
+    if (fast_path)
+    {
+      count = *q++;
+      if (count == 3)
+      {
+        memcpy(&indices[num_indices], q, sizeof(uint32_t) * 3);
+        if (indices[num_indices] >= num_vertices ||
+            indices[num_indices + 1] >= num_vertices ||
+            indices[num_indices + 2] >= num_vertices)
+          goto fail;
+
+        num_indices += 3;
+        p = q + sizeof(uint32_t) * 3;
+        continue;
+      }
+    }
+    else
+    {
+      q += list_offset;
+      count = read_index(q, list->count_type);
+      q += type_size(list->count_type);
+    }
+
+    if (count >= 3)
+    {
+      first = read_index(q, list->type);
+      prev = read_index(q + index_size, list->type);
+      if (first >= num_vertices || prev >= num_vertices)
+        goto fail;
+
+      for (k = 2; k < count; ++k)
+      {
+        uint32_t index = read_index(q + (size_t)k * index_size, list->type);
+        if (index >= num_vertices)
+          goto fail;
+
+        indices[num_indices++] = first;
+        indices[num_indices++] = prev;
+        indices[num_indices++] = index;
+        prev = index;
+      }
+    }
+
+    p += fast_path ? 1 + (size_t)count * index_size : record_size(element, p, data_end);
+  }
+
+  *out_indices = indices;
+  *out_num_indices = (uint32_t)num_indices;
+  return true;
+
+fail:
+  free(indices);
+  return false;
+}
+
+bool libload_ply_load(const char* filename, libload_obj_model_t** out_model)
+{
+  bool result = false;
+  uint64_t file_size = 0;
+  uint8_t* file = 0;
+  const uint8_t* file_end = 0;
+  const uint8_t* data = 0;
+  const uint8_t* vertex_data = 0;
+  const uint8_t* face_data = 0;
+  ply_element_t* elements = 0;
+  const ply_element_t* vertex_element = 0;
+  const ply_element_t* face_element = 0;
+  uint32_t num_elements = 0;
+  libload_obj_model_t* model = 0;
+  uint32_t i;
+
+  if (!out_model)
+    goto cleanup;
+
+  file = (uint8_t*)map_file(filename, &file_size);
+  if (!file)
+    goto cleanup;
+
+  file_end = file + file_size;
+
+  elements = (ply_element_t*)malloc(sizeof(ply_element_t) * PLY_MAX_ELEMENTS);
+  if (!elements)
+    goto cleanup;
+
+  if (!parse_header((const char*)file, (const char*)file_end, elements, &num_elements, &data))
+    goto cleanup;
+
+  // locate the vertex & face data, skipping over any other elements
+  for (i = 0; i < num_elements && data; ++i)
+  {
+    if (strcmp(elements[i].name, "vertex") == 0)
+    {
+      vertex_element = &elements[i];
+      vertex_data = data;
+    }
+    else if (strcmp(elements[i].name, "face") == 0)
+    {
+      face_element = &elements[i];
+      face_data = data;
+    }
+
+    data = skip_element(&elements[i], data, file_end);
+  }
+
+  if (!data || !vertex_element || vertex_element->stride == 0)
+    goto cleanup;
+
+  model = (libload_obj_model_t*)malloc(sizeof(libload_obj_model_t));
+  if (!model)
+    goto cleanup;
+
+  memset(model, 0, sizeof(libload_obj_model_t));
+  model->num_vertices = vertex_element->count;
+
+  if (vertex_layout_matches(vertex_element, vertex_data))
+  {
+    // use the vertices in place. the view is copy-on-write, so later passes
+    // (normals, tangents, welding...) can still modify them.
+    model->vertices = (libload_obj_vertex_t*)vertex_data;
+    model->mapped_file = file;
+    file = 0;
+  }
+  else
+  {
+    model->vertices = (libload_obj_vertex_t*)malloc(sizeof(libload_obj_vertex_t) * ((size_t)model->num_vertices + 1));
+    if (!model->vertices)
+      goto cleanup;
+
+    if (!load_vertices(vertex_element, vertex_data, model->vertices))
+      goto cleanup;
+  }
+
+  if (face_element)
+  {
+    if (!load_faces(face_element, face_data, file_end, model->num_vertices, &model->indices, &model->num_indices))
+      goto cleanup;
+  }
+
+  *out_model = model;
+  model = 0;
+  result = true;
+
+cleanup:
+  libload_obj_free(model);
+
+  if (elements)
+    free(elements);
+
+  // only unmapped here if the vertices weren't imported in place
+  unmap_file(file);
+
+  return result;
+}
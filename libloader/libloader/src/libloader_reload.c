@@ -0,0 +1,438 @@
+//=============================================================================
+// libloader_reload.c - Incremental reloading of OBJ model files
+// Reza Nourai, 2016
+//=============================================================================
+
+#include "..\include\libloader.h"
+#include "libloader_util.h"
+
+#include <stdio.h>
+#include <malloc.h>
+#include <string.h>
+
+static void free_index_contents(libload_obj_reload_index_t* index)
+{
+  if (index->vertex_keys)
+    free(index->vertex_keys);
+  if (index->vert_texcoords)
+    free(index->vert_texcoords);
+  if (index->vert_normals)
+    free(index->vert_normals);
+  if (index->verts)
+    free(index->verts);
+  if (index->sections)
+    free(index->sections);
+
+  memset(index, 0, sizeof(libload_obj_reload_index_t));
+}
+
+// replaces the contents of model & index with a fresh load of the file
+static bool reload_all(const char* filename, libload_obj_model_t* model, libload_obj_reload_index_t* index)
+{
+  libload_obj_reload_index_t fresh;
+  libload_obj_model_t* loaded = 0;
+
+  memset(&fresh, 0, sizeof(fresh));
+
+  if (load_obj_indexed(filename, &fresh, &loaded) != LIBLOAD_OBJ_OK)
+  {
+    free_index_contents(&fresh);
+    return false;
+  }
+
+  free_model_vertices(model);
+  if (model->indices)
+    free(model->indices);
+  if (model->parts)
+    free(model->parts);
+
+  *model = *loaded;
+  free(loaded);
+
+  free_index_contents(index);
+  *index = fresh;
+  return true;
+}
+
+// returns the next line of the section (lines are already \0 terminated), or null at its end
+static const char* next_line(const char** inout_p, const char* section_end)
+{
+  const char* line = *inout_p;
+
+  while (line < section_end && *line == '\0')
+    ++line;
+
+  if (line >= section_end)
+    return 0;
+
+  *inout_p = find_char(line, section_end, '\0');
+  return line;
+}
+
+// checks that the faces of a modified section reference the same vertices as before
+static bool faces_match(const char* buffer, const obj_section_t* section, const obj_section_t* old_section,
+  const libload_obj_model_t* model, const libload_obj_reload_index_t* index)
+{
+  const char* p = buffer + section->offset;
+  const char* section_end = p + section->length;
+  const char* line = 0;
+  uint32_t num_verts = section->first_vert;
+  uint32_t num_vert_normals = section->first_normal;
+  uint32_t num_vert_texcoords = section->first_texcoord;
+  uint32_t num_indices = 0;
+  uint32_t k;
+
+  while ((line = next_line(&p, section_end)) != 0)
+  {
+    obj_directive_t directive = classify_obj_line(line);
+
+    if (directive == OBJ_VERTEX)
+    {
+      ++num_verts;
+    }
+    else if (directive == OBJ_NORMAL)
+    {
+      ++num_vert_normals;
+    }
+    else if (directive == OBJ_TEXCOORD)
+    {
+      ++num_vert_texcoords;
+    }
+    else if (directive == OBJ_FACE)
+    {
+      uint64_t keys[6];
+      uint32_t num_keys = parse_face(line + 2, num_verts, num_vert_normals, num_vert_texcoords, keys);
+
+      if (num_keys == 0 || num_indices + num_keys > old_section->num_indices)
+        return false;
+
+      for (k = 0; k < num_keys; ++k)
+      {
+        uint32_t vertex = model->indices[old_section->base_index + num_indices + k];
+        if (vertex >= index->num_vertices || index->vertex_keys[vertex] != keys[k])
+          return false;
+      }
+
+      num_indices += num_keys;
+    }
+  }
+
+  return num_indices == old_section->num_indices;
+}
+
+static void set_if_changed(void* dest, const void* value, size_t num_bytes, uint8_t* dirty)
+{
+  if (memcmp(dest, value, num_bytes) != 0)
+  {
+    memcpy(dest, value, num_bytes);
+    *dirty = 1;
+  }
+}
+
+// re-parses the attributes declared by a modified section. with null dirty flags
+// the lines are only checked & nothing is written. otherwise the values are
+// stored in the index & model, flagging the attributes whose values changed.
+static bool parse_attributes(const char* buffer, const obj_section_t* section, libload_obj_model_t* model, libload_obj_reload_index_t* index,
+  uint8_t* vert_dirty, uint8_t* normal_dirty, uint8_t* texcoord_dirty)
+{
+  bool apply = (vert_dirty != 0);
+  const char* p = buffer + section->offset;
+  const char* section_end = p + section->length;
+  const char* line = 0;
+  uint32_t vert = section->first_vert;
+  uint32_t normal = section->first_normal;
+  uint32_t texcoord = section->first_texcoord;
+
+  while ((line = next_line(&p, section_end)) != 0)
+  {
+    obj_directive_t directive = classify_obj_line(line);
+    libload_float3_t value;
+    libload_float2_t value2;
+
+    if (directive == OBJ_MTLLIB)
+    {
+      if (apply)
+      {
+        sscanf_s(line + 7, "%s", model->material_file,
+          (uint32_t)LIBLOAD_ARRAYSIZE(model->material_file));
+      }
+    }
+    else if (directive == OBJ_VERTEX)
+    {
+      if (sscanf_s(line + 2, "%f %f %f", &value.x, &value.y, &value.z) != 3)
+        return false;
+
+      if (apply)
+        set_if_changed(&index->verts[vert], &value, sizeof(value), &vert_dirty[vert]);
+      ++vert;
+    }
+    else if (directive == OBJ_NORMAL)
+    {
+      if (sscanf_s(line + 3, "%f %f %f", &value.x, &value.y, &value.z) != 3)
+        return false;
+
+      if (apply)
+        set_if_changed(&index->vert_normals[normal], &value, sizeof(value), &normal_dirty[normal]);
+      ++normal;
+    }
+    else if (directive == OBJ_TEXCOORD)
+    {
+      if (sscanf_s(line + 3, "%f %f", &value2.x, &value2.y) != 2)
+        return false;
+
+      if (apply)
+        set_if_changed(&index->vert_texcoords[texcoord], &value2, sizeof(value2), &texcoord_dirty[texcoord]);
+      ++texcoord;
+    }
+  }
+
+  return true;
+}
+
+// part names come from the g & usemtl lines, which always start a section. every
+// usemtl section must already be known to start one of the model's parts.
+static void update_part_names(const char* buffer, const obj_section_t* sections, libload_obj_model_t* model, const libload_obj_reload_index_t* index)
+{
+  char groupname[64] = {0};
+  uint32_t s;
+
+  for (s = 0; s < index->num_sections; ++s)
+  {
+    const char* line = buffer + sections[s].offset;
+    obj_directive_t directive = classify_obj_line(line);
+
+    if (directive == OBJ_GROUP)
+    {
+      sscanf_s(line + 2, "%s", groupname,
+        (uint32_t)LIBLOAD_ARRAYSIZE(groupname));
+    }
+    else if (directive == OBJ_USEMTL)
+    {
+      libload_obj_model_part_t* part = &model->parts[index->sections[s].part];
+
+      strcpy_s(part->name, LIBLOAD_ARRAYSIZE(part->name), groupname);
+      sscanf_s(line + 7, "%s", part->material_name,
+        (uint32_t)LIBLOAD_ARRAYSIZE(part->material_name));
+      _strlwr_s(part->material_name, LIBLOAD_ARRAYSIZE(part->material_name));
+    }
+  }
+}
+
+bool libload_obj_load_for_reload(const char* filename, libload_obj_model_t** out_model, libload_obj_reload_index_t** out_index)
+{
+  bool result = false;
+  libload_obj_reload_index_t* index = 0;
+  libload_obj_model_t* model = 0;
+
+  if (!out_model || !out_index)
+    goto cleanup;
+
+  index = (libload_obj_reload_index_t*)malloc(sizeof(libload_obj_reload_index_t));
+  if (!index)
+    goto cleanup;
+
+  memset(index, 0, sizeof(libload_obj_reload_index_t));
+
+  if (load_obj_indexed(filename, index, &model) != LIBLOAD_OBJ_OK)
+    goto cleanup;
+
+  *out_model = model;
+  *out_index = index;
+  model = 0;
+  index = 0;
+  result = true;
+
+cleanup:
+  libload_obj_free(model);
+  libload_obj_free_reload_index(index);
+
+  return result;
+}
+
+bool libload_obj_reload(const char* filename, libload_obj_model_t* model, libload_obj_reload_index_t* index, libload_obj_reload_stats_t* out_stats)
+{
+  bool result = false;
+  bool patchable = true;
+  char* buffer = 0;
+  char* buffer_end = 0;
+  char* p = 0;
+  uint32_t buffer_capacity = 0;
+  uint32_t buffer_size = 0;
+  obj_section_t* sections = 0;
+  uint32_t num_sections = 0;
+  uint8_t* changed = 0;
+  uint8_t* vert_dirty = 0;
+  uint8_t* normal_dirty = 0;
+  uint8_t* texcoord_dirty = 0;
+  uint32_t reparsed = 0;
+  uint32_t updated = 0;
+  uint32_t s, i;
+
+  if (!model || !index)
+    goto cleanup;
+
+  if (out_stats)
+  {
+    memset(out_stats, 0, sizeof(libload_obj_reload_stats_t));
+    out_stats->num_sections = index->num_sections;
+  }
+
+  if (!read_text_file_into(filename, &buffer, &buffer_capacity, &buffer_size))
+    goto cleanup;
+
+  buffer_end = buffer + buffer_size;
+
+  // the modified file must split into the same sections, each starting with
+  // the same kind of line & declaring the same number of attributes, for the
+  // rest of the model to stay valid
+  num_sections = split_sections(buffer, buffer_end, 0);
+  if (num_sections != index->num_sections)
+    patchable = false;
+
+  if (patchable)
+  {
+    sections = (obj_section_t*)malloc(sizeof(obj_section_t) * num_sections);
+    changed = (uint8_t*)malloc(num_sections);
+    if (!sections || !changed)
+      goto cleanup;
+
+    split_sections(buffer, buffer_end, sections);
+
+    for (s = 0; s < num_sections; ++s)
+    {
+      const obj_section_t* old_section = &index->sections[s];
+
+      changed[s] = (sections[s].hash != old_section->hash || sections[s].length != old_section->length);
+      if (sections[s].directive != old_section->directive ||
+          (sections[s].directive == OBJ_USEMTL && old_section->part >= model->num_parts) ||
+          sections[s].num_verts != old_section->num_verts ||
+          sections[s].num_normals != old_section->num_normals ||
+          sections[s].num_texcoords != old_section->num_texcoords)
+      {
+        patchable = false;
+        break;
+      }
+    }
+  }
+
+  // terminate every line, as the loader does
+  for (p = (char*)find_line_end(buffer, buffer_end); p < buffer_end; p = (char*)find_line_end(p + 1, buffer_end))
+    *p = '\0';
+
+  // faces of changed sections must still produce exactly the same vertices, &
+  // their attributes must parse. nothing is modified until all of this is known
+  for (s = 0; patchable && s < num_sections; ++s)
+  {
+    if (changed[s] &&
+        (!faces_match(buffer, &sections[s], &index->sections[s], model, index) ||
+         !parse_attributes(buffer, &sections[s], model, index, 0, 0, 0)))
+      patchable = false;
+  }
+
+  if (patchable)
+  {
+    vert_dirty = (uint8_t*)malloc(index->num_verts + 1);
+    normal_dirty = (uint8_t*)malloc(index->num_vert_normals + 1);
+    texcoord_dirty = (uint8_t*)malloc(index->num_vert_texcoords + 1);
+    if (!vert_dirty || !normal_dirty || !texcoord_dirty)
+      goto cleanup;
+
+    memset(vert_dirty, 0, index->num_verts + 1);
+    memset(normal_dirty, 0, index->num_vert_normals + 1);
+    memset(texcoord_dirty, 0, index->num_vert_texcoords + 1);
+
+    for (s = 0; s < num_sections; ++s)
+    {
+      if (changed[s])
+      {
+        parse_attributes(buffer, &sections[s], model, index, vert_dirty, normal_dirty, texcoord_dirty);
+        ++reparsed;
+      }
+    }
+  }
+
+  if (!patchable)
+  {
+    if (!reload_all(filename, model, index))
+      goto cleanup;
+
+    if (out_stats)
+    {
+      out_stats->num_sections = index->num_sections;
+      out_stats->reparsed_sections = index->num_sections;
+      out_stats->updated_vertices = model->num_vertices;
+      out_stats->full_reload = true;
+    }
+
+    result = true;
+    goto cleanup;
+  }
+
+  update_part_names(buffer, sections, model, index);
+
+  // update every vertex that refers to a changed attribute, whichever section
+  // created it. keys hold 0-based indices, 20 bits each (OBJ_KEY_*). parse_face
+  // stores 0 for a normal or texcoord the face leaves out, which is past the end
+  // of the list when the file has none, so every index is range checked
+  for (i = 0; i < index->num_vertices && i < model->num_vertices; ++i)
+  {
+    libload_obj_vertex_t* vertex = &model->vertices[i];
+    uint64_t key = index->vertex_keys[i];
+    uint32_t vert = OBJ_KEY_VERT(key);
+    uint32_t normal = OBJ_KEY_NORMAL(key);
+    uint32_t texcoord = OBJ_KEY_TEXCOORD(key);
+    bool update_vert = (vert < index->num_verts && vert_dirty[vert]);
+    bool update_normal = (normal < index->num_vert_normals && normal_dirty[normal]);
+    bool update_texcoord = (texcoord < index->num_vert_texcoords && texcoord_dirty[texcoord]);
+
+    if (update_vert)
+      vertex->position = index->verts[vert];
+    if (update_normal)
+      vertex->normal = index->vert_normals[normal];
+    if (update_texcoord)
+      vertex->texcoord = index->vert_texcoords[texcoord];
+
+    if (update_vert || update_normal || update_texcoord)
+      ++updated;
+  }
+
+  for (s = 0; s < num_sections; ++s)
+  {
+    index->sections[s].offset = sections[s].offset;
+    index->sections[s].length = sections[s].length;
+    index->sections[s].hash = sections[s].hash;
+  }
+
+  if (out_stats)
+  {
+    out_stats->reparsed_sections = reparsed;
+    out_stats->updated_vertices = updated;
+  }
+
+  result = true;
+
+cleanup:
+  if (texcoord_dirty)
+    free(texcoord_dirty);
+  if (normal_dirty)
+    free(normal_dirty);
+  if (vert_dirty)
+    free(vert_dirty);
+  if (changed)
+    free(changed);
+  if (sections)
+    free(sections);
+  if (buffer)
+    free(buffer);
+
+  return result;
+}
+
+void libload_obj_free_reload_index(libload_obj_reload_index_t* index)
+{
+  if (index)
+  {
+    free_index_contents(index);
+    free(index);
+  }
+}
@@ -0,0 +1,499 @@
+//=============================================================================
+// libloader_tiles.c - Spatial tiling & streaming of large models
+// Reza Nourai, 2016
+//=============================================================================
+
+#include "..\include\libloader.h"
+#include "libloader_util.h"
+
+#include <stdio.h>
+#include <malloc.h>
+#include <string.h>
+#include <float.h>
+
+#define TILE_FILE_MAGIC 0x46544c4c  // 'LLTF'
+#define TILE_FILE_VERSION 1
+#define TILE_PAGE_SIZE 4096
+#define TILE_MAX_TILES (1u << 20)  // keeps the per-tile tables' sizes well within 32 bits
+#define NO_PART UINT32_MAX
+
+// file layout: header, tile table, then each tile's data starting on a page
+// boundary (vertices, indices, then parts)
+typedef struct
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_tiles;
+  uint32_t grid[3];
+  libload_bounds_t bounds;
+  char material_file[512];
+} tile_file_header_t;
+
+typedef struct
+{
+  libload_bounds_t bounds;
+  uint64_t offset;
+  uint64_t num_bytes;
+  uint32_t num_vertices;
+  uint32_t num_indices;
+  uint32_t num_parts;
+  uint32_t reserved;
+} tile_entry_t;
+
+static void bounds_clear(libload_bounds_t* bounds)
+{
+  bounds->min.x = bounds->min.y = bounds->min.z = FLT_MAX;
+  bounds->max.x = bounds->max.y = bounds->max.z = -FLT_MAX;
+}
+
+static void bounds_add(libload_bounds_t* bounds, const libload_float3_t* p)
+{
+  if (p->x < bounds->min.x) bounds->min.x = p->x;
+  if (p->y < bounds->min.y) bounds->min.y = p->y;
+  if (p->z < bounds->min.z) bounds->min.z = p->z;
+  if (p->x > bounds->max.x) bounds->max.x = p->x;
+  if (p->y > bounds->max.y) bounds->max.y = p->y;
+  if (p->z > bounds->max.z) bounds->max.z = p->z;
+}
+
+static bool bounds_overlap(const libload_bounds_t* a, const libload_bounds_t* b)
+{
+  return
+    a->min.x <= b->max.x && a->max.x >= b->min.x &&
+    a->min.y <= b->max.y && a->max.y >= b->min.y &&
+    a->min.z <= b->max.z && a->max.z >= b->min.z;
+}
+
+static uint32_t grid_coord(float value, float min, float max, uint32_t num_cells)
+{
+  float t = (max > min) ? (value - min) / (max - min) : 0.f;
+  int64_t cell = (int64_t)(t * num_cells);
+
+  if (cell < 0)
+    cell = 0;
+  if (cell >= (int64_t)num_cells)
+    cell = num_cells - 1;
+
+  return (uint32_t)cell;
+}
+
+static bool write_padding(FILE* file, uint64_t* inout_offset)
+{
+  static const uint8_t zeros[TILE_PAGE_SIZE] = {0};
+  uint64_t padding = (TILE_PAGE_SIZE - (*inout_offset % TILE_PAGE_SIZE)) % TILE_PAGE_SIZE;
+
+  if (padding > 0 && fwrite(zeros, 1, (size_t)padding, file) != padding)
+    return false;
+
+  *inout_offset += padding;
+  return true;
+}
+
+bool libload_obj_write_tiles(const libload_obj_model_t* model, uint32_t tiles_x, uint32_t tiles_y, uint32_t tiles_z, const char* filename)
+{
+  bool result = false;
+  FILE* file = 0;
+  tile_file_header_t header;
+  tile_entry_t* entries = 0;
+  uint32_t num_triangles = 0;
+  uint32_t* triangle_part = 0;
+  uint32_t* tile_start = 0;
+  uint32_t* tile_cursor = 0;
+  uint32_t* tile_triangles = 0;
+  uint32_t* remap = 0;
+  uint32_t* remap_tile = 0;
+  libload_obj_vertex_t* vertices = 0;
+  uint32_t* indices = 0;
+  libload_obj_model_part_t* parts = 0;
+  uint64_t offset = 0;
+  uint32_t i, t, k;
+
+  if (!model || !filename || tiles_x == 0 || tiles_y == 0 || tiles_z == 0)
+    goto cleanup;
+
+  // each factor is below 2^32, so the product of the first two can't overflow
+  // 64 bits, & the third is only applied once that's known to be small
+  if ((uint64_t)tiles_x * tiles_y > TILE_MAX_TILES ||
+      (uint64_t)tiles_x * tiles_y * tiles_z > TILE_MAX_TILES)
+    goto cleanup;
+
+  memset(&header, 0, sizeof(header));
+  header.magic = TILE_FILE_MAGIC;
+  header.version = TILE_FILE_VERSION;
+  header.grid[0] = tiles_x;
+  header.grid[1] = tiles_y;
+  header.grid[2] = tiles_z;
+  header.num_tiles = tiles_x * tiles_y * tiles_z;
+  strcpy_s(header.material_file, LIBLOAD_ARRAYSIZE(header.material_file), model->material_file);
+
+  bounds_clear(&header.bounds);
+  for (i = 0; i < model->num_vertices; ++i)
+    bounds_add(&header.bounds, &model->vertices[i].position);
+
+  num_triangles = model->num_indices / 3;
+
+  entries = (tile_entry_t*)malloc(sizeof(tile_entry_t) * header.num_tiles);
+  triangle_part = (uint32_t*)malloc(sizeof(uint32_t) * (num_triangles + 1));
+  tile_start = (uint32_t*)malloc(sizeof(uint32_t) * (header.num_tiles + 1));
+  tile_cursor = (uint32_t*)malloc(sizeof(uint32_t) * (header.num_tiles + 1));
+  tile_triangles = (uint32_t*)malloc(sizeof(uint32_t) * (num_triangles + 1));
+  remap = (uint32_t*)malloc(sizeof(uint32_t) * (model->num_vertices + 1));
+  remap_tile = (uint32_t*)malloc(sizeof(uint32_t) * (model->num_vertices + 1));
+  vertices = (libload_obj_vertex_t*)malloc(sizeof(libload_obj_vertex_t) * (model->num_indices + 1));
+  indices = (uint32_t*)malloc(sizeof(uint32_t) * (model->num_indices + 1));
+  parts = (libload_obj_model_part_t*)malloc(sizeof(libload_obj_model_part_t) * (num_triangles + 1));
+  if (!entries || !triangle_part || !tile_start || !tile_cursor || !tile_triangles || !remap || !remap_tile ||
+      !vertices || !indices || !parts)
+    goto cleanup;
+
+  memset(entries, 0, sizeof(tile_entry_t) * header.num_tiles);
+  memset(tile_start, 0, sizeof(uint32_t) * (header.num_tiles + 1));
+  memset(remap_tile, 0xFF, sizeof(uint32_t) * (model->num_vertices + 1));
+
+  for (t = 0; t < num_triangles; ++t)
+    triangle_part[t] = NO_PART;
+
+  for (i = 0; i < model->num_parts; ++i)
+  {
+    const libload_obj_model_part_t* part = &model->parts[i];
+    for (k = part->base_index / 3; k < (part->base_index + part->num_indices) / 3 && k < num_triangles; ++k)
+      triangle_part[k] = i;
+  }
+
+  // assign each triangle to the tile containing its centroid. a counting sort
+  // keeps the triangles of each tile in their original order, which keeps the
+  // triangles of a part together
+  for (t = 0; t < num_triangles; ++t)
+  {
+    const uint32_t* tri = &model->indices[t * 3];
+    libload_float3_t c;
+    uint32_t tile;
+
+    for (k = 0; k < 3; ++k)
+    {
+      if (tri[k] >= model->num_vertices)
+        goto cleanup;
+    }
+
+    c.x = (model->vertices[tri[0]].position.x + model->vertices[tri[1]].position.x + model->vertices[tri[2]].position.x) / 3.f;
+    c.y = (model->vertices[tri[0]].position.y + model->vertices[tri[1]].position.y + model->vertices[tri[2]].position.y) / 3.f;
+    c.z = (model->vertices[tri[0]].position.z + model->vertices[tri[1]].position.z + model->vertices[tri[2]].position.z) / 3.f;
+
+    tile =
+      (grid_coord(c.z, header.bounds.min.z, header.bounds.max.z, tiles_z) * tiles_y +
+       grid_coord(c.y, header.bounds.min.y, header.bounds.max.y, tiles_y)) * tiles_x +
+       grid_coord(c.x, header.bounds.min.x, header.bounds.max.x, tiles_x);
+
+    tile_triangles[t] = tile; // stash the tile for the scatter below
+    ++tile_start[tile + 1];
+  }
+
+  for (i = 0; i < header.num_tiles; ++i)
+    tile_start[i + 1] += tile_start[i];
+
+  // scatter triangle ids into their tiles, using the index buffer as temporary storage
+  memcpy(tile_cursor, tile_start, sizeof(uint32_t) * header.num_tiles);
+  for (t = 0; t < num_triangles; ++t)
+    indices[tile_cursor[tile_triangles[t]]++] = t;
+  memcpy(tile_triangles, indices, sizeof(uint32_t) * num_triangles);
+
+  if (fopen_s(&file, filename, "wb") != 0)
+    goto cleanup;
+
+  // the table is written again once the tiles are laid out
+  if (fwrite(&header, sizeof(header), 1, file) != 1 ||
+      fwrite(entries, sizeof(tile_entry_t), header.num_tiles, file) != header.num_tiles)
+    goto cleanup;
+
+  offset = sizeof(header) + sizeof(tile_entry_t) * (uint64_t)header.num_tiles;
+
+  for (i = 0; i < header.num_tiles; ++i)
+  {
+    tile_entry_t* entry = &entries[i];
+    uint32_t current_part = NO_PART;
+    libload_obj_model_part_t* part = 0;
+
+    bounds_clear(&entry->bounds);
+
+    for (t = tile_start[i]; t < tile_start[i + 1]; ++t)
+    {
+      uint32_t tri = tile_triangles[t];
+
+      if (model->num_parts > 0 && (!part || triangle_part[tri] != current_part))
+      {
+        current_part = triangle_part[tri];
+        part = &parts[entry->num_parts++];
+        if (current_part != NO_PART)
+          *part = model->parts[current_part];
+        else
+          memset(part, 0, sizeof(libload_obj_model_part_t));
+        part->base_index = entry->num_indices;
+        part->num_indices = 0;
+      }
+
+      for (k = 0; k < 3; ++k)
+      {
+        uint32_t index = model->indices[tri * 3 + k];
+
+        if (remap_tile[index] != i)
+        {
+          remap_tile[index] = i;
+          remap[index] = entry->num_vertices;
+          vertices[entry->num_vertices++] = model->vertices[index];
+          bounds_add(&entry->bounds, &model->vertices[index].position);
+        }
+
+        indices[entry->num_indices++] = remap[index];
+      }
+
+      if (part)
+        part->num_indices += 3;
+    }
+
+    if (entry->num_indices == 0)
+      continue;
+
+    if (!write_padding(file, &offset))
+      goto cleanup;
+
+    entry->offset = offset;
+    entry->num_bytes =
+      sizeof(libload_obj_vertex_t) * (uint64_t)entry->num_vertices +
+      sizeof(uint32_t) * (uint64_t)entry->num_indices +
+      sizeof(libload_obj_model_part_t) * (uint64_t)entry->num_parts;
+
+    if (fwrite(vertices, sizeof(libload_obj_vertex_t), entry->num_vertices, file) != entry->num_vertices ||
+        fwrite(indices, sizeof(uint32_t), entry->num_indices, file) != entry->num_indices ||
+        fwrite(parts, sizeof(libload_obj_model_part_t), entry->num_parts, file) != entry->num_parts)
+      goto cleanup;
+
+    offset += entry->num_bytes;
+  }
+
+  if (!write_padding(file, &offset))
+    goto cleanup;
+
+  if (_fseeki64(file, sizeof(header), SEEK_SET) != 0 ||
+      fwrite(entries, sizeof(tile_entry_t), header.num_tiles, file) != header.num_tiles)
+    goto cleanup;
+
+  result = true;
+
+cleanup:
+  if (file)
+    fclose(file);
+  if (parts)
+    free(parts);
+  if (indices)
+    free(indices);
+  if (vertices)
+    free(vertices);
+  if (remap_tile)
+    free(remap_tile);
+  if (remap)
+    free(remap);
+  if (tile_triangles)
+    free(tile_triangles);
+  if (tile_cursor)
+    free(tile_cursor);
+  if (tile_start)
+    free(tile_start);
+  if (triangle_part)
+    free(triangle_part);
+  if (entries)
+    free(entries);
+
+  return result;
+}
+
+bool libload_tile_file_open(const char* filename, libload_tile_file_t** out_tile_file)
+{
+  bool result = false;
+  FILE* file = 0;
+  tile_file_header_t header;
+  tile_entry_t* entries = 0;
+  libload_tile_file_t* tile_file = 0;
+  uint32_t i;
+
+  if (!out_tile_file)
+    goto cleanup;
+
+  if (fopen_s(&file, filename, "rb") != 0)
+    goto cleanup;
+
+  if (fread_s(&header, sizeof(header), sizeof(header), 1, file) != 1 ||
+      header.magic != TILE_FILE_MAGIC || header.version != TILE_FILE_VERSION)
+    goto cleanup;
+
+  if (header.num_tiles == 0 || header.num_tiles > TILE_MAX_TILES)
+    goto cleanup;
+
+  entries = (tile_entry_t*)malloc(sizeof(tile_entry_t) * (header.num_tiles + 1));
+  if (!entries)
+    goto cleanup;
+
+  if (fread_s(entries, sizeof(tile_entry_t) * header.num_tiles, sizeof(tile_entry_t), header.num_tiles, file) != header.num_tiles)
+    goto cleanup;
+
+  tile_file = (libload_tile_file_t*)malloc(sizeof(libload_tile_file_t));
+  if (!tile_file)
+    goto cleanup;
+
+  memset(tile_file, 0, sizeof(libload_tile_file_t));
+
+  tile_file->tiles = (libload_tile_t*)malloc(sizeof(libload_tile_t) * (header.num_tiles + 1));
+  if (!tile_file->tiles)
+    goto cleanup;
+
+  memset(tile_file->tiles, 0, sizeof(libload_tile_t) * (header.num_tiles + 1));
+
+  strcpy_s(tile_file->material_file, LIBLOAD_ARRAYSIZE(tile_file->material_file), header.material_file);
+  tile_file->bounds = header.bounds;
+  tile_file->num_tiles = header.num_tiles;
+
+  for (i = 0; i < header.num_tiles; ++i)
+  {
+    libload_tile_t* tile = &tile_file->tiles[i];
+    tile->bounds = entries[i].bounds;
+    tile->offset = entries[i].offset;
+    tile->num_bytes = entries[i].num_bytes;
+    tile->num_vertices = entries[i].num_vertices;
+    tile->num_indices = entries[i].num_indices;
+    tile->num_parts = entries[i].num_parts;
+  }
+
+  // kept open for streaming tiles in & out
+  tile_file->file = file;
+  file = 0;
+
+  *out_tile_file = tile_file;
+  tile_file = 0;
+  result = true;
+
+cleanup:
+  libload_tile_file_close(tile_file);
+
+  if (entries)
+    free(entries);
+  if (file)
+    fclose(file);
+
+  return result;
+}
+
+static bool load_tile(libload_tile_file_t* tile_file, libload_tile_t* tile)
+{
+  FILE* file = (FILE*)tile_file->file;
+  libload_obj_model_t* model = 0;
+
+  model = (libload_obj_model_t*)malloc(sizeof(libload_obj_model_t));
+  if (!model)
+    goto fail;
+
+  memset(model, 0, sizeof(libload_obj_model_t));
+  strcpy_s(model->material_file, LIBLOAD_ARRAYSIZE(model->material_file), tile_file->material_file);
+
+  model->vertices = (libload_obj_vertex_t*)malloc(sizeof(libload_obj_vertex_t) * (tile->num_vertices + 1));
+  model->indices = (uint32_t*)malloc(sizeof(uint32_t) * (tile->num_indices + 1));
+  model->parts = (libload_obj_model_part_t*)malloc(sizeof(libload_obj_model_part_t) * (tile->num_parts + 1));
+  if (!model->vertices || !model->indices || !model->parts)
+    goto fail;
+
+  model->num_vertices = tile->num_vertices;
+  model->num_indices = tile->num_indices;
+  model->num_parts = tile->num_parts;
+
+  // tile data is contiguous & starts on a page boundary
+  if (_fseeki64(file, (int64_t)tile->offset, SEEK_SET) != 0 ||
+      fread_s(model->vertices, sizeof(libload_obj_vertex_t) * model->num_vertices, sizeof(libload_obj_vertex_t), model->num_vertices, file) != model->num_vertices ||
+      fread_s(model->indices, sizeof(uint32_t) * model->num_indices, sizeof(uint32_t), model->num_indices, file) != model->num_indices ||
+      fread_s(model->parts, sizeof(libload_obj_model_part_t) * model->num_parts, sizeof(libload_obj_model_part_t), model->num_parts, file) != model->num_parts)
+    goto fail;
+
+  tile->model = model;
+  tile_file->resident_bytes += tile->num_bytes;
+  ++tile_file->num_resident;
+  return true;
+
+fail:
+  libload_obj_free(model);
+  return false;
+}
+
+static void unload_tile(libload_tile_file_t* tile_file, libload_tile_t* tile)
+{
+  if (tile->model)
+  {
+    libload_obj_free(tile->model);
+    tile->model = 0;
+    tile_file->resident_bytes -= tile->num_bytes;
+    --tile_file->num_resident;
+  }
+}
+
+bool libload_tile_file_load_region(libload_tile_file_t* tile_file, const libload_bounds_t* region)
+{
+  bool result = true;
+  uint32_t i;
+
+  if (!tile_file || !region)
+    return false;
+
+  for (i = 0; i < tile_file->num_tiles; ++i)
+  {
+    libload_tile_t* tile = &tile_file->tiles[i];
+    if (!tile->model && tile->num_indices > 0 && bounds_overlap(&tile->bounds, region))
+    {
+      if (!load_tile(tile_file, tile))
+        result = false;
+    }
+  }
+
+  return result;
+}
+
+void libload_tile_file_unload_region(libload_tile_file_t* tile_file, const libload_bounds_t* region)
+{
+  uint32_t i;
+
+  if (!tile_file || !region)
+    return;
+
+  for (i = 0; i < tile_file->num_tiles; ++i)
+  {
+    if (bounds_overlap(&tile_file->tiles[i].bounds, region))
+      unload_tile(tile_file, &tile_file->tiles[i]);
+  }
+}
+
+void libload_tile_file_unload_outside(libload_tile_file_t* tile_file, const libload_bounds_t* region)
+{
+  uint32_t i;
+
+  if (!tile_file || !region)
+    return;
+
+  for (i = 0; i < tile_file->num_tiles; ++i)
+  {
+    if (!bounds_overlap(&tile_file->tiles[i].bounds, region))
+      unload_tile(tile_file, &tile_file->tiles[i]);
+  }
+}
+
+void libload_tile_file_close(libload_tile_file_t* tile_file)
+{
+  uint32_t i;
+
+  if (tile_file)
+  {
+    if (tile_file->tiles)
+    {
+      for (i = 0; i < tile_file->num_tiles; ++i)
+        unload_tile(tile_file, &tile_file->tiles[i]);
+      free(tile_file->tiles);
+    }
+    if (tile_file->file)
+      fclose((FILE*)tile_file->file);
+    free(tile_file);
+  }
+}
@@ -6,6 +6,8 @@
 #include "..\include\libloader.h"
 #include "libloader_util.h"
 
+#include <Windows.h>
+#include <intrin.h>
 #include <stdio.h>
 #include <malloc.h>
 #include <assert.h>
@@ -53,6 +55,110 @@ cleanup:
   return buffer;
 }
 
+bool read_text_file_into(const char* filename, char** inout_buffer, uint32_t* inout_capacity, uint32_t* out_num_bytes)
+{
+  bool result = false;
+  errno_t err = 0;
+  FILE* file = 0;
+  size_t len = 0;
+
+  *out_num_bytes = 0;
+
+  err = fopen_s(&file, filename, "rb");
+  if (err != 0)
+    goto cleanup;
+
+  if (fseek(file, 0, SEEK_END) != 0)
+    goto cleanup;
+
+  len = ftell(file);
+  rewind(file);
+
+  if (len > *inout_capacity || !*inout_buffer)
+  {
+    if (*inout_buffer)
+      free(*inout_buffer);
+
+    *inout_capacity = 0;
+    *inout_buffer = (char*)malloc(len + 1);
+    if (!*inout_buffer)
+      goto cleanup;
+
+    *inout_capacity = (uint32_t)len;
+  }
+
+  if (fread_s(*inout_buffer, *inout_capacity, 1, len, file) != len)
+    goto cleanup;
+
+  // there's always room for a terminator, so the last line is a valid string
+  (*inout_buffer)[len] = '\0';
+
+  *out_num_bytes = (uint32_t)len;
+  result = true;
+
+cleanup:
+  if (file)
+    fclose(file);
+
+  return result;
+}
+
+//=============================================================================
+// mapped files
+//=============================================================================
+
+void* map_file(const char* filename, uint64_t* out_num_bytes)
+{
+  HANDLE file = INVALID_HANDLE_VALUE;
+  HANDLE mapping = 0;
+  LARGE_INTEGER size;
+  void* view = 0;
+
+  *out_num_bytes = 0;
+
+  file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+  if (file == INVALID_HANDLE_VALUE)
+    goto cleanup;
+
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    goto cleanup;
+
+  mapping = CreateFileMappingA(file, 0, PAGE_WRITECOPY, 0, 0, 0);
+  if (!mapping)
+    goto cleanup;
+
+  // the view keeps the mapping alive, so both handles can be closed below
+  view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+  if (!view)
+    goto cleanup;
+
+  *out_num_bytes = (uint64_t)size.QuadPart;
+
+cleanup:
+  if (mapping)
+    CloseHandle(mapping);
+  if (file != INVALID_HANDLE_VALUE)
+    CloseHandle(file);
+
+  return view;
+}
+
+void unmap_file(void* view)
+{
+  if (view)
+    UnmapViewOfFile(view);
+}
+
+void free_model_vertices(libload_obj_model_t* model)
+{
+  if (model->vertices && !model->mapped_file)
+    free(model->vertices);
+
+  unmap_file(model->mapped_file);
+  model->mapped_file = 0;
+  model->vertices = 0;
+}
+
 //=============================================================================
 // keyvalue pair
 //=============================================================================
@@ -131,3 +237,249 @@ void keyvalue_insert(keyvalue_pair_t* map, uint32_t* map_size, uint32_t map_max,
 
   ++(*map_size);
 }
+
+//=============================================================================
+// line scanning
+//=============================================================================
+
+static const char* scan_scalar(const char* p, const char* end, char a, char b)
+{
+  while (p < end && *p != a && *p != b)
+    ++p;
+  return p;
+}
+
+static const char* scan_sse2(const char* p, const char* end, char a, char b)
+{
+  __m128i va = _mm_set1_epi8(a);
+  __m128i vb = _mm_set1_epi8(b);
+  unsigned long bit;
+
+  for (; end - p >= 16; p += 16)
+  {
+    __m128i chars = _mm_loadu_si128((const __m128i*)p);
+    int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chars, va), _mm_cmpeq_epi8(chars, vb)));
+    if (mask)
+    {
+      _BitScanForward(&bit, (unsigned long)mask);
+      return p + bit;
+    }
+  }
+
+  return scan_scalar(p, end, a, b);
+}
+
+static const char* scan_avx2(const char* p, const char* end, char a, char b)
+{
+  __m256i va = _mm256_set1_epi8(a);
+  __m256i vb = _mm256_set1_epi8(b);
+  unsigned long bit;
+
+  for (; end - p >= 32; p += 32)
+  {
+    __m256i chars = _mm256_loadu_si256((const __m256i*)p);
+    int mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chars, va), _mm256_cmpeq_epi8(chars, vb)));
+    if (mask)
+    {
+      _BitScanForward(&bit, (unsigned long)mask);
+      return p + bit;
+    }
+  }
+
+  return scan_sse2(p, end, a, b);
+}
+
+static bool cpu_has_avx2(void)
+{
+  int info[4];
+
+  // AVX2 needs both the instructions & the OS saving the ymm registers
+  __cpuid(info, 0);
+  if (info[0] >= 7)
+  {
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6)
+    {
+      __cpuidex(info, 7, 0);
+      if (info[1] & (1 << 5))
+        return true;
+    }
+  }
+
+  return false;
+}
+
+static scan_func_t select_scan(void)
+{
+  // SSE2 is always available on x64
+  return cpu_has_avx2() ? scan_avx2 : scan_sse2;
+}
+
+scan_func_t get_scan_path(scan_path_t path)
+{
+  switch (path)
+  {
+  case SCAN_SCALAR: return scan_scalar;
+  case SCAN_SSE2: return scan_sse2;
+  case SCAN_AVX2: return cpu_has_avx2() ? scan_avx2 : 0;
+  default: return 0;
+  }
+}
+
+static const char* scan(const char* p, const char* end, char a, char b)
+{
+  // selected on first use. racing threads all pick the same function
+  static scan_func_t scan_func = 0;
+
+  if (!scan_func)
+    scan_func = select_scan();
+
+  return scan_func(p, end, a, b);
+}
+
+const char* find_line_end(const char* p, const char* end)
+{
+  return scan(p, end, '\n', '\r');
+}
+
+const char* find_char(const char* p, const char* end, char c)
+{
+  return scan(p, end, c, c);
+}
+
+//=============================================================================
+// hashing
+//=============================================================================
+
+uint64_t hash_bytes(uint64_t hash, const void* data, size_t num_bytes)
+{
+  const uint8_t* bytes = (const uint8_t*)data;
+  size_t i = 0;
+
+  for (i = 0; i < num_bytes; ++i)
+  {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+
+  return hash;
+}
+
+//=============================================================================
+// timing
+//=============================================================================
+
+double get_time_ms(void)
+{
+  LARGE_INTEGER counter, freq;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&counter);
+  return 1000.0 * (double)counter.QuadPart / (double)freq.QuadPart;
+}
+
+//=============================================================================
+// parallel for
+//=============================================================================
+
+typedef struct
+{
+  parallel_task_t task;
+  void* context;
+  uint32_t num_items;
+  volatile LONG next_item;
+} parallel_job_t;
+
+typedef struct
+{
+  parallel_job_t* job;
+  uint32_t worker;
+} parallel_worker_t;
+
+static DWORD WINAPI parallel_worker_proc(LPVOID param)
+{
+  parallel_worker_t* worker = (parallel_worker_t*)param;
+  parallel_job_t* job = worker->job;
+
+  for (;;)
+  {
+    uint32_t item = (uint32_t)(InterlockedIncrement(&job->next_item) - 1);
+    if (item >= job->num_items)
+      break;
+
+    job->task(job->context, item, worker->worker);
+  }
+
+  return 0;
+}
+
+uint32_t get_num_workers(uint32_t num_workers, uint32_t num_items)
+{
+  if (num_workers == 0)
+  {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    num_workers = (uint32_t)info.dwNumberOfProcessors;
+  }
+
+  if (num_workers > num_items)
+    num_workers = num_items;
+
+  return num_workers > 0 ? num_workers : 1;
+}
+
+void parallel_for(uint32_t num_items, uint32_t num_workers, parallel_task_t task, void* context)
+{
+  parallel_job_t job;
+  parallel_worker_t* workers = 0;
+  HANDLE* threads = 0;
+  uint32_t i = 0;
+
+  job.task = task;
+  job.context = context;
+  job.num_items = num_items;
+  job.next_item = 0;
+
+  num_workers = get_num_workers(num_workers, num_items);
+
+  if (num_workers > 1)
+  {
+    workers = (parallel_worker_t*)malloc(sizeof(parallel_worker_t) * num_workers);
+    threads = (HANDLE*)malloc(sizeof(HANDLE) * num_workers);
+  }
+
+  if (!workers || !threads)
+  {
+    // run everything on the calling thread
+    for (i = 0; i < num_items; ++i)
+      task(context, i, 0);
+    goto cleanup;
+  }
+
+  for (i = 0; i < num_workers; ++i)
+  {
+    workers[i].job = &job;
+    workers[i].worker = i;
+    threads[i] = 0;
+  }
+
+  // if a thread fails to start, the remaining workers pick up its share
+  for (i = 1; i < num_workers; ++i)
+    threads[i] = CreateThread(0, 0, parallel_worker_proc, &workers[i], 0, 0);
+
+  parallel_worker_proc(&workers[0]);
+
+  for (i = 1; i < num_workers; ++i)
+  {
+    if (threads[i])
+    {
+      WaitForSingleObject(threads[i], INFINITE);
+      CloseHandle(threads[i]);
+    }
+  }
+
+cleanup:
+  if (threads)
+    free(threads);
+  if (workers)
+    free(workers);
+}
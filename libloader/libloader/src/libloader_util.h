@@ -12,6 +12,43 @@
 
 char* read_text_file(const char* filename, uint32_t* out_num_bytes);
 
+// reads into a caller owned buffer, which is reallocated only if the file doesn't fit
+bool read_text_file_into(const char* filename, char** inout_buffer, uint32_t* inout_capacity, uint32_t* out_num_bytes);
+
+//=============================================================================
+// line scanning. returns the first '\n' or '\r' (or c) in [p, end), or end if
+// there is none. vectorized with AVX2 or SSE2, picked by CPU support.
+//=============================================================================
+
+const char* find_line_end(const char* p, const char* end);
+const char* find_char(const char* p, const char* end, char c);
+
+// the individual implementations, so they can be checked against each other &
+// benchmarked. each returns the first a or b in [p, end), or end.
+typedef const char* (*scan_func_t)(const char* p, const char* end, char a, char b);
+
+typedef enum
+{
+  SCAN_SCALAR,
+  SCAN_SSE2,
+  SCAN_AVX2,
+  SCAN_NUM_PATHS,
+} scan_path_t;
+
+// returns null if the CPU doesn't support the path
+scan_func_t get_scan_path(scan_path_t path);
+
+//=============================================================================
+// map a file into memory. the view is copy-on-write, so callers may modify
+// the returned memory without touching the file.
+//=============================================================================
+
+void* map_file(const char* filename, uint64_t* out_num_bytes);
+void unmap_file(void* view);
+
+// frees the model's vertex buffer, which may point into a mapped file
+void free_model_vertices(libload_obj_model_t* model);
+
 //=============================================================================
 // keyvalue pair (map) with uint64 key & uint32 values
 //=============================================================================
@@ -24,3 +61,132 @@ typedef struct
 
 bool keyvalue_find(const keyvalue_pair_t* map, uint32_t map_size, uint64_t key, uint32_t* value);
 void keyvalue_insert(keyvalue_pair_t* map, uint32_t* map_size, uint32_t map_max, uint64_t key, uint32_t value);
+
+//=============================================================================
+// 64bit FNV-1a hash. pass in the previous hash to continue hashing, or
+// LIBLOAD_HASH_SEED to start a new one
+//=============================================================================
+
+#define LIBLOAD_HASH_SEED 0xcbf29ce484222325ull
+
+uint64_t hash_bytes(uint64_t hash, const void* data, size_t num_bytes);
+
+//=============================================================================
+// timing
+//=============================================================================
+
+double get_time_ms(void);
+
+//=============================================================================
+// simple parallel for. items are handed out dynamically to the workers, and
+// the calling thread participates as worker 0. worker indices are stable for
+// the duration of the call, so tasks can use them to index per-worker scratch.
+// num_workers == 0 means one worker per logical processor.
+//=============================================================================
+
+typedef void (*parallel_task_t)(void* context, uint32_t item, uint32_t worker);
+
+uint32_t get_num_workers(uint32_t num_workers, uint32_t num_items);
+void parallel_for(uint32_t num_items, uint32_t num_workers, parallel_task_t task, void* context);
+
+//=============================================================================
+// OBJ & MTL parsing internals, shared by the loader, the incremental reloader
+// & libloader_bench
+//=============================================================================
+
+typedef enum
+{
+  OBJ_UNKNOWN,
+  OBJ_COMMENT,
+  OBJ_MTLLIB,
+  OBJ_VERTEX,
+  OBJ_NORMAL,
+  OBJ_TEXCOORD,
+  OBJ_GROUP,
+  OBJ_USEMTL,
+  OBJ_SMOOTH,
+  OBJ_FACE,
+} obj_directive_t;
+
+// vertex keys pack the 0-based position, normal & texcoord indices 20 bits each
+#define OBJ_KEY_VERT(key) ((uint32_t)((key) >> 40) & 0xFFFFF)
+#define OBJ_KEY_NORMAL(key) ((uint32_t)((key) >> 20) & 0xFFFFF)
+#define OBJ_KEY_TEXCOORD(key) ((uint32_t)(key) & 0xFFFFF)
+
+#define OBJ_NO_PART UINT32_MAX
+
+// a run of lines starting at a g or usemtl line (the first section starts at
+// the top of the file instead)
+typedef struct
+{
+  uint32_t offset;            // byte range in the file
+  uint32_t length;
+  uint64_t hash;              // hash of the section's text
+  uint32_t first_vert;        // v, vn & vt lines declared by the section
+  uint32_t num_verts;
+  uint32_t first_normal;
+  uint32_t num_normals;
+  uint32_t first_texcoord;
+  uint32_t num_texcoords;
+  uint32_t base_index;        // indices emitted by the section's faces
+  uint32_t num_indices;
+  uint32_t part;              // part started by the section's usemtl, or OBJ_NO_PART
+  obj_directive_t directive;  // OBJ_GROUP or OBJ_USEMTL for the line starting the section, else OBJ_UNKNOWN
+} obj_section_t;
+
+struct libload_obj_reload_index_t
+{
+  uint32_t num_sections;
+  obj_section_t* sections;
+
+  // raw attributes, indexed by vertex keys
+  uint32_t num_verts;
+  uint32_t num_vert_normals;
+  uint32_t num_vert_texcoords;
+  libload_float3_t* verts;
+  libload_float3_t* vert_normals;
+  libload_float2_t* vert_texcoords;
+
+  // key of each model vertex
+  uint32_t num_vertices;
+  uint64_t* vertex_keys;
+};
+
+obj_directive_t classify_obj_line(const char* line);
+
+typedef enum
+{
+  MTL_UNKNOWN,
+  MTL_COMMENT,
+  MTL_NEWMTL,
+  MTL_NS,
+  MTL_NI,
+  MTL_D,
+  MTL_TR,
+  MTL_TF,
+  MTL_ILLUM,
+  MTL_KA,
+  MTL_KD,
+  MTL_KS,
+  MTL_KE,
+  MTL_MAP_KA,
+  MTL_MAP_KD,
+  MTL_MAP_D,
+  MTL_MAP_BUMP,
+  MTL_BUMP,
+} mtl_directive_t;
+
+mtl_directive_t classify_mtl_line(const char* line);
+
+// parses the vertex references of a face line (after the "f ") into vertex
+// keys, 3 for a triangle or 6 for a quad. returns 0 for unsupported faces.
+uint32_t parse_face(const char* line, uint32_t num_verts, uint32_t num_vert_normals, uint32_t num_vert_texcoords, uint64_t keys[6]);
+
+void vertex_from_key(libload_obj_vertex_t* vertex, uint64_t key,
+  const libload_float3_t* verts, const libload_float3_t* vert_normals, const libload_float2_t* vert_texcoords);
+
+// splits the file text into sections. pass null for out_sections to count them.
+uint32_t split_sections(const char* buffer, const char* buffer_end, obj_section_t* out_sections);
+
+// loads a model & fills in its reload index
+libload_obj_error_t load_obj_indexed(const char* filename, libload_obj_reload_index_t* index, libload_obj_model_t** out_model);
@@ -0,0 +1,289 @@
+//=============================================================================
+// libloader_weld.c - Epsilon vertex welding
+// Reza Nourai, 2016
+//=============================================================================
+
+#include "..\include\libloader.h"
+#include "libloader_util.h"
+
+#include <malloc.h>
+#include <string.h>
+#include <math.h>
+
+#define EMPTY_SLOT UINT32_MAX
+
+typedef struct
+{
+  int64_t x, y, z;
+} grid_cell_t;
+
+typedef struct
+{
+  libload_obj_model_t* model;
+  uint32_t* indices;            // welded copy of the model's indices
+  const libload_obj_model_part_t* parts;
+  const libload_obj_weld_options_t* options;
+  float inv_cell_size;
+  volatile bool failed;
+} weld_job_t;
+
+static grid_cell_t get_cell(const libload_float3_t* position, float inv_cell_size)
+{
+  grid_cell_t cell;
+
+  if (inv_cell_size > 0.f)
+  {
+    cell.x = (int64_t)floor((double)position->x * inv_cell_size);
+    cell.y = (int64_t)floor((double)position->y * inv_cell_size);
+    cell.z = (int64_t)floor((double)position->z * inv_cell_size);
+  }
+  else
+  {
+    // exact welding, so only identical positions share a cell
+    uint32_t bits[3];
+    memcpy(bits, position, sizeof(bits));
+    cell.x = bits[0];
+    cell.y = bits[1];
+    cell.z = bits[2];
+  }
+
+  return cell;
+}
+
+static uint32_t hash_cell(const grid_cell_t* cell, uint32_t mask)
+{
+  return (uint32_t)hash_bytes(LIBLOAD_HASH_SEED, cell, sizeof(grid_cell_t)) & mask;
+}
+
+static bool within(float a, float b, float tolerance)
+{
+  return fabsf(a - b) <= tolerance;
+}
+
+static bool within3(const libload_float3_t* a, const libload_float3_t* b, float tolerance)
+{
+  return within(a->x, b->x, tolerance) && within(a->y, b->y, tolerance) && within(a->z, b->z, tolerance);
+}
+
+static bool vertices_match(const libload_obj_vertex_t* a, const libload_obj_vertex_t* b, const libload_obj_weld_options_t* options)
+{
+  return
+    within3(&a->position, &b->position, options->position_tolerance) &&
+    within3(&a->normal, &b->normal, options->normal_tolerance) &&
+    within3(&a->tangent, &b->tangent, options->normal_tolerance) &&
+    within3(&a->bitangent, &b->bitangent, options->normal_tolerance) &&
+    within(a->texcoord.x, b->texcoord.x, options->texcoord_tolerance) &&
+    within(a->texcoord.y, b->texcoord.y, options->texcoord_tolerance);
+}
+
+// welds the vertices referenced by one part by pointing its indices in the job's
+// copy at the first matching vertex. each part only touches its own index
+// range, so parts can be welded concurrently.
+static void weld_part(void* context, uint32_t item, uint32_t worker)
+{
+  weld_job_t* job = (weld_job_t*)context;
+  const libload_obj_model_part_t* part = &job->parts[item];
+  const libload_obj_model_t* model = job->model;
+  uint32_t* indices = &job->indices[part->base_index];
+  uint32_t num_buckets = 1, mask = 0;
+  uint32_t* buckets = 0;
+  uint32_t* next = 0;
+  uint32_t* welded = 0;
+  grid_cell_t* cells = 0;
+  uint32_t num_welded = 0;
+  uint32_t i;
+  int dx, dy, dz;
+  int range = (job->inv_cell_size > 0.f) ? 1 : 0;
+
+  (void)worker;
+
+  if (part->num_indices == 0)
+    return;
+
+  while (num_buckets < part->num_indices * 2)
+    num_buckets <<= 1;
+  mask = num_buckets - 1;
+
+  buckets = (uint32_t*)malloc(sizeof(uint32_t) * num_buckets);
+  next = (uint32_t*)malloc(sizeof(uint32_t) * part->num_indices);
+  welded = (uint32_t*)malloc(sizeof(uint32_t) * part->num_indices);
+  cells = (grid_cell_t*)malloc(sizeof(grid_cell_t) * part->num_indices);
+  if (!buckets || !next || !welded || !cells)
+  {
+    job->failed = true;
+    goto cleanup;
+  }
+
+  memset(buckets, 0xFF, sizeof(uint32_t) * num_buckets);
+
+  for (i = 0; i < part->num_indices; ++i)
+  {
+    const libload_obj_vertex_t* vertex = &model->vertices[indices[i]];
+    grid_cell_t cell = get_cell(&vertex->position, job->inv_cell_size);
+    uint32_t best = EMPTY_SLOT;
+
+    // a vertex within tolerance can only be in a neighboring cell. pick the
+    // earliest match so repeated references to one vertex weld consistently
+    for (dz = -range; dz <= range; ++dz)
+    {
+      for (dy = -range; dy <= range; ++dy)
+      {
+        for (dx = -range; dx <= range; ++dx)
+        {
+          grid_cell_t neighbor;
+          uint32_t slot;
+
+          neighbor.x = cell.x + dx;
+          neighbor.y = cell.y + dy;
+          neighbor.z = cell.z + dz;
+
+          for (slot = buckets[hash_cell(&neighbor, mask)]; slot != EMPTY_SLOT; slot = next[slot])
+          {
+            if (slot < best &&
+                cells[slot].x == neighbor.x && cells[slot].y == neighbor.y && cells[slot].z == neighbor.z &&
+                vertices_match(&model->vertices[welded[slot]], vertex, job->options))
+            {
+              best = slot;
+            }
+          }
+        }
+      }
+    }
+
+    if (best == EMPTY_SLOT)
+    {
+      uint32_t bucket = hash_cell(&cell, mask);
+      best = num_welded++;
+      welded[best] = indices[i];
+      cells[best] = cell;
+      next[best] = buckets[bucket];
+      buckets[bucket] = best;
+    }
+
+    indices[i] = welded[best];
+  }
+
+cleanup:
+  if (cells)
+    free(cells);
+  if (welded)
+    free(welded);
+  if (next)
+    free(next);
+  if (buckets)
+    free(buckets);
+}
+
+bool libload_obj_weld_vertices(libload_obj_model_t* model, const libload_obj_weld_options_t* options, libload_obj_weld_stats_t* out_stats)
+{
+  bool result = false;
+  double start_time = get_time_ms();
+  weld_job_t job;
+  libload_obj_model_part_t* all_parts = 0;
+  uint32_t num_parts = 0;
+  uint32_t first_index = 0;
+  uint32_t* indices = 0;
+  uint32_t* remap = 0;
+  libload_obj_vertex_t* vertices = 0;
+  uint32_t num_vertices = 0;
+  uint32_t i;
+
+  if (!model || !options)
+    goto cleanup;
+
+  if (out_stats)
+  {
+    memset(out_stats, 0, sizeof(libload_obj_weld_stats_t));
+    out_stats->source_vertices = model->num_vertices;
+    out_stats->welded_vertices = model->num_vertices;
+  }
+
+  memset(&job, 0, sizeof(job));
+  job.model = model;
+  job.options = options;
+  job.inv_cell_size = options->position_tolerance > 0.f ? 1.f / options->position_tolerance : 0.f;
+
+  // indices before the first usemtl (all of them, in models without any)
+  // are treated as one more part, in front of the others
+  job.parts = model->parts;
+  num_parts = model->num_parts;
+
+  first_index = model->num_indices;
+  for (i = 0; i < model->num_parts; ++i)
+  {
+    if (model->parts[i].base_index < first_index)
+      first_index = model->parts[i].base_index;
+  }
+
+  if (first_index > 0 || num_parts == 0)
+  {
+    all_parts = (libload_obj_model_part_t*)malloc(sizeof(libload_obj_model_part_t) * (num_parts + 1));
+    if (!all_parts)
+      goto cleanup;
+
+    memset(&all_parts[0], 0, sizeof(libload_obj_model_part_t));
+    all_parts[0].num_indices = first_index;
+    if (num_parts > 0)
+      memcpy(&all_parts[1], model->parts, sizeof(libload_obj_model_part_t) * num_parts);
+
+    job.parts = all_parts;
+    ++num_parts;
+  }
+
+  // parts are welded into a copy of the indices & all buffers are allocated up
+  // front, so the model is only changed once nothing else can fail
+  indices = (uint32_t*)malloc(sizeof(uint32_t) * (model->num_indices + 1));
+  remap = (uint32_t*)malloc(sizeof(uint32_t) * (model->num_vertices + 1));
+  vertices = (libload_obj_vertex_t*)malloc(sizeof(libload_obj_vertex_t) * (model->num_vertices + 1));
+  if (!indices || !remap || !vertices)
+    goto cleanup;
+
+  memcpy(indices, model->indices, sizeof(uint32_t) * model->num_indices);
+  job.indices = indices;
+
+  parallel_for(num_parts, options->num_threads, weld_part, &job);
+  if (job.failed)
+    goto cleanup;
+
+  // compact the vertex buffer down to the vertices still referenced, in order
+  // of first use
+  memset(remap, 0xFF, sizeof(uint32_t) * (model->num_vertices + 1));
+
+  for (i = 0; i < model->num_indices; ++i)
+  {
+    uint32_t index = indices[i];
+    if (remap[index] == EMPTY_SLOT)
+    {
+      remap[index] = num_vertices;
+      vertices[num_vertices++] = model->vertices[index];
+    }
+    indices[i] = remap[index];
+  }
+
+  if (out_stats)
+    out_stats->welded_vertices = num_vertices;
+
+  memcpy(model->indices, indices, sizeof(uint32_t) * model->num_indices);
+
+  free_model_vertices(model);
+  model->vertices = vertices;
+  model->num_vertices = num_vertices;
+  vertices = 0;
+
+  result = true;
+
+cleanup:
+  if (vertices)
+    free(vertices);
+  if (remap)
+    free(remap);
+  if (indices)
+    free(indices);
+  if (all_parts)
+    free(all_parts);
+
+  if (out_stats)
+    out_stats->elapsed_ms = (float)(get_time_ms() - start_time);
+
+  return result;
+}
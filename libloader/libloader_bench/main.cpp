@@ -0,0 +1,646 @@
+#include <Windows.h>
+#include <Shlwapi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+#include <vector>
+
+#include <libloader.h>
+
+extern "C"
+{
+#include "..\libloader\src\libloader_util.h"
+}
+
+// Measures how well a model compresses with the geometry codec & how fast it
+// encodes & decodes, checking that every decode reproduces the model exactly.
+// Also checks that every line scanning path the CPU supports finds the same
+// line ends, & how fast each one scans the model file & its materials. For OBJ
+// & MTL files the line classification, face parsing & full load are timed too,
+// to show the scanner's share of a load. For OBJ files libload_obj_load_many is
+// timed on copies of the file with 1, 2, 4, ... threads up to one per logical
+// processor, to show how batched loading scales. Welding is checked on a small
+// built in model with faces before its first usemtl.
+//
+// usage: libloader_bench <model.obj|model.ply|materials.mtl> [iterations]
+//
+// codec throughput is measured against the raw vertex + index bytes of the
+// model, everything else against the file size, using the fastest of the iterations.
+
+static const char* const c_scan_path_names[SCAN_NUM_PATHS] = { "scalar", "sse2", "avx2" };
+
+static bool ModelsEqual(const libload_obj_model_t* a, const libload_obj_model_t* b)
+{
+  return
+    a->num_vertices == b->num_vertices &&
+    a->num_indices == b->num_indices &&
+    a->num_parts == b->num_parts &&
+    strcmp(a->material_file, b->material_file) == 0 &&
+    memcmp(a->vertices, b->vertices, sizeof(libload_obj_vertex_t) * a->num_vertices) == 0 &&
+    memcmp(a->indices, b->indices, sizeof(uint32_t) * a->num_indices) == 0 &&
+    memcmp(a->parts, b->parts, sizeof(libload_obj_model_part_t) * a->num_parts) == 0;
+}
+
+static double GigabytesPerSecond(uint64_t num_bytes, double seconds)
+{
+  return (seconds > 0.0) ? num_bytes / (seconds * 1e9) : 0.0;
+}
+
+static double GetSeconds()
+{
+  LARGE_INTEGER freq{}, now{};
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&now);
+  return now.QuadPart / (double)freq.QuadPart;
+}
+
+static bool BenchCodec(const libload_obj_model_t* model, uint32_t iterations)
+{
+  LARGE_INTEGER freq{};
+  QueryPerformanceFrequency(&freq);
+
+  uint64_t raw_bytes = sizeof(libload_obj_vertex_t) * (uint64_t)model->num_vertices + sizeof(uint32_t) * (uint64_t)model->num_indices;
+  uint64_t encoded_bytes = 0;
+  uint8_t* encoded = nullptr;
+  double best_encode = DBL_MAX;
+  double best_decode = DBL_MAX;
+
+  for (uint32_t i = 0; i < iterations; ++i)
+  {
+    if (encoded)
+      libload_obj_free_encoded(encoded);
+    encoded = nullptr;
+
+    LARGE_INTEGER start{}, end{};
+    QueryPerformanceCounter(&start);
+    bool result = libload_obj_encode(model, &encoded, &encoded_bytes);
+    QueryPerformanceCounter(&end);
+    if (!result)
+    {
+      printf("Encoding failed.\n");
+      return false;
+    }
+
+    double seconds = (end.QuadPart - start.QuadPart) / (double)freq.QuadPart;
+    if (seconds < best_encode)
+      best_encode = seconds;
+  }
+
+  bool result = true;
+  for (uint32_t i = 0; i < iterations && result; ++i)
+  {
+    libload_obj_model_t* decoded = nullptr;
+
+    LARGE_INTEGER start{}, end{};
+    QueryPerformanceCounter(&start);
+    result = libload_obj_decode(encoded, encoded_bytes, &decoded);
+    QueryPerformanceCounter(&end);
+
+    if (!result)
+      printf("Decoding failed.\n");
+    else if (!ModelsEqual(model, decoded))
+    {
+      printf("Decoded model doesn't match the source.\n");
+      result = false;
+    }
+
+    double seconds = (end.QuadPart - start.QuadPart) / (double)freq.QuadPart;
+    if (seconds < best_decode)
+      best_decode = seconds;
+
+    libload_obj_free(decoded);
+  }
+
+  libload_obj_free_encoded(encoded);
+
+  if (result)
+  {
+    printf("Codec: %llu -> %llu bytes (%2.2fx)\n", raw_bytes, encoded_bytes, (double)raw_bytes / (double)encoded_bytes);
+    printf("  encode %3.2fms (%2.3f GB/s)\n", 1000.0 * best_encode, GigabytesPerSecond(raw_bytes, best_encode));
+    printf("  decode %3.2fms (%2.3f GB/s)\n", 1000.0 * best_decode, GigabytesPerSecond(raw_bytes, best_decode));
+  }
+
+  return result;
+}
+
+// welds a small model whose first faces come before any usemtl, checking that
+// those faces are welded like the part after them & stay in range
+static bool CheckWeld()
+{
+  static const char c_model[] =
+    "v 0 0 0\nv 1 0 0\nv 0 1 0\nv 1 1 0\nv 1 0 0\nv 0 1 0\nvt 0 0\nvn 0 0 1\n"
+    "f 1/1/1 2/1/1 3/1/1\nf 5/1/1 4/1/1 6/1/1\n"
+    "usemtl a\nf 1/1/1 2/1/1 3/1/1\nf 5/1/1 4/1/1 6/1/1\n";
+
+  char dir[MAX_PATH], filename[MAX_PATH];
+  if (!GetTempPathA(MAX_PATH, dir) || !GetTempFileNameA(dir, "llw", 0, filename))
+    return false;
+
+  FILE* file = nullptr;
+  if (fopen_s(&file, filename, "wb") != 0)
+    return false;
+  fwrite(c_model, 1, sizeof(c_model) - 1, file);
+  fclose(file);
+
+  libload_obj_model_t* model = nullptr;
+  bool result = libload_obj_load(filename, &model);
+  DeleteFileA(filename);
+  if (!result)
+  {
+    printf("Weld: failed to load the check model.\n");
+    return false;
+  }
+
+  libload_obj_weld_options_t options = { 0.001f, 0.01f, 0.01f, 0 };
+  result = libload_obj_weld_vertices(model, &options, nullptr) && model->num_parts == 1 && model->parts[0].base_index == 6;
+
+  // both quads share their diagonal, so each is left with 4 distinct vertices
+  for (uint32_t range = 0; range < 2 && result; ++range)
+  {
+    uint32_t distinct[6];
+    uint32_t num_distinct = 0;
+    for (uint32_t i = range * 6; i < range * 6 + 6 && result; ++i)
+    {
+      uint32_t index = model->indices[i];
+      result = index < model->num_vertices;
+
+      uint32_t j = 0;
+      while (j < num_distinct && distinct[j] != index)
+        ++j;
+      if (j == num_distinct)
+        distinct[num_distinct++] = index;
+    }
+    result = result && num_distinct == 4;
+  }
+
+  if (!result)
+    printf("Weld: faces before the first usemtl weren't welded.\n");
+
+  libload_obj_free(model);
+  return result;
+}
+
+// compares every scan path against the scalar one, for all short lengths &
+// alignments & with matches at every position in & around the vector widths
+static bool CheckScanPaths()
+{
+  scan_func_t scalar = get_scan_path(SCAN_SCALAR);
+  char buffer[256];
+  uint32_t seed = 1;
+
+  for (uint32_t round = 0; round < 64; ++round)
+  {
+    // sparse line ends, denser in later rounds
+    for (uint32_t i = 0; i < sizeof(buffer); ++i)
+    {
+      seed = seed * 1664525 + 1013904223;
+      uint32_t r = (seed >> 16) % (128 - round);
+      buffer[i] = (r == 0) ? '\n' : (r == 1) ? '\r' : (char)('a' + (seed >> 24) % 26);
+    }
+
+    for (uint32_t path = SCAN_SSE2; path < SCAN_NUM_PATHS; ++path)
+    {
+      scan_func_t scan = get_scan_path((scan_path_t)path);
+      if (!scan)
+        continue;
+
+      for (uint32_t start = 0; start < 64; ++start)
+      {
+        for (uint32_t length = 0; start + length <= sizeof(buffer); ++length)
+        {
+          const char* p = buffer + start;
+          const char* end = p + length;
+          if (scan(p, end, '\n', '\r') != scalar(p, end, '\n', '\r') ||
+              scan(p, end, 'q', 'q') != scalar(p, end, 'q', 'q'))
+          {
+            printf("Scan: %s disagrees with scalar at offset %u, length %u.\n", c_scan_path_names[path], start, length);
+            return false;
+          }
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+static bool BenchScan(const char* filename, uint32_t iterations)
+{
+  uint32_t num_bytes = 0;
+  char* text = read_text_file(filename, &num_bytes);
+  if (!text)
+  {
+    printf("Failed to read %s.\n", filename);
+    return false;
+  }
+
+  LARGE_INTEGER freq{};
+  QueryPerformanceFrequency(&freq);
+
+  bool result = true;
+  uint64_t expected_lines = 0, expected_checksum = 0;
+
+  for (uint32_t path = SCAN_SCALAR; path < SCAN_NUM_PATHS && result; ++path)
+  {
+    scan_func_t scan = get_scan_path((scan_path_t)path);
+    if (!scan)
+    {
+      printf("  %-6s not supported\n", c_scan_path_names[path]);
+      continue;
+    }
+
+    double best = DBL_MAX;
+    uint64_t lines = 0, checksum = 0;
+
+    for (uint32_t i = 0; i < iterations; ++i)
+    {
+      const char* p = text;
+      const char* end = text + num_bytes;
+      lines = 0;
+      checksum = 0;
+
+      LARGE_INTEGER start{}, stop{};
+      QueryPerformanceCounter(&start);
+      while ((p = scan(p, end, '\n', '\r')) < end)
+      {
+        checksum += p - text;
+        ++lines;
+        ++p;
+      }
+      QueryPerformanceCounter(&stop);
+
+      double seconds = (stop.QuadPart - start.QuadPart) / (double)freq.QuadPart;
+      if (seconds < best)
+        best = seconds;
+    }
+
+    if (path == SCAN_SCALAR)
+    {
+      expected_lines = lines;
+      expected_checksum = checksum;
+      printf("Scan %s: %u bytes, %llu line ends\n", filename, num_bytes, lines);
+    }
+    else if (lines != expected_lines || checksum != expected_checksum)
+    {
+      printf("Scan: %s found different line ends than scalar.\n", c_scan_path_names[path]);
+      result = false;
+    }
+
+    printf("  %-6s %3.2fms (%2.3f GB/s)\n", c_scan_path_names[path], 1000.0 * best, GigabytesPerSecond(num_bytes, best));
+  }
+
+  free(text);
+  return result;
+}
+
+// times classifying every line of an OBJ file, then parsing its faces into
+// vertex keys, the two steps the loader runs on each line after finding it
+static bool BenchParse(const char* filename, uint32_t iterations)
+{
+  uint32_t num_bytes = 0;
+  char* text = read_text_file(filename, &num_bytes);
+  if (!text)
+  {
+    printf("Failed to read %s.\n", filename);
+    return false;
+  }
+
+  const char* end = text + num_bytes;
+  uint32_t counts[OBJ_FACE + 1] = {};
+  double best_classify = DBL_MAX;
+
+  for (uint32_t i = 0; i < iterations; ++i)
+  {
+    memset(counts, 0, sizeof(counts));
+
+    double start = GetSeconds();
+    for (const char* line = text; line < end; ++line)
+    {
+      while (line < end && (*line == ' ' || *line == '\t'))
+        ++line;
+
+      const char* line_end = find_line_end(line, end);
+      ++counts[classify_obj_line(line)];
+      line = line_end;
+    }
+    double seconds = GetSeconds() - start;
+    if (seconds < best_classify)
+      best_classify = seconds;
+  }
+
+  // faces are parsed from their own lines, terminated like the loader does,
+  // along with the attribute counts so far for relative indices
+  struct FaceLine
+  {
+    const char* line;
+    uint32_t num_verts, num_normals, num_texcoords;
+  };
+
+  std::vector<FaceLine> faces;
+  faces.reserve(counts[OBJ_FACE]);
+
+  uint32_t num_verts = 0, num_normals = 0, num_texcoords = 0;
+  for (char* line = text; line < end; ++line)
+  {
+    while (line < end && (*line == ' ' || *line == '\t'))
+      ++line;
+
+    char* line_end = (char*)find_line_end(line, end);
+    switch (classify_obj_line(line))
+    {
+    case OBJ_VERTEX: ++num_verts; break;
+    case OBJ_NORMAL: ++num_normals; break;
+    case OBJ_TEXCOORD: ++num_texcoords; break;
+    case OBJ_FACE: faces.push_back({ line + 2, num_verts, num_normals, num_texcoords }); break;
+    default: break;
+    }
+
+    if (line_end < end)
+      *line_end = '\0';
+    line = line_end;
+  }
+
+  double best_faces = DBL_MAX;
+  uint64_t num_keys = 0, checksum = 0;
+
+  for (uint32_t i = 0; i < iterations; ++i)
+  {
+    num_keys = 0;
+    checksum = 0;
+
+    double start = GetSeconds();
+    for (const FaceLine& face : faces)
+    {
+      uint64_t keys[6];
+      uint32_t n = parse_face(face.line, face.num_verts, face.num_normals, face.num_texcoords, keys);
+      for (uint32_t k = 0; k < n; ++k)
+        checksum += keys[k];
+      num_keys += n;
+    }
+    double seconds = GetSeconds() - start;
+    if (seconds < best_faces)
+      best_faces = seconds;
+  }
+
+  printf("Parse %s: %u v, %u vn, %u vt, %u f, %u other lines (%llu keys, checksum %llx)\n", filename,
+    counts[OBJ_VERTEX], counts[OBJ_NORMAL], counts[OBJ_TEXCOORD], counts[OBJ_FACE],
+    counts[OBJ_UNKNOWN] + counts[OBJ_COMMENT] + counts[OBJ_MTLLIB] + counts[OBJ_GROUP] + counts[OBJ_USEMTL] + counts[OBJ_SMOOTH],
+    num_keys, checksum);
+  printf("  scan + classify %3.2fms (%2.3f GB/s)\n", 1000.0 * best_classify, GigabytesPerSecond(num_bytes, best_classify));
+  printf("  parse faces     %3.2fms (%2.2f M faces/s)\n", 1000.0 * best_faces,
+    (best_faces > 0.0) ? faces.size() / (best_faces * 1e6) : 0.0);
+
+  free(text);
+  return true;
+}
+
+// times the full load of a model file, for comparison with its scan & parse
+static bool BenchLoad(const char* filename, bool ply, uint32_t iterations)
+{
+  uint32_t num_bytes = 0;
+  char* text = read_text_file(filename, &num_bytes);
+  if (!text)
+  {
+    printf("Failed to read %s.\n", filename);
+    return false;
+  }
+  free(text);
+
+  double best = DBL_MAX;
+  for (uint32_t i = 0; i < iterations; ++i)
+  {
+    libload_obj_model_t* model = nullptr;
+
+    double start = GetSeconds();
+    bool result = ply ? libload_ply_load(filename, &model) : libload_obj_load(filename, &model);
+    double seconds = GetSeconds() - start;
+
+    if (!result)
+    {
+      printf("Failed to load model file %s.\n", filename);
+      return false;
+    }
+    libload_obj_free(model);
+
+    if (seconds < best)
+      best = seconds;
+  }
+
+  printf("Load %s: %3.2fms (%2.3f GB/s)\n", filename, 1000.0 * best, GigabytesPerSecond(num_bytes, best));
+  return true;
+}
+
+// times libload_obj_load_many on copies of a model file with 1, 2, 4, ... threads
+// up to one per logical processor, checking every copy matches a single load
+static bool BenchLoadMany(const char* filename, uint32_t iterations)
+{
+  uint32_t num_bytes = 0;
+  char* text = read_text_file(filename, &num_bytes);
+  if (!text)
+  {
+    printf("Failed to read %s.\n", filename);
+    return false;
+  }
+  free(text);
+
+  libload_obj_model_t* reference = nullptr;
+  if (!libload_obj_load(filename, &reference))
+  {
+    printf("Failed to load model file %s.\n", filename);
+    return false;
+  }
+
+  // enough files that every thread gets a few
+  uint32_t max_threads = get_num_workers(0, UINT32_MAX);
+  uint32_t num_files = (max_threads * 4 > 16) ? max_threads * 4 : 16;
+  std::vector<const char*> filenames(num_files, filename);
+  std::vector<libload_obj_load_result_t> results(num_files);
+
+  printf("Load many %s (%u copies):\n", filename, num_files);
+
+  bool result = true;
+  double base = 0.0;
+  for (uint32_t num_threads = 1; result; num_threads = (num_threads * 2 < max_threads) ? num_threads * 2 : max_threads)
+  {
+    double best = DBL_MAX;
+    for (uint32_t i = 0; i < iterations && result; ++i)
+    {
+      double start = GetSeconds();
+      result = libload_obj_load_many(filenames.data(), num_files, num_threads, results.data());
+      double seconds = GetSeconds() - start;
+
+      for (uint32_t j = 0; j < num_files; ++j)
+      {
+        if (result && !ModelsEqual(reference, results[j].model))
+        {
+          printf("Load many: copy %u doesn't match a single load.\n", j);
+          result = false;
+        }
+        libload_obj_free(results[j].model);
+      }
+
+      if (seconds < best)
+        best = seconds;
+    }
+
+    if (!result)
+    {
+      printf("Load many: failed with %u threads.\n", num_threads);
+      break;
+    }
+
+    if (num_threads == 1)
+      base = best;
+
+    printf("  %3u threads %3.2fms (%2.3f GB/s, %.2fx)\n", num_threads, 1000.0 * best,
+      GigabytesPerSecond((uint64_t)num_bytes * num_files, best), (best > 0.0) ? base / best : 0.0);
+
+    if (num_threads >= max_threads)
+      break;
+  }
+
+  libload_obj_free(reference);
+  return result;
+}
+
+// times classifying every line of a material library, then the full load the
+// viewer does (counting the materials, then filling them in)
+static bool BenchMaterials(const char* filename, uint32_t iterations)
+{
+  uint32_t num_bytes = 0;
+  char* text = read_text_file(filename, &num_bytes);
+  if (!text)
+  {
+    printf("Failed to read %s.\n", filename);
+    return false;
+  }
+
+  const char* end = text + num_bytes;
+  uint32_t num_lines = 0, num_known = 0;
+  double best_classify = DBL_MAX;
+
+  for (uint32_t i = 0; i < iterations; ++i)
+  {
+    num_lines = 0;
+    num_known = 0;
+
+    double start = GetSeconds();
+    for (const char* line = text; line < end; ++line)
+    {
+      while (line < end && (*line == ' ' || *line == '\t'))
+        ++line;
+
+      const char* line_end = find_char(line, end, '\n');
+      if (classify_mtl_line(line) != MTL_UNKNOWN)
+        ++num_known;
+      ++num_lines;
+      line = line_end;
+    }
+    double seconds = GetSeconds() - start;
+    if (seconds < best_classify)
+      best_classify = seconds;
+  }
+
+  free(text);
+
+  double best_load = DBL_MAX;
+  uint32_t num_materials = 0;
+  std::vector<libload_mtl_t> materials;
+
+  for (uint32_t i = 0; i < iterations; ++i)
+  {
+    double start = GetSeconds();
+    num_materials = 0;
+    bool result = libload_mtl_load(filename, &num_materials, nullptr);
+    if (result)
+    {
+      materials.resize(num_materials);
+      result = libload_mtl_load(filename, &num_materials, materials.data());
+    }
+    double seconds = GetSeconds() - start;
+
+    if (!result)
+    {
+      printf("Failed to load materials from %s.\n", filename);
+      return false;
+    }
+
+    if (seconds < best_load)
+      best_load = seconds;
+  }
+
+  printf("Materials %s: %u lines, %u known, %u materials\n", filename, num_lines, num_known, num_materials);
+  printf("  scan + classify %3.2fms (%2.3f GB/s)\n", 1000.0 * best_classify, GigabytesPerSecond(num_bytes, best_classify));
+  printf("  load (2 passes) %3.2fms (%2.3f GB/s)\n", 1000.0 * best_load, GigabytesPerSecond(2 * (uint64_t)num_bytes, best_load));
+  return true;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 2)
+  {
+    printf("usage: libloader_bench <model.obj|model.ply|materials.mtl> [iterations]\n");
+    return 1;
+  }
+
+  const char* filename = argv[1];
+  uint32_t iterations = (argc > 2) ? (uint32_t)atoi(argv[2]) : 10;
+  if (iterations == 0)
+    iterations = 1;
+
+  bool result = CheckScanPaths();
+  result = CheckWeld() && result;
+
+  LPSTR extension = PathFindExtensionA(filename);
+  if (StrCmpIA(extension, ".mtl") == 0)
+  {
+    result = BenchScan(filename, iterations) && result;
+    result = BenchMaterials(filename, iterations) && result;
+    return result ? 0 : 1;
+  }
+
+  bool ply = (StrCmpIA(extension, ".ply") == 0);
+  libload_obj_model_t* model = nullptr;
+  if (!(ply ? libload_ply_load(filename, &model) : libload_obj_load(filename, &model)))
+  {
+    printf("Failed to load model file %s.\n", filename);
+    return 1;
+  }
+
+  // the material library is named relative to the model
+  char material_file[MAX_PATH]{};
+  if (model->material_file[0])
+  {
+    strcpy_s(material_file, filename);
+    PathRemoveFileSpecA(material_file);
+    PathAppendA(material_file, model->material_file);
+  }
+
+  // bench the same data the viewer renders
+  libload_obj_compute_normals(model);
+  libload_obj_compute_tangent_space(model);
+  libload_obj_batch_by_material(model, nullptr);
+
+  printf("%s: %u vertices, %u indices, %u parts, best of %u iterations\n",
+    filename, model->num_vertices, model->num_indices, model->num_parts, iterations);
+
+  result = BenchCodec(model, iterations) && result;
+  libload_obj_free(model);
+
+  result = BenchScan(filename, iterations) && result;
+  if (!ply)
+    result = BenchParse(filename, iterations) && result;
+  result = BenchLoad(filename, ply, iterations) && result;
+  if (!ply)
+    result = BenchLoadMany(filename, iterations) && result;
+
+  if (material_file[0] && PathFileExistsA(material_file))
+  {
+    result = BenchScan(material_file, iterations) && result;
+    result = BenchMaterials(material_file, iterations) && result;
+  }
+
+  return result ? 0 : 1;
+}
@@ -0,0 +1,404 @@
+#include <Windows.h>
+#include <Shlwapi.h>
+#include <stdio.h>
+#include <math.h>
+
+#include <memory>
+#include <vector>
+#include <string>
+#include <map>
+
+#include <DirectXTex.h>
+
+#include <libloader.h>
+
+// Cooks a model, its materials & their textures into a single scene bundle,
+// which the viewer (or any runtime) maps & uploads without decoding anything.
+//
+// usage: libloader_cook <model.obj|model.ply> <scene.llb> [cache directory]
+//
+// with a cache directory, textures cooked by earlier runs (for this or any other
+// scene) are reused as long as the source file's contents haven't changed.
+//
+// before cooking, a small texture whose size isn't a multiple of 4 is cooked &
+// checked against its source, so a broken texture path fails the run.
+
+struct CookedTextures
+{
+  std::vector<std::unique_ptr<DirectX::ScratchImage>> images;
+  std::vector<libload_bundle_texture_t> textures;
+  std::vector<libload_bundle_mip_t> mips;
+  std::vector<const void*> mip_texels;
+  std::map<std::string, uint32_t> by_path;
+  wchar_t cache_directory[MAX_PATH];
+};
+
+// bump this whenever CookTexture's processing changes, so stale cache entries are never used
+static const char c_cook_cache_tag[] = "libloader_cook v3";
+
+static HRESULT LoadTexture(const wchar_t* fullpath, DirectX::TexMetadata* metadata, DirectX::ScratchImage& image)
+{
+  if (!PathFileExists(fullpath))
+    return E_FAIL;
+
+  LPWSTR extension = PathFindExtension(fullpath);
+  if (!extension)
+    return E_FAIL;
+
+  if (StrCmpI(extension, L".tga") == 0)
+  {
+    return DirectX::LoadFromTGAFile(fullpath, metadata, image);
+  }
+  else if (StrCmpI(extension, L".dds") == 0)
+  {
+    return DirectX::LoadFromDDSFile(fullpath, 0, metadata, image);
+  }
+  else
+  {
+    return DirectX::LoadFromWICFile(fullpath, 0, metadata, image);
+  }
+}
+
+// builds the full mip chain of a single level RGBA8 image & block compresses it:
+// BC1, or BC3 if it has any translucent texels. the top level of a block
+// compressed texture must be a multiple of 4 texels, so other sizes are resized
+// up to the next one. the whole image still spans texcoords 0 to 1, so UVs &
+// tiling are unaffected.
+static HRESULT CookImage(const DirectX::Image& image, DirectX::ScratchImage& out_compressed)
+{
+  HRESULT hr = S_OK;
+
+  const DirectX::Image* top = &image;
+  DirectX::ScratchImage resized;
+  size_t width = (image.width + 3) & ~(size_t)3;
+  size_t height = (image.height + 3) & ~(size_t)3;
+  if (width != image.width || height != image.height)
+  {
+    hr = DirectX::Resize(image, width, height, DirectX::TEX_FILTER_DEFAULT, resized);
+    if (FAILED(hr))
+      return hr;
+    top = resized.GetImage(0, 0, 0);
+  }
+
+  DirectX::ScratchImage mipped;
+  hr = DirectX::GenerateMipMaps(*top, DirectX::TEX_FILTER_DEFAULT, 0, mipped);
+  if (FAILED(hr))
+    return hr;
+
+  DXGI_FORMAT format = mipped.IsAlphaAllOpaque() ? DXGI_FORMAT_BC1_UNORM : DXGI_FORMAT_BC3_UNORM;
+  return DirectX::Compress(mipped.GetImages(), mipped.GetImageCount(), mipped.GetMetadata(),
+    format, DirectX::TEX_COMPRESS_PARALLEL, 0.5f, out_compressed);
+}
+
+// loads a texture file as a single RGBA8 level, whatever was in it, & cooks it
+static HRESULT CompressTexture(const wchar_t* fullpath, DirectX::ScratchImage& out_compressed)
+{
+  HRESULT hr = S_OK;
+
+  DirectX::TexMetadata metadata;
+  std::unique_ptr<DirectX::ScratchImage> image(new DirectX::ScratchImage);
+  hr = LoadTexture(fullpath, &metadata, *image);
+  if (FAILED(hr))
+    return hr;
+
+  if (DirectX::IsCompressed(metadata.format))
+  {
+    std::unique_ptr<DirectX::ScratchImage> decompressed(new DirectX::ScratchImage);
+    hr = DirectX::Decompress(*image->GetImage(0, 0, 0), DXGI_FORMAT_R8G8B8A8_UNORM, *decompressed);
+    if (FAILED(hr))
+      return hr;
+    image.swap(decompressed);
+  }
+  else if (metadata.format != DXGI_FORMAT_R8G8B8A8_UNORM)
+  {
+    std::unique_ptr<DirectX::ScratchImage> converted(new DirectX::ScratchImage);
+    hr = DirectX::Convert(*image->GetImage(0, 0, 0), DXGI_FORMAT_R8G8B8A8_UNORM, DirectX::TEX_FILTER_DEFAULT, 0.5f, *converted);
+    if (FAILED(hr))
+      return hr;
+    image.swap(converted);
+  }
+
+  return CookImage(*image->GetImage(0, 0, 0), out_compressed);
+}
+
+// samples an RGBA8 image bilinearly at a texcoord, clamping at the edges
+static void SampleImage(const DirectX::Image& image, float u, float v, float out_rgba[4])
+{
+  float x = u * image.width - 0.5f;
+  float y = v * image.height - 0.5f;
+  x = (x < 0.f) ? 0.f : (x > image.width - 1.f) ? image.width - 1.f : x;
+  y = (y < 0.f) ? 0.f : (y > image.height - 1.f) ? image.height - 1.f : y;
+
+  size_t x0 = (size_t)x, y0 = (size_t)y;
+  size_t x1 = (x0 + 1 < image.width) ? x0 + 1 : x0;
+  size_t y1 = (y0 + 1 < image.height) ? y0 + 1 : y0;
+  float fx = x - x0, fy = y - y0;
+
+  const uint8_t* row0 = image.pixels + image.rowPitch * y0;
+  const uint8_t* row1 = image.pixels + image.rowPitch * y1;
+  for (size_t c = 0; c < 4; ++c)
+  {
+    float top = row0[x0 * 4 + c] + (row0[x1 * 4 + c] - row0[x0 * 4 + c]) * fx;
+    float bottom = row1[x0 * 4 + c] + (row1[x1 * 4 + c] - row1[x0 * 4 + c]) * fx;
+    out_rgba[c] = top + (bottom - top) * fy;
+  }
+}
+
+// cooks a gray gradient (so BC1 can fit it well) whose size isn't a multiple of
+// 4 & compares it with its source at texcoords approaching 1, where padding or a
+// shifted image would show up first
+static bool CheckNonAlignedTexture()
+{
+  static const size_t c_width = 13, c_height = 9;
+  static const float c_coords[] = { 0.7f, 0.8f, 0.9f, 0.99f };
+  static const float c_max_error = 16.f;
+
+  DirectX::ScratchImage source;
+  if (FAILED(source.Initialize2D(DXGI_FORMAT_R8G8B8A8_UNORM, c_width, c_height, 1, 1)))
+    return false;
+
+  const DirectX::Image* image = source.GetImage(0, 0, 0);
+  for (size_t y = 0; y < c_height; ++y)
+  {
+    uint8_t* row = image->pixels + image->rowPitch * y;
+    for (size_t x = 0; x < c_width; ++x)
+    {
+      uint8_t gray = (uint8_t)(x * 160 / (c_width - 1) + y * 95 / (c_height - 1));
+      row[x * 4 + 0] = gray;
+      row[x * 4 + 1] = gray;
+      row[x * 4 + 2] = gray;
+      row[x * 4 + 3] = 255;
+    }
+  }
+
+  DirectX::ScratchImage compressed, decompressed;
+  if (FAILED(CookImage(*image, compressed)) ||
+      FAILED(DirectX::Decompress(*compressed.GetImage(0, 0, 0), DXGI_FORMAT_R8G8B8A8_UNORM, decompressed)))
+  {
+    printf("Texture check: failed to cook the check texture.\n");
+    return false;
+  }
+
+  const DirectX::Image* cooked = decompressed.GetImage(0, 0, 0);
+  for (float u : c_coords)
+  {
+    for (float v : c_coords)
+    {
+      float expected[4], actual[4];
+      SampleImage(*image, u, v, expected);
+      SampleImage(*cooked, u, v, actual);
+
+      for (size_t c = 0; c < 3; ++c)
+      {
+        if (fabsf(actual[c] - expected[c]) > c_max_error)
+        {
+          printf("Texture check: a %ux%u texture cooked to %ux%u is off by %.0f at (%.2f, %.2f).\n",
+            (uint32_t)c_width, (uint32_t)c_height, (uint32_t)cooked->width, (uint32_t)cooked->height,
+            fabsf(actual[c] - expected[c]), u, v);
+          return false;
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+// cooks a texture for the bundle, or reuses an earlier run's result from the
+// cache. textures shared by several materials are only cooked once.
+static HRESULT CookTexture(const char* directory, const char* map, CookedTextures* cooked, uint32_t* out_texture_index)
+{
+  HRESULT hr = S_OK;
+
+  *out_texture_index = LIBLOAD_BUNDLE_NO_TEXTURE;
+  if (map[0] == 0)
+    return S_OK;
+
+  char full_path[1024]{};
+  sprintf_s(full_path, "%s\\%s", directory, map);
+
+  auto it = cooked->by_path.find(full_path);
+  if (it != cooked->by_path.end())
+  {
+    *out_texture_index = it->second;
+    return S_OK;
+  }
+
+  wchar_t full_pathW[1024]{};
+  swprintf_s(full_pathW, L"%S", full_path);
+
+  DirectX::TexCacheParams params{};
+  params.format = DXGI_FORMAT_UNKNOWN;
+  params.mipLevels = 0;
+  params.filter = DirectX::TEX_FILTER_DEFAULT;
+  params.pExtra = c_cook_cache_tag;
+  params.extraSize = sizeof(c_cook_cache_tag);
+
+  DirectX::TexCacheKey key{};
+  bool cacheable = cooked->cache_directory[0] &&
+    SUCCEEDED(DirectX::ComputeTexCacheKeyFromFile(full_pathW, params, key));
+
+  std::unique_ptr<DirectX::ScratchImage> compressed(new DirectX::ScratchImage);
+  if (!cacheable || FAILED(DirectX::LoadFromTexCache(cooked->cache_directory, key, nullptr, *compressed)))
+  {
+    hr = CompressTexture(full_pathW, *compressed);
+    if (FAILED(hr))
+      return hr;
+
+    if (cacheable)
+    {
+      hr = DirectX::SaveToTexCache(cooked->cache_directory, key, compressed->GetImages(), compressed->GetImageCount(),
+        compressed->GetMetadata(), 0);
+      if (FAILED(hr))
+        printf("Can't add %s to the texture cache (%08X).\n", full_path, hr);
+    }
+  }
+
+  const DirectX::TexMetadata& cooked_metadata = compressed->GetMetadata();
+
+  libload_bundle_texture_t texture{};
+  texture.format = (uint32_t)cooked_metadata.format;
+  texture.width = (uint32_t)cooked_metadata.width;
+  texture.height = (uint32_t)cooked_metadata.height;
+  texture.num_mips = (uint32_t)cooked_metadata.mipLevels;
+  texture.first_mip = (uint32_t)cooked->mips.size();
+
+  for (size_t i = 0; i < cooked_metadata.mipLevels; ++i)
+  {
+    const DirectX::Image* level = compressed->GetImage(i, 0, 0);
+
+    libload_bundle_mip_t mip{};
+    mip.row_pitch = (uint32_t)level->rowPitch;
+    mip.slice_pitch = (uint32_t)level->slicePitch;
+    cooked->mips.push_back(mip);
+    cooked->mip_texels.push_back(level->pixels);
+  }
+
+  *out_texture_index = (uint32_t)cooked->textures.size();
+  cooked->textures.push_back(texture);
+  cooked->images.push_back(std::move(compressed));
+  cooked->by_path[full_path] = *out_texture_index;
+
+  return S_OK;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc < 3)
+  {
+    printf("usage: libloader_cook <model.obj|model.ply> <scene.llb> [cache directory]\n");
+    return 1;
+  }
+
+  const char* filename = argv[1];
+  const char* bundle_filename = argv[2];
+
+  // WIC needs COM
+  HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+  if (FAILED(hr))
+  {
+    printf("Failed to initialize COM.\n");
+    return 1;
+  }
+
+  if (!CheckNonAlignedTexture())
+  {
+    CoUninitialize();
+    return 1;
+  }
+
+  LPSTR extension = PathFindExtensionA(filename);
+  libload_obj_model_t* model = nullptr;
+  bool result = (StrCmpIA(extension, ".ply") == 0) ?
+    libload_ply_load(filename, &model) :
+    libload_obj_load(filename, &model);
+  if (!result)
+  {
+    printf("Failed to load model file %s.\n", filename);
+    CoUninitialize();
+    return 1;
+  }
+
+  // do everything the viewer does at load time, so the bundle is ready to draw
+  libload_obj_batch_stats_t batch_stats{};
+  libload_obj_compute_normals(model);
+  libload_obj_compute_tangent_space(model);
+  libload_obj_batch_by_material(model, &batch_stats);
+
+  char directory[1024]{};
+  strcpy_s(directory, filename);
+  PathRemoveFileSpecA(directory);
+
+  CookedTextures cooked;
+  cooked.cache_directory[0] = 0;
+  if (argc > 3)
+    swprintf_s(cooked.cache_directory, L"%S", argv[3]);
+  std::vector<libload_bundle_material_t> bundle_materials;
+
+  uint32_t num_materials = 0;
+  std::vector<libload_mtl_t> materials;
+  if (libload_mtl_load(model->material_file, &num_materials, nullptr))
+  {
+    materials.resize(num_materials);
+    if (!libload_mtl_load(model->material_file, &num_materials, materials.data()))
+    {
+      printf("Failed to load materials from %s.\n", model->material_file);
+      materials.clear();
+    }
+  }
+
+  for (auto& material : materials)
+  {
+    libload_bundle_material_t bundle_material{};
+    strcpy_s(bundle_material.name, material.name);
+    bundle_material.Kd = material.Kd;
+    bundle_material.d = material.d;
+
+    hr = CookTexture(directory, material.map_Kd, &cooked, &bundle_material.diffuse_texture);
+    if (FAILED(hr))
+    {
+      printf("Can't cook %s for %s, using its diffuse color.\n", material.map_Kd, material.name);
+      bundle_material.diffuse_texture = LIBLOAD_BUNDLE_NO_TEXTURE;
+    }
+
+    hr = CookTexture(directory, material.map_bump, &cooked, &bundle_material.normal_texture);
+    if (FAILED(hr))
+    {
+      printf("Can't cook %s for %s, leaving it out.\n", material.map_bump, material.name);
+      bundle_material.normal_texture = LIBLOAD_BUNDLE_NO_TEXTURE;
+    }
+
+    bundle_materials.push_back(bundle_material);
+  }
+
+  if (bundle_materials.empty())
+  {
+    libload_bundle_material_t bundle_material{};
+    strcpy_s(bundle_material.name, "default");
+    bundle_material.Kd.x = bundle_material.Kd.y = bundle_material.Kd.z = 1.f;
+    bundle_material.d = 1.f;
+    bundle_material.diffuse_texture = LIBLOAD_BUNDLE_NO_TEXTURE;
+    bundle_material.normal_texture = LIBLOAD_BUNDLE_NO_TEXTURE;
+    bundle_materials.push_back(bundle_material);
+  }
+
+  result = libload_bundle_write(bundle_filename, model,
+    bundle_materials.data(), (uint32_t)bundle_materials.size(),
+    cooked.textures.data(), (uint32_t)cooked.textures.size(),
+    cooked.mips.data(), cooked.mip_texels.data(), (uint32_t)cooked.mips.size());
+  if (result)
+  {
+    printf("%s: %d verts, %d indices, %d draws, %d materials, %d textures (%d mips)\n", bundle_filename,
+      model->num_vertices, model->num_indices, batch_stats.batched_draws,
+      (uint32_t)bundle_materials.size(), (uint32_t)cooked.textures.size(), (uint32_t)cooked.mips.size());
+  }
+  else
+  {
+    printf("Failed to write %s.\n", bundle_filename);
+  }
+
+  libload_obj_free(model);
+  CoUninitialize();
+
+  return result ? 0 : 1;
+}
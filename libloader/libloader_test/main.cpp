@@ -34,7 +34,7 @@ int WINAPI WinMain(HINSTANCE instance, HINSTANCE, LPSTR command_line, int)
     // No filename passed in, so prompt for file
     OPENFILENAMEA ofn{};
     ofn.lStructSize = sizeof(ofn);
-    ofn.lpstrFilter = "All Assets (*.tga, *.dds, *.obj)\0*.tga;*.dda;*.obj\0TGA images\0*.tga\0DDS images\0*.dds\0OBJ models\0*.obj\0All Files\0*.*\0\0";
+    ofn.lpstrFilter = "All Assets (*.tga, *.dds, *.obj, *.ply, *.llb)\0*.tga;*.dda;*.obj;*.ply;*.llb\0TGA images\0*.tga\0DDS images\0*.dds\0OBJ models\0*.obj\0PLY models\0*.ply\0Scene bundles\0*.llb\0All Files\0*.*\0\0";
     ofn.lpstrFile = filename;
     ofn.nMaxFile = _countof(filename);
     ofn.Flags = OFN_FILEMUSTEXIST | OFN_PATHMUSTEXIST;
@@ -153,8 +153,22 @@ LRESULT CALLBACK WndProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
   return DefWindowProc(hwnd, msg, wParam, lParam);
 }
 
+// decoded copies of non-DDS textures live in a content-addressed cache under %TEMP%,
+// so reopening a scene skips the PNG/JPEG/TGA decoders.
+static const char c_decoded_cache_tag[] = "libloader_test decoded";
+
+static bool GetTextureCacheDirectory(wchar_t (&directory)[MAX_PATH])
+{
+  DWORD length = GetTempPathW(MAX_PATH, directory);
+  if (length == 0 || length >= MAX_PATH)
+    return false;
+  return wcscat_s(directory, L"libloader_texcache") == 0;
+}
+
 HRESULT LoadTexture(const wchar_t* fullpath, DirectX::TexMetadata* metadata, DirectX::ScratchImage& image)
 {
+  HRESULT hr = S_OK;
+
   if (!PathFileExists(fullpath))
     return E_FAIL;
 
@@ -162,17 +176,63 @@ HRESULT LoadTexture(const wchar_t* fullpath, DirectX::TexMetadata* metadata, Dir
   if (!extension)
     return E_FAIL;
 
-  if (StrCmpI(extension, L".tga") == 0)
+  if (StrCmpI(extension, L".dds") == 0)
   {
-    return DirectX::LoadFromTGAFile(fullpath, metadata, image);
+    return DirectX::LoadFromDDSFile(fullpath, 0, metadata, image);
   }
-  else if (StrCmpI(extension, L".dds") == 0)
+
+  wchar_t cache_directory[MAX_PATH]{};
+  DirectX::TexCacheParams params{};
+  params.format = DXGI_FORMAT_UNKNOWN;
+  params.mipLevels = 1;
+  params.pExtra = c_decoded_cache_tag;
+  params.extraSize = sizeof(c_decoded_cache_tag);
+
+  DirectX::TexCacheKey key{};
+  bool cacheable = GetTextureCacheDirectory(cache_directory) &&
+    SUCCEEDED(DirectX::ComputeTexCacheKeyFromFile(fullpath, params, key));
+  if (cacheable && SUCCEEDED(DirectX::LoadFromTexCache(cache_directory, key, metadata, image)))
+    return S_OK;
+
+  if (StrCmpI(extension, L".tga") == 0)
   {
-    return DirectX::LoadFromDDSFile(fullpath, 0, metadata, image);
+    hr = DirectX::LoadFromTGAFile(fullpath, metadata, image);
   }
   else
   {
-    return DirectX::LoadFromWICFile(fullpath, 0, metadata, image);
+    hr = DirectX::LoadFromWICFile(fullpath, 0, metadata, image);
+  }
+
+  // a failure to cache only costs the next load a decode
+  if (SUCCEEDED(hr) && cacheable)
+    (void)DirectX::SaveToTexCache(cache_directory, key, image.GetImages(), image.GetImageCount(), image.GetMetadata(), 256 * 1024 * 1024);
+
+  return hr;
+}
+
+// describes one of the bundle's textures for CreateTexture2D. the texels stay in the mapped file
+static void GetBundleTexture(const libload_bundle_t* bundle, uint32_t texture_index,
+  D3D11_TEXTURE2D_DESC* out_desc, std::vector<D3D11_SUBRESOURCE_DATA>* out_mips)
+{
+  const libload_bundle_texture_t& texture = bundle->textures[texture_index];
+
+  *out_desc = D3D11_TEXTURE2D_DESC{};
+  out_desc->ArraySize = 1;
+  out_desc->BindFlags = D3D11_BIND_SHADER_RESOURCE;
+  out_desc->Format = (DXGI_FORMAT)texture.format;
+  out_desc->Width = texture.width;
+  out_desc->Height = texture.height;
+  out_desc->SampleDesc.Count = 1;
+  out_desc->MipLevels = texture.num_mips;
+  out_desc->Usage = D3D11_USAGE_IMMUTABLE;
+
+  out_mips->resize(texture.num_mips);
+  for (uint32_t i = 0; i < texture.num_mips; ++i)
+  {
+    const libload_bundle_mip_t& mip = bundle->mips[texture.first_mip + i];
+    (*out_mips)[i].pSysMem = bundle->data + mip.offset;
+    (*out_mips)[i].SysMemPitch = mip.row_pitch;
+    (*out_mips)[i].SysMemSlicePitch = mip.slice_pitch;
   }
 }
 
@@ -233,23 +293,119 @@ HRESULT LoadAsset(const char* filename, HWND hwnd, std::unique_ptr<BaseRenderer>
       *out_error_message = L"Failed to open DDS file.";
     }
   }
-  else if (StrCmpIA(extension, ".obj") == 0)
+  else if (StrCmpIA(extension, ".llb") == 0)
+  {
+    ModelRenderer* model_renderer = new ModelRenderer;
+    out_renderer->reset(model_renderer);
+
+    uint32_t num_verts = 0;
+    uint32_t num_indices = 0;
+    uint32_t num_draws = 0;
+    uint32_t num_textures = 0;
+    LARGE_INTEGER start{}, end{}, freq{};
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+
+    // everything in the bundle is already in its final form, so it's uploaded
+    // straight out of the mapped file
+    libload_bundle_t* bundle = nullptr;
+    if (libload_bundle_open(filename, &bundle))
+    {
+      num_verts = bundle->num_vertices;
+      num_indices = bundle->num_indices;
+      num_draws = bundle->num_parts;
+      num_textures = bundle->num_textures;
+
+      hr = model_renderer->Initialize(hwnd, bundle->num_vertices, (const Vertex3D*)bundle->vertices,
+        bundle->num_indices, bundle->indices);
+      if (SUCCEEDED(hr))
+      {
+        std::vector<uint32_t> material_handles(bundle->num_materials);
+        for (uint32_t i = 0; i < bundle->num_materials && SUCCEEDED(hr); ++i)
+        {
+          const libload_bundle_material_t& material = bundle->materials[i];
+          if (material.diffuse_texture != LIBLOAD_BUNDLE_NO_TEXTURE)
+          {
+            D3D11_TEXTURE2D_DESC diff_desc{}, norm_desc{};
+            std::vector<D3D11_SUBRESOURCE_DATA> diffuse_mips, normal_mips;
+            GetBundleTexture(bundle, material.diffuse_texture, &diff_desc, &diffuse_mips);
+
+            bool has_normals = (material.normal_texture != LIBLOAD_BUNDLE_NO_TEXTURE);
+            if (has_normals)
+            {
+              GetBundleTexture(bundle, material.normal_texture, &norm_desc, &normal_mips);
+            }
+
+            hr = model_renderer->CreateMaterial(diff_desc, diffuse_mips.data(),
+              has_normals ? &norm_desc : nullptr, has_normals ? normal_mips.data() : nullptr,
+              &material_handles[i]);
+          }
+          else
+          {
+            uint32_t color =
+              0xFF000000 |
+              ((uint32_t)((uint8_t)(material.Kd.z * 255)) << 16) |
+              ((uint32_t)((uint8_t)(material.Kd.y * 255)) << 8) |
+              ((uint32_t)((uint8_t)(material.Kd.x * 255)));
+            hr = model_renderer->CreateMaterial(
+              1, 1, DXGI_FORMAT_R8G8B8A8_UNORM, &color,
+              0, 0, DXGI_FORMAT_UNKNOWN, nullptr,
+              &material_handles[i]);
+          }
+        }
+
+        if (SUCCEEDED(hr))
+        {
+          for (uint32_t i = 0; i < bundle->num_parts; ++i)
+          {
+            const libload_bundle_part_t& part = bundle->parts[i];
+            model_renderer->AddModel(part.base_index, part.num_indices, material_handles[part.material]);
+          }
+        }
+        else
+        {
+          *out_error_message = L"Failed to create material resources.";
+        }
+      }
+      else
+      {
+        *out_error_message = L"Failed to create model renderer.";
+      }
+      libload_bundle_close(bundle);
+    }
+    else
+    {
+      hr = E_FAIL;
+      *out_error_message = L"Failed to open bundle file.";
+    }
+
+    QueryPerformanceCounter(&end);
+    wchar_t message[500]{};
+    swprintf_s(message, L"Verts: %d, Indices: %d, Draws: %d, Textures: %d, Elapsed: %3.2fms\n", num_verts, num_indices,
+      num_draws, num_textures, 1000.f * (end.QuadPart - start.QuadPart) / (float)freq.QuadPart);
+    OutputDebugString(message);
+  }
+  else if (StrCmpIA(extension, ".obj") == 0 || StrCmpIA(extension, ".ply") == 0)
   {
     ModelRenderer* model_renderer = new ModelRenderer;
     out_renderer->reset(model_renderer);
 
     uint32_t num_verts = 0;
     uint32_t num_indices = 0;
+    libload_obj_batch_stats_t batch_stats{};
     LARGE_INTEGER start{}, end{}, freq{};
     QueryPerformanceFrequency(&freq);
     QueryPerformanceCounter(&start);
 
     libload_obj_model_t* model = nullptr;
-    bool result = libload_obj_load(filename, &model);
+    bool result = (StrCmpIA(extension, ".ply") == 0) ?
+      libload_ply_load(filename, &model) :
+      libload_obj_load(filename, &model);
     if (result)
     {
       libload_obj_compute_normals(model);
       libload_obj_compute_tangent_space(model);
+      libload_obj_batch_by_material(model, &batch_stats);
 
       num_verts = model->num_vertices;
       num_indices = model->num_indices;
@@ -373,12 +529,13 @@ HRESULT LoadAsset(const char* filename, HWND hwnd, std::unique_ptr<BaseRenderer>
     else
     {
       hr = E_FAIL;
-      *out_error_message = L"Failed to load OBJ file.";
+      *out_error_message = L"Failed to load model file.";
     }
 
     QueryPerformanceCounter(&end);
     wchar_t message[500]{};
-    swprintf_s(message, L"Verts: %d, Indices: %d, Elapsed: %3.2fms\n", num_verts, num_indices, 1000.f * (end.QuadPart - start.QuadPart) / (float)freq.QuadPart);
+    swprintf_s(message, L"Verts: %d, Indices: %d, Draws: %d (from %d), Elapsed: %3.2fms\n", num_verts, num_indices,
+      batch_stats.batched_draws, batch_stats.source_draws, 1000.f * (end.QuadPart - start.QuadPart) / (float)freq.QuadPart);
     OutputDebugString(message);
   }
 
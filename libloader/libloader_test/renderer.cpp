@@ -467,6 +467,53 @@ HRESULT ModelRenderer::CreateMaterial(
   return S_OK;
 }
 
+HRESULT ModelRenderer::CreateMaterial(
+  const D3D11_TEXTURE2D_DESC& diff_desc, const D3D11_SUBRESOURCE_DATA* diffuse_mips,
+  const D3D11_TEXTURE2D_DESC* norm_desc, const D3D11_SUBRESOURCE_DATA* normal_mips,
+  uint32_t* out_material_handle)
+{
+  HRESULT hr = S_OK;
+
+  material_data mat{};
+
+  Microsoft::WRL::ComPtr<ID3D11Texture2D> texture;
+  hr = device_->CreateTexture2D(&diff_desc, diffuse_mips, texture.ReleaseAndGetAddressOf());
+  if (FAILED(hr))
+  {
+    assert(false);
+    return hr;
+  }
+
+  hr = device_->CreateShaderResourceView(texture.Get(), nullptr, &mat.diffuse_srv);
+  if (FAILED(hr))
+  {
+    assert(false);
+    return hr;
+  }
+
+  if (norm_desc && normal_mips)
+  {
+    hr = device_->CreateTexture2D(norm_desc, normal_mips, texture.ReleaseAndGetAddressOf());
+    if (FAILED(hr))
+    {
+      assert(false);
+      return hr;
+    }
+
+    hr = device_->CreateShaderResourceView(texture.Get(), nullptr, &mat.normals_srv);
+    if (FAILED(hr))
+    {
+      assert(false);
+      return hr;
+    }
+  }
+
+  materials_.push_back(mat);
+  *out_material_handle = (uint32_t)(materials_.size() - 1);
+
+  return S_OK;
+}
+
 void ModelRenderer::AddModel(uint32_t base_index, uint32_t num_indices, uint32_t material_handle)
 {
   model_data model{};
@@ -83,6 +83,11 @@ public:
     uint32_t diff_width, uint32_t diff_height, DXGI_FORMAT diff_format, const uint32_t* diffuse,
     uint32_t norm_width, uint32_t norm_height, DXGI_FORMAT norm_format, const uint32_t* normals,
     uint32_t* out_material_handle);
+  // takes complete mip chains in any format, such as the block compressed textures of a bundle
+  HRESULT CreateMaterial(
+    const D3D11_TEXTURE2D_DESC& diff_desc, const D3D11_SUBRESOURCE_DATA* diffuse_mips,
+    const D3D11_TEXTURE2D_DESC* norm_desc, const D3D11_SUBRESOURCE_DATA* normal_mips,
+    uint32_t* out_material_handle);
   void AddModel(uint32_t base_index, uint32_t num_indices, uint32_t material_handle);
 
   virtual void HandleInput() override;